@@ -0,0 +1,28 @@
+#
+#  python_bench.py - rlm_python module used by python_bench.sh
+#
+#  Version:	$Id$
+#
+#  Does the same work whether the request is passed as a tuple of
+#  (name, value) tuples, or as a radiusd.Request object, so the two
+#  calling conventions can be compared.
+#
+
+import radiusd
+
+def authorize(p):
+    if isinstance(p, radiusd.Request):
+        if 'User-Name' not in p.request:
+            return radiusd.RLM_MODULE_NOOP
+
+        p.control['Cleartext-Password'] = p.request['User-Password']
+        p.reply['Reply-Message'] = 'Hello %s' % p.request['User-Name']
+        return radiusd.RLM_MODULE_UPDATED
+
+    attrs = dict(p)
+    if 'User-Name' not in attrs:
+        return radiusd.RLM_MODULE_NOOP
+
+    return (radiusd.RLM_MODULE_UPDATED,
+            (('Reply-Message', 'Hello %s' % attrs['User-Name']),),
+            (('Cleartext-Password', attrs['User-Password']),))
@@ -0,0 +1,103 @@
+#!/bin/sh
+#
+#  python_bench.sh - Measure rlm_python request throughput.
+#
+#  Version:	$Id$
+#
+#  Sends Access-Requests with a number of attributes to a running
+#  server with radclient, and reports requests/s.
+#
+#  The server should have a "python" module instance loading
+#  python_bench.py from this directory (set python_path, module =
+#  python_bench and func_authorize = authorize), listed in authorize
+#  before "pap".
+#
+#  Run it once with "pass_request = no", and once with "pass_request =
+#  yes" to compare the tuple and object calling conventions.  Running
+#  each with "thread_interpreters = yes" shows the effect of giving
+#  each thread its own interpreter.
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+#
+#  Copyright 2016  The FreeRADIUS server project
+#
+
+SERVER=127.0.0.1
+SECRET=testing123
+USER=bob
+PASSWORD=hello
+COUNT=10000
+PARALLEL=32
+EXTRA=20
+
+usage() {
+	echo "Usage: $0 [options]"
+	echo "  -s <server>    server to send requests to (default $SERVER)"
+	echo "  -x <secret>    shared secret (default $SECRET)"
+	echo "  -u <user>      User-Name (default $USER)"
+	echo "  -w <password>  User-Password (default $PASSWORD)"
+	echo "  -c <count>     number of requests (default $COUNT)"
+	echo "  -p <parallel>  outstanding requests (default $PARALLEL)"
+	echo "  -e <extra>     extra attributes per request (default $EXTRA)"
+	exit 1
+}
+
+while getopts "s:x:u:w:c:p:e:h" opt; do
+	case $opt in
+	s) SERVER=$OPTARG ;;
+	x) SECRET=$OPTARG ;;
+	u) USER=$OPTARG ;;
+	w) PASSWORD=$OPTARG ;;
+	c) COUNT=$OPTARG ;;
+	p) PARALLEL=$OPTARG ;;
+	e) EXTRA=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+for prog in radclient awk; do
+	if ! command -v $prog > /dev/null 2>&1; then
+		echo "$0: $prog not found" >&2
+		exit 1
+	fi
+done
+
+#
+#  Realistic requests carry a lot more than User-Name and
+#  User-Password, and the tuple convention converts every one of
+#  them, so pad the requests out with Class attributes.
+#
+REQUESTS=$(mktemp /tmp/python_bench.XXXXXX) || exit 1
+trap 'rm -f "$REQUESTS"' EXIT
+
+awk -v count="$COUNT" -v user="$USER" -v pass="$PASSWORD" -v extra="$EXTRA" 'BEGIN {
+	for (i = 0; i < count; i++) {
+		printf "User-Name = \"%s\", User-Password = \"%s\", NAS-Port = %d", user, pass, i
+		for (j = 0; j < extra; j++) printf ", Class = \"bench-%d-%d\"", i, j
+		printf "\n\n"
+	}
+}' > "$REQUESTS"
+
+START=$(date +%s.%N)
+radclient -q -p "$PARALLEL" -f "$REQUESTS" "$SERVER" auth "$SECRET"
+END=$(date +%s.%N)
+
+awk -v start="$START" -v end="$END" -v sent="$COUNT" 'BEGIN {
+	elapsed = end - start
+	if (elapsed <= 0) elapsed = 0.001
+	printf "requests:   %d\n", sent
+	printf "elapsed:    %.3fs\n", elapsed
+	printf "requests/s: %.1f\n", sent / elapsed
+}'
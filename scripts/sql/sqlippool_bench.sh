@@ -0,0 +1,134 @@
+#!/bin/sh
+#
+#  sqlippool_bench.sh - Measure rlm_sqlippool allocation throughput.
+#
+#  Version:	$Id$
+#
+#  Populates an SQLite ippool database, then sends Access-Requests for
+#  unique Calling-Station-Ids to a running server with radclient, and
+#  reports allocations/s, both in total and per SQL connection.
+#
+#  The server should have the "sql" module using the "rlm_sql_sqlite"
+#  driver pointing at the same database file, "sqlippool" listed in
+#  post-auth, and Pool-Name set for the test user.  Set "start" and
+#  "max" in the sql module's "pool" section to the same value, and pass
+#  that value as -n, so the per-connection figure is meaningful.
+#
+#  Run it once with the default queries, and once with
+#  "allocate_single = yes" and "allocate_clear_interval" set, to compare
+#  the two allocation modes.
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+#
+#  Copyright 2016  The FreeRADIUS server project
+#
+
+DB=/tmp/sqlippool_bench.db
+SCHEMA=raddb/mods-config/sql/ippool/sqlite/schema.sql
+TABLE=radippool
+POOL=bench
+SERVER=127.0.0.1
+SECRET=testing123
+USER=bob
+PASSWORD=hello
+COUNT=10000
+PARALLEL=32
+CONNECTIONS=1
+
+usage() {
+	echo "Usage: $0 [options]"
+	echo "  -f <file>      SQLite database to create (default $DB)"
+	echo "  -S <schema>    ippool schema (default $SCHEMA)"
+	echo "  -P <pool>      Pool-Name to populate (default $POOL)"
+	echo "  -s <server>    server to send requests to (default $SERVER)"
+	echo "  -x <secret>    shared secret (default $SECRET)"
+	echo "  -u <user>      User-Name (default $USER)"
+	echo "  -w <password>  User-Password (default $PASSWORD)"
+	echo "  -c <count>     number of allocations (default $COUNT)"
+	echo "  -p <parallel>  outstanding requests (default $PARALLEL)"
+	echo "  -n <conns>     SQL connections the server uses (default $CONNECTIONS)"
+	exit 1
+}
+
+while getopts "f:S:P:s:x:u:w:c:p:n:h" opt; do
+	case $opt in
+	f) DB=$OPTARG ;;
+	S) SCHEMA=$OPTARG ;;
+	P) POOL=$OPTARG ;;
+	s) SERVER=$OPTARG ;;
+	x) SECRET=$OPTARG ;;
+	u) USER=$OPTARG ;;
+	w) PASSWORD=$OPTARG ;;
+	c) COUNT=$OPTARG ;;
+	p) PARALLEL=$OPTARG ;;
+	n) CONNECTIONS=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+for prog in sqlite3 radclient awk; do
+	if ! command -v $prog > /dev/null 2>&1; then
+		echo "$0: $prog not found" >&2
+		exit 1
+	fi
+done
+
+#
+#  Create the pool with one address per allocation, so the pool never
+#  runs dry during the run.
+#
+rm -f "$DB"
+sed "s/^CREATE TABLE *(/CREATE TABLE $TABLE (/" "$SCHEMA" | sqlite3 "$DB" || exit 1
+
+awk -v count="$COUNT" -v pool="$POOL" -v table="$TABLE" 'BEGIN {
+	print "BEGIN;"
+	for (i = 0; i < count; i++) {
+		printf "INSERT INTO %s (id, pool_name, framedipaddress, calledstationid, callingstationid, pool_key) ", table
+		printf "VALUES (%d, '\''%s'\'', '\''10.%d.%d.%d'\'', '\'''\'', '\'''\'', '\''0'\'');\n", \
+			i + 1, pool, int(i / 65536) % 256, int(i / 256) % 256, i % 256
+	}
+	print "COMMIT;"
+}' | sqlite3 "$DB" || exit 1
+
+#
+#  One request per allocation, each with a unique Calling-Station-Id
+#  and NAS-Port so every request allocates a new address.
+#
+REQUESTS=$(mktemp /tmp/sqlippool_bench.XXXXXX) || exit 1
+trap 'rm -f "$REQUESTS"' EXIT
+
+awk -v count="$COUNT" -v user="$USER" -v pass="$PASSWORD" -v pool="$POOL" 'BEGIN {
+	for (i = 0; i < count; i++) {
+		printf "User-Name = \"%s\", User-Password = \"%s\", ", user, pass
+		printf "NAS-Port = %d, Calling-Station-Id = \"02-00-%02X-%02X-%02X-%02X\"\n\n", \
+			i, int(i / 16777216) % 256, int(i / 65536) % 256, int(i / 256) % 256, i % 256
+	}
+}' > "$REQUESTS"
+
+START=$(date +%s.%N)
+radclient -q -p "$PARALLEL" -f "$REQUESTS" "$SERVER" auth "$SECRET"
+END=$(date +%s.%N)
+
+ALLOCATED=$(sqlite3 "$DB" "SELECT COUNT(*) FROM $TABLE WHERE pool_name = '$POOL' AND expiry_time IS NOT NULL;")
+
+awk -v start="$START" -v end="$END" -v sent="$COUNT" -v allocated="$ALLOCATED" -v conns="$CONNECTIONS" 'BEGIN {
+	elapsed = end - start
+	if (elapsed <= 0) elapsed = 0.001
+	printf "requests:           %d\n", sent
+	printf "allocated:          %d\n", allocated
+	printf "elapsed:            %.3fs\n", elapsed
+	printf "allocations/s:      %.1f\n", allocated / elapsed
+	printf "allocations/s/conn: %.1f\n", allocated / elapsed / conns
+}'
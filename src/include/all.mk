@@ -20,9 +20,11 @@ HEADERS	= \
 	conf.h \
 	conffile.h \
 	detail.h \
+	detail_binary.h \
 	event.h \
 	hash.h \
 	heap.h \
+	trie.h \
 	libradius.h \
 	md4.h \
 	md5.h \
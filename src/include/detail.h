@@ -44,6 +44,33 @@ typedef enum detail_entry_state_t {
 	STATE_REPLIED
 } detail_entry_state_t;
 
+/** A record which has been read from the detail file, and sent for processing
+ *
+ * Only used when max_outstanding > 1.
+ */
+typedef struct detail_entry_t {
+	bool		in_use;
+	bool		running;		//!< Packet sent, waiting for the request to finish.
+	uint32_t	seq;			//!< Identifies the packet currently being processed.
+	off_t		record_offset;		//!< Start of the record in the file.
+	off_t		timestamp_offset;	//!< Where to mark the record as done.
+	time_t		retry;			//!< When to send it again.
+	int		tries;
+
+	VALUE_PAIR	*vps;			//!< Read from the file, for retransmissions.
+	fr_ipaddr_t	client_ip;
+	time_t		timestamp;
+	uint8_t		code;
+} detail_entry_t;
+
+/** Sent from detail_send() and detail_recv() to the reader thread when max_outstanding > 1
+ *
+ */
+typedef struct detail_ack_t {
+	uint32_t	seq;			//!< Of the packet the request was created from.
+	bool		replied;		//!< Whether the record was processed successfully.
+} detail_ack_t;
+
 typedef struct listen_detail_t {
 	fr_event_t	*ev;	/* has to be first entry (ugh) */
 	char const 	*name;			//!< Identifier used in log messages
@@ -58,6 +85,10 @@ typedef struct listen_detail_t {
 	pthread_t	pthread_id;
 
 	FILE		*fp;
+	bool		binary;			//!< File is in the binary detail format.
+	uint8_t const	*map;			//!< Binary detail file, mapped into memory.
+	size_t		map_len;		//!< Length of the mapping.
+	uint8_t		code;			//!< Packet code of the current binary record.
 	off_t		offset;
 	detail_file_state_t 	file_state;
 	detail_entry_state_t 	entry_state;
@@ -66,6 +97,7 @@ typedef struct listen_detail_t {
 	fr_ipaddr_t	client_ip;
 
 	off_t		last_offset;
+	off_t		record_offset;		//!< Start of the record we're reading.
 	off_t		timestamp_offset;
 	bool		done_entry;		//!< Are we done reading this entry?
 	bool		track;			//!< Do we track progress through the file?
@@ -78,7 +110,14 @@ typedef struct listen_detail_t {
 	int		packets;
 	int		tries;
 	bool		one_shot;
-	int		outstanding;
+	uint32_t	max_outstanding;	//!< How many records may be processed at once.
+	uint32_t	outstanding;		//!< How many records are being processed.
+	detail_entry_t	*entries;		//!< Records being processed, max_outstanding of them.
+
+	char const	*filename_checkpoint;	//!< Records everything before the offset in here as done.
+	int		checkpoint_fd;
+	off_t		checkpoint;		//!< Offset of the first record which isn't done.
+
 	int		has_rtt;
 	int		srtt;
 	int		rttvar;
@@ -0,0 +1,97 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_DETAIL_BINARY_H
+#define _FR_DETAIL_BINARY_H
+/**
+ * $Id$
+ *
+ * @file include/detail_binary.h
+ * @brief Encode and decode records in the binary detail file format.
+ *
+ * A binary detail file is a sequence of records, each of which is a fixed
+ * size header, followed by the attributes of the packet in RADIUS wire
+ * format.  All integers are in network byte order.
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+RCSIDH(detail_binary_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FR_DETAIL_BINARY_MAGIC		"FRdb"	//!< First four bytes of every record.
+#define FR_DETAIL_BINARY_HDR_LEN	52	//!< Length of fr_detail_binary_hdr_t.
+#define FR_DETAIL_BINARY_MAX_LEN	8192	//!< Maximum length of a record, including the header.
+
+#define FR_DETAIL_BINARY_DONE		0x01	//!< Record has been processed by a "track"ing reader.
+
+/** On disk header of a binary detail record
+ *
+ * Everything is a byte array, so the header can be read from any offset
+ * in a mapped file without worrying about alignment or padding.
+ */
+typedef struct fr_detail_binary_hdr_t {
+	uint8_t		magic[4];		//!< FR_DETAIL_BINARY_MAGIC.
+	uint8_t		length[4];		//!< Length of the record, including this header.
+	uint8_t		code;			//!< Packet code.
+	uint8_t		flags;			//!< FR_DETAIL_BINARY_DONE.
+	uint8_t		af;			//!< 4 or 6 if the addresses and ports below are set, else 0.
+	uint8_t		reserved;
+	uint8_t		timestamp[4];		//!< When the packet was received.
+	uint8_t		src_port[2];
+	uint8_t		dst_port[2];
+	uint8_t		src_ipaddr[16];
+	uint8_t		dst_ipaddr[16];
+} fr_detail_binary_hdr_t;
+
+_Static_assert(sizeof(fr_detail_binary_hdr_t) == FR_DETAIL_BINARY_HDR_LEN,
+	       "FR_DETAIL_BINARY_HDR_LEN must match the size of fr_detail_binary_hdr_t");
+
+/** A decoded binary detail record
+ *
+ */
+typedef struct fr_detail_binary_t {
+	uint8_t		code;			//!< Packet code.
+	uint8_t		flags;			//!< FR_DETAIL_BINARY_DONE.
+	time_t		timestamp;		//!< When the packet was received.
+	fr_ipaddr_t	src_ipaddr;		//!< af is AF_UNSPEC if the addresses weren't logged.
+	fr_ipaddr_t	dst_ipaddr;
+	uint16_t	src_port;
+	uint16_t	dst_port;
+	VALUE_PAIR	*vps;			//!< The attributes of the packet.
+} fr_detail_binary_t;
+
+/** Decide whether an attribute should be left out of a binary detail record
+ *
+ * @param[in] vp	being encoded.
+ * @param[in] uctx	passed to fr_detail_binary_encode().
+ * @return true to skip the attribute, false to encode it.
+ */
+typedef bool (*fr_detail_binary_skip_t)(VALUE_PAIR const *vp, void *uctx);
+
+ssize_t	fr_detail_binary_encode(uint8_t *out, size_t outlen, RADIUS_PACKET const *packet,
+				time_t timestamp, bool log_srcdst,
+				fr_detail_binary_skip_t skip, void *uctx);
+
+ssize_t	fr_detail_binary_decode(TALLOC_CTX *ctx, fr_detail_binary_t *out, uint8_t const *data, size_t data_len);
+
+bool	fr_detail_binary_is_binary(uint8_t const *data, size_t data_len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _FR_DETAIL_BINARY_H */
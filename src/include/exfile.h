@@ -35,8 +35,39 @@ extern "C" {
  */
 typedef struct exfile_t exfile_t;
 
+/** When the writer thread syncs files
+ *
+ */
+typedef enum {
+	EXFILE_FSYNC_NONE = 0,				//!< Leave it to the kernel.
+	EXFILE_FSYNC_ALWAYS,				//!< After every batch written to a file.
+	EXFILE_FSYNC_INTERVAL				//!< At most once every fsync_interval seconds.
+} exfile_fsync_t;
+
+extern FR_NAME_NUMBER const exfile_fsync_table[];
+
+/** Statistics for the writer thread
+ *
+ */
+typedef struct exfile_stats_t {
+	uint32_t	size;				//!< Maximum number of records which can be queued.
+	uint32_t	depth;				//!< Records currently queued.
+	uint32_t	depth_max;			//!< Most records seen queued by the writer.
+	uint64_t	queued;				//!< Records queued by workers.
+	uint64_t	written;			//!< Records written.
+	uint64_t	failed;				//!< Records which couldn't be written.
+	uint64_t	flushes;			//!< Calls to writev().
+	uint64_t	bytes;				//!< Bytes written.
+	uint64_t	fsyncs;				//!< Calls to fsync().
+	uint64_t	stalls;				//!< Times a worker had to wait for space in the queue.
+} exfile_stats_t;
+
 exfile_t	*exfile_init(TALLOC_CTX *ctx, uint32_t entries, uint32_t idle, bool locking);
 
+int		exfile_enable_async(exfile_t *ef, uint32_t queue_size, exfile_fsync_t fsync, uint32_t fsync_interval);
+
+void		exfile_async_stats(exfile_t *ef, exfile_stats_t *stats);
+
 void		exfile_enable_triggers(exfile_t *ef, CONF_SECTION *cs, char const *trigger_prefix,
 				       VALUE_PAIR *trigger_args);
 
@@ -47,6 +78,9 @@ int		exfile_close(exfile_t *lf, REQUEST *request, int fd);
 
 int		exfile_unlock(exfile_t *lf, REQUEST *request, int fd);
 
+int		exfile_write(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions,
+			     struct iovec const *vector, int iovcnt);
+
 #ifdef __cplusplus
 }
 #endif
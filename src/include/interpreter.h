@@ -81,8 +81,23 @@ typedef struct {
 
 	map_proc_inst_t		*proc_inst;	//!< Instantiation data for #MOD_MAP.
 	bool			done_pass2;
+
+	fr_hash_table_t		*case_table;	//!< #MOD_SWITCH, literal case values, if every case
+						//!< is a literal value.
+	modcallable		*default_case;	//!< #MOD_SWITCH, the case without a value.
 } modgroup;
 
+/** A literal 'case' value in the #MOD_SWITCH case_table
+ *
+ */
+typedef struct {
+	PW_TYPE			type;		//!< Type of the value.
+	value_data_t const	*data;		//!< Value to match.
+	modcallable		*c;		//!< The #MOD_CASE to run.
+	int			position;	//!< Of the case within the switch.  If several cases
+						//!< match, the first one wins.
+} modcase_t;
+
 typedef struct {
 	modcallable		mc;
 	module_instance_t	*modinst;
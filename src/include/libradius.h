@@ -147,7 +147,8 @@ typedef void (*sig_t)(int);
  *			Put in there by rad_decode, and must be put in the
  *			response RADIUS_PACKET as well before calling fr_radius_send
  *
- *	verified:	Filled in by rad_decode for accounting-request packets
+ *	verified:	Set by fr_radius_verify_batch() if the authenticators
+ *			have already been checked.
  *
  *	data,data_len:	Used between fr_radius_recv and fr_radius_decode.
  */
@@ -163,6 +164,7 @@ typedef struct radius_packet {
 	unsigned int		code;			//!< Packet code (type).
 
 	uint8_t			vector[AUTH_VECTOR_LEN];//!< RADIUS authentication vector.
+	bool			verified;		//!< Authenticators checked by fr_radius_verify_batch().
 
 	uint32_t       		count;			//!< Number of times we've seen this packet
 	struct timeval		timestamp;		//!< When we received the packet.
@@ -255,10 +257,18 @@ RADIUS_PACKET	*fr_radius_recv(TALLOC_CTX *ctx, int fd, int flags, bool require_m
 
 ssize_t		fr_radius_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *src_port, unsigned int *code);
 
+struct udp_mmsg_t;
+ssize_t		fr_radius_recv_header_mmsg(struct udp_mmsg_t const *msg, unsigned int *code);
+
+RADIUS_PACKET	*fr_radius_recv_mmsg(TALLOC_CTX *ctx, int fd, struct udp_mmsg_t const *msg, bool require_ma);
+
 void		fr_radius_recv_discard(int sockfd);
 
 int		fr_radius_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret);
 
+unsigned int	fr_radius_verify_batch(RADIUS_PACKET *packets[], RADIUS_PACKET *originals[],
+				       char const *secrets[], unsigned int num);
+
 int		fr_radius_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const *secret);
 
 int		fr_radius_encode(RADIUS_PACKET *packet, RADIUS_PACKET const *original, char const *secret);
@@ -319,6 +329,7 @@ ssize_t		fr_radius_decode_pair(TALLOC_CTX *ctx,  vp_cursor_t *cursor, fr_dict_at
  *	cursor.c
  */
 VALUE_PAIR	*fr_cursor_init(vp_cursor_t *cursor, VALUE_PAIR * const *node);
+VALUE_PAIR	*fr_cursor_init_indexed(vp_cursor_t *cursor, fr_pair_index_t *index);
 void		fr_cursor_copy(vp_cursor_t *out, vp_cursor_t *in);
 VALUE_PAIR	*fr_cursor_first(vp_cursor_t *cursor);
 VALUE_PAIR	*fr_cursor_last(vp_cursor_t *cursor);
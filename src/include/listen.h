@@ -16,6 +16,7 @@
 #ifndef _FR_LISTEN_H
 #define _FR_LISTEN_H
 #include <freeradius-devel/pcap.h>
+#include <freeradius-devel/udp.h>
 /**
  * $Id$
  *
@@ -152,6 +153,14 @@ typedef struct listen_socket_t {
 						//!< configuration of SO_RCVBUF, as SO_SNDBUF
 						//!< controls the maximum datagram size.
 
+	udp_mmsg_batch_t	*batch;		//!< Buffers for reading multiple datagrams
+						//!< per wakeup, NULL if recv_batch <= 1.
+
+	uint32_t		num_sockets;	//!< Number of SO_REUSEPORT sockets opened for
+						//!< the listen section.  If more than one, each
+						//!< is read by its own thread and event loop.
+	struct listen_thread_t	*thread;	//!< The thread which owns this socket, if any.
+
 #ifdef WITH_TCP
 	/* for a proxy connecting to home servers */
 	time_t			last_packet;
@@ -86,6 +86,16 @@ void	fr_hmac_md5(uint8_t digest[MD5_DIGEST_LENGTH], uint8_t const *text, size_t
 /* md5.c */
 void	fr_md5_calc(uint8_t *out, uint8_t const *in, size_t inlen);
 
+/* md5_multi.c */
+typedef struct fr_md5_multi_t {
+	uint8_t const	*in[2];			//!< Buffers to hash, as if they were concatenated.
+	size_t		inlen[2];		//!< Length of each buffer, the second may be 0.
+	uint8_t		*out;			//!< Where to write the MD5_DIGEST_LENGTH byte digest.
+} fr_md5_multi_t;
+
+unsigned int	fr_md5_multi_lanes(void);
+void		fr_md5_calc_multi(fr_md5_multi_t const *jobs, unsigned int num);
+
 #ifdef __cplusplus
 }
 #endif
@@ -154,6 +154,8 @@ fr_connection_pool_t	*module_connection_pool_init(CONF_SECTION *module,
 						     char const *log_prefix,
 						     char const *trigger_prefix,
 						     VALUE_PAIR *trigger_args);
+#define MODULE_EXFILE_CF_KEY "exfile"	//!< Where module_exfile_init() stores the handle in the module section.
+
 exfile_t *module_exfile_init(TALLOC_CTX *ctx,
 			     CONF_SECTION *module,
 			     uint32_t max_entries,
@@ -133,6 +133,12 @@ typedef struct value_pair {
 	value_data_t		data;
 } VALUE_PAIR;
 
+/** An index of the attributes in a VALUE_PAIR list, keyed by #fr_dict_attr_t
+ *
+ * Private to pair.c, see #fr_pair_index_alloc.
+ */
+typedef struct fr_pair_index fr_pair_index_t;
+
 /** Abstraction to allow iterating over different configurations of VALUE_PAIRs
  *
  * This allows functions which do not care about the structure of collections of VALUE_PAIRs
@@ -147,6 +153,8 @@ typedef struct vp_cursor {
 	VALUE_PAIR	*last;					//!< Temporary only used for fr_cursor_append
 	VALUE_PAIR	*current;				//!< The current attribute.
 	VALUE_PAIR	*next;					//!< Next attribute to process.
+	fr_pair_index_t	*index;					//!< Index of the list, kept up to date by the
+								//!< fr_cursor_* functions.  May be NULL.
 } vp_cursor_t;
 
 /** A VALUE_PAIR in string format.
@@ -224,6 +232,15 @@ int		fr_pair_update_by_num(TALLOC_CTX *ctx, VALUE_PAIR **list,
 				      value_data_t *value);
 void		fr_pair_delete_by_num(VALUE_PAIR **head, unsigned int vendor, unsigned int attr, int8_t tag);
 
+/* Indexing */
+fr_pair_index_t	*fr_pair_index_alloc(TALLOC_CTX *ctx, VALUE_PAIR **head);
+int		fr_pair_index_rebuild(fr_pair_index_t *index);
+VALUE_PAIR	**fr_pair_index_list(fr_pair_index_t *index);
+VALUE_PAIR	*fr_pair_index_find(fr_pair_index_t *index, fr_dict_attr_t const *da, int8_t tag);
+void		fr_pair_index_insert(fr_pair_index_t *index, VALUE_PAIR *vp, bool at_head);
+void		fr_pair_index_remove(fr_pair_index_t *index, VALUE_PAIR *vp);
+int		fr_pair_index_verify(fr_pair_index_t *index);
+
 /* Sorting */
 typedef		int8_t (*fr_cmp_t)(void const *a, void const *b);
 
@@ -33,6 +33,18 @@ RCSIDH(pcap_h, "$Id$")
 #include <sys/types.h>
 #include <pcap.h>
 
+/*
+ *	Linux can deliver captured packets through a ring buffer mapped
+ *	into our address space (PACKET_MMAP), which is much cheaper than
+ *	copying each packet out with recvfrom().
+ */
+#ifdef HAVE_LINUX_IF_PACKET_H
+#  include <linux/if_packet.h>
+#  ifdef TPACKET3_HDRLEN
+#    define HAVE_PCAP_RING 1
+#  endif
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -95,6 +107,25 @@ struct fr_pcap {
 	int			fd;				//!< Selectable file descriptor we feed to select.
 	struct pcap_stat	pstats;				//!< The last set of pcap stats for this handle.
 
+#ifdef HAVE_PCAP_RING
+	bool			ring;				//!< Capture using a TPACKET_V3 ring instead of libpcap.
+								//!< Only valid for live capture handles.
+	struct {
+		uint8_t			*map;			//!< The memory mapped ring.
+		size_t			map_len;		//!< Length of the ring.
+		unsigned int		block_size;		//!< Size of each block in the ring.
+		unsigned int		block_num;		//!< Number of blocks in the ring.
+		unsigned int		block_idx;		//!< Block we're reading, or will read next.
+		struct tpacket_block_desc *block;		//!< Block we're reading, NULL if we're waiting
+								//!< for the kernel to fill one.
+		struct tpacket3_hdr	*frame;			//!< Next frame in the current block.
+		uint32_t		frames_left;		//!< Frames remaining in the current block.
+		struct pcap_pkthdr	header;			//!< Header of the last frame returned.
+		struct pcap_stat	stats;			//!< Running totals, the kernel resets its
+								//!< counters every time they're read.
+	} tp;
+#endif
+
 	fr_pcap_t		*next;				//!< Next handle in collection.
 };
 
@@ -102,6 +133,8 @@ int		fr_pcap_if_link_layer(char *errbuff, pcap_if_t *dev);
 fr_pcap_t	*fr_pcap_init(TALLOC_CTX *ctx, char const *name, fr_pcap_type_t type);
 int		fr_pcap_open(fr_pcap_t *handle);
 int		fr_pcap_apply_filter(fr_pcap_t *handle, char const *expression);
+int		fr_pcap_next(fr_pcap_t *handle, struct pcap_pkthdr **header, uint8_t const **data);
+int		fr_pcap_stats(fr_pcap_t *handle, struct pcap_stat *stats);
 char		*fr_pcap_device_names(TALLOC_CTX *ctx, fr_pcap_t *handle, char c);
 int		fr_pcap_mac_addr(uint8_t *macaddr, char *ifname);
 #endif
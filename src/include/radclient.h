@@ -27,6 +27,10 @@ RCSIDH(radclient_h, "$Id$")
 
 #include <freeradius-devel/libradius.h>
 
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,6 +44,7 @@ extern "C" {
 #define DEBUG2(fmt, ...)	if (do_output && (fr_debug_lvl > 1)) fprintf(fr_log_fp, fmt "\n", ## __VA_ARGS__)
 
 
+#define INFO(fmt, ...)		if (do_output) fprintf(fr_log_fp, fmt "\n", ## __VA_ARGS__)
 #define ERROR(fmt, ...)		if (do_output) fr_perror("radclient: " fmt, ## __VA_ARGS__)
 
 #define RDEBUG_ENABLED()	(do_output && (fr_debug_lvl > 0))
@@ -88,6 +93,59 @@ struct rc_request {
 	char const	*name;		//!< Test name (as specified in the request).
 };
 
+#ifdef HAVE_PTHREAD_H
+#define RC_LOAD_HIST_SUB_BITS	5		//!< 32 buckets per power of two, so ~3% precision.
+#define RC_LOAD_HIST_MAX_BIT	36		//!< Latencies up to ~19 hours, in microseconds.
+#define RC_LOAD_HIST_BUCKETS	((RC_LOAD_HIST_MAX_BIT - RC_LOAD_HIST_SUB_BITS + 2) << RC_LOAD_HIST_SUB_BITS)
+
+#define RC_LOAD_BURST		256		//!< Maximum packets sent or received before doing
+						//!< something else.
+
+/** Counters for the open-loop load generator
+ *
+ */
+typedef struct rc_load_stats {
+	uint64_t	sent;			//!< Requests sent.
+	uint64_t	received;		//!< Responses received and verified.
+	uint64_t	timeouts;		//!< Requests which received no response within the timeout.
+	uint64_t	no_id;			//!< Requests not sent, because every ID on every socket was in use.
+	uint64_t	errors;			//!< Requests we failed to send, and bad responses.
+	uint64_t	latency[RC_LOAD_HIST_BUCKETS];	//!< Log-linear histogram of response times
+							//!< in microseconds.
+} rc_load_stats_t;
+
+typedef struct rc_load_request rc_load_request_t;
+
+/** A request sent by the open-loop load generator
+ *
+ * Requests are reused once they've been answered or have timed out, so
+ * the attributes are only copied from the base request once.
+ */
+struct rc_load_request {
+	RADIUS_PACKET		*packet;	//!< The outgoing request.  Must be first, for fr_packet2myptr().
+	rc_request_t const	*base;		//!< Request read from the input file, which this is a copy of.
+	unsigned int		base_idx;	//!< Index of the base request, for the free lists.
+	uint64_t		sent;		//!< When the request was sent, in microseconds.
+
+	rc_load_request_t	*prev;		//!< Outstanding requests, oldest first.
+	rc_load_request_t	*next;
+};
+
+/** A thread sending requests at a fixed rate
+ *
+ * Each thread has its own sockets and packet list, so the only
+ * state shared with the main thread is the stats.
+ */
+typedef struct rc_load_thread {
+	int			id;		//!< Thread number, for logging.
+	pthread_t		thread;		//!< Thread sending the requests.
+	bool			running;	//!< Whether the thread was started.
+
+	pthread_mutex_t		mutex;		//!< Protects the stats.
+	rc_load_stats_t		stats;		//!< Counters since the last report.
+} rc_load_thread_t;
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -147,7 +147,8 @@ typedef struct main_config {
 
 	struct timeval	init_delay;			//!< Initial request processing delay.
 
-	uint32_t       	talloc_pool_size;		//!< Size of pool to allocate to hold each #REQUEST.
+	uint32_t       	talloc_pool_size;		//!< Initial size of pool to allocate to hold each #REQUEST.
+	uint32_t	talloc_pool_cache;		//!< Maximum number of empty pools each thread keeps for re-use.
 
 	bool		memory_report;			//!< Print a memory report on what's left unfreed.
 							//!< Can only be used when the server is running in single
@@ -398,6 +399,21 @@ REQUEST		*request_alloc(TALLOC_CTX *ctx);
 REQUEST		*request_alloc_fake(REQUEST *oldreq);
 REQUEST		*request_alloc_coa(REQUEST *request);
 REQUEST		*request_alloc_proxy(REQUEST *request);
+
+/** Statistics for the pools requests are allocated in
+ *
+ */
+typedef struct request_pool_stats_t {
+	uint64_t	created;			//!< Pools allocated by request_pool_alloc().
+	uint64_t	reused;				//!< Pools taken from a thread's cache.
+	uint64_t	sampled;			//!< Pools whose footprint was measured when freed.
+	uint64_t	overflowed;			//!< Sampled pools which were too small for the request.
+	uint32_t	size;				//!< Size new pools are currently allocated with.
+} request_pool_stats_t;
+
+TALLOC_CTX	*request_pool_alloc(char const *name);
+void		request_pool_free(TALLOC_CTX *ctx);
+void		request_pool_stats(request_pool_stats_t *stats);
 int		request_data_add(REQUEST *request, void *unique_ptr, int unique_int, void *opaque,
 				 bool free_on_replace, bool free_on_parent, bool persist);
 void		*request_data_get(REQUEST *request, void *unique_ptr, int unique_int);
@@ -553,6 +569,8 @@ int	total_active_threads(void);
 void	thread_pool_lock(void);
 void	thread_pool_unlock(void);
 void	thread_pool_queue_stats(int array[RAD_LISTEN_MAX], int pps[2]);
+uint64_t thread_pool_num_stolen(void);
+void	thread_pool_shared_enqueue(void);
 
 /* main_config.c */
 /* Define a global config structure */
@@ -583,6 +601,7 @@ fr_event_list_t *radius_event_list_corral(event_corral_t hint);
 int radius_event_init(TALLOC_CTX *ctx);
 int radius_event_start(bool spawn_flag);
 void radius_event_free(void);
+void radius_event_discard(REQUEST *request);
 int radius_event_process(void);
 void radius_update_listener(rad_listen_t *listener);
 void revive_home_server(void *ctx, struct timeval *now);
@@ -29,6 +29,10 @@ RCSIDH(radsniff_h, "$Id$")
 
 #include <sys/types.h>
 
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/pcap.h>
 #include <freeradius-devel/event.h>
@@ -44,6 +48,8 @@ RCSIDH(radsniff_h, "$Id$")
 #define RS_RETRANSMIT_MAX	5		//!< Maximum number of times we expect to see a packet retransmitted
 #define RS_MAX_ATTRS		50		//!< Maximum number of attributes we can filter on.
 #define RS_SOCKET_REOPEN_DELAY  5000		//!< How long we delay re-opening a collectd socket.
+#define RS_WORKER_QUEUE_LEN	8192		//!< Maximum number of packets waiting for each worker.
+#define RS_WORKER_MAX		64		//!< Maximum number of worker threads.
 
 /*
  *	Logging macros
@@ -218,6 +224,48 @@ typedef struct rs_event {
 	rs_stats_t		*stats;			//!< Where to write stats.
 } rs_event_t;
 
+#ifdef HAVE_PTHREAD_H
+/** A copy of a captured packet, waiting to be processed by a worker
+ *
+ */
+typedef struct rs_work {
+	rs_event_t		*event;			//!< Capture source the packet was read from.
+	uint64_t		count;			//!< Number of the packet.
+	struct pcap_pkthdr	header;			//!< Copy of the PCAP packet header.
+	uint8_t			data[];			//!< Copy of the PCAP packet data.
+} rs_work_t;
+
+/** A thread processing a subset of the captured flows
+ *
+ * Each worker has its own request trees, timer events and stats, so the
+ * workers never need to coordinate with each other.  Packets are assigned
+ * to workers by hashing their addresses, ports and ID, so a request and
+ * its response always end up on the same worker.
+ */
+typedef struct rs_worker {
+	int			id;			//!< Worker number, for logging.
+	pthread_t		thread;			//!< Thread running the worker.
+	bool			running;		//!< Whether the thread was started.
+
+	TALLOC_CTX		*ctx;			//!< Requests being tracked by this worker.
+	fr_event_list_t		*list;			//!< Timer events for this worker's requests.
+	rbtree_t		*request_tree;		//!< Requests, keyed by the expected response.
+	rbtree_t		*link_tree;		//!< Requests, keyed by the linking attributes.
+
+	rs_stats_t		*stats;			//!< Merged into the main stats every interval.
+	pthread_mutex_t		stats_mutex;		//!< Held while the stats are being updated or merged.
+
+	pthread_mutex_t		queue_mutex;		//!< Protects the queue and the fields below.
+	rs_work_t		**queue;		//!< Circular buffer of packets to process.
+	unsigned int		queue_head;		//!< Next packet to process.
+	unsigned int		queue_num;		//!< Number of packets in the queue.
+	uint64_t		queue_dropped;		//!< Packets dropped this interval, as the queue was full.
+	bool			stop;			//!< Exit after processing the current packet.
+
+	int			wake[2];		//!< Written to when the queue stops being empty.
+} rs_worker_t;
+#endif
+
 typedef struct rs_update rs_update_t;
 
 /** Callback for printing stats header.
@@ -286,6 +334,9 @@ struct rs {
 
 	int			buffer_pkts;		//!< Size of the ring buffer to setup for live capture.
 	uint64_t		limit;			//!< Maximum number of packets to capture
+	bool			ring;			//!< Capture using a TPACKET_V3 ring (Linux only).
+	int			workers;		//!< Number of threads to process packets with.
+							//!< 0 processes them in the capture thread.
 
 	struct {
 		int			interval;		//!< Time between stats updates in seconds.
@@ -39,6 +39,24 @@ extern "C" {
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+/** A datagram received by udp_recv_mmsg()
+ *
+ */
+typedef struct udp_mmsg_t {
+	uint8_t			*data;		//!< Datagram contents.
+	ssize_t			data_len;	//!< Length of the datagram.
+
+	fr_ipaddr_t		src_ipaddr;
+	uint16_t		src_port;
+	fr_ipaddr_t		dst_ipaddr;
+	uint16_t		dst_port;
+	int			if_index;
+
+	struct timeval		when;		//!< When the datagram was received.
+} udp_mmsg_t;
+
+typedef struct udp_mmsg_batch_t udp_mmsg_batch_t;
+
 ssize_t udp_send(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *src_ipaddr, uint16_t src_port, int if_index,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t dst_port);
@@ -52,6 +70,10 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
 		 struct timeval *when);
 
+udp_mmsg_batch_t *udp_mmsg_batch_alloc(TALLOC_CTX *ctx, int num);
+
+int udp_recv_mmsg(int sockfd, udp_mmsg_batch_t *batch, udp_mmsg_t **out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -37,6 +37,8 @@ int recvfromto(int s, void *buf, size_t len, int flags,
 	       struct sockaddr *from, socklen_t *fromlen,
 	       struct sockaddr *to, socklen_t *tolen,
 	       int *if_index, struct timeval *when);
+void udpfromto_cmsg(struct msghdr *msgh, struct sockaddr *to, socklen_t *tolen,
+		    int *if_index, struct timeval *when);
 int sendfromto(int s, void *buf, size_t len, int flags,
 	       struct sockaddr *from, socklen_t fromlen,
 	       struct sockaddr *to, socklen_t tolen,
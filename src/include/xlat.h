@@ -86,6 +86,12 @@ ssize_t xlat_tokenize(TALLOC_CTX *ctx, char *fmt, xlat_exp_t **head, char const
 
 size_t xlat_snprint(char *buffer, size_t bufsize, xlat_exp_t const *node);
 
+ssize_t xlat_cache_add(TALLOC_CTX *owner, char const *fmt, char const **error);
+
+xlat_exp_t const *xlat_cache_find(char const *fmt);
+
+void xlat_cache_hup(void);
+
 #define XLAT_DEFAULT_BUF_LEN	2048
 
 int		xlat_register(void *mod_inst, char const *name,
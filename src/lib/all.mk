@@ -8,6 +8,7 @@ TARGET		:= libfreeradius-radius.a
 SOURCES		:= cbuff.c \
 		   cursor.c \
 		   debug.c \
+		   detail_binary.c \
 		   dict.c \
 		   filters.c \
 		   hash.c \
@@ -20,6 +21,7 @@ SOURCES		:= cbuff.c \
 		   missing.c \
 		   md4.c \
 		   md5.c \
+		   md5_multi.c \
 		   net.c \
 		   pair.c \
 		   pcap.c \
@@ -43,6 +45,7 @@ SOURCES		:= cbuff.c \
 		   event.c \
 		   getaddrinfo.c \
 		   heap.c \
+		   trie.c \
 		   tcp.c \
 		   udp.c \
 		   base64.c \
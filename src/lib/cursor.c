@@ -21,6 +21,8 @@
  *
  * @note Do not modify collections of VALUE_PAIRs pointed to by a cursor
  *	 with none fr_cursor_* functions, during the lifetime of that cursor.
+ *	 This goes double for indexed lists, where the index would be left
+ *	 pointing at the wrong attributes.
  *
  * @author Arran Cudbard-Bell <a.cudbardb@freeradius.org>
  * @copyright 2013-2015 Arran Cudbard-Bell <a.cudbardb@freeradius.org>
@@ -87,6 +89,28 @@ VALUE_PAIR *fr_cursor_init(vp_cursor_t *cursor, VALUE_PAIR * const *const_vp)
 	return cursor->current;
 }
 
+/** Setup a cursor to iterate over an indexed list of attribute pairs
+ *
+ * Modifications made to the list with the cursor keep the index up to date,
+ * and #fr_cursor_next_by_da uses the index to find the first matching
+ * attribute, when it's called on a freshly initialised cursor.
+ *
+ * @param cursor Where to initialise the cursor (uses existing structure).
+ * @param index of the list to iterate over, see #fr_pair_index_alloc.
+ * @return the first attribute in the list.
+ */
+VALUE_PAIR *fr_cursor_init_indexed(vp_cursor_t *cursor, fr_pair_index_t *index)
+{
+	VALUE_PAIR *vp;
+
+	if (!index) return NULL;
+
+	vp = fr_cursor_init(cursor, fr_pair_index_list(index));
+	cursor->index = index;
+
+	return vp;
+}
+
 /** Copy a cursor
  *
  * @param in Cursor to copy.
@@ -240,6 +264,14 @@ VALUE_PAIR *fr_cursor_next_by_da(vp_cursor_t *cursor, fr_dict_attr_t const *da,
 
 	if (!cursor->first) return NULL;
 
+	/*
+	 *	Searching from the start of an indexed list, the
+	 *	index has the answer.
+	 */
+	if (cursor->index && !cursor->found && cursor->current && (cursor->current == *cursor->first)) {
+		return fr_cursor_update(cursor, fr_pair_index_find(cursor->index, da, tag));
+	}
+
 	for (i = cursor->found ? cursor->found->next : cursor->current;
 	     i != NULL;
 	     i = i->next) {
@@ -370,6 +402,7 @@ void fr_cursor_prepend(vp_cursor_t *cursor, VALUE_PAIR *vp)
 	if (!*(cursor->first)) {
 		*cursor->first = vp;
 		cursor->current = vp;
+		if (cursor->index) fr_pair_index_insert(cursor->index, vp, true);
 
 		return;
 	}
@@ -379,6 +412,7 @@ void fr_cursor_prepend(vp_cursor_t *cursor, VALUE_PAIR *vp)
 	 */
 	vp->next = *cursor->first;
 	*cursor->first = vp;
+	if (cursor->index) fr_pair_index_insert(cursor->index, vp, true);
 
 	/*
 	 *	Either current was never set, or something iterated to the
@@ -426,6 +460,7 @@ void fr_cursor_append(vp_cursor_t *cursor, VALUE_PAIR *vp)
 	if (!*(cursor->first)) {
 		*cursor->first = vp;
 		cursor->current = vp;
+		if (cursor->index) fr_pair_index_insert(cursor->index, vp, true);
 
 		return;
 	}
@@ -462,6 +497,7 @@ void fr_cursor_append(vp_cursor_t *cursor, VALUE_PAIR *vp)
 	 */
 	cursor->last->next = vp;
 	cursor->last = vp;	/* Wind it forward a little more */
+	if (cursor->index) fr_pair_index_insert(cursor->index, vp, false);
 
 	/*
 	 *	If the next pointer was NULL, and the VALUE_PAIR
@@ -553,6 +589,7 @@ VALUE_PAIR *fr_cursor_remove(vp_cursor_t *cursor)
 
 fixup:
 	vp->next = NULL;			/* limit scope of fr_pair_list_free() */
+	if (cursor->index) fr_pair_index_remove(cursor->index, vp);
 
 	/*
 	 *	Fixup cursor->found if we removed the VP it was referring to,
@@ -586,6 +623,7 @@ VALUE_PAIR *fr_cursor_replace(vp_cursor_t *cursor, VALUE_PAIR *new)
 	vp = cursor->current;
 	if (!vp) {
 		*cursor->first = new;
+		if (cursor->index) (void) fr_pair_index_rebuild(cursor->index);
 		return NULL;
 	}
 
@@ -600,6 +638,11 @@ VALUE_PAIR *fr_cursor_replace(vp_cursor_t *cursor, VALUE_PAIR *new)
 	new->next = vp->next;
 	vp->next = NULL;
 
+	if (cursor->index) {
+		fr_pair_index_remove(cursor->index, vp);
+		fr_pair_index_insert(cursor->index, new, (last == cursor->first));
+	}
+
 	return vp;
 }
 
@@ -630,6 +673,7 @@ void fr_cursor_free(vp_cursor_t *cursor)
 		cursor->found = NULL;
 		cursor->last = NULL;
 		fr_pair_list_free(cursor->first);
+		if (cursor->index) (void) fr_pair_index_rebuild(cursor->index);
 	}
 
 	vp = cursor->current;
@@ -651,6 +695,7 @@ void fr_cursor_free(vp_cursor_t *cursor)
 	}
 
 	fr_pair_list_free(&before->next);
+	if (cursor->index) (void) fr_pair_index_rebuild(cursor->index);
 
 	cursor->current = before;		/* current jumps back one, but this is usually desirable */
 	cursor->next = NULL;			/* we just truncated the list, there is no next... */
@@ -0,0 +1,279 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/detail_binary.c
+ * @brief Encode and decode records in the binary detail file format.
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/detail_binary.h>
+
+/*
+ *	Encrypted attributes are hidden with an empty secret and a
+ *	zero vector.  The file is no more secret than a text detail
+ *	file, but the attributes round trip through the normal RADIUS
+ *	encoder and decoder.
+ */
+static void detail_binary_ctx(fr_radius_ctx_t *ctx, RADIUS_PACKET *fake, uint8_t code, char const *secret)
+{
+	memset(fake, 0, sizeof(*fake));
+	fake->code = code;
+
+	ctx->packet = fake;
+	ctx->original = fake;
+	ctx->secret = secret;
+}
+
+/** Encode a packet as a binary detail record
+ *
+ * Attributes which can't be encoded in RADIUS format (internal attributes)
+ * are silently skipped, as they are when the packet is sent on the wire.
+ *
+ * @param[out] out		Where to write the record.
+ * @param[in] outlen		Length of the output buffer.
+ * @param[in] packet		to encode.
+ * @param[in] timestamp		to write into the record header.
+ * @param[in] log_srcdst	write the packet's addresses and ports into the header.
+ * @param[in] skip		Optional callback to leave attributes out of the record.
+ * @param[in] uctx		passed to skip.
+ * @return
+ *	- The length of the record.
+ *	- -1 on error, including the record being too large for the buffer.
+ */
+ssize_t fr_detail_binary_encode(uint8_t *out, size_t outlen, RADIUS_PACKET const *packet,
+				time_t timestamp, bool log_srcdst,
+				fr_detail_binary_skip_t skip, void *uctx)
+{
+	fr_detail_binary_hdr_t	*hdr = (fr_detail_binary_hdr_t *) out;
+	uint8_t			*p, *end;
+	uint32_t		num;
+	uint16_t		port;
+	VALUE_PAIR		*vp;
+	vp_cursor_t		cursor;
+	RADIUS_PACKET		fake;
+	fr_radius_ctx_t		encoder_ctx;
+	char			*secret;
+
+	if (outlen > FR_DETAIL_BINARY_MAX_LEN) outlen = FR_DETAIL_BINARY_MAX_LEN;
+	if (outlen < FR_DETAIL_BINARY_HDR_LEN) {
+		fr_strerror_printf("Output buffer too small");
+		return -1;
+	}
+
+	memset(hdr, 0, FR_DETAIL_BINARY_HDR_LEN);
+	memcpy(hdr->magic, FR_DETAIL_BINARY_MAGIC, sizeof(hdr->magic));
+	hdr->code = packet->code;
+
+	num = htonl((uint32_t) timestamp);
+	memcpy(hdr->timestamp, &num, sizeof(hdr->timestamp));
+
+	if (log_srcdst) switch (packet->src_ipaddr.af) {
+	case AF_INET:
+		hdr->af = 4;
+		memcpy(hdr->src_ipaddr, &packet->src_ipaddr.ipaddr.ip4addr, 4);
+		memcpy(hdr->dst_ipaddr, &packet->dst_ipaddr.ipaddr.ip4addr, 4);
+		break;
+
+	case AF_INET6:
+		hdr->af = 6;
+		memcpy(hdr->src_ipaddr, &packet->src_ipaddr.ipaddr.ip6addr, 16);
+		memcpy(hdr->dst_ipaddr, &packet->dst_ipaddr.ipaddr.ip6addr, 16);
+		break;
+
+	default:
+		break;
+	}
+
+	if (hdr->af) {
+		port = htons(packet->src_port);
+		memcpy(hdr->src_port, &port, sizeof(hdr->src_port));
+		port = htons(packet->dst_port);
+		memcpy(hdr->dst_port, &port, sizeof(hdr->dst_port));
+	}
+
+	secret = talloc_typed_strdup(NULL, "");
+	if (!secret) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+	detail_binary_ctx(&encoder_ctx, &fake, packet->code, secret);
+
+	p = out + FR_DETAIL_BINARY_HDR_LEN;
+	end = out + outlen;
+
+	vp = fr_cursor_init(&cursor, &packet->vps);
+	while (vp) {
+		int len;
+
+		if (skip && skip(vp, uctx)) {
+			vp = fr_cursor_next(&cursor);
+			continue;
+		}
+
+		if ((end - p) <= 2) goto too_big;
+
+		len = fr_radius_encode_pair(p, end - p, &cursor, &encoder_ctx);
+		if (len < 0) {
+			talloc_free(secret);
+			return -1;
+		}
+
+		/*
+		 *	Zero length means either the attribute was
+		 *	skipped, or there wasn't room for it.  The
+		 *	encoder advances the cursor in the first case.
+		 */
+		if ((len == 0) && (fr_cursor_current(&cursor) == vp)) {
+		too_big:
+			talloc_free(secret);
+			fr_strerror_printf("Record too large for buffer of %zu bytes", outlen);
+			return -1;
+		}
+
+		p += len;
+		vp = fr_cursor_current(&cursor);
+	}
+	talloc_free(secret);
+
+	num = htonl(p - out);
+	memcpy(hdr->length, &num, sizeof(hdr->length));
+
+	return p - out;
+}
+
+/** Check whether a buffer starts with a binary detail record
+ *
+ * @param[in] data	to check.
+ * @param[in] data_len	of data.
+ * @return true if the data looks like a binary detail file.
+ */
+bool fr_detail_binary_is_binary(uint8_t const *data, size_t data_len)
+{
+	if (data_len < sizeof(((fr_detail_binary_hdr_t *) NULL)->magic)) return false;
+
+	return (memcmp(data, FR_DETAIL_BINARY_MAGIC, sizeof(((fr_detail_binary_hdr_t *) NULL)->magic)) == 0);
+}
+
+/** Decode one binary detail record
+ *
+ * The attributes are decoded straight from the buffer, which is usually
+ * a mapped detail file.
+ *
+ * @param[in] ctx	to allocate VALUE_PAIRs in.
+ * @param[out] out	Where to write the decoded record.
+ * @param[in] data	Start of the record.
+ * @param[in] data_len	Length of data remaining in the buffer.
+ * @return
+ *	- The length of the record.
+ *	- 0 if the buffer holds a truncated record.
+ *	- -1 if the record is malformed.
+ */
+ssize_t fr_detail_binary_decode(TALLOC_CTX *ctx, fr_detail_binary_t *out, uint8_t const *data, size_t data_len)
+{
+	fr_detail_binary_hdr_t const	*hdr = (fr_detail_binary_hdr_t const *) data;
+	uint8_t const			*p, *end;
+	uint32_t			num;
+	uint16_t			port;
+	VALUE_PAIR			*head = NULL;
+	vp_cursor_t			cursor;
+	RADIUS_PACKET			fake;
+	fr_radius_ctx_t			decoder_ctx;
+	char				*secret;
+
+	memset(out, 0, sizeof(*out));
+
+	if (data_len < FR_DETAIL_BINARY_HDR_LEN) return 0;
+
+	if (!fr_detail_binary_is_binary(data, data_len)) {
+		fr_strerror_printf("Bad magic in record header");
+		return -1;
+	}
+
+	memcpy(&num, hdr->length, sizeof(num));
+	num = ntohl(num);
+	if ((num < FR_DETAIL_BINARY_HDR_LEN) || (num > FR_DETAIL_BINARY_MAX_LEN)) {
+		fr_strerror_printf("Invalid record length %u", num);
+		return -1;
+	}
+	if (num > data_len) return 0;
+
+	out->code = hdr->code;
+	out->flags = hdr->flags;
+
+	memcpy(&num, hdr->timestamp, sizeof(num));
+	out->timestamp = ntohl(num);
+
+	switch (hdr->af) {
+	case 4:
+		out->src_ipaddr.af = out->dst_ipaddr.af = AF_INET;
+		out->src_ipaddr.prefix = out->dst_ipaddr.prefix = 32;
+		memcpy(&out->src_ipaddr.ipaddr.ip4addr, hdr->src_ipaddr, 4);
+		memcpy(&out->dst_ipaddr.ipaddr.ip4addr, hdr->dst_ipaddr, 4);
+		break;
+
+	case 6:
+		out->src_ipaddr.af = out->dst_ipaddr.af = AF_INET6;
+		out->src_ipaddr.prefix = out->dst_ipaddr.prefix = 128;
+		memcpy(&out->src_ipaddr.ipaddr.ip6addr, hdr->src_ipaddr, 16);
+		memcpy(&out->dst_ipaddr.ipaddr.ip6addr, hdr->dst_ipaddr, 16);
+		break;
+
+	default:
+		out->src_ipaddr.af = out->dst_ipaddr.af = AF_UNSPEC;
+		break;
+	}
+
+	memcpy(&port, hdr->src_port, sizeof(port));
+	out->src_port = ntohs(port);
+	memcpy(&port, hdr->dst_port, sizeof(port));
+	out->dst_port = ntohs(port);
+
+	memcpy(&num, hdr->length, sizeof(num));
+	p = data + FR_DETAIL_BINARY_HDR_LEN;
+	end = data + ntohl(num);
+
+	secret = talloc_typed_strdup(NULL, "");
+	if (!secret) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+	detail_binary_ctx(&decoder_ctx, &fake, out->code, secret);
+
+	fr_cursor_init(&cursor, &head);
+	while (p < end) {
+		ssize_t len;
+
+		len = fr_radius_decode_pair(ctx, &cursor, fr_dict_root(fr_dict_internal), p, end - p, &decoder_ctx);
+		if (len <= 0) {
+			talloc_free(secret);
+			fr_pair_list_free(&head);
+			if (len == 0) fr_strerror_printf("Zero length attribute in record");
+			return -1;
+		}
+		p += len;
+	}
+	talloc_free(secret);
+
+	out->vps = head;
+
+	return end - data;
+}
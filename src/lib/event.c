@@ -36,6 +36,15 @@ RCSID("$Id$")
 #endif
 #endif	/* HAVE_KQUEUE */
 
+/*
+ *	Prefer epoll over select on systems which have it.  kqueue
+ *	takes precedence, as the two are never both available.
+ */
+#if !defined(HAVE_KQUEUE) && defined(HAVE_EPOLL_CREATE1) && defined(HAVE_SYS_EPOLL_H)
+#  define HAVE_EPOLL
+#  include <sys/epoll.h>
+#endif
+
 typedef struct fr_event_fd_t {
 	int			fd;
 	fr_event_fd_handler_t	handler;
@@ -44,6 +53,12 @@ typedef struct fr_event_fd_t {
 
 #define FR_EV_MAX_FDS (256)
 
+/*
+ *	How many ready FDs we get from the kernel in one epoll_wait().
+ *	Any more are returned by the next call.
+ */
+#define FR_EV_BATCH_FDS (256)
+
 #undef USEC
 #define USEC (1000000)
 
@@ -58,16 +73,25 @@ struct fr_event_list_t {
 	bool		dispatch;
 
 	int		num_readers;
-#ifndef HAVE_KQUEUE
+#if defined(HAVE_KQUEUE)
+	int		kq;
+	struct kevent	events[FR_EV_MAX_FDS]; /* so it doesn't go on the stack every time */
+	fr_event_fd_t	readers[FR_EV_MAX_FDS];
+
+#elif defined(HAVE_EPOLL)
+	int		epfd;
+	struct epoll_event events[FR_EV_BATCH_FDS];
+
+	int		max_readers;	//!< Number of entries in readers.
+	fr_event_fd_t	*readers;	//!< Indexed by FD, and grown as needed.
+
+#else
 	int		max_readers;
 
 	bool		changed;
 
-#else
-	int		kq;
-	struct kevent	events[FR_EV_MAX_FDS]; /* so it doesn't go on the stack every time */
-#endif
 	fr_event_fd_t	readers[FR_EV_MAX_FDS];
+#endif
 };
 
 /*
@@ -108,8 +132,10 @@ static int _event_list_free(fr_event_list_t *list)
 
 	fr_heap_delete(el->times);
 
-#ifdef HAVE_KQUEUE
+#if defined(HAVE_KQUEUE)
 	close(el->kq);
+#elif defined(HAVE_EPOLL)
+	close(el->epfd);
 #endif
 
 	return 0;
@@ -118,7 +144,9 @@ static int _event_list_free(fr_event_list_t *list)
 
 fr_event_list_t *fr_event_list_create(TALLOC_CTX *ctx, fr_event_status_t status)
 {
+#ifndef HAVE_EPOLL
 	int i;
+#endif
 	fr_event_list_t *el;
 
 	el = talloc_zero(ctx, fr_event_list_t);
@@ -133,19 +161,33 @@ fr_event_list_t *fr_event_list_create(TALLOC_CTX *ctx, fr_event_status_t status)
 		return NULL;
 	}
 
+#if defined(HAVE_EPOLL)
+	/*
+	 *	The destructor closes the FD, so make sure it's valid
+	 *	before we can fail.
+	 */
+	el->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->epfd < 0) {
+		el->epfd = -1;
+		talloc_free(el);
+		return NULL;
+	}
+
+#else
 	for (i = 0; i < FR_EV_MAX_FDS; i++) {
 		el->readers[i].fd = -1;
 	}
 
-#ifndef HAVE_KQUEUE
+#  ifndef HAVE_KQUEUE
 	el->changed = true;	/* force re-set of fds's */
 
-#else
+#  else
 	el->kq = kqueue();
 	if (el->kq < 0) {
 		talloc_free(el);
 		return NULL;
 	}
+#  endif
 #endif
 
 	el->status = status;
@@ -351,10 +393,12 @@ int fr_event_fd_insert(fr_event_list_t *el, int type, int fd,
 		return 0;
 	}
 
+#ifndef HAVE_EPOLL
 	if (el->num_readers >= FR_EV_MAX_FDS) {
 		fr_strerror_printf("Too many readers");
 		return 0;
 	}
+#endif
 	ef = NULL;
 
 #ifdef HAVE_KQUEUE
@@ -395,6 +439,65 @@ int fr_event_fd_insert(fr_event_list_t *el, int type, int fd,
 		break;
 	}
 
+#elif defined(HAVE_EPOLL)
+	/*
+	 *	FDs are small integers, so we index the readers by FD.
+	 *	The array is grown to fit, and there's no fixed limit
+	 *	on the number of readers.
+	 */
+	if (fd >= el->max_readers) {
+		int		max;
+		fr_event_fd_t	*readers;
+
+		max = el->max_readers ? el->max_readers : FR_EV_MAX_FDS;
+		while (max <= fd) max *= 2;
+
+		readers = talloc_realloc(el, el->readers, fr_event_fd_t, max);
+		if (!readers) {
+			fr_strerror_printf("Out of memory");
+			return 0;
+		}
+
+		for (i = el->max_readers; i < max; i++) readers[i].fd = -1;
+
+		el->readers = readers;
+		el->max_readers = max;
+	}
+
+	/*
+	 *	Be fail-safe on multiple inserts.
+	 */
+	if (el->readers[fd].fd == fd) {
+		if ((el->readers[fd].handler != handler) ||
+		    (el->readers[fd].ctx != ctx)) {
+			fr_strerror_printf("Multiple handlers for same FD");
+			return 0;
+		}
+
+		return 1;
+	}
+
+	{
+		struct epoll_event evset;
+
+		/*
+		 *	Level triggered, as the handlers read one
+		 *	packet per call, and expect to be called
+		 *	again if there's more data.
+		 */
+		memset(&evset, 0, sizeof(evset));
+		evset.events = EPOLLIN;
+		evset.data.fd = fd;
+
+		if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, fd, &evset) < 0) {
+			fr_strerror_printf("Failed inserting event for FD %i: %s", fd, fr_syserror(errno));
+			return 0;
+		}
+	}
+
+	ef = &el->readers[fd];
+	el->num_readers++;
+
 #else  /* HAVE_KQUEUE */
 
 	for (i = 0; i <= el->max_readers; i++) {
@@ -433,7 +536,7 @@ int fr_event_fd_insert(fr_event_list_t *el, int type, int fd,
 	ef->handler = handler;
 	ef->ctx = ctx;
 
-#ifndef HAVE_KQUEUE
+#if !defined(HAVE_KQUEUE) && !defined(HAVE_EPOLL)
 	el->changed = true;
 #endif
 
@@ -473,6 +576,22 @@ int fr_event_fd_delete(fr_event_list_t *el, int type, int fd)
 		return 1;
 	}
 
+#elif defined(HAVE_EPOLL)
+	i = fd;
+	if ((i >= el->max_readers) || (el->readers[i].fd != fd)) return 0;
+
+	/*
+	 *	The caller MAY have closed the FD, in which case the
+	 *	kernel has already removed it.  So we ignore the
+	 *	return code from epoll_ctl().
+	 */
+	(void) epoll_ctl(el->epfd, EPOLL_CTL_DEL, fd, NULL);
+
+	el->readers[i].fd = -1;
+	el->num_readers--;
+
+	return 1;
+
 #else
 
 	for (i = 0; i < el->max_readers; i++) {
@@ -507,8 +626,10 @@ int fr_event_loop(fr_event_list_t *el)
 {
 	int i, rcode;
 	struct timeval when, *wake;
-#ifdef HAVE_KQUEUE
+#if defined(HAVE_KQUEUE)
 	struct timespec ts_when, *ts_wake;
+#elif defined(HAVE_EPOLL)
+	int timeout;
 #else
 	int maxfd = 0;
 	fd_set read_fds, master_fds;
@@ -520,7 +641,7 @@ int fr_event_loop(fr_event_list_t *el)
 	el->dispatch = true;
 
 	while (!el->exit) {
-#ifndef HAVE_KQUEUE
+#if !defined(HAVE_KQUEUE) && !defined(HAVE_EPOLL)
 		/*
 		 *	Cache the list of FD's to watch.
 		 */
@@ -590,7 +711,25 @@ int fr_event_loop(fr_event_list_t *el)
 		 */
 		if (el->status) el->status(wake);
 
-#ifndef HAVE_KQUEUE
+#if defined(HAVE_EPOLL)
+		/*
+		 *	Round the timeout up, so that we don't wake up
+		 *	just before the first event is due.
+		 */
+		if (wake) {
+			timeout = (wake->tv_sec * 1000) + ((wake->tv_usec + 999) / 1000);
+		} else {
+			timeout = -1;
+		}
+
+		rcode = epoll_wait(el->epfd, el->events, FR_EV_BATCH_FDS, timeout);
+		if ((rcode < 0) && (errno != EINTR)) {
+			fr_strerror_printf("Failed in epoll_wait: %s", fr_syserror(errno));
+			el->dispatch = false;
+			return -1;
+		}
+
+#elif !defined(HAVE_KQUEUE)
 		read_fds = master_fds;
 		rcode = select(maxfd + 1, &read_fds, NULL, NULL, wake);
 		if ((rcode < 0) && (errno != EINTR)) {
@@ -621,7 +760,27 @@ int fr_event_loop(fr_event_list_t *el)
 
 		if (rcode <= 0) continue;
 
-#ifndef HAVE_KQUEUE
+#if defined(HAVE_EPOLL)
+		/*
+		 *	Service all of the ready FDs.  A handler may
+		 *	delete (or re-use) other FDs in this batch, so
+		 *	we look each one up again before calling it.
+		 *	Errors and hangups are passed to the handler,
+		 *	which SHOULD delete the connection.
+		 */
+		for (i = 0; i < rcode; i++) {
+			fr_event_fd_t *ef;
+			int fd = el->events[i].data.fd;
+
+			if (fd >= el->max_readers) continue;
+
+			ef = &el->readers[fd];
+			if (ef->fd != fd) continue;
+
+			ef->handler(el, ef->fd, ef->ctx);
+		}
+
+#elif !defined(HAVE_KQUEUE)
 		/*
 		 *	Loop over all of the sockets to see if there's
 		 *	an event for that socket.
@@ -690,13 +849,28 @@ int fr_event_loop(fr_event_list_t *el)
  *  OR
  *
  *   valgrind --tool=memcheck --leak-check=full --show-reachable=yes ./event
+ *
+ *  OR
+ *
+ *   ./event -b 1000 10000
+ *
+ *  to benchmark FD dispatch.  For each count, that many pipes are
+ *  registered with the event list, and BENCH_TOKENS bytes are passed
+ *  between randomly chosen pipes until BENCH_WAKEUPS reads have been
+ *  done.  The same work is then done with a select() loop, which
+ *  behaves the same as the select() backend.  select() can't watch
+ *  more than FD_SETSIZE descriptors, so it is skipped for larger
+ *  counts.  The FD limit is raised to the hard limit, which must be
+ *  at least twice the largest count.
  */
+#include <sys/resource.h>
+#include <fcntl.h>
 
-static void print_time(void *ctx)
+static void print_time(void *ctx, UNUSED struct timeval *now)
 {
 	struct timeval *when = ctx;
 
-	printf("%d.%06d\n", when->tv_sec, when->tv_usec);
+	printf("%d.%06d\n", (int) when->tv_sec, (int) when->tv_usec);
 	fflush(stdout);
 }
 
@@ -715,24 +889,198 @@ static uint32_t event_rand(void)
 	return num;
 }
 
+#define BENCH_TOKENS	(16)
+#define BENCH_WAKEUPS	(200000)
+
+typedef struct {
+	int		num;
+	int		*rfds;
+	int		*wfds;
+	uint32_t	count;
+} bench_ctx_t;
+
+/*
+ *	Read the token, and pass it on to a random pipe.
+ */
+static void bench_pass(bench_ctx_t *bc, int fd)
+{
+	char c;
+
+	if (read(fd, &c, 1) != 1) return;
+
+	if (write(bc->wfds[event_rand() % bc->num], &c, 1) != 1) {
+		fprintf(stderr, "write failed: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	bc->count++;
+}
+
+static void bench_handler(fr_event_list_t *el, int fd, void *ctx)
+{
+	bench_ctx_t *bc = ctx;
+
+	bench_pass(bc, fd);
+	if (bc->count >= BENCH_WAKEUPS) fr_event_loop_exit(el, 1);
+}
+
+static double bench_elapsed(struct timeval *start)
+{
+	struct timeval end;
+
+	gettimeofday(&end, NULL);
+
+	return ((end.tv_sec - start->tv_sec) * 1e9) + ((end.tv_usec - start->tv_usec) * 1e3);
+}
+
+static void bench_seed(bench_ctx_t *bc)
+{
+	int i;
+
+	for (i = 0; i < BENCH_TOKENS; i++) {
+		if (write(bc->wfds[event_rand() % bc->num], "x", 1) != 1) exit(1);
+	}
+}
+
+static void bench_drain(bench_ctx_t *bc)
+{
+	int i;
+	char c;
+
+	for (i = 0; i < bc->num; i++) while (read(bc->rfds[i], &c, 1) == 1);
+}
+
+static void bench_run(int num)
+{
+	int		i;
+	bench_ctx_t	bc;
+	struct timeval	start;
+	fr_event_list_t	*el;
+
+	memset(&bc, 0, sizeof(bc));
+	bc.num = num;
+	bc.rfds = talloc_array(NULL, int, num);
+	bc.wfds = talloc_array(NULL, int, num);
+
+	for (i = 0; i < num; i++) {
+		int fds[2];
+
+		if (pipe(fds) < 0) {
+			fprintf(stderr, "Can't open %i pipes (%s).  Raise the FD limit\n", num, fr_syserror(errno));
+			exit(1);
+		}
+		fr_nonblock(fds[0]);
+		bc.rfds[i] = fds[0];
+
+		/*
+		 *	Move the write side out of the way, so that
+		 *	select() can watch as many readers as possible.
+		 */
+		bc.wfds[i] = fcntl(fds[1], F_DUPFD, FD_SETSIZE);
+		if (bc.wfds[i] < 0) {
+			bc.wfds[i] = fds[1];
+		} else {
+			close(fds[1]);
+		}
+	}
+
+	/*
+	 *	The event list.
+	 */
+	el = fr_event_list_create(NULL, NULL);
+	if (!el) exit(1);
+
+	for (i = 0; i < num; i++) {
+		if (!fr_event_fd_insert(el, 0, bc.rfds[i], bench_handler, &bc)) {
+			printf("%6i fds  event list:  %s\n", num, fr_strerror());
+			break;
+		}
+	}
+
+	if (i == num) {
+		bench_seed(&bc);
+		gettimeofday(&start, NULL);
+		fr_event_loop(el);
+		printf("%6i fds  event list: %8.0f ns/wakeup\n", num, bench_elapsed(&start) / bc.count);
+	}
+	talloc_free(el);
+	bench_drain(&bc);
+
+	/*
+	 *	select(), with the fd_set cached between calls.
+	 */
+	if (bc.rfds[num - 1] >= FD_SETSIZE) {
+		printf("%6i fds  select():   n/a (FD_SETSIZE is %i)\n", num, FD_SETSIZE);
+	} else {
+		int	maxfd = 0;
+		fd_set	master_fds, read_fds;
+
+		FD_ZERO(&master_fds);
+		for (i = 0; i < num; i++) {
+			if (bc.rfds[i] > maxfd) maxfd = bc.rfds[i];
+			FD_SET(bc.rfds[i], &master_fds);
+		}
+
+		bc.count = 0;
+		bench_seed(&bc);
+		gettimeofday(&start, NULL);
+		while (bc.count < BENCH_WAKEUPS) {
+			read_fds = master_fds;
+			if (select(maxfd + 1, &read_fds, NULL, NULL, NULL) <= 0) continue;
+
+			for (i = 0; i < num; i++) {
+				if (FD_ISSET(bc.rfds[i], &read_fds)) bench_pass(&bc, bc.rfds[i]);
+			}
+		}
+		printf("%6i fds  select():   %8.0f ns/wakeup\n", num, bench_elapsed(&start) / bc.count);
+		bench_drain(&bc);
+	}
+
+	for (i = 0; i < num; i++) {
+		close(bc.rfds[i]);
+		close(bc.wfds[i]);
+	}
+	talloc_free(bc.rfds);
+	talloc_free(bc.wfds);
+}
 
 #define MAX 100
 int main(int argc, char **argv)
 {
-	int i, rcode;
+	int i;
 	struct timeval array[MAX];
+	fr_event_t *events[MAX];
 	struct timeval now, when;
 	fr_event_list_t *el;
 
-	el = fr_event_list_create(NULL, NULL);
-	if (!el) exit(1);
-
 	memset(&rand_pool, 0, sizeof(rand_pool));
 	rand_pool.randrsl[1] = time(NULL);
 
 	fr_randinit(&rand_pool, 1);
 	rand_pool.randcnt = 0;
 
+	if ((argc > 1) && (strcmp(argv[1], "-b") == 0)) {
+		struct rlimit rlim;
+
+		if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
+			rlim.rlim_cur = rlim.rlim_max;
+			(void) setrlimit(RLIMIT_NOFILE, &rlim);
+		}
+
+		if (argc == 2) {
+			bench_run(1000);
+			bench_run(10000);
+		}
+		for (i = 2; i < argc; i++) bench_run(atoi(argv[i]));
+
+		return 0;
+	}
+
+	el = fr_event_list_create(NULL, NULL);
+	if (!el) exit(1);
+
+	memset(events, 0, sizeof(events));
+
 	gettimeofday(&array[0], NULL);
 	for (i = 1; i < MAX; i++) {
 		array[i] = array[i - 1];
@@ -742,7 +1090,7 @@ int main(int argc, char **argv)
 			array[i].tv_usec -= 1000000;
 			array[i].tv_sec++;
 		}
-		fr_event_insert(el, print_time, &array[i], &array[i]);
+		fr_event_insert(el, print_time, &array[i], &array[i], &events[i]);
 	}
 
 	while (fr_event_list_num_elements(el)) {
@@ -0,0 +1,409 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/md5_multi.c
+ * @brief Calculate multiple independent MD5 digests at once.
+ *
+ * MD5 is a serial chain of dependent operations, so a single digest
+ * can't make use of SIMD registers.  What we can do is run one digest
+ * in each lane of a vector register, so that four (SSE2/NEON) or eight
+ * (AVX2) unrelated messages are hashed for roughly the cost of one.
+ *
+ * RADIUS authenticators are all MD5(packet + secret), and a batch of
+ * packets read with recvmmsg() gives us plenty of independent messages.
+ *
+ * The vector code uses the GCC/clang vector extensions.  The AVX2
+ * variant is compiled with a target attribute and only used if the CPU
+ * we're running on supports it.  Other compilers get the scalar code.
+ *
+ * @copyright 2016 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+
+#define MD5_MULTI_BLOCK_LENGTH	64
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define HAVE_MD5_MULTI_VECTOR
+#  if defined(__x86_64__) || defined(__i386__)
+#    define HAVE_MD5_MULTI_AVX2
+#  endif
+#endif
+
+/** Write a 32bit value out in little endian byte order
+ *
+ */
+#define PUT_32BIT_LE(_cp, _value) do {\
+	(_cp)[3] = (_value) >> 24;\
+	(_cp)[2] = (_value) >> 16;\
+	(_cp)[1] = (_value) >> 8;\
+	(_cp)[0] = (_value); } while (0)
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+static inline uint32_t GET_32BIT_LE(uint8_t const *cp)
+{
+	uint32_t value;
+
+	memcpy(&value, cp, sizeof(value));
+	return value;
+}
+#else
+#  define GET_32BIT_LE(_cp) (\
+	(uint32_t)((_cp)[0]) |\
+	(uint32_t)((_cp)[1]) <<  8 |\
+	(uint32_t)((_cp)[2]) << 16 |\
+	(uint32_t)((_cp)[3]) << 24)
+#endif
+
+/** Total length of the data for a job
+ *
+ */
+#define MD5_MULTI_LEN(_job) ((_job)->inlen[0] + (_job)->inlen[1])
+
+/** Number of 64 byte blocks needed for a job, including padding
+ *
+ */
+#define MD5_MULTI_BLOCKS(_job) (((MD5_MULTI_LEN(_job) + 8) / MD5_MULTI_BLOCK_LENGTH) + 1)
+
+/** Fill in one padded 64 byte block of the (virtual) concatenation of the job's buffers
+ *
+ * @param[out] block to write.
+ * @param[in] job to read data from.
+ * @param[in] offset of the block, from the start of the data.
+ * @param[in] last true if this is the final block, which contains the bit count.
+ */
+static void md5_multi_block(uint8_t block[MD5_MULTI_BLOCK_LENGTH], fr_md5_multi_t const *job,
+			    size_t offset, bool last)
+{
+	size_t		start = 0, total = MD5_MULTI_LEN(job);
+	uint64_t	bits;
+	int		i;
+
+	memset(block, 0, MD5_MULTI_BLOCK_LENGTH);
+
+	for (i = 0; i < 2; i++) {
+		size_t end = start + job->inlen[i];
+
+		if ((end > offset) && (start < (offset + MD5_MULTI_BLOCK_LENGTH))) {
+			size_t from = (offset > start) ? offset - start : 0;
+			size_t to = (start > offset) ? start - offset : 0;
+			size_t len = job->inlen[i] - from;
+
+			if (len > (MD5_MULTI_BLOCK_LENGTH - to)) len = MD5_MULTI_BLOCK_LENGTH - to;
+
+			memcpy(block + to, job->in[i] + from, len);
+		}
+		start = end;
+	}
+
+	if ((total >= offset) && (total < (offset + MD5_MULTI_BLOCK_LENGTH))) block[total - offset] = 0x80;
+
+	if (!last) return;
+
+	bits = ((uint64_t) total) << 3;
+	for (i = 0; i < 8; i++) block[56 + i] = (bits >> (i * 8)) & 0xff;
+}
+
+/** Calculate the digest for a single job with the normal MD5 functions
+ *
+ */
+static void md5_multi_scalar(fr_md5_multi_t const *job)
+{
+	FR_MD5_CTX ctx;
+
+	fr_md5_init(&ctx);
+	fr_md5_update(&ctx, job->in[0], job->inlen[0]);
+	if (job->inlen[1]) fr_md5_update(&ctx, job->in[1], job->inlen[1]);
+	fr_md5_final(job->out, &ctx);
+}
+
+#ifdef HAVE_MD5_MULTI_VECTOR
+/* The four core functions, these work equally well on vectors */
+#define F1(x, y, z) (z ^ (x & (y ^ z)))
+#define F2(x, y, z) F1(z, x, y)
+#define F3(x, y, z) (x ^ y ^ z)
+#define F4(x, y, z) (y ^ (x | ~z))
+
+#define MD5STEP(f, w, x, y, z, data, s) (w += f(x, y, z) + data, w = w << s | w >> (32 - s),  w += x)
+
+/** All 64 MD5 steps, operating on a, b, c, d and in[]
+ *
+ */
+#define MD5_ROUNDS \
+do { \
+	MD5STEP(F1, a, b, c, d, in[ 0] + 0xd76aa478,  7); \
+	MD5STEP(F1, d, a, b, c, in[ 1] + 0xe8c7b756, 12); \
+	MD5STEP(F1, c, d, a, b, in[ 2] + 0x242070db, 17); \
+	MD5STEP(F1, b, c, d, a, in[ 3] + 0xc1bdceee, 22); \
+	MD5STEP(F1, a, b, c, d, in[ 4] + 0xf57c0faf,  7); \
+	MD5STEP(F1, d, a, b, c, in[ 5] + 0x4787c62a, 12); \
+	MD5STEP(F1, c, d, a, b, in[ 6] + 0xa8304613, 17); \
+	MD5STEP(F1, b, c, d, a, in[ 7] + 0xfd469501, 22); \
+	MD5STEP(F1, a, b, c, d, in[ 8] + 0x698098d8,  7); \
+	MD5STEP(F1, d, a, b, c, in[ 9] + 0x8b44f7af, 12); \
+	MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17); \
+	MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22); \
+	MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122,  7); \
+	MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12); \
+	MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17); \
+	MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22); \
+	MD5STEP(F2, a, b, c, d, in[ 1] + 0xf61e2562,  5); \
+	MD5STEP(F2, d, a, b, c, in[ 6] + 0xc040b340,  9); \
+	MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14); \
+	MD5STEP(F2, b, c, d, a, in[ 0] + 0xe9b6c7aa, 20); \
+	MD5STEP(F2, a, b, c, d, in[ 5] + 0xd62f105d,  5); \
+	MD5STEP(F2, d, a, b, c, in[10] + 0x02441453,  9); \
+	MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14); \
+	MD5STEP(F2, b, c, d, a, in[ 4] + 0xe7d3fbc8, 20); \
+	MD5STEP(F2, a, b, c, d, in[ 9] + 0x21e1cde6,  5); \
+	MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6,  9); \
+	MD5STEP(F2, c, d, a, b, in[ 3] + 0xf4d50d87, 14); \
+	MD5STEP(F2, b, c, d, a, in[ 8] + 0x455a14ed, 20); \
+	MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905,  5); \
+	MD5STEP(F2, d, a, b, c, in[ 2] + 0xfcefa3f8,  9); \
+	MD5STEP(F2, c, d, a, b, in[ 7] + 0x676f02d9, 14); \
+	MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20); \
+	MD5STEP(F3, a, b, c, d, in[ 5] + 0xfffa3942,  4); \
+	MD5STEP(F3, d, a, b, c, in[ 8] + 0x8771f681, 11); \
+	MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16); \
+	MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23); \
+	MD5STEP(F3, a, b, c, d, in[ 1] + 0xa4beea44,  4); \
+	MD5STEP(F3, d, a, b, c, in[ 4] + 0x4bdecfa9, 11); \
+	MD5STEP(F3, c, d, a, b, in[ 7] + 0xf6bb4b60, 16); \
+	MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23); \
+	MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6,  4); \
+	MD5STEP(F3, d, a, b, c, in[ 0] + 0xeaa127fa, 11); \
+	MD5STEP(F3, c, d, a, b, in[ 3] + 0xd4ef3085, 16); \
+	MD5STEP(F3, b, c, d, a, in[ 6] + 0x04881d05, 23); \
+	MD5STEP(F3, a, b, c, d, in[ 9] + 0xd9d4d039,  4); \
+	MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11); \
+	MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16); \
+	MD5STEP(F3, b, c, d, a, in[ 2] + 0xc4ac5665, 23); \
+	MD5STEP(F4, a, b, c, d, in[ 0] + 0xf4292244,  6); \
+	MD5STEP(F4, d, a, b, c, in[ 7] + 0x432aff97, 10); \
+	MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15); \
+	MD5STEP(F4, b, c, d, a, in[ 5] + 0xfc93a039, 21); \
+	MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3,  6); \
+	MD5STEP(F4, d, a, b, c, in[ 3] + 0x8f0ccc92, 10); \
+	MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15); \
+	MD5STEP(F4, b, c, d, a, in[ 1] + 0x85845dd1, 21); \
+	MD5STEP(F4, a, b, c, d, in[ 8] + 0x6fa87e4f,  6); \
+	MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10); \
+	MD5STEP(F4, c, d, a, b, in[ 6] + 0xa3014314, 15); \
+	MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21); \
+	MD5STEP(F4, a, b, c, d, in[ 4] + 0xf7537e82,  6); \
+	MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10); \
+	MD5STEP(F4, c, d, a, b, in[ 2] + 0x2ad7d2bb, 15); \
+	MD5STEP(F4, b, c, d, a, in[ 9] + 0xeb86d391, 21); \
+} while (0)
+
+/** Hash up to _lanes jobs in parallel, using the vector type _vec
+ *
+ * Jobs may be of different lengths.  Each lane runs for as many
+ * blocks as the longest job, and lanes which have already finished
+ * have their state masked so that further blocks don't alter it.
+ */
+#define MD5_MULTI_FUNC(_name, _vec, _lanes, _attr) \
+_attr static void _name(fr_md5_multi_t const *jobs, unsigned int num) \
+{ \
+	_vec		a, b, c, d, in[16], state[4], mask; \
+	uint8_t		block[MD5_MULTI_BLOCK_LENGTH]; \
+	size_t		blocks[_lanes], max = 0, i; \
+	unsigned int	j, k; \
+	for (j = 0; j < _lanes; j++) { \
+		blocks[j] = (j < num) ? MD5_MULTI_BLOCKS(&jobs[j]) : 0; \
+		if (blocks[j] > max) max = blocks[j]; \
+	} \
+	for (j = 0; j < _lanes; j++) { \
+		state[0][j] = 0x67452301; \
+		state[1][j] = 0xefcdab89; \
+		state[2][j] = 0x98badcfe; \
+		state[3][j] = 0x10325476; \
+	} \
+	for (i = 0; i < max; i++) { \
+		for (j = 0; j < _lanes; j++) { \
+			if (i < blocks[j]) { \
+				md5_multi_block(block, &jobs[j], i * MD5_MULTI_BLOCK_LENGTH, (i + 1) == blocks[j]); \
+				for (k = 0; k < 16; k++) in[k][j] = GET_32BIT_LE(block + (k * 4)); \
+				mask[j] = 0xffffffff; \
+			} else { \
+				for (k = 0; k < 16; k++) in[k][j] = 0; \
+				mask[j] = 0; \
+			} \
+		} \
+		a = state[0]; \
+		b = state[1]; \
+		c = state[2]; \
+		d = state[3]; \
+		MD5_ROUNDS; \
+		state[0] += a & mask; \
+		state[1] += b & mask; \
+		state[2] += c & mask; \
+		state[3] += d & mask; \
+	} \
+	for (j = 0; j < num; j++) { \
+		for (k = 0; k < 4; k++) PUT_32BIT_LE(jobs[j].out + (k * 4), (uint32_t) state[k][j]); \
+	} \
+}
+
+typedef uint32_t md5_v4_t __attribute__((vector_size(16)));
+MD5_MULTI_FUNC(md5_multi_x4, md5_v4_t, 4, )
+
+#  ifdef HAVE_MD5_MULTI_AVX2
+typedef uint32_t md5_v8_t __attribute__((vector_size(32)));
+MD5_MULTI_FUNC(md5_multi_x8, md5_v8_t, 8, __attribute__((target("avx2"))))
+#  endif
+#endif
+
+/** Return the number of messages fr_md5_calc_multi() hashes in parallel on this CPU
+ *
+ * @return
+ *	- 8 if the CPU supports AVX2.
+ *	- 4 if we're using 128bit vectors (SSE2, NEON etc...).
+ *	- 1 if we're using the scalar code.
+ */
+unsigned int fr_md5_multi_lanes(void)
+{
+#ifdef HAVE_MD5_MULTI_AVX2
+	if (__builtin_cpu_supports("avx2")) return 8;
+#endif
+#ifdef HAVE_MD5_MULTI_VECTOR
+	return 4;
+#else
+	return 1;
+#endif
+}
+
+/** Calculate the MD5 digests of multiple independent messages
+ *
+ * Each job is the concatenation of up to two buffers (usually packet
+ * data and a shared secret).  Jobs are hashed in groups, one job per
+ * vector lane.  Any jobs left over at the end that can't fill at least
+ * two lanes are hashed with the normal MD5 functions.
+ *
+ * @param[in] jobs to hash.  The digests are written to each job's out buffer.
+ * @param[in] num number of jobs.
+ */
+void fr_md5_calc_multi(fr_md5_multi_t const *jobs, unsigned int num)
+{
+	unsigned int i = 0;
+
+#ifdef HAVE_MD5_MULTI_VECTOR
+	unsigned int lanes = fr_md5_multi_lanes();
+
+	while ((num - i) > 1) {
+		unsigned int todo = num - i;
+
+		if (todo > lanes) todo = lanes;
+
+#  ifdef HAVE_MD5_MULTI_AVX2
+		if ((lanes == 8) && (todo > 4)) {
+			md5_multi_x8(jobs + i, todo);
+			i += todo;
+			continue;
+		}
+#  endif
+		if (todo > 4) todo = 4;
+		md5_multi_x4(jobs + i, todo);
+		i += todo;
+	}
+#endif
+
+	for (; i < num; i++) md5_multi_scalar(&jobs[i]);
+}
+
+#ifdef TESTING
+/*
+ *  cc -g -DTESTING -I ../include md5_multi.c md5.c -o md5_multi -ltalloc
+ *
+ *  ./md5_multi [iterations]
+ */
+#define BATCH 64
+
+int main(int argc, char **argv)
+{
+	uint8_t		data[BATCH][4096];
+	uint8_t		secret[] = "testing123";
+	uint8_t		out[BATCH][MD5_DIGEST_LENGTH];
+	uint8_t		check[MD5_DIGEST_LENGTH];
+	uint8_t		buffer[sizeof(data[0]) + sizeof(secret)];
+	fr_md5_multi_t	jobs[BATCH];
+	unsigned int	i, j, iterations = 100000;
+	struct timeval	start, end;
+	double		scalar, multi;
+
+	if (argc > 1) iterations = atoi(argv[1]);
+
+	for (i = 0; i < BATCH; i++) {
+		for (j = 0; j < sizeof(data[i]); j++) data[i][j] = fr_rand();
+	}
+
+	/*
+	 *	Check every length that crosses a block or padding
+	 *	boundary against the scalar code.
+	 */
+	for (j = 0; j < 300; j++) {
+		for (i = 0; i < BATCH; i++) {
+			jobs[i].in[0] = data[i];
+			jobs[i].inlen[0] = (j + i) % 300;
+			jobs[i].in[1] = secret;
+			jobs[i].inlen[1] = (i & 0x01) ? 0 : sizeof(secret) - 1;
+			jobs[i].out = out[i];
+		}
+
+		fr_md5_calc_multi(jobs, (j % BATCH) + 1);
+
+		for (i = 0; i < (j % BATCH) + 1; i++) {
+			memcpy(buffer, jobs[i].in[0], jobs[i].inlen[0]);
+			memcpy(buffer + jobs[i].inlen[0], jobs[i].in[1], jobs[i].inlen[1]);
+			fr_md5_calc(check, buffer, jobs[i].inlen[0] + jobs[i].inlen[1]);
+
+			if (memcmp(check, out[i], sizeof(check)) != 0) {
+				fprintf(stderr, "Digest mismatch for job %u length %zu\n",
+					i, jobs[i].inlen[0] + jobs[i].inlen[1]);
+				fr_exit(1);
+			}
+		}
+	}
+
+	/*
+	 *	Benchmark with typical accounting packet sizes.
+	 */
+	for (i = 0; i < BATCH; i++) jobs[i].inlen[0] = 100 + (fr_rand() % 200);
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < iterations; j++) {
+		for (i = 0; i < BATCH; i++) md5_multi_scalar(&jobs[i]);
+	}
+	gettimeofday(&end, NULL);
+	scalar = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	gettimeofday(&start, NULL);
+	for (j = 0; j < iterations; j++) fr_md5_calc_multi(jobs, BATCH);
+	gettimeofday(&end, NULL);
+	multi = (end.tv_sec - start.tv_sec) + ((end.tv_usec - start.tv_usec) / 1000000.0);
+
+	printf("lanes %u: scalar %.0f digests/s, multi %.0f digests/s\n", fr_md5_multi_lanes(),
+	       (BATCH * iterations) / scalar, (BATCH * iterations) / multi);
+
+	return 0;
+}
+#endif
@@ -834,6 +834,415 @@ void fr_pair_delete_by_num(VALUE_PAIR **head, unsigned int vendor, unsigned int
 	}
 }
 
+/** An index of the attributes in a VALUE_PAIR list
+ *
+ * Holds the first instance of each attribute in the list, and the number
+ * of instances.  Separately, it counts the instances of each vendor/attr
+ * number, as raw and unknown attributes have a different da to the known
+ * attribute with the same number.  The index is updated by the fr_cursor_* functions when
+ * the list is modified through a cursor initialised with
+ * #fr_cursor_init_indexed.  If the list is modified any other way,
+ * #fr_pair_index_rebuild must be called before the index is used again.
+ */
+struct fr_pair_index {
+	VALUE_PAIR		**head;		//!< List we're indexing.
+	fr_hash_table_t		*ht;		//!< Entries keyed by #fr_dict_attr_t.
+	fr_hash_table_t		*nums;		//!< Counts keyed by vendor/attr.
+	bool			invalid;	//!< Out of memory updating the index, so
+						//!< lookups fall back to walking the list.
+};
+
+typedef struct fr_pair_index_entry {
+	fr_dict_attr_t const	*da;
+	VALUE_PAIR		*first;		//!< First instance of da in the list.  NULL
+						//!< if it has to be found again.
+	unsigned int		count;		//!< Number of instances of da in the list.
+} fr_pair_index_entry_t;
+
+typedef struct fr_pair_index_num {
+	unsigned int		vendor;
+	unsigned int		attr;
+	unsigned int		count;		//!< Number of attributes in the list with this
+						//!< vendor/attr, whatever their da.
+} fr_pair_index_num_t;
+
+static uint32_t pair_index_hash(void const *data)
+{
+	fr_pair_index_entry_t const *entry = data;
+
+	return fr_hash(&entry->da, sizeof(entry->da));
+}
+
+static int pair_index_cmp(void const *one, void const *two)
+{
+	fr_pair_index_entry_t const *a = one, *b = two;
+
+	return (a->da < b->da) - (a->da > b->da);
+}
+
+static uint32_t pair_index_num_hash(void const *data)
+{
+	fr_pair_index_num_t const *num = data;
+	uint32_t hash;
+
+	hash = fr_hash(&num->vendor, sizeof(num->vendor));
+	return fr_hash_update(&num->attr, sizeof(num->attr), hash);
+}
+
+static int pair_index_num_cmp(void const *one, void const *two)
+{
+	fr_pair_index_num_t const *a = one, *b = two;
+
+	if (a->vendor != b->vendor) return (a->vendor < b->vendor) - (a->vendor > b->vendor);
+
+	return (a->attr < b->attr) - (a->attr > b->attr);
+}
+
+static void pair_index_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+static fr_pair_index_num_t *pair_index_num(fr_pair_index_t *index, unsigned int vendor, unsigned int attr)
+{
+	fr_pair_index_num_t my_num;
+
+	my_num.vendor = vendor;
+	my_num.attr = attr;
+	return fr_hash_table_finddata(index->nums, &my_num);
+}
+
+/** Count an attribute's vendor/attr number
+ *
+ */
+static void pair_index_num_add(fr_pair_index_t *index, fr_dict_attr_t const *da)
+{
+	fr_pair_index_num_t *num;
+
+	num = pair_index_num(index, da->vendor, da->attr);
+	if (num) {
+		num->count++;
+		return;
+	}
+
+	num = talloc(index, fr_pair_index_num_t);
+	if (!num) {
+	oom:
+		index->invalid = true;
+		return;
+	}
+	num->vendor = da->vendor;
+	num->attr = da->attr;
+	num->count = 1;
+
+	if (!fr_hash_table_insert(index->nums, num)) {
+		talloc_free(num);
+		goto oom;
+	}
+}
+
+static fr_pair_index_entry_t *pair_index_entry(fr_pair_index_t *index, fr_dict_attr_t const *da)
+{
+	fr_pair_index_entry_t my_entry;
+
+	my_entry.da = da;
+	return fr_hash_table_finddata(index->ht, &my_entry);
+}
+
+/** Add an attribute to the index, creating the entry for its da if needed
+ *
+ */
+static void pair_index_add(fr_pair_index_t *index, VALUE_PAIR *vp)
+{
+	fr_pair_index_entry_t *entry;
+
+	pair_index_num_add(index, vp->da);
+
+	entry = pair_index_entry(index, vp->da);
+	if (entry) {
+		entry->count++;
+		return;
+	}
+
+	entry = talloc(index, fr_pair_index_entry_t);
+	if (!entry) {
+	oom:
+		index->invalid = true;
+		return;
+	}
+	entry->da = vp->da;
+	entry->first = vp;
+	entry->count = 1;
+
+	if (!fr_hash_table_insert(index->ht, entry)) {
+		talloc_free(entry);
+		goto oom;
+	}
+}
+
+static int _fr_pair_index_free(fr_pair_index_t *index)
+{
+	fr_hash_table_free(index->ht);
+	fr_hash_table_free(index->nums);
+
+	return 0;
+}
+
+/** Allocate an index for a list of VALUE_PAIRs
+ *
+ * The index makes finding the first instance of an attribute O(1), instead
+ * of walking the list.  It's worth having for large lists which are searched
+ * many times, such as the attributes in accounting packets.
+ *
+ * @note The index is only kept up to date when the list is modified with a
+ *	cursor initialised with #fr_cursor_init_indexed.  If the list is modified
+ *	any other way, call #fr_pair_index_rebuild before the index is used again.
+ *
+ * @param[in] ctx to allocate the index in.
+ * @param[in] head of the list to index.  Must remain valid for the lifetime
+ *	of the index.
+ * @return
+ *	- A new index.
+ *	- NULL on error.
+ */
+fr_pair_index_t *fr_pair_index_alloc(TALLOC_CTX *ctx, VALUE_PAIR **head)
+{
+	fr_pair_index_t *index;
+
+	if (!fr_cond_assert(head)) return NULL;
+
+	index = talloc_zero(ctx, fr_pair_index_t);
+	if (!index) return NULL;
+	index->head = head;
+	talloc_set_destructor(index, _fr_pair_index_free);
+
+	if (fr_pair_index_rebuild(index) < 0) {
+		talloc_free(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+/** Rebuild an index from the list it refers to
+ *
+ * @param[in] index to rebuild.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_pair_index_rebuild(fr_pair_index_t *index)
+{
+	VALUE_PAIR *vp;
+
+	if (index->ht) fr_hash_table_free(index->ht);
+	if (index->nums) fr_hash_table_free(index->nums);
+	index->nums = NULL;
+	index->invalid = false;
+
+	index->ht = fr_hash_table_create(NULL, pair_index_hash, pair_index_cmp, pair_index_entry_free);
+	if (index->ht) index->nums = fr_hash_table_create(NULL, pair_index_num_hash, pair_index_num_cmp,
+							  pair_index_entry_free);
+	if (!index->ht || !index->nums) {
+		fr_strerror_printf("Out of memory");
+		index->invalid = true;
+		return -1;
+	}
+
+	for (vp = *index->head; vp; vp = vp->next) {
+		VERIFY_VP(vp);
+		pair_index_add(index, vp);
+	}
+
+	if (index->invalid) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Return the list an index refers to
+ *
+ * @param[in] index to return the list for.
+ * @return the head of the list.
+ */
+VALUE_PAIR **fr_pair_index_list(fr_pair_index_t *index)
+{
+	return index->head;
+}
+
+/** Find the first attribute matching a da and tag, using an index
+ *
+ * Equivalent to #fr_pair_find_by_da, but in constant time for untagged
+ * attributes.
+ *
+ * @param[in] index of the list to search.
+ * @param[in] da to match.
+ * @param[in] tag to match. TAG_ANY matches any tag, TAG_NONE matches tagless VPs.
+ * @return
+ *	- The first matching #VALUE_PAIR.
+ *	- NULL if no #VALUE_PAIR matches.
+ */
+VALUE_PAIR *fr_pair_index_find(fr_pair_index_t *index, fr_dict_attr_t const *da, int8_t tag)
+{
+	fr_pair_index_entry_t	*entry;
+	VALUE_PAIR		*vp;
+
+	if (!fr_cond_assert(da)) return NULL;
+
+	if (index->invalid) return fr_pair_find_by_da(*index->head, da, tag);
+
+	entry = pair_index_entry(index, da);
+	if (!entry) return NULL;
+
+	/*
+	 *	The first instance was removed, or something was
+	 *	inserted in the middle of the list.  Find the first
+	 *	instance again.
+	 */
+	if (!entry->first) {
+		for (vp = *index->head; vp; vp = vp->next) if (vp->da == da) break;
+		if (!vp) return NULL;
+
+		entry->first = vp;
+	}
+
+	vp = entry->first;
+	VERIFY_VP(vp);
+
+	if (!da->flags.has_tag || (tag == TAG_ANY)) return vp;
+
+	for (; vp; vp = vp->next) if ((vp->da == da) && TAG_EQ(tag, vp->tag)) break;
+
+	return vp;
+}
+
+/** Update an index after a VALUE_PAIR has been linked into the list
+ *
+ * @param[in] index to update.
+ * @param[in] vp which was added.
+ * @param[in] at_head true if vp was inserted at the head of the list.
+ */
+void fr_pair_index_insert(fr_pair_index_t *index, VALUE_PAIR *vp, bool at_head)
+{
+	fr_pair_index_entry_t *entry;
+
+	if (index->invalid) return;
+
+	entry = pair_index_entry(index, vp->da);
+	if (!entry) {
+		pair_index_add(index, vp);
+		return;
+	}
+
+	pair_index_num_add(index, vp->da);
+	entry->count++;
+
+	/*
+	 *	Appending doesn't change the first instance.  Inserting
+	 *	in the middle might, so it's found again on the next
+	 *	lookup.
+	 */
+	if (at_head) {
+		entry->first = vp;
+	} else if (vp->next) {
+		entry->first = NULL;
+	}
+}
+
+/** Update an index after a VALUE_PAIR has been unlinked from the list
+ *
+ * @param[in] index to update.
+ * @param[in] vp which was removed.
+ */
+void fr_pair_index_remove(fr_pair_index_t *index, VALUE_PAIR *vp)
+{
+	fr_pair_index_entry_t	*entry;
+	fr_pair_index_num_t	*num;
+
+	if (index->invalid) return;
+
+	num = pair_index_num(index, vp->da->vendor, vp->da->attr);
+	if (!fr_cond_assert(num)) return;
+	if (--num->count == 0) fr_hash_table_delete(index->nums, num);
+
+	entry = pair_index_entry(index, vp->da);
+	if (!fr_cond_assert(entry)) return;
+
+	if (--entry->count == 0) {
+		fr_hash_table_delete(index->ht, entry);
+		return;
+	}
+
+	if (entry->first == vp) entry->first = NULL;
+}
+
+/** Check that an index matches the list it refers to
+ *
+ * For tests, and for debugging code which modifies indexed lists.
+ *
+ * @param[in] index to check.
+ * @return
+ *	- 0 if the index is consistent with the list, or is marked invalid (and so
+ *	  isn't used).
+ *	- -1 if it isn't, with the reason available from fr_strerror().
+ */
+int fr_pair_index_verify(fr_pair_index_t *index)
+{
+	fr_pair_index_t		*fresh;
+	fr_pair_index_entry_t	*entry, *expected;
+	fr_pair_index_num_t	*num, *expected_num;
+	VALUE_PAIR		*vp;
+	int			ret = -1;
+
+	if (index->invalid) return 0;
+
+	fresh = fr_pair_index_alloc(NULL, index->head);
+	if (!fresh) return -1;
+
+	if ((fr_hash_table_num_elements(index->ht) != fr_hash_table_num_elements(fresh->ht)) ||
+	    (fr_hash_table_num_elements(index->nums) != fr_hash_table_num_elements(fresh->nums))) {
+		fr_strerror_printf("Index has %i attributes and %i numbers, but the list has %i and %i",
+				   fr_hash_table_num_elements(index->ht), fr_hash_table_num_elements(index->nums),
+				   fr_hash_table_num_elements(fresh->ht), fr_hash_table_num_elements(fresh->nums));
+		goto finish;
+	}
+
+	for (vp = *index->head; vp; vp = vp->next) {
+		expected = pair_index_entry(fresh, vp->da);
+		entry = pair_index_entry(index, vp->da);
+		if (!entry || (entry->count != expected->count)) {
+			fr_strerror_printf("Index has %u instances of %s, but the list has %u",
+					   entry ? entry->count : 0, vp->da->name, expected->count);
+			goto finish;
+		}
+
+		/*
+		 *	NULL means it's found again on the next lookup.
+		 */
+		if (entry->first && (entry->first != expected->first)) {
+			fr_strerror_printf("Index has the wrong first instance of %s", vp->da->name);
+			goto finish;
+		}
+
+		expected_num = pair_index_num(fresh, vp->da->vendor, vp->da->attr);
+		num = pair_index_num(index, vp->da->vendor, vp->da->attr);
+		if (!num || (num->count != expected_num->count)) {
+			fr_strerror_printf("Index has %u instances of %u.%u, but the list has %u",
+					   num ? num->count : 0, vp->da->vendor, vp->da->attr, expected_num->count);
+			goto finish;
+		}
+	}
+
+	ret = 0;
+
+finish:
+	talloc_free(fresh);
+
+	return ret;
+}
+
 int8_t fr_pair_cmp_by_da_tag(void const *a, void const *b)
 {
 	VALUE_PAIR const *my_a = a;
@@ -1516,6 +1925,49 @@ VALUE_PAIR *fr_pair_list_copy_by_num(TALLOC_CTX *ctx, VALUE_PAIR *from, unsigned
 
 
 
+/*
+ *	Destination lists shorter than this are searched linearly, as
+ *	building an index costs more than a few short scans.
+ */
+#define PAIR_LIST_MOVE_INDEX_MIN	(32)
+
+/** Find a pair in the destination list of fr_pair_list_move
+ *
+ * The index is only built if we need to search the list, and the list
+ * is long enough for it to be worthwhile.  So moving attributes with
+ * "+=", or into a short list, doesn't pay for it.
+ *
+ * @param[in,out] index of the destination list, built on first use.
+ * @param[in,out] linear set on first use if the list is too short to index.
+ * @param[in] to destination list.
+ * @param[in] da to find.
+ * @return the first pair matching da, or NULL.
+ */
+static VALUE_PAIR *pair_list_move_find(fr_pair_index_t **index, bool *linear, VALUE_PAIR **to, fr_dict_attr_t const *da)
+{
+	VALUE_PAIR	*vp;
+	unsigned int	len = 0;
+
+	if (!*to) return NULL;
+
+	if (*index) return fr_pair_index_find(*index, da, TAG_ANY);
+	if (*linear) return fr_pair_find_by_da(*to, da, TAG_ANY);
+
+	for (vp = *to; vp && (len < PAIR_LIST_MOVE_INDEX_MIN); vp = vp->next) len++;
+	if (len < PAIR_LIST_MOVE_INDEX_MIN) {
+		*linear = true;
+		return fr_pair_find_by_da(*to, da, TAG_ANY);
+	}
+
+	*index = fr_pair_index_alloc(NULL, to);
+	if (!*index) {
+		*linear = true;
+		return fr_pair_find_by_da(*to, da, TAG_ANY);
+	}
+
+	return fr_pair_index_find(*index, da, TAG_ANY);
+}
+
 /** Move pairs from source list to destination list respecting operator
  *
  * @note This function does some additional magic that's probably not needed
@@ -1526,6 +1978,9 @@ VALUE_PAIR *fr_pair_list_copy_by_num(TALLOC_CTX *ctx, VALUE_PAIR *from, unsigned
  *
  * @note Does not respect tags when matching.
  *
+ * @note If the "to" list is long, it's indexed while it's being edited, so
+ *	moving a large list is O(n) instead of O(n^2).
+ *
  * @param[in] ctx for talloc
  * @param[in,out] to destination list.
  * @param[in,out] from source list.
@@ -1537,6 +1992,8 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 	VALUE_PAIR *i, *found;
 	VALUE_PAIR *head_new, **tail_new;
 	VALUE_PAIR **tail_from;
+	fr_pair_index_t *index = NULL;
+	bool linear = false;
 
 	if (!to || !from || !*from) return;
 
@@ -1588,7 +2045,7 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 		 *	it doesn't already exist.
 		 */
 		case T_OP_EQ:
-			found = fr_pair_find_by_da(*to, i->da, TAG_ANY);
+			found = pair_list_move_find(&index, &linear, to, i->da);
 			if (!found) goto do_add;
 
 			tail_from = &(i->next);
@@ -1599,7 +2056,7 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 		 *	of the same vendor/attr which already exists.
 		 */
 		case T_OP_SET:
-			found = fr_pair_find_by_da(*to, i->da, TAG_ANY);
+			found = pair_list_move_find(&index, &linear, to, i->da);
 			if (!found) goto do_add;
 
 			/*
@@ -1633,10 +2090,24 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 			}
 
 			/*
-			 *	Delete *all* of the attributes
-			 *	of the same number.
+			 *	Delete *all* of the other attributes
+			 *	of the same number, including raw or
+			 *	unknown ones with a different da.  The
+			 *	index tells us if there are any, so we
+			 *	usually don't have to walk the rest of
+			 *	the list.
 			 */
-			fr_pair_delete_by_num(&found->next, found->da->vendor, found->da->attr, TAG_ANY);
+			if (!index) {
+				fr_pair_delete_by_num(&found->next, found->da->vendor, found->da->attr, TAG_ANY);
+			} else {
+				fr_pair_index_num_t *num;
+
+				num = index->invalid ? NULL : pair_index_num(index, found->da->vendor, found->da->attr);
+				if (!num || (num->count > 1)) {
+					fr_pair_delete_by_num(&found->next, found->da->vendor, found->da->attr, TAG_ANY);
+					(void) fr_pair_index_rebuild(index);
+				}
+			}
 
 			/*
 			 *	Remove this attribute from the
@@ -1662,6 +2133,8 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 		}
 	} /* loop over the "from" list. */
 
+	talloc_free(index);
+
 	/*
 	 *	Take the "new" list, and append it to the "to" list.
 	 */
@@ -37,6 +37,20 @@
 #include <freeradius-devel/net.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef HAVE_PCAP_RING
+#  include <sys/mman.h>
+#  include <sys/socket.h>
+#  include <net/if_arp.h>
+#  include <linux/if_ether.h>
+#  include <linux/filter.h>
+
+#  define PCAP_RING_BLOCK_SIZE	(1 << 20)	//!< Must be a multiple of the page size.
+#  define PCAP_RING_FRAME_SIZE	2048		//!< Only used for sanity checks by the kernel with V3.
+#  define PCAP_RING_BLOCK_MIN	4
+#  define PCAP_RING_RETIRE_TOV	10		//!< Milliseconds before a partially filled block
+						//!< is handed to us anyway.
+#endif
+
 /** Talloc destructor to free pcap resources associated with a handle.
  *
  * @param pcap to free.
@@ -44,6 +58,19 @@
  */
 static int _free_pcap(fr_pcap_t *pcap)
 {
+#ifdef HAVE_PCAP_RING
+	if (pcap->tp.map) munmap(pcap->tp.map, pcap->tp.map_len);
+
+	/*
+	 *	Ring handles own their socket directly, there's
+	 *	no libpcap handle to close it for us.
+	 */
+	if (pcap->ring && !pcap->handle && (pcap->fd > 0)) {
+		close(pcap->fd);
+		pcap->fd = -1;
+	}
+#endif
+
 	switch (pcap->type) {
 	case PCAP_INTERFACE_IN:
 	case PCAP_INTERFACE_OUT:
@@ -178,6 +205,176 @@ int fr_pcap_mac_addr(uint8_t *macaddr, char *ifname)
 #endif
 }
 
+#ifdef HAVE_PCAP_RING
+/** Open a TPACKET_V3 capture ring on an interface
+ *
+ * The kernel writes packets into blocks in a ring we share with it, and
+ * wakes us when a block is full (or has timed out).  We then read every
+ * packet in the block, before handing it back.
+ *
+ * A dead libpcap handle is also opened, so that filters can be compiled,
+ * and the handle can be used to infer the link type of output files.
+ *
+ * @param pcap created with fr_pcap_init.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_pcap_ring_open(fr_pcap_t *pcap)
+{
+	struct tpacket_req3	req;
+	struct sockaddr_ll	sll;
+	struct ifreq		ifr;
+	int			version = TPACKET_V3;
+	size_t			want;
+
+	pcap->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (pcap->fd < 0) {
+		fr_strerror_printf("Failed creating packet socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	We don't have libpcap to strip off other link layer
+	 *	headers for us.
+	 */
+	memset(&ifr, 0, sizeof(ifr));
+	strlcpy(ifr.ifr_name, pcap->name, sizeof(ifr.ifr_name));
+	if (ioctl(pcap->fd, SIOCGIFHWADDR, &ifr) < 0) {
+		fr_strerror_printf("Failed getting link type for interface %s: %s", pcap->name, fr_syserror(errno));
+		goto error;
+	}
+	if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+		fr_strerror_printf("Ring capture is only supported on Ethernet interfaces");
+		goto error;
+	}
+
+	if (setsockopt(pcap->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		fr_strerror_printf("Failed setting TPACKET_V3: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	Size the ring the same as the libpcap buffer would be.
+	 */
+	want = SNAPLEN * (pcap->buffer_pkts ? pcap->buffer_pkts : PCAP_BUFFER_DEFAULT);
+	pcap->tp.block_size = PCAP_RING_BLOCK_SIZE;
+	pcap->tp.block_num = want / PCAP_RING_BLOCK_SIZE;
+	if (pcap->tp.block_num < PCAP_RING_BLOCK_MIN) pcap->tp.block_num = PCAP_RING_BLOCK_MIN;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = pcap->tp.block_size;
+	req.tp_block_nr = pcap->tp.block_num;
+	req.tp_frame_size = PCAP_RING_FRAME_SIZE;
+	req.tp_frame_nr = (pcap->tp.block_size / PCAP_RING_FRAME_SIZE) * pcap->tp.block_num;
+	req.tp_retire_blk_tov = PCAP_RING_RETIRE_TOV;
+
+	if (setsockopt(pcap->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		fr_strerror_printf("Failed creating capture ring: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	pcap->tp.map_len = (size_t) pcap->tp.block_size * pcap->tp.block_num;
+	pcap->tp.map = mmap(NULL, pcap->tp.map_len, PROT_READ | PROT_WRITE, MAP_SHARED, pcap->fd, 0);
+	if (pcap->tp.map == MAP_FAILED) {
+		pcap->tp.map = NULL;
+		fr_strerror_printf("Failed mapping capture ring: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ALL);
+	sll.sll_ifindex = pcap->if_index;
+	if (bind(pcap->fd, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
+		fr_strerror_printf("Failed binding to interface %s: %s", pcap->name, fr_syserror(errno));
+		goto error;
+	}
+
+	if (pcap->promiscuous) {
+		struct packet_mreq mreq;
+
+		memset(&mreq, 0, sizeof(mreq));
+		mreq.mr_ifindex = pcap->if_index;
+		mreq.mr_type = PACKET_MR_PROMISC;
+		if (setsockopt(pcap->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+			fr_strerror_printf("Failed enabling promiscuous mode: %s", fr_syserror(errno));
+			goto error;
+		}
+	}
+
+	pcap->link_layer = DLT_EN10MB;
+	pcap->handle = pcap_open_dead(pcap->link_layer, SNAPLEN);
+	if (!pcap->handle) {
+		fr_strerror_printf("Unknown error occurred opening dead PCAP handle");
+		goto error;
+	}
+
+	return 0;
+
+error:
+	if (pcap->tp.map) {
+		munmap(pcap->tp.map, pcap->tp.map_len);
+		pcap->tp.map = NULL;
+	}
+	close(pcap->fd);
+	pcap->fd = -1;
+
+	return -1;
+}
+
+/** Return the next packet from a TPACKET_V3 ring
+ *
+ * @param[in] pcap handle to read from.
+ * @param[out] header Where to write a pointer to the packet header.
+ * @param[out] data Where to write a pointer to the packet data.
+ * @return
+ *	- 1 if a packet was returned.
+ *	- 0 if there are no packets waiting.
+ */
+static int fr_pcap_ring_next(fr_pcap_t *pcap, struct pcap_pkthdr **header, uint8_t const **data)
+{
+	struct tpacket3_hdr *frame;
+
+	/*
+	 *	The previous packet was the last one in the block,
+	 *	so it's now safe to give the block back.
+	 */
+	while (!pcap->tp.block || !pcap->tp.frames_left) {
+		struct tpacket_block_desc *block;
+
+		if (pcap->tp.block) {
+			__sync_synchronize();
+			pcap->tp.block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+			pcap->tp.block = NULL;
+			pcap->tp.block_idx = (pcap->tp.block_idx + 1) % pcap->tp.block_num;
+		}
+
+		block = (struct tpacket_block_desc *) (pcap->tp.map + ((size_t) pcap->tp.block_idx * pcap->tp.block_size));
+		if (!(block->hdr.bh1.block_status & TP_STATUS_USER)) return 0;
+		__sync_synchronize();
+
+		pcap->tp.block = block;
+		pcap->tp.frames_left = block->hdr.bh1.num_pkts;
+		pcap->tp.frame = (struct tpacket3_hdr *) ((uint8_t *) block + block->hdr.bh1.offset_to_first_pkt);
+	}
+
+	frame = pcap->tp.frame;
+	pcap->tp.header.ts.tv_sec = frame->tp_sec;
+	pcap->tp.header.ts.tv_usec = frame->tp_nsec / 1000;
+	pcap->tp.header.caplen = frame->tp_snaplen;
+	pcap->tp.header.len = frame->tp_len;
+
+	*header = &pcap->tp.header;
+	*data = (uint8_t const *) frame + frame->tp_mac;
+
+	pcap->tp.frame = (struct tpacket3_hdr *) ((uint8_t *) frame + frame->tp_next_offset);
+	pcap->tp.frames_left--;
+
+	return 1;
+}
+#endif
+
 /** Open a PCAP handle abstraction
  *
  * This opens interfaces for capture or injection, or files/streams for reading/writing.
@@ -205,6 +402,23 @@ int fr_pcap_open(fr_pcap_t *pcap)
 			return -1;
 		}
 
+#ifdef HAVE_PCAP_RING
+		if (pcap->ring) {
+			if (pcap->type != PCAP_INTERFACE_IN) {
+				fr_strerror_printf("Ring capture is only supported for input");
+				return -1;
+			}
+
+			if (fr_pcap_ring_open(pcap) < 0) return -1;
+
+			if (fr_pcap_mac_addr((uint8_t *)&pcap->ether_addr, pcap->name) != 0) {
+				fr_strerror_printf("Couldn't get MAC address for interface %s", pcap->name);
+				return -1;
+			}
+			break;
+		}
+#endif
+
 #if defined(HAVE_PCAP_CREATE) && defined(HAVE_PCAP_ACTIVATE)
 		pcap->handle = pcap_create(pcap->name, pcap->errbuf);
 		if (!pcap->handle) {
@@ -395,6 +609,28 @@ int fr_pcap_apply_filter(fr_pcap_t *pcap, char const *expression)
 		return -1;
 	}
 
+#ifdef HAVE_PCAP_RING
+	/*
+	 *	Classic BPF, so the kernel can run the program directly.
+	 */
+	if (pcap->ring) {
+		struct sock_fprog prog;
+
+		prog.len = fp.bf_len;
+		prog.filter = (struct sock_filter *) fp.bf_insns;
+
+		if (setsockopt(pcap->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+			fr_strerror_printf("Failed attaching filter: %s", fr_syserror(errno));
+			pcap_freecode(&fp);
+
+			return -1;
+		}
+		pcap_freecode(&fp);
+
+		return 0;
+	}
+#endif
+
 	if (pcap_setfilter(pcap->handle, &fp) < 0) {
 		fr_strerror_printf("%s", pcap_geterr(pcap->handle));
 
@@ -404,6 +640,69 @@ int fr_pcap_apply_filter(fr_pcap_t *pcap, char const *expression)
 	return 0;
 }
 
+/** Read the next packet from a capture handle
+ *
+ * The packet remains valid until the next call.
+ *
+ * @param[in] pcap handle to read from.
+ * @param[out] header Where to write a pointer to the packet header.
+ * @param[out] data Where to write a pointer to the packet data.
+ * @return
+ *	- 1 if a packet was returned.
+ *	- 0 if there are no packets waiting.
+ *	- -1 on error.
+ *	- -2 if there are no more packets in a capture file.
+ */
+int fr_pcap_next(fr_pcap_t *pcap, struct pcap_pkthdr **header, uint8_t const **data)
+{
+	int ret;
+
+#ifdef HAVE_PCAP_RING
+	if (pcap->ring) return fr_pcap_ring_next(pcap, header, data);
+#endif
+
+	ret = pcap_next_ex(pcap->handle, header, data);
+	if (ret == -1) fr_strerror_printf("%s", pcap_geterr(pcap->handle));
+
+	return ret;
+}
+
+/** Get capture statistics for a handle
+ *
+ * @param[in] pcap handle to get stats for.
+ * @param[out] stats Where to write the totals.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_pcap_stats(fr_pcap_t *pcap, struct pcap_stat *stats)
+{
+#ifdef HAVE_PCAP_RING
+	if (pcap->ring) {
+		struct tpacket_stats_v3	tp_stats;
+		socklen_t		len = sizeof(tp_stats);
+
+		if (getsockopt(pcap->fd, SOL_PACKET, PACKET_STATISTICS, &tp_stats, &len) < 0) {
+			fr_strerror_printf("%s", fr_syserror(errno));
+			return -1;
+		}
+
+		pcap->tp.stats.ps_recv += tp_stats.tp_packets;
+		pcap->tp.stats.ps_drop += tp_stats.tp_drops;
+		*stats = pcap->tp.stats;
+
+		return 0;
+	}
+#endif
+
+	if (pcap_stats(pcap->handle, stats) != 0) {
+		fr_strerror_printf("%s", pcap_geterr(pcap->handle));
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Retrieve list of interface names that will be used for capture.
  * Only used for debugging.
  *
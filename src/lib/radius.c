@@ -277,30 +277,16 @@ void fr_radius_make_secret(uint8_t *digest, uint8_t const *vector, char const *s
 	for (i = 0; i < AUTH_VECTOR_LEN; i++ ) digest[i] ^= value[i];
 }
 
-/** Basic validation of RADIUS packet header
- *
- * @note fr_strerror errors are only available if fr_debug_lvl > 0. This is to reduce CPU time
- *	consumed when discarding malformed packet.
+/** Check the first 4 bytes of a RADIUS packet
  *
- * @param[in] sockfd we're reading from.
- * @param[out] src_ipaddr of the packet.
- * @param[out] src_port of the packet.
- * @param[out] code Pointer to where to write the packet code.
  * @return
- *	- -1 on failure.
- *	- 1 on decode error.
+ *	- 0 if the header is invalid.
  *	- >= RADIUS_HDR_LEN on success. This is the packet length as specified in the header.
  */
-ssize_t fr_radius_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *src_port, unsigned int *code)
+static ssize_t radius_header_check(uint8_t const *header, ssize_t data_len, fr_ipaddr_t const *src_ipaddr,
+				   unsigned int *code)
 {
-	ssize_t			data_len, packet_len;
-	uint8_t			header[4];
-
-	data_len = udp_recv_peek(sockfd, header, sizeof(header), UDP_FLAGS_PEEK, src_ipaddr, src_port);
-	if (data_len < 0) {
-		if ((errno == EAGAIN) || (errno == EINTR)) return 0;
-		return -1;
-	}
+	ssize_t			packet_len;
 
 	/*
 	 *	Too little data is available, discard the packet.
@@ -313,8 +299,6 @@ invalid:
 		FR_DEBUG_STRERROR_PRINTF("Invalid data from %s: %s",
 					 inet_ntop(src_ipaddr->af, &src_ipaddr->ipaddr, buffer, sizeof(buffer)),
 					 fr_strerror());
-		udp_recv_discard(sockfd);
-
 		return 0;
 	}
 
@@ -352,6 +336,54 @@ invalid:
 	return packet_len;
 }
 
+/** Basic validation of RADIUS packet header
+ *
+ * @note fr_strerror errors are only available if fr_debug_lvl > 0. This is to reduce CPU time
+ *	consumed when discarding malformed packet.
+ *
+ * @param[in] sockfd we're reading from.
+ * @param[out] src_ipaddr of the packet.
+ * @param[out] src_port of the packet.
+ * @param[out] code Pointer to where to write the packet code.
+ * @return
+ *	- -1 on failure.
+ *	- 1 on decode error.
+ *	- >= RADIUS_HDR_LEN on success. This is the packet length as specified in the header.
+ */
+ssize_t fr_radius_recv_header(int sockfd, fr_ipaddr_t *src_ipaddr, uint16_t *src_port, unsigned int *code)
+{
+	ssize_t			data_len, packet_len;
+	uint8_t			header[4];
+
+	data_len = udp_recv_peek(sockfd, header, sizeof(header), UDP_FLAGS_PEEK, src_ipaddr, src_port);
+	if (data_len < 0) {
+		if ((errno == EAGAIN) || (errno == EINTR)) return 0;
+		return -1;
+	}
+
+	packet_len = radius_header_check(header, data_len, src_ipaddr, code);
+	if (packet_len == 0) udp_recv_discard(sockfd);
+
+	return packet_len;
+}
+
+/** Basic validation of the RADIUS packet header of a datagram read by udp_recv_mmsg()
+ *
+ * @note fr_strerror errors are only available if fr_debug_lvl > 0.
+ *
+ * @param[in] msg the datagram.
+ * @param[out] code Pointer to where to write the packet code.
+ * @return
+ *	- 0 on decode error.  The datagram should be ignored.
+ *	- >= RADIUS_HDR_LEN on success. This is the packet length as specified in the header.
+ */
+ssize_t fr_radius_recv_header_mmsg(udp_mmsg_t const *msg, unsigned int *code)
+{
+	if (msg->data_len < 0) return 0;
+
+	return radius_header_check(msg->data, msg->data_len, &msg->src_ipaddr, code);
+}
+
 /** Wrapper for recvfrom, which handles recvfromto, IPv6, and all possible combinations
  *
  */
@@ -1060,6 +1092,43 @@ bool fr_radius_ok(RADIUS_PACKET *packet, bool require_ma, decode_fail_t *reason)
 	return (failure == DECODE_FAIL_NONE);
 }
 
+/** Check a received packet, and finish initialising it
+ *
+ * Frees the packet on error.
+ */
+static RADIUS_PACKET *radius_recv_finish(RADIUS_PACKET *packet, int fd, bool require_ma)
+{
+	/*
+	 *	See if it's a well-formed RADIUS packet.
+	 */
+	if (!fr_radius_ok(packet, require_ma, NULL)) {
+		fr_radius_free(&packet);
+		return NULL;
+	}
+
+	/*
+	 *	Remember which socket we read the packet from.
+	 */
+	packet->sockfd = fd;
+
+	/*
+	 *	FIXME: Do even more filtering by only permitting
+	 *	certain IP's.  The problem is that we don't know
+	 *	how to do this properly for all possible clients...
+	 */
+
+	/*
+	 *	Explicitely set the VP list to empty.
+	 */
+	packet->vps = NULL;
+
+#ifndef NDEBUG
+	if ((fr_debug_lvl > 3) && fr_log_fp) fr_radius_print_hex(packet);
+#endif
+
+	return packet;
+}
+
 /** Receive UDP client requests, and fill in the basics of a RADIUS_PACKET structure
  *
  */
@@ -1123,35 +1192,61 @@ RADIUS_PACKET *fr_radius_recv(TALLOC_CTX *ctx, int fd, int flags, bool require_m
 		return NULL;
 	}
 
-	/*
-	 *	See if it's a well-formed RADIUS packet.
-	 */
-	if (!fr_radius_ok(packet, require_ma, NULL)) {
-		fr_radius_free(&packet);
+	return radius_recv_finish(packet, fd, require_ma);
+}
+
+/** Create a RADIUS_PACKET from a datagram read by udp_recv_mmsg()
+ *
+ * The caller should have checked the header with fr_radius_recv_header_mmsg().
+ *
+ * @param[in] ctx to allocate the packet in.
+ * @param[in] fd the datagram was read from.
+ * @param[in] msg the datagram.
+ * @param[in] require_ma whether a Message-Authenticator is required.
+ * @return
+ *	- The new packet.
+ *	- NULL if the packet is malformed.
+ */
+RADIUS_PACKET *fr_radius_recv_mmsg(TALLOC_CTX *ctx, int fd, udp_mmsg_t const *msg, bool require_ma)
+{
+	size_t			data_len;
+	RADIUS_PACKET		*packet;
+
+	if (msg->data_len < RADIUS_HDR_LEN) {
+		FR_DEBUG_STRERROR_PRINTF("Empty packet: Socket is not ready");
 		return NULL;
 	}
 
-	/*
-	 *	Remember which socket we read the packet from.
-	 */
-	packet->sockfd = fd;
+	packet = fr_radius_alloc(ctx, false);
+	if (!packet) {
+		fr_strerror_printf("out of memory");
+		return NULL;
+	}
 
 	/*
-	 *	FIXME: Do even more filtering by only permitting
-	 *	certain IP's.  The problem is that we don't know
-	 *	how to do this properly for all possible clients...
+	 *	Only copy as much as the header says is there.
+	 *	Anything after that would be ignored anyway.
 	 */
+	data_len = (msg->data[2] << 8) | msg->data[3];
+	if (data_len > (size_t) msg->data_len) data_len = msg->data_len;
 
-	/*
-	 *	Explicitely set the VP list to empty.
-	 */
-	packet->vps = NULL;
+	packet->data = talloc_memdup(packet, msg->data, data_len);
+	if (!packet->data) {
+		fr_strerror_printf("out of memory");
+		fr_radius_free(&packet);
+		return NULL;
+	}
+	packet->data_len = data_len;
 
-#ifndef NDEBUG
-	if ((fr_debug_lvl > 3) && fr_log_fp) fr_radius_print_hex(packet);
-#endif
+	packet->code = msg->data[0];
+	packet->src_ipaddr = msg->src_ipaddr;
+	packet->src_port = msg->src_port;
+	packet->dst_ipaddr = msg->dst_ipaddr;
+	packet->dst_port = msg->dst_port;
+	packet->if_index = msg->if_index;
+	packet->timestamp = msg->when;
 
-	return packet;
+	return radius_recv_finish(packet, fd, require_ma);
 }
 
 /** Verify the Request/Response Authenticator (and Message-Authenticator if present) of a packet
@@ -1167,6 +1262,11 @@ int fr_radius_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const
 
 	if (!packet || !packet->data) return -1;
 
+	/*
+	 *	Already checked by fr_radius_verify_batch().
+	 */
+	if (packet->verified) return 0;
+
 	/*
 	 *	Before we allocate memory for the attributes, do more
 	 *	sanity checking.
@@ -1328,6 +1428,109 @@ int fr_radius_verify(RADIUS_PACKET *packet, RADIUS_PACKET *original, char const
 	return 0;
 }
 
+/** Maximum number of packets fr_radius_verify_batch() hashes at once
+ *
+ * Larger batches are split.  This just bounds the amount of stack used.
+ */
+#define RADIUS_MD5_BATCH	64
+
+/** Verify the Request/Response Authenticators of multiple packets at once
+ *
+ * Calculates the authenticators for all of the packets together with
+ * fr_md5_calc_multi(), and marks the packets which pass as verified, so
+ * that a later call to fr_radius_verify() for them returns immediately.
+ *
+ * Only packets which are fully checked by their Request/Response
+ * Authenticator are handled here.  Packets with a Message-Authenticator,
+ * Access-Requests, responses without an original request, and packets
+ * that fail verification are left alone.  fr_radius_verify() will check
+ * them as normal, and produce the appropriate error.
+ *
+ * @param[in] packets to verify.  Must have passed fr_radius_ok().
+ * @param[in] originals the requests each packet is a response to.  May be NULL
+ *	if none of the packets are responses, otherwise entries may be NULL.
+ * @param[in] secrets shared secret for each packet.
+ * @param[in] num number of packets.
+ * @return the number of packets marked as verified.
+ */
+unsigned int fr_radius_verify_batch(RADIUS_PACKET *packets[], RADIUS_PACKET *originals[],
+				    char const *secrets[], unsigned int num)
+{
+	fr_md5_multi_t	jobs[RADIUS_MD5_BATCH];
+	RADIUS_PACKET	*checked[RADIUS_MD5_BATCH];
+	uint8_t		digests[RADIUS_MD5_BATCH][MD5_DIGEST_LENGTH];
+	unsigned int	i, j, done = 0, verified = 0;
+
+	while (done < num) {
+		unsigned int todo = 0;
+
+		for (i = done; (i < num) && (todo < RADIUS_MD5_BATCH); i++) {
+			RADIUS_PACKET	*packet = packets[i];
+			RADIUS_PACKET	*original = originals ? originals[i] : NULL;
+			uint8_t		*attr, *end;
+
+			if (!packet || !packet->data || packet->verified) continue;
+
+			switch (packet->code) {
+			case PW_CODE_COA_REQUEST:
+			case PW_CODE_DISCONNECT_REQUEST:
+			case PW_CODE_ACCOUNTING_REQUEST:
+				memset(packet->data + 4, 0, AUTH_VECTOR_LEN);
+				break;
+
+			case PW_CODE_ACCESS_ACCEPT:
+			case PW_CODE_ACCESS_REJECT:
+			case PW_CODE_ACCESS_CHALLENGE:
+			case PW_CODE_ACCOUNTING_RESPONSE:
+			case PW_CODE_DISCONNECT_ACK:
+			case PW_CODE_DISCONNECT_NAK:
+			case PW_CODE_COA_ACK:
+			case PW_CODE_COA_NAK:
+				if (!original) continue;
+				memcpy(packet->data + 4, original->vector, AUTH_VECTOR_LEN);
+				break;
+
+			default:
+				continue;
+			}
+
+			/*
+			 *	fr_radius_ok() has checked the attribute
+			 *	lengths, so we can walk over them safely.
+			 */
+			end = packet->data + packet->data_len;
+			for (attr = packet->data + RADIUS_HDR_LEN; attr < end; attr += attr[1]) {
+				if (attr[0] == PW_MESSAGE_AUTHENTICATOR) break;
+			}
+			if (attr < end) {
+				memcpy(packet->data + 4, packet->vector, AUTH_VECTOR_LEN);
+				continue;
+			}
+
+			jobs[todo].in[0] = packet->data;
+			jobs[todo].inlen[0] = packet->data_len;
+			jobs[todo].in[1] = (uint8_t const *) secrets[i];
+			jobs[todo].inlen[1] = talloc_array_length(secrets[i]) - 1;
+			jobs[todo].out = digests[todo];
+			checked[todo++] = packet;
+		}
+		done = i;
+
+		fr_md5_calc_multi(jobs, todo);
+
+		for (j = 0; j < todo; j++) {
+			memcpy(checked[j]->data + 4, checked[j]->vector, AUTH_VECTOR_LEN);
+
+			if (fr_radius_digest_cmp(digests[j], checked[j]->vector, AUTH_VECTOR_LEN) != 0) continue;
+
+			checked[j]->verified = true;
+			verified++;
+		}
+	}
+
+	return verified;
+}
+
 /** Encode a packet
  *
  */
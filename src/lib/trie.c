@@ -0,0 +1,538 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/trie.c
+ * @brief Path compressed binary tries, for longest prefix matching.
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/trie.h>
+
+/*
+ *	Each node holds a key of "bits" bits, which is a prefix of the
+ *	keys of all of its children.  Nodes with only one child are
+ *	removed (path compression), so each lookup visits at most one
+ *	node per distinct prefix length on the path to the key, and
+ *	compares each bit of the key at most once.
+ *
+ *	Nodes without data are "glue", which exist only to join two
+ *	subtrees that diverge at that bit.  Glue nodes always have
+ *	two children.
+ */
+typedef struct fr_trie_node_t {
+	struct fr_trie_node_t	*child[2];
+	void			*data;
+	size_t			bits;
+	uint8_t			key[];
+} fr_trie_node_t;
+
+struct fr_trie_t {
+	fr_trie_node_t		*root;
+	uint32_t		num_elements;
+};
+
+/*
+ *	Bit zero is the most significant bit of the first byte.
+ */
+#define TRIE_BIT(_key, _bit) (((_key)[(_bit) >> 3] >> (7 - ((_bit) & 0x07))) & 0x01)
+
+/*
+ *	Return the first bit in the range [start, end) where the two
+ *	keys differ, or "end" if they're the same.
+ */
+static size_t trie_mismatch(uint8_t const *a, uint8_t const *b, size_t start, size_t end)
+{
+	size_t i = start;
+
+	while (i < end) {
+		size_t	byte = i >> 3;
+		uint8_t	diff;
+
+		diff = (a[byte] ^ b[byte]) & (0xff >> (i & 0x07));
+		if (diff) {
+			i = byte << 3;
+			while ((diff & 0x80) == 0) {
+				diff <<= 1;
+				i++;
+			}
+
+			return (i < end) ? i : end;
+		}
+
+		i = (byte + 1) << 3;
+	}
+
+	return end;
+}
+
+static fr_trie_node_t *trie_node_alloc(fr_trie_t *ft, uint8_t const *key, size_t bits, void *data)
+{
+	fr_trie_node_t	*node;
+	size_t		len = (bits + 7) >> 3;
+
+	node = talloc_zero_size(ft, sizeof(*node) + len);
+	if (!node) return NULL;
+	talloc_set_name_const(node, "fr_trie_node_t");
+
+	/*
+	 *	Zero out the bits past the end of the prefix, so that
+	 *	it doesn't matter what the caller left there.
+	 */
+	if (len) {
+		memcpy(node->key, key, len);
+		if (bits & 0x07) node->key[len - 1] &= (0xff << (8 - (bits & 0x07)));
+	}
+
+	node->bits = bits;
+	node->data = data;
+
+	return node;
+}
+
+/** Allocate a new trie
+ *
+ * @param[in] ctx to allocate the trie in.
+ * @return
+ *	- New trie.
+ *	- NULL on error.
+ */
+fr_trie_t *fr_trie_alloc(TALLOC_CTX *ctx)
+{
+	return talloc_zero(ctx, fr_trie_t);
+}
+
+/** Insert data for a prefix
+ *
+ * @param[in] ft to insert into.
+ * @param[in] key the prefix, most significant bit first.
+ * @param[in] key_bits length of the prefix.
+ * @param[in] data to associate with the prefix.  Must not be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the prefix already exists, or on error.
+ */
+int fr_trie_insert(fr_trie_t *ft, uint8_t const *key, size_t key_bits, void *data)
+{
+	fr_trie_node_t	**link = &ft->root;
+	fr_trie_node_t	*node, *leaf, *glue;
+	size_t		checked = 0;
+
+	if (!data) {
+		fr_strerror_printf("Cannot insert NULL data into trie");
+		return -1;
+	}
+
+	while ((node = *link) != NULL) {
+		size_t common;
+
+		common = trie_mismatch(node->key, key, checked, (node->bits < key_bits) ? node->bits : key_bits);
+
+		/*
+		 *	The node is a prefix of the key.  Either it IS
+		 *	the key, or we go further down.
+		 */
+		if (common == node->bits) {
+			if (node->bits == key_bits) {
+				if (node->data) {
+					fr_strerror_printf("Prefix already exists in trie");
+					return -1;
+				}
+
+				node->data = data;
+				ft->num_elements++;
+				return 0;
+			}
+
+			checked = node->bits;
+			link = &node->child[TRIE_BIT(key, node->bits)];
+			continue;
+		}
+
+		leaf = trie_node_alloc(ft, key, key_bits, data);
+		if (!leaf) {
+		oom:
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+
+		/*
+		 *	The key is a prefix of the node.  The new leaf
+		 *	goes above it.
+		 */
+		if (common == key_bits) {
+			leaf->child[TRIE_BIT(node->key, key_bits)] = node;
+			*link = leaf;
+			ft->num_elements++;
+			return 0;
+		}
+
+		/*
+		 *	The key and the node diverge part way through.
+		 *	Join them with a glue node.
+		 */
+		glue = trie_node_alloc(ft, key, common, NULL);
+		if (!glue) {
+			talloc_free(leaf);
+			goto oom;
+		}
+
+		glue->child[TRIE_BIT(node->key, common)] = node;
+		glue->child[TRIE_BIT(key, common)] = leaf;
+		*link = glue;
+		ft->num_elements++;
+		return 0;
+	}
+
+	*link = trie_node_alloc(ft, key, key_bits, data);
+	if (!*link) goto oom;
+
+	ft->num_elements++;
+	return 0;
+}
+
+/*
+ *	Find the node for an exact prefix, and the link which points
+ *	to it.  Also return the parent and its link, for fr_trie_remove().
+ */
+static fr_trie_node_t *trie_node_find(fr_trie_t *ft, uint8_t const *key, size_t key_bits,
+				      fr_trie_node_t ***link_p, fr_trie_node_t ***parent_link_p)
+{
+	fr_trie_node_t	**link = &ft->root, **parent_link = NULL;
+	fr_trie_node_t	*node;
+	size_t		checked = 0;
+
+	while ((node = *link) != NULL) {
+		if (node->bits > key_bits) return NULL;
+
+		if (trie_mismatch(node->key, key, checked, node->bits) < node->bits) return NULL;
+
+		if (node->bits == key_bits) break;
+
+		checked = node->bits;
+		parent_link = link;
+		link = &node->child[TRIE_BIT(key, node->bits)];
+	}
+
+	if (!node || !node->data) return NULL;
+
+	if (link_p) *link_p = link;
+	if (parent_link_p) *parent_link_p = parent_link;
+
+	return node;
+}
+
+/** Find the data for an exact prefix
+ *
+ * @param[in] ft to search.
+ * @param[in] key the prefix, most significant bit first.
+ * @param[in] key_bits length of the prefix.
+ * @return
+ *	- The data for the prefix.
+ *	- NULL if the prefix isn't in the trie.
+ */
+void *fr_trie_find(fr_trie_t *ft, uint8_t const *key, size_t key_bits)
+{
+	fr_trie_node_t *node;
+
+	node = trie_node_find(ft, key, key_bits, NULL, NULL);
+	if (!node) return NULL;
+
+	return node->data;
+}
+
+/** Find the data for the longest prefix which contains a key
+ *
+ * This is done in a single pass down the trie.
+ *
+ * @param[in] ft to search.
+ * @param[in] key to look up, most significant bit first.
+ * @param[in] key_bits length of the key.
+ * @param[in] match optional callback to filter prefixes.  If it
+ *	returns false, shorter prefixes are used instead.
+ * @param[in] uctx passed to match.
+ * @return
+ *	- The data for the longest matching prefix.
+ *	- NULL if no prefix matches.
+ */
+void *fr_trie_lookup(fr_trie_t *ft, uint8_t const *key, size_t key_bits,
+		     fr_trie_match_t match, void *uctx)
+{
+	fr_trie_node_t	*node = ft->root;
+	size_t		checked = 0;
+	void		*found = NULL;
+
+	while (node) {
+		if (node->bits > key_bits) break;
+
+		if (trie_mismatch(node->key, key, checked, node->bits) < node->bits) break;
+
+		if (node->data && (!match || match(node->data, uctx))) found = node->data;
+
+		if (node->bits == key_bits) break;
+
+		checked = node->bits;
+		node = node->child[TRIE_BIT(key, node->bits)];
+	}
+
+	return found;
+}
+
+/** Remove a prefix from the trie
+ *
+ * @param[in] ft to remove the prefix from.
+ * @param[in] key the prefix, most significant bit first.
+ * @param[in] key_bits length of the prefix.
+ * @return
+ *	- The data which was associated with the prefix.
+ *	- NULL if the prefix wasn't in the trie.
+ */
+void *fr_trie_remove(fr_trie_t *ft, uint8_t const *key, size_t key_bits)
+{
+	fr_trie_node_t	**link, **parent_link;
+	fr_trie_node_t	*node, *parent;
+	void		*data;
+
+	node = trie_node_find(ft, key, key_bits, &link, &parent_link);
+	if (!node) return NULL;
+
+	data = node->data;
+	node->data = NULL;
+	ft->num_elements--;
+
+	/*
+	 *	It's still needed to join its children.
+	 */
+	if (node->child[0] && node->child[1]) return data;
+
+	*link = node->child[0] ? node->child[0] : node->child[1];
+	talloc_free(node);
+
+	/*
+	 *	If the parent is glue, and now has only one child,
+	 *	it's no longer needed either.
+	 */
+	if (!parent_link) return data;
+
+	parent = *parent_link;
+	if (!parent->data && (!parent->child[0] || !parent->child[1])) {
+		*parent_link = parent->child[0] ? parent->child[0] : parent->child[1];
+		talloc_free(parent);
+	}
+
+	return data;
+}
+
+/** Return the number of prefixes in the trie
+ *
+ */
+uint32_t fr_trie_num_elements(fr_trie_t *ft)
+{
+	return ft->num_elements;
+}
+
+#ifdef TESTING
+/*
+ *  cc -g -O2 -DTESTING -I .. trie.c rbtree.c -o trie -ltalloc
+ *
+ *  ./trie [num_prefixes [num_lookups]]
+ *
+ *  Checks the trie against the old client_find() algorithm, of one
+ *  rbtree per prefix length searched from /32 down to the shortest
+ *  prefix, and then times both.
+ */
+typedef struct trie_thing {
+	uint32_t	addr;		//!< Host byte order, masked.
+	uint32_t	prefix;
+} trie_thing;
+
+static int trie_thing_cmp(void const *one, void const *two)
+{
+	trie_thing const *a = one;
+	trie_thing const *b = two;
+
+	if (a->addr < b->addr) return -1;
+	if (a->addr > b->addr) return +1;
+	return 0;
+}
+
+static uint32_t trie_mask(uint32_t addr, uint32_t prefix)
+{
+	if (prefix == 0) return 0;
+
+	return addr & (0xffffffff << (32 - prefix));
+}
+
+static void trie_key(uint8_t key[4], uint32_t addr)
+{
+	key[0] = addr >> 24;
+	key[1] = addr >> 16;
+	key[2] = addr >> 8;
+	key[3] = addr;
+}
+
+static trie_thing *rbtree_lpm(rbtree_t **trees, uint32_t min_prefix, uint32_t addr)
+{
+	int32_t		i;
+	trie_thing	my_thing, *found;
+
+	for (i = 32; i >= (int32_t) min_prefix; i--) {
+		if (!trees[i]) continue;
+
+		my_thing.addr = trie_mask(addr, i);
+		found = rbtree_finddata(trees[i], &my_thing);
+		if (found) return found;
+	}
+
+	return NULL;
+}
+
+static uint64_t trie_usec(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return ((now.tv_sec - start->tv_sec) * 1000000) + (now.tv_usec - start->tv_usec);
+}
+
+int main(int argc, char **argv)
+{
+	fr_trie_t	*ft;
+	rbtree_t	*trees[33];
+	trie_thing	*things;
+	uint32_t	*lookups;
+	uint32_t	i, num = 100000, num_lookups = 1000000, min_prefix = 32;
+	uint32_t	trie_found = 0, tree_found = 0;
+	uint8_t		key[4];
+	uint64_t	trie_time, tree_time;
+	struct timeval	start;
+
+	if (argc > 1) num = atoi(argv[1]);
+	if (argc > 2) num_lookups = atoi(argv[2]);
+
+	memset(trees, 0, sizeof(trees));
+
+	ft = fr_trie_alloc(NULL);
+	things = talloc_zero_array(NULL, trie_thing, num);
+	lookups = talloc_array(NULL, uint32_t, num_lookups);
+
+	/*
+	 *	A mix of prefix lengths, like a large site would have.
+	 *	Mostly single NAS addresses, plus a spread of networks.
+	 */
+	for (i = 0; i < num; i++) {
+		uint32_t r = random() % 100;
+
+		if (r < 70) {
+			things[i].prefix = 32;
+		} else if (r < 85) {
+			things[i].prefix = 24;
+		} else {
+			things[i].prefix = 8 + (random() % 25);
+		}
+
+		things[i].addr = trie_mask((uint32_t) random() ^ ((uint32_t) random() << 16), things[i].prefix);
+
+		if (!trees[things[i].prefix]) trees[things[i].prefix] = rbtree_create(NULL, trie_thing_cmp, NULL, 0);
+		if (!rbtree_insert(trees[things[i].prefix], &things[i])) continue;	/* duplicate */
+
+		trie_key(key, things[i].addr);
+		if (fr_trie_insert(ft, key, things[i].prefix, &things[i]) < 0) {
+			fprintf(stderr, "Failed inserting %u: %s\n", i, fr_strerror());
+			fr_exit(1);
+		}
+
+		if (things[i].prefix < min_prefix) min_prefix = things[i].prefix;
+	}
+
+	/*
+	 *	Half of the lookups are for addresses inside a known
+	 *	prefix, the rest are random (and mostly miss).
+	 */
+	for (i = 0; i < num_lookups; i++) {
+		if (i & 0x01) {
+			trie_thing *t = &things[random() % num];
+
+			lookups[i] = t->addr | (random() & ~(t->prefix ? (0xffffffff << (32 - t->prefix)) : 0));
+		} else {
+			lookups[i] = (uint32_t) random() ^ ((uint32_t) random() << 16);
+		}
+	}
+
+	for (i = 0; i < num_lookups; i++) {
+		trie_key(key, lookups[i]);
+		if (fr_trie_lookup(ft, key, 32, NULL, NULL) != rbtree_lpm(trees, min_prefix, lookups[i])) {
+			fprintf(stderr, "Lookup %u (%08x) differs between trie and rbtrees\n", i, lookups[i]);
+			fr_exit(1);
+		}
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_lookups; i++) {
+		trie_key(key, lookups[i]);
+		if (fr_trie_lookup(ft, key, 32, NULL, NULL)) trie_found++;
+	}
+	trie_time = trie_usec(&start);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < num_lookups; i++) {
+		if (rbtree_lpm(trees, min_prefix, lookups[i])) tree_found++;
+	}
+	tree_time = trie_usec(&start);
+
+	if (trie_found != tree_found) {
+		fprintf(stderr, "Trie matched %u lookups, rbtrees matched %u\n", trie_found, tree_found);
+		fr_exit(1);
+	}
+
+	printf("%u prefixes (shortest /%u), %u lookups, %u matched\n",
+	       fr_trie_num_elements(ft), min_prefix, num_lookups, trie_found);
+	printf("trie    %8.1f ns/lookup\n", (trie_time * 1000.0) / num_lookups);
+	printf("rbtrees %8.1f ns/lookup\n", (tree_time * 1000.0) / num_lookups);
+
+	/*
+	 *	Remove everything, checking that the other prefixes
+	 *	are still found.
+	 */
+	for (i = 0; i < num; i++) {
+		trie_key(key, things[i].addr);
+		if (fr_trie_find(ft, key, things[i].prefix) != &things[i]) continue;	/* was a duplicate */
+
+		if (fr_trie_remove(ft, key, things[i].prefix) != &things[i]) {
+			fprintf(stderr, "Failed removing %u\n", i);
+			fr_exit(1);
+		}
+
+		if (fr_trie_find(ft, key, things[i].prefix)) {
+			fprintf(stderr, "Removed %u but still in trie\n", i);
+			fr_exit(1);
+		}
+	}
+
+	if (fr_trie_num_elements(ft) != 0) {
+		fprintf(stderr, "%u elements left in the trie\n", fr_trie_num_elements(ft));
+		fr_exit(1);
+	}
+
+	return 0;
+}
+#endif
@@ -38,6 +38,27 @@ RCSID("$Id$")
 
 #define FR_DEBUG_STRERROR_PRINTF if (fr_debug_lvl) fr_strerror_printf
 
+/*
+ *	Per-datagram state for udp_recv_mmsg().
+ */
+struct udp_mmsg_batch_t {
+	int			num;		//!< Maximum number of datagrams per call.
+	udp_mmsg_t		*msgs;
+
+#ifdef HAVE_RECVMMSG
+	int			sockfd;		//!< Socket which "sockname" is for.
+	struct sockaddr_storage	sockname;	//!< Local address of the socket.
+	socklen_t		sizeof_sockname;
+
+	struct mmsghdr		*hdrs;
+	struct iovec		*iov;
+	struct sockaddr_storage	*src;
+	uint8_t			*cbuf;		//!< num * UDP_MMSG_CBUF_LEN bytes of auxiliary data.
+#endif
+};
+
+#define UDP_MMSG_CBUF_LEN	(256)
+
 /** Send a packet via a UDP socket.
  *
  * @param[in] sockfd we're reading from.
@@ -239,3 +260,168 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 
 	return received;
 }
+
+
+/** Allocate the buffers needed to receive a batch of datagrams
+ *
+ * @param[in] ctx to allocate the batch in.
+ * @param[in] num the maximum number of datagrams to receive per call to udp_recv_mmsg().
+ * @return
+ *	- The new batch.
+ *	- NULL on error.
+ */
+udp_mmsg_batch_t *udp_mmsg_batch_alloc(TALLOC_CTX *ctx, int num)
+{
+	int			i;
+	udp_mmsg_batch_t	*batch;
+
+	if (num < 1) {
+		fr_strerror_printf("Batch size must be at least 1");
+		return NULL;
+	}
+
+	batch = talloc_zero(ctx, udp_mmsg_batch_t);
+	if (!batch) return NULL;
+
+	batch->num = num;
+#ifdef HAVE_RECVMMSG
+	batch->sockfd = -1;
+#endif
+
+	batch->msgs = talloc_zero_array(batch, udp_mmsg_t, num);
+	if (!batch->msgs) {
+	error:
+		talloc_free(batch);
+		return NULL;
+	}
+
+	for (i = 0; i < num; i++) {
+		batch->msgs[i].data = talloc_array(batch->msgs, uint8_t, MAX_PACKET_LEN);
+		if (!batch->msgs[i].data) goto error;
+	}
+
+#ifdef HAVE_RECVMMSG
+	batch->hdrs = talloc_zero_array(batch, struct mmsghdr, num);
+	batch->iov = talloc_zero_array(batch, struct iovec, num);
+	batch->src = talloc_zero_array(batch, struct sockaddr_storage, num);
+	batch->cbuf = talloc_zero_array(batch, uint8_t, num * UDP_MMSG_CBUF_LEN);
+	if (!batch->hdrs || !batch->iov || !batch->src || !batch->cbuf) goto error;
+#endif
+
+	return batch;
+}
+
+/** Read as many datagrams as are available, up to the batch size
+ *
+ * Where recvmmsg() is available, all of the datagrams are read with one system
+ * call.  Otherwise one datagram is read per call.
+ *
+ * The destination address of each datagram is filled in the same way as udp_recv()
+ * does, i.e. using udpfromto if it's available.  Datagrams which are larger than
+ * MAX_PACKET_LEN are truncated.
+ *
+ * @param[in] sockfd we're reading from.  Must not be connected.
+ * @param[in] batch of buffers, from udp_mmsg_batch_alloc().
+ * @param[out] out the datagrams which were read.  Valid until the next call.
+ * @return
+ *	- > 0 the number of datagrams read.
+ *	- 0 if there were no datagrams to read.
+ *	- < 0 on error.
+ */
+int udp_recv_mmsg(int sockfd, udp_mmsg_batch_t *batch, udp_mmsg_t **out)
+{
+	int			received;
+#ifdef HAVE_RECVMMSG
+	int			i;
+	uint16_t		port;
+#endif
+
+	*out = batch->msgs;
+
+#ifdef HAVE_RECVMMSG
+	/*
+	 *	The local address of the socket doesn't change, so we
+	 *	only get it once.
+	 */
+	if (batch->sockfd != sockfd) {
+		batch->sizeof_sockname = sizeof(batch->sockname);
+		if (getsockname(sockfd, (struct sockaddr *)&batch->sockname, &batch->sizeof_sockname) < 0) {
+			fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+			return -1;
+		}
+		batch->sockfd = sockfd;
+	}
+
+	for (i = 0; i < batch->num; i++) {
+		struct msghdr *msgh = &batch->hdrs[i].msg_hdr;
+
+		batch->iov[i].iov_base = batch->msgs[i].data;
+		batch->iov[i].iov_len = MAX_PACKET_LEN;
+
+		msgh->msg_name = &batch->src[i];
+		msgh->msg_namelen = sizeof(batch->src[i]);
+		msgh->msg_iov = &batch->iov[i];
+		msgh->msg_iovlen = 1;
+		msgh->msg_control = batch->cbuf + (i * UDP_MMSG_CBUF_LEN);
+		msgh->msg_controllen = UDP_MMSG_CBUF_LEN;
+		msgh->msg_flags = 0;
+	}
+
+	received = recvmmsg(sockfd, batch->hdrs, batch->num, MSG_DONTWAIT, NULL);
+	if (received < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return 0;
+
+		fr_strerror_printf("Failed receiving datagrams: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < received; i++) {
+		udp_mmsg_t		*msg = &batch->msgs[i];
+		struct msghdr		*msgh = &batch->hdrs[i].msg_hdr;
+		struct sockaddr_storage	dst;
+		socklen_t		sizeof_dst = batch->sizeof_sockname;
+
+		msg->data_len = batch->hdrs[i].msg_len;
+
+		/*
+		 *	Unknown address family.  Tell the caller
+		 *	to skip it.
+		 */
+		if (!fr_ipaddr_from_sockaddr(&batch->src[i], msgh->msg_namelen, &msg->src_ipaddr, &port)) {
+			msg->data_len = -1;
+			continue;
+		}
+		msg->src_port = port;
+
+		memcpy(&dst, &batch->sockname, sizeof(dst));
+#ifdef WITH_UDPFROMTO
+		udpfromto_cmsg(msgh, (struct sockaddr *)&dst, &sizeof_dst, &msg->if_index, &msg->when);
+#else
+		msg->if_index = 0;
+		gettimeofday(&msg->when, NULL);
+#endif
+		fr_ipaddr_from_sockaddr(&dst, sizeof_dst, &msg->dst_ipaddr, &port);
+		msg->dst_port = port;
+	}
+
+#else
+	/*
+	 *	Without recvmmsg() we can't tell if there's more than
+	 *	one datagram waiting without risking blocking.  So we
+	 *	read one, and let the caller be called again.
+	 */
+	batch->msgs[0].data_len = udp_recv(sockfd, batch->msgs[0].data, MAX_PACKET_LEN, UDP_FLAGS_NONE,
+					   &batch->msgs[0].src_ipaddr, &batch->msgs[0].src_port,
+					   &batch->msgs[0].dst_ipaddr, &batch->msgs[0].dst_port,
+					   &batch->msgs[0].if_index, &batch->msgs[0].when);
+	if (batch->msgs[0].data_len < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return 0;
+
+		fr_strerror_printf("Failed receiving datagram: %s", fr_syserror(errno));
+		return -1;
+	}
+	received = 1;
+#endif
+
+	return received;
+}
@@ -157,6 +157,77 @@ int udpfromto_init(int s)
 	return setsockopt(s, proto, flag, &opt, sizeof(opt));
 }
 
+/** Process the auxiliary data returned by recvmsg(), or by recvmmsg()
+ *
+ * @param[in] msgh The message header, with msg_control pointing to the auxiliary data.
+ * @param[in,out] to Must be initialised with the address the socket is bound to.  If
+ *	the socket is bound to INADDR_ANY, the IP address will be replaced with the
+ *	destination address of the datagram.
+ * @param[in,out] tolen Length of the structure pointed to by to.
+ * @param[out] if_index The interface the datagram was received on, or 0 if unknown.
+ * @param[out] when The time the datagram was received.  If SO_TIMESTAMP was not set
+ *	on the socket, gettimeofday will be used instead.
+ */
+void udpfromto_cmsg(struct msghdr *msgh, struct sockaddr *to, socklen_t *tolen,
+		    int *if_index, struct timeval *when)
+{
+	struct cmsghdr *cmsg;
+
+	if (if_index) *if_index = 0;
+	if (when) {
+		when->tv_sec = 0;
+		when->tv_usec = 0;
+	}
+
+	/* Process auxiliary received data in msgh */
+	for (cmsg = CMSG_FIRSTHDR(msgh);
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+
+#ifdef IP_PKTINFO
+		if ((cmsg->cmsg_level == SOL_IP) &&
+		    (cmsg->cmsg_type == IP_PKTINFO)) {
+			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
+			*tolen = sizeof(struct sockaddr_in);
+			if (if_index) *if_index = i->ipi_ifindex;
+			break;
+		}
+#endif
+
+#ifdef IP_RECVDSTADDR
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
+			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+			((struct sockaddr_in *)to)->sin_addr = *i;
+			*tolen = sizeof(struct sockaddr_in);
+			break;
+		}
+#endif
+
+#ifdef IPV6_PKTINFO
+		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
+		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
+			struct in6_pktinfo *i =
+				(struct in6_pktinfo *) CMSG_DATA(cmsg);
+			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
+			*tolen = sizeof(struct sockaddr_in6);
+			if (if_index) *if_index = i->ipi6_ifindex;
+			break;
+		}
+#endif
+
+#ifdef SO_TIMESTAMP
+		if (when && (cmsg->cmsg_level == SOL_IP) &&
+		    (cmsg->cmsg_type == SO_TIMESTAMP)) {
+			memcpy(when, CMSG_DATA(cmsg), sizeof(*when));
+		}
+#endif
+	}
+
+	if (when && !when->tv_sec) gettimeofday(when, NULL);
+}
+
 /** Read a packet from a file descriptor, retrieving additional header information
  *
  * Abstracts away the complexity of using the complexity of using recvmsg().
@@ -188,7 +259,6 @@ int recvfromto(int s, void *buf, size_t len, int flags,
 	       int *if_index, struct timeval *when)
 {
 	struct msghdr msgh;
-	struct cmsghdr *cmsg;
 	struct iovec iov;
 	char cbuf[256];
 	int err;
@@ -292,59 +362,7 @@ int recvfromto(int s, void *buf, size_t len, int flags,
 
 	if (fromlen) *fromlen = msgh.msg_namelen;
 
-	if (if_index) *if_index = 0;
-	if (when) {
-		when->tv_sec = 0;
-		when->tv_usec = 0;
-	}
-
-	/* Process auxiliary received data in msgh */
-	for (cmsg = CMSG_FIRSTHDR(&msgh);
-	     cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msgh,cmsg)) {
-
-#ifdef IP_PKTINFO
-		if ((cmsg->cmsg_level == SOL_IP) &&
-		    (cmsg->cmsg_type == IP_PKTINFO)) {
-			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
-			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
-			*tolen = sizeof(struct sockaddr_in);
-			if (if_index) *if_index = i->ipi_ifindex;
-			break;
-		}
-#endif
-
-#ifdef IP_RECVDSTADDR
-		if ((cmsg->cmsg_level == IPPROTO_IP) &&
-		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
-			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
-			((struct sockaddr_in *)to)->sin_addr = *i;
-			*tolen = sizeof(struct sockaddr_in);
-			break;
-		}
-#endif
-
-#ifdef IPV6_PKTINFO
-		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
-		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
-			struct in6_pktinfo *i =
-				(struct in6_pktinfo *) CMSG_DATA(cmsg);
-			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
-			*tolen = sizeof(struct sockaddr_in6);
-			if (if_index) *if_index = i->ipi6_ifindex;
-			break;
-		}
-#endif
-
-#ifdef SO_TIMESTAMP
-		if (when && (cmsg->cmsg_level == SOL_IP) &&
-		    (cmsg->cmsg_type == SO_TIMESTAMP)) {
-			memcpy(when, CMSG_DATA(cmsg), sizeof(*when));
-		}
-#endif
-	}
-
-	if (when && !when->tv_sec) gettimeofday(when, NULL);
+	udpfromto_cmsg(&msgh, to, tolen, if_index, when);
 
 	return err;
 }
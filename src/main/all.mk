@@ -4,6 +4,7 @@ SUBMAKEFILES := \
     radsniff.mk \
     radmin.mk \
     radattr.mk \
+    raddetail.mk \
     radwho.mk \
     radsnmp.mk \
     radlast.mk \
@@ -28,6 +28,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/trie.h>
 
 #include <sys/stat.h>
 
@@ -40,9 +41,20 @@ RCSID("$Id$")
 #endif
 #endif
 
+/*
+ *	Clients are kept in one trie per address family, keyed by
+ *	network.  Each entry holds all of the clients for that
+ *	network.  There's usually only one, but with TCP there may be
+ *	separate UDP and TCP clients for the same network.
+ */
+typedef struct client_network_t {
+	uint32_t	num;
+	RADCLIENT	**clients;
+} client_network_t;
+
 struct radclient_list {
-	rbtree_t	*trees[129]; /* for 0..128, inclusive. */
-	uint32_t       	min_prefix;
+	fr_trie_t	*v4;
+	fr_trie_t	*v6;
 };
 
 
@@ -99,29 +111,66 @@ void client_free(RADCLIENT *client)
 }
 
 /*
- *	Callback for comparing two clients.
+ *	Whether a client can be used for packets of a protocol.
  */
-static int client_ipaddr_cmp(void const *one, void const *two)
+#ifdef WITH_TCP
+static bool client_proto_match(RADCLIENT const *client, int proto)
 {
-	RADCLIENT const *a = one;
-	RADCLIENT const *b = two;
-#ifndef WITH_TCP
-
-	return fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
-#else
-	int rcode;
-
-	rcode = fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
-	if (rcode != 0) return rcode;
-
 	/*
 	 *	Wildcard match
 	 */
-	if ((a->proto == IPPROTO_IP) ||
-	    (b->proto == IPPROTO_IP)) return 0;
+	if ((client->proto == IPPROTO_IP) ||
+	    (proto == IPPROTO_IP)) return true;
 
-	return (a->proto - b->proto);
+	return (client->proto == proto);
+}
+#else
+#  define client_proto_match(_client, _proto) (true)
 #endif
+
+/*
+ *	Find the client for a protocol, in the list of clients for a network.
+ */
+static RADCLIENT *client_network_find(client_network_t const *network, int proto)
+{
+	uint32_t i;
+
+	for (i = 0; i < network->num; i++) {
+		if (client_proto_match(network->clients[i], proto)) return network->clients[i];
+	}
+
+	return NULL;
+}
+
+/*
+ *	Callback for fr_trie_lookup().  Skip networks which don't have
+ *	a client for the protocol.
+ */
+static bool client_network_match(void const *data, void *uctx)
+{
+	return (client_network_find(data, *(int *) uctx) != NULL);
+}
+
+/*
+ *	Get the trie and key for an IP address.
+ */
+static fr_trie_t *client_trie(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
+			      uint8_t const **key, size_t *key_bits)
+{
+	switch (ipaddr->af) {
+	case AF_INET:
+		*key = (uint8_t const *) &ipaddr->ipaddr.ip4addr.s_addr;
+		*key_bits = 32;
+		return clients->v4;
+
+	case AF_INET6:
+		*key = (uint8_t const *) &ipaddr->ipaddr.ip6addr.s6_addr;
+		*key_bits = 128;
+		return clients->v6;
+
+	default:
+		return NULL;
+	}
 }
 
 #ifdef WITH_STATS
@@ -139,16 +188,9 @@ static int client_num_cmp(void const *one, void const *two)
  */
 void client_list_free(RADCLIENT_LIST *clients)
 {
-	int i;
-
 	if (!clients) clients = root_clients;
 	if (!clients) return;	/* Clients may not have been initialised yet */
 
-	for (i = 0; i <= 128; i++) {
-		if (clients->trees[i]) rbtree_free(clients->trees[i]);
-		clients->trees[i] = NULL;
-	}
-
 	if (clients == root_clients) {
 #ifdef WITH_STATS
 		if (tree_num) rbtree_free(tree_num);
@@ -176,7 +218,12 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
 
 	if (!clients) return NULL;
 
-	clients->min_prefix = 128;
+	clients->v4 = fr_trie_alloc(clients);
+	clients->v6 = fr_trie_alloc(clients);
+	if (!clients->v4 || !clients->v6) {
+		talloc_free(clients);
+		return NULL;
+	}
 
 	return clients;
 }
@@ -191,8 +238,12 @@ RADCLIENT_LIST *client_list_init(CONF_SECTION *cs)
  */
 bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
-	RADCLIENT *old;
-	char buffer[FR_IPADDR_PREFIX_STRLEN];
+	RADCLIENT		*old, **clients_array;
+	client_network_t	*net;
+	fr_trie_t		*trie;
+	uint8_t const		*key;
+	size_t			key_bits;
+	char			buffer[FR_IPADDR_PREFIX_STRLEN];
 
 	if (!client) return false;
 
@@ -279,22 +330,16 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 		}
 	}
 
-	/*
-	 *	Create a tree for it.
-	 */
-	if (!clients->trees[client->ipaddr.prefix]) {
-		clients->trees[client->ipaddr.prefix] = rbtree_create(clients, client_ipaddr_cmp, NULL, 0);
-		if (!clients->trees[client->ipaddr.prefix]) {
-			return false;
-		}
-	}
+	trie = client_trie(clients, &client->ipaddr, &key, &key_bits);
+	if (!trie) return false;
 
 #define namecmp(a) ((!old->a && !client->a) || (old->a && client->a && (strcmp(old->a, client->a) == 0)))
 
 	/*
 	 *	Cannot insert the same client twice.
 	 */
-	old = rbtree_finddata(clients->trees[client->ipaddr.prefix], client);
+	net = fr_trie_find(trie, key, client->ipaddr.prefix);
+	old = net ? client_network_find(net, client->proto) : NULL;
 	if (old) {
 		/*
 		 *	If it's a complete duplicate, then free the new
@@ -328,10 +373,23 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	/*
 	 *	Other error adding client: likely is fatal.
 	 */
-	if (!rbtree_insert(clients->trees[client->ipaddr.prefix], client)) {
-		return false;
+	if (!net) {
+		net = talloc_zero(clients, client_network_t);
+		if (!net) return false;
+
+		if (fr_trie_insert(trie, key, client->ipaddr.prefix, net) < 0) {
+			ERROR("Failed adding client %s: %s", client->shortname, fr_strerror());
+			talloc_free(net);
+			return false;
+		}
 	}
 
+	clients_array = talloc_realloc(net, net->clients, RADCLIENT *, net->num + 1);
+	if (!clients_array) return false;
+
+	net->clients = clients_array;
+	net->clients[net->num++] = client;
+
 #ifdef WITH_STATS
 	if (!tree_num) {
 		tree_num = rbtree_create(clients, client_num_cmp, NULL, 0);
@@ -364,10 +422,6 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 	if (tree_num) rbtree_insert(tree_num, client);
 #endif
 
-	if (client->ipaddr.prefix < clients->min_prefix) {
-		clients->min_prefix = client->ipaddr.prefix;
-	}
-
 	(void) talloc_steal(clients, client); /* reparent it */
 
 	return true;
@@ -377,6 +431,12 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 #ifdef WITH_DYNAMIC_CLIENTS
 void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 {
+	client_network_t	*network;
+	fr_trie_t		*trie;
+	uint8_t const		*key;
+	size_t			key_bits;
+	uint32_t		i;
+
 	if (!client) return;
 
 	if (!clients) clients = root_clients;
@@ -390,7 +450,27 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 #ifdef WITH_STATS
 	rbtree_deletebydata(tree_num, client);
 #endif
-	rbtree_deletebydata(clients->trees[client->ipaddr.prefix], client);
+
+	trie = client_trie(clients, &client->ipaddr, &key, &key_bits);
+	if (!trie) return;
+
+	network = fr_trie_find(trie, key, client->ipaddr.prefix);
+	if (!network) return;
+
+	for (i = 0; i < network->num; i++) {
+		if (network->clients[i] != client) continue;
+
+		network->clients[i] = network->clients[--network->num];
+		break;
+	}
+
+	/*
+	 *	That was the last client for the network.
+	 */
+	if (network->num == 0) {
+		fr_trie_remove(trie, key, client->ipaddr.prefix);
+		talloc_free(network);
+	}
 }
 #endif
 
@@ -430,40 +510,26 @@ RADCLIENT *client_findbynumber(UNUSED const RADCLIENT_LIST *clients, UNUSED int
  */
 RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr, int proto)
 {
-	int32_t i, max_prefix;
-	RADCLIENT myclient;
+	client_network_t	*network;
+	fr_trie_t		*trie;
+	uint8_t const		*key;
+	size_t			key_bits;
 
 	if (!clients) clients = root_clients;
 
 	if (!clients || !ipaddr) return NULL;
 
-	switch (ipaddr->af) {
-	case AF_INET:
-		max_prefix = 32;
-		break;
-
-	case AF_INET6:
-		max_prefix = 128;
-		break;
-
-	default :
-		return NULL;
-	}
-
-	for (i = max_prefix; i >= (int32_t) clients->min_prefix; i--) {
-		void *data;
-
-		if (!clients->trees[i]) continue;
+	trie = client_trie(clients, ipaddr, &key, &key_bits);
+	if (!trie) return NULL;
 
-		myclient.ipaddr = *ipaddr;
-		myclient.proto = proto;
-		fr_ipaddr_mask(&myclient.ipaddr, i);
-
-		data = rbtree_finddata(clients->trees[i], &myclient);
-		if (data) return data;
-	}
+	/*
+	 *	Find the most specific network which has a client
+	 *	for this protocol.
+	 */
+	network = fr_trie_lookup(trie, key, key_bits, client_network_match, &proto);
+	if (!network) return NULL;
 
-	return NULL;
+	return client_network_find(network, proto);
 }
 
 /*
@@ -2473,6 +2473,129 @@ static int command_stats_state(rad_listen_t *listener, UNUSED int argc, UNUSED c
 	return CMD_OK;
 }
 
+static int command_stats_pool(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
+{
+	request_pool_stats_t	stats;
+	uint64_t		total;
+
+	request_pool_stats(&stats);
+	total = stats.created + stats.reused;
+
+	cprintf(listener, "pool_size\t\t%" PRIu32 "\n", stats.size);
+	cprintf(listener, "pools_created\t\t%" PRIu64 "\n", stats.created);
+	cprintf(listener, "pools_reused\t\t%" PRIu64 "\n", stats.reused);
+	cprintf(listener, "pools_hit_rate\t\t%.2f%%\n", total ? (stats.reused * 100.0) / total : 0.0);
+	cprintf(listener, "pools_sampled\t\t%" PRIu64 "\n", stats.sampled);
+	cprintf(listener, "pools_overflowed\t%" PRIu64 "\n", stats.overflowed);
+
+	return CMD_OK;
+}
+
+static int command_stats_exfile(rad_listen_t *listener, int argc, char *argv[])
+{
+	CONF_SECTION		*cs;
+	module_instance_t	*instance;
+	exfile_t		*ef;
+	exfile_stats_t		stats;
+
+	if (argc == 0) {
+		cprintf_error(listener, "Must specify <module>\n");
+		return CMD_FAIL;
+	}
+
+	cs = cf_section_sub_find(main_config.config, "modules");
+	if (!cs) return CMD_FAIL;
+
+	instance = module_find(cs, argv[0]);
+	if (!instance) {
+		cprintf_error(listener, "No such module \"%s\"\n", argv[0]);
+		return CMD_FAIL;
+	}
+
+	ef = cf_data_find(instance->cs, MODULE_EXFILE_CF_KEY);
+	if (!ef) {
+		cprintf_error(listener, "Module %s does not write to files\n", argv[0]);
+		return CMD_FAIL;
+	}
+
+	exfile_async_stats(ef, &stats);
+	if (!stats.size) {
+		cprintf_error(listener, "Module %s does not write asynchronously\n", argv[0]);
+		return CMD_FAIL;
+	}
+
+	cprintf(listener, "queue_size\t\t%" PRIu32 "\n", stats.size);
+	cprintf(listener, "queue_depth\t\t%" PRIu32 "\n", stats.depth);
+	cprintf(listener, "queue_depth_max\t\t%" PRIu32 "\n", stats.depth_max);
+	cprintf(listener, "records_queued\t\t%" PRIu64 "\n", stats.queued);
+	cprintf(listener, "records_written\t\t%" PRIu64 "\n", stats.written);
+	cprintf(listener, "records_failed\t\t%" PRIu64 "\n", stats.failed);
+	cprintf(listener, "queue_stalls\t\t%" PRIu64 "\n", stats.stalls);
+	cprintf(listener, "flushes\t\t\t%" PRIu64 "\n", stats.flushes);
+	cprintf(listener, "bytes_written\t\t%" PRIu64 "\n", stats.bytes);
+	cprintf(listener, "bytes_per_flush\t\t%.1f\n", stats.flushes ? (double) stats.bytes / stats.flushes : 0.0);
+	cprintf(listener, "records_per_flush\t%.1f\n", stats.flushes ? (double) stats.written / stats.flushes : 0.0);
+	cprintf(listener, "fsyncs\t\t\t%" PRIu64 "\n", stats.fsyncs);
+
+	return CMD_OK;
+}
+
+#ifdef WITH_TLS
+static int command_stats_tickets(rad_listen_t *listener, int argc, char *argv[])
+{
+	CONF_SECTION		*cs, *subcs = NULL;
+	module_instance_t	*instance;
+	fr_tls_conf_t		*conf;
+	tls_ticket_stats_t	stats;
+	bool			found = false;
+
+	if (argc == 0) {
+		cprintf_error(listener, "Must specify <module>\n");
+		return CMD_FAIL;
+	}
+
+	cs = cf_section_sub_find(main_config.config, "modules");
+	if (!cs) return CMD_FAIL;
+
+	instance = module_find(cs, argv[0]);
+	if (!instance) {
+		cprintf_error(listener, "No such module \"%s\"\n", argv[0]);
+		return CMD_FAIL;
+	}
+
+	/*
+	 *	The TLS configuration is cached in the section
+	 *	it was parsed from, which for EAP is one of the
+	 *	module's subsections.
+	 */
+	while ((subcs = cf_subsection_find_next(instance->cs, subcs, NULL)) != NULL) {
+		char const *name;
+
+		conf = cf_data_find(subcs, "tls-conf");
+		if (!conf || !conf->session_ticket_keys) continue;
+
+		name = cf_section_name2(subcs);
+		if (!name) name = cf_section_name1(subcs);
+
+		tls_ticket_stats(&stats, conf->session_ticket_keys);
+
+		cprintf(listener, "tls_config\t\t%s\n", name);
+		cprintf(listener, "ticket_hits\t\t%" PRIu64 "\n", stats.hits);
+		cprintf(listener, "ticket_misses\t\t%" PRIu64 "\n", stats.misses);
+		cprintf(listener, "ticket_renewals\t\t%" PRIu64 "\n", stats.renewals);
+		cprintf(listener, "ticket_keys\t\t%u\n", stats.keys);
+		found = true;
+	}
+
+	if (!found) {
+		cprintf_error(listener, "Module %s does not use session tickets\n", argv[0]);
+		return CMD_FAIL;
+	}
+
+	return CMD_OK;
+}
+#endif
+
 static int command_stats_queue(rad_listen_t *listener, UNUSED int argc, UNUSED char *argv[])
 {
 	int array[RAD_LISTEN_MAX], pps[2];
@@ -2488,6 +2611,8 @@ static int command_stats_queue(rad_listen_t *listener, UNUSED int argc, UNUSED c
 	cprintf(listener, "queue_pps_in\t\t" PU "\n", pps[0]);
 	cprintf(listener, "queue_pps_out\t\t" PU "\n", pps[1]);
 
+	cprintf(listener, "queue_stolen\t\t%" PRIu64 "\n", thread_pool_num_stolen());
+
 	return CMD_OK;
 }
 
@@ -2894,6 +3019,14 @@ static fr_command_table_t command_table_stats[] = {
 	  command_stats_home_server, NULL },
 #endif
 
+	{ "exfile", FR_READ,
+	  "stats exfile <module> - show statistics for a module's asynchronous file writer",
+	  command_stats_exfile, NULL },
+
+	{ "pool", FR_READ,
+	  "stats pool - show statistics for the memory pools requests are allocated in",
+	  command_stats_pool, NULL },
+
 	{ "queue", FR_READ,
 	  "stats queue - show statistics for packet queues",
 	  command_stats_queue, NULL },
@@ -2902,6 +3035,12 @@ static fr_command_table_t command_table_stats[] = {
 	  "stats state - show statistics for states",
 	  command_stats_state, NULL },
 
+#ifdef WITH_TLS
+	{ "tickets", FR_READ,
+	  "stats tickets <module> - show statistics for a module's TLS session tickets",
+	  command_stats_tickets, NULL },
+#endif
+
 	{ "socket", FR_READ,
 	  "stats socket <ipaddr> <port> [udp|tcp] "
 	  "- show statistics for given socket",
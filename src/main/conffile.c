@@ -1484,25 +1484,22 @@ int cf_section_parse_pass2(CONF_SECTION *cs, void *base, CONF_PARSER const varia
 		}
 
 		/*
-		 *	Parse (and throw away) the xlat string (for validation).
+		 *	Parse the xlat string once, both to validate it,
+		 *	and to cache the parsed version, so that it doesn't
+		 *	need to be re-parsed each time it's expanded.
 		 *
 		 *	FIXME: All of these should be converted from PW_TYPE_XLAT
 		 *	to PW_TYPE_TMPL.
 		 */
 		if (is_xlat) {
-			char const	*error;
+			char const	*error = NULL;
 			ssize_t		slen;
-			char		*value;
-			xlat_exp_t	*xlat;
 
 		redo:
-			xlat = NULL;
-
 			/*
 			 *	xlat expansions should be parseable.
 			 */
-			value = talloc_strdup(cs, cp->value); /* modified by xlat_tokenize */
-			slen = xlat_tokenize(cs, value, &xlat, &error);
+			slen = xlat_cache_add(cp, cp->value, &error);
 			if (slen < 0) {
 				char *spaces, *text;
 
@@ -1514,14 +1511,9 @@ int cf_section_parse_pass2(CONF_SECTION *cs, void *base, CONF_PARSER const varia
 
 				talloc_free(spaces);
 				talloc_free(text);
-				talloc_free(value);
-				talloc_free(xlat);
 				return -1;
 			}
 
-			talloc_free(value);
-			talloc_free(xlat);
-
 			/*
 			 *	If the "multi" flag is set, check all of them.
 			 */
@@ -26,6 +26,7 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/detail.h>
+#include <freeradius-devel/detail_binary.h>
 #include <freeradius-devel/process.h>
 #include <freeradius-devel/rad_assert.h>
 
@@ -37,6 +38,10 @@ RCSID("$Id$")
 #include <glob.h>
 #endif
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 #include <pthread.h>
 
 #include <fcntl.h>
@@ -61,6 +66,48 @@ static FR_NAME_NUMBER state_names[] = {
 };
 
 
+/*
+ *	Each packet we create has a unique ID, ports and destination
+ *	IP, generated from a 32-bit sequence number.  That lets us
+ *	work out which record a request came from, without keeping
+ *	pointers to the request.
+ */
+static void detail_packet_seq_set(RADIUS_PACKET *packet, uint32_t seq)
+{
+	packet->id = seq & 0xff;
+	packet->src_port = 1024 + ((seq >> 8) & 0xff);
+	packet->dst_port = 1024 + ((seq >> 16) & 0xff);
+
+	packet->dst_ipaddr.af = AF_INET;
+	packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl((INADDR_LOOPBACK & ~0xffffff) | ((seq >> 24) & 0xff));
+}
+
+static uint32_t detail_packet_seq(RADIUS_PACKET const *packet)
+{
+	return (packet->id & 0xff) |
+	       (((uint32_t) (packet->src_port - 1024) & 0xff) << 8) |
+	       (((uint32_t) (packet->dst_port - 1024) & 0xff) << 16) |
+	       ((ntohl(packet->dst_ipaddr.ipaddr.ip4addr.s_addr) & 0xff) << 24);
+}
+
+/*
+ *	Tell the reader thread that a record has been processed.
+ *	The ack is smaller than PIPE_BUF, so writes from different
+ *	threads don't interleave.
+ */
+static void detail_ack(listen_detail_t *data, RADIUS_PACKET const *packet, bool replied)
+{
+	detail_ack_t ack;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.seq = detail_packet_seq(packet);
+	ack.replied = replied;
+
+	if (write(data->child_pipe[1], &ack, sizeof(ack)) < 0) {
+		ERROR("detail (%s): Failed writing ack to reader thread: %s", data->name, fr_syserror(errno));
+	}
+}
+
 /*
  *	If we're limiting outstanding packets, then mark the response
  *	as being sent.
@@ -73,6 +120,20 @@ int detail_send(rad_listen_t *listener, REQUEST *request)
 	rad_assert(request->listener == listener);
 	rad_assert(listener->send == detail_send);
 
+	/*
+	 *	With more than one record outstanding, the reader
+	 *	thread does all of the book-keeping.  Just tell it
+	 *	which record this was, and whether it was processed.
+	 */
+	if (data->max_outstanding > 1) {
+		if (request->reply->code == 0) {
+			RDEBUG("detail (%s): No response to request.  Will retry in %d seconds",
+			       data->name, data->retry_interval);
+		}
+		detail_ack(data, request->packet, (request->reply->code != 0));
+		return 0;
+	}
+
 	/*
 	 *	This request timed out.  Remember that, and tell the
 	 *	caller it's OK to read more "detail" file stuff.
@@ -294,6 +355,272 @@ static int detail_open(rad_listen_t *this)
 }
 
 
+/*
+ *	Release the mapping of a binary detail file.
+ */
+static void detail_unmap(listen_detail_t *data)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (data->map) {
+		void *map;
+
+		memcpy(&map, &data->map, sizeof(map));
+		munmap(map, data->map_len);
+	}
+#endif
+	data->map = NULL;
+	data->map_len = 0;
+}
+
+/*
+ *	Check whether the work file is in the binary format, and if
+ *	so, map (or re-map) all of it into memory.  Binary records are
+ *	then decoded directly from the mapping, with no copying, and
+ *	no parsing of text.
+ *
+ *	Returns -1 on error, 0 if the file is a text file, 1 if it's
+ *	binary, and mapped.
+ */
+static int detail_map(listen_detail_t *data)
+{
+	struct stat	buf;
+	uint8_t		magic[4];
+	void		*map;
+
+	if (fstat(data->work_fd, &buf) < 0) {
+		ERROR("detail (%s): Failed to stat detail file: %s", data->name, fr_syserror(errno));
+		return -1;
+	}
+
+	if (!data->binary) {
+		if (buf.st_size < (off_t) sizeof(magic)) return 0;
+
+		if (pread(data->work_fd, magic, sizeof(magic), 0) != sizeof(magic)) {
+			ERROR("detail (%s): Failed reading detail file: %s", data->name, fr_syserror(errno));
+			return -1;
+		}
+		if (!fr_detail_binary_is_binary(magic, sizeof(magic))) return 0;
+	}
+
+	if ((size_t) buf.st_size == data->map_len) return 1;
+
+#ifndef HAVE_SYS_MMAN_H
+	ERROR("detail (%s): Binary detail files are not supported on this system", data->name);
+	return -1;
+#else
+	detail_unmap(data);
+
+	map = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, data->work_fd, 0);
+	if (map == MAP_FAILED) {
+		ERROR("detail (%s): Failed mapping detail file: %s", data->name, fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	We read the records from front to back, once.
+	 */
+#  ifdef MADV_SEQUENTIAL
+	(void) madvise(map, buf.st_size, MADV_SEQUENTIAL);
+#  endif
+
+	data->map = map;
+	data->map_len = buf.st_size;
+	data->binary = true;
+
+	return 1;
+#endif
+}
+
+/*
+ *	Decode the binary record at the current offset.
+ *
+ *	Returns -1 if the record is malformed or truncated, 0 on success.
+ */
+static int detail_read_binary(listen_detail_t *data)
+{
+	ssize_t			len;
+	fr_detail_binary_t	record;
+	vp_cursor_t		cursor;
+	VALUE_PAIR		*vp;
+
+	len = fr_detail_binary_decode(data, &record, data->map + data->offset, data->map_len - data->offset);
+	if (len <= 0) {
+		if (len == 0) {
+			ERROR("detail (%s): Truncated record: treating it as EOF for detail file %s",
+			      data->name, data->filename_work);
+		} else {
+			ERROR("detail (%s): Invalid record at offset %zu in detail file %s: %s",
+			      data->name, (size_t) data->offset, data->filename_work, fr_strerror());
+		}
+		return -1;
+	}
+
+	data->last_offset = data->record_offset = data->timestamp_offset = data->offset;
+	data->offset += len;
+
+	data->code = record.code;
+	data->timestamp = record.timestamp;
+	data->done_entry = (record.flags & FR_DETAIL_BINARY_DONE) != 0;
+	if (record.src_ipaddr.af != AF_UNSPEC) data->client_ip = record.src_ipaddr;
+
+	data->vps = record.vps;
+
+	fr_cursor_init(&cursor, &data->vps);
+	vp = fr_pair_afrom_num(data, 0, PW_PACKET_ORIGINAL_TIMESTAMP);
+	if (vp) {
+		vp->vp_date = (uint32_t) data->timestamp;
+		vp->type = VT_DATA;
+		fr_cursor_append(&cursor, vp);
+	}
+
+	data->entry_state = STATE_QUEUED;
+
+	return 0;
+}
+
+/*
+ *	Mark the record whose timestamp is at "offset" as done, so
+ *	that it's skipped if the file is read again.
+ */
+static void detail_mark_done(listen_detail_t *data, off_t offset)
+{
+	if (!data->fp || (offset < 0)) return;
+
+	if (data->binary) {
+		uint8_t flags;
+
+		/*
+		 *	Set the "done" flag in the record header.
+		 */
+		flags = data->map[offset + offsetof(fr_detail_binary_hdr_t, flags)];
+		flags |= FR_DETAIL_BINARY_DONE;
+
+		if (pwrite(data->work_fd, &flags, sizeof(flags),
+			   offset + offsetof(fr_detail_binary_hdr_t, flags)) < 0) {
+			WARN("detail (%s): Failed marking request as done: %s",
+			     data->name, fr_syserror(errno));
+		}
+		return;
+	}
+
+	if (fseek(data->fp, offset, SEEK_SET) < 0) {
+		WARN("detail (%s): Failed seeking to timestamp offset: %s",
+		     data->name, fr_syserror(errno));
+	} else if (fwrite("\tDone", 1, 5, data->fp) < 5) {
+		WARN("detail (%s): Failed marking request as done: %s",
+		     data->name, fr_syserror(errno));
+	} else if (fflush(data->fp) != 0) {
+		WARN("detail (%s): Failed flushing marked detail file to disk: %s",
+		     data->name, fr_syserror(errno));
+	}
+
+	if (fseek(data->fp, data->offset, SEEK_SET) < 0) {
+		WARN("detail (%s): Failed seeking to next detail request: %s",
+		     data->name, fr_syserror(errno));
+	}
+}
+
+/*
+ *	Open the checkpoint file for the work file, and return the
+ *	offset to resume reading from.
+ *
+ *	The checkpoint holds the inode of the work file, so that a
+ *	checkpoint left over from a previous work file is ignored.
+ */
+static off_t detail_checkpoint_open(listen_detail_t *data)
+{
+	struct stat	buf;
+	char		buffer[64];
+	ssize_t		len;
+	uint64_t	ino, offset;
+
+	data->checkpoint = 0;
+
+	if (fstat(data->work_fd, &buf) < 0) return 0;
+
+	data->checkpoint_fd = open(data->filename_checkpoint, O_RDWR | O_CREAT, 0600);
+	if (data->checkpoint_fd < 0) {
+		WARN("detail (%s): Failed opening checkpoint file %s: %s",
+		     data->name, data->filename_checkpoint, fr_syserror(errno));
+		return 0;
+	}
+
+	len = pread(data->checkpoint_fd, buffer, sizeof(buffer) - 1, 0);
+	if (len <= 0) return 0;
+	buffer[len] = '\0';
+
+	if ((sscanf(buffer, "%" SCNu64 " %" SCNu64, &ino, &offset) != 2) ||
+	    (ino != (uint64_t) buf.st_ino) || (offset > (uint64_t) buf.st_size)) {
+		DEBUG("detail (%s): Ignoring stale checkpoint file %s", data->name, data->filename_checkpoint);
+		if (ftruncate(data->checkpoint_fd, 0) < 0) {
+			WARN("detail (%s): Failed truncating checkpoint file %s: %s",
+			     data->name, data->filename_checkpoint, fr_syserror(errno));
+		}
+		return 0;
+	}
+
+	data->checkpoint = offset;
+
+	return offset;
+}
+
+/*
+ *	Every record before the first one we're still processing is
+ *	done.  If that's moved forward, record it, so that we start
+ *	from there if the server is restarted.
+ */
+static void detail_checkpoint_update(listen_detail_t *data)
+{
+	struct stat	buf;
+	off_t		checkpoint = data->offset;
+	uint32_t	i;
+	char		buffer[64];
+	int		len;
+
+	for (i = 0; i < data->max_outstanding; i++) {
+		detail_entry_t *entry = &data->entries[i];
+
+		if (!entry->in_use || (entry->record_offset < 0)) continue;
+		if (entry->record_offset < checkpoint) checkpoint = entry->record_offset;
+	}
+
+	if (checkpoint <= data->checkpoint) return;
+	data->checkpoint = checkpoint;
+
+	if ((data->checkpoint_fd < 0) || (fstat(data->work_fd, &buf) < 0)) return;
+
+	/*
+	 *	Fixed width, so we never have to truncate the file.
+	 */
+	len = snprintf(buffer, sizeof(buffer), "%" PRIu64 " %020" PRIu64 "\n",
+		       (uint64_t) buf.st_ino, (uint64_t) checkpoint);
+	if (pwrite(data->checkpoint_fd, buffer, len, 0) < 0) {
+		WARN("detail (%s): Failed writing checkpoint file %s: %s",
+		     data->name, data->filename_checkpoint, fr_syserror(errno));
+	}
+}
+
+/*
+ *	The file has been closed, so forget where in-flight records
+ *	came from.  They're still retransmitted until they're done.
+ */
+static void detail_checkpoint_close(listen_detail_t *data)
+{
+	uint32_t i;
+
+	for (i = 0; i < data->max_outstanding; i++) {
+		data->entries[i].record_offset = -1;
+		data->entries[i].timestamp_offset = -1;
+	}
+
+	if (data->checkpoint_fd >= 0) {
+		close(data->checkpoint_fd);
+		data->checkpoint_fd = -1;
+	}
+	unlink(data->filename_checkpoint);
+	data->checkpoint = 0;
+}
+
 /*
  *	FIXME: add a configuration "exit when done" so that the detail
  *	file reader can be used as a one-off tool to update stuff.
@@ -316,6 +643,7 @@ int detail_recv(rad_listen_t *listener)
 	RADIUS_PACKET *packet;
 	listen_detail_t *data = listener->data;
 	RAD_REQUEST_FUNP fun = NULL;
+	bool replied;
 
 	/*
 	 *	Block until there's a packet ready.
@@ -347,14 +675,21 @@ int detail_recv(rad_listen_t *listener)
 		break;
 
 	default:
-		data->entry_state = STATE_REPLIED;
+		replied = true;
 		goto signal_thread;
 	}
 
 	if (!request_receive(NULL, listener, packet, &data->detail_client, fun)) {
-		data->entry_state = STATE_NO_REPLY;	/* try again later */
+		replied = false;	/* try again later */
 
 	signal_thread:
+		if (data->max_outstanding > 1) {
+			detail_ack(data, packet, replied);
+			fr_radius_free(&packet);
+			return 0;
+		}
+
+		data->entry_state = replied ? STATE_REPLIED : STATE_NO_REPLY;
 		fr_radius_free(&packet);
 		if (write(data->child_pipe[1], &c, 1) < 0) {
 			ERROR("detail (%s): Failed writing ack to reader thread: %s", data->name,
@@ -368,6 +703,129 @@ int detail_recv(rad_listen_t *listener)
 	return 0;
 }
 
+/*
+ *	Create a packet from the record we've read.
+ */
+static RADIUS_PACKET *detail_packet_build(listen_detail_t *data)
+{
+	VALUE_PAIR	*vp;
+	RADIUS_PACKET	*packet;
+
+	/*
+	 *	Allocate the packet.  If we fail, it's a serious
+	 *	problem.
+	 */
+	packet = fr_radius_alloc(NULL, true);
+	if (!packet) {
+		ERROR("detail (%s): FATAL: Failed allocating memory for detail", data->name);
+		fr_exit(1);
+	}
+
+	memset(packet, 0, sizeof(*packet));
+	packet->sockfd = -1;
+	packet->src_ipaddr.af = AF_INET;
+	packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(INADDR_NONE);
+
+	/*
+	 *	If everything's OK, this is a waste of memory.
+	 *	Otherwise, it lets us re-send the original packet
+	 *	contents, unmolested.
+	 */
+	packet->vps = fr_pair_list_copy(packet, data->vps);
+
+	packet->code = data->binary ? data->code : PW_CODE_ACCOUNTING_REQUEST;
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TYPE, TAG_ANY);
+	if (vp) packet->code = vp->vp_integer;
+
+	gettimeofday(&packet->timestamp, NULL);
+
+	/*
+	 *	Remember where it came from, so that we don't
+	 *	proxy it to the place it came from...
+	 */
+	if (data->client_ip.af != AF_UNSPEC) {
+		packet->src_ipaddr = data->client_ip;
+	}
+
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IP_ADDRESS, TAG_ANY);
+	if (vp) {
+		packet->src_ipaddr.af = AF_INET;
+		packet->src_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		packet->src_ipaddr.prefix = 32;
+	} else {
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IPV6_ADDRESS, TAG_ANY);
+		if (vp) {
+			packet->src_ipaddr.af = AF_INET6;
+			memcpy(&packet->src_ipaddr.ipaddr.ip6addr,
+			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+			packet->src_ipaddr.prefix = 128;
+		}
+	}
+
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IP_ADDRESS, TAG_ANY);
+	if (vp) {
+		packet->dst_ipaddr.af = AF_INET;
+		packet->dst_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		packet->dst_ipaddr.prefix = 32;
+	} else {
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IPV6_ADDRESS, TAG_ANY);
+		if (vp) {
+			packet->dst_ipaddr.af = AF_INET6;
+			memcpy(&packet->dst_ipaddr.ipaddr.ip6addr,
+			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+			packet->dst_ipaddr.prefix = 128;
+		}
+	}
+
+	/*
+	 *	Generate packet ID, ports, IP via a counter.
+	 */
+	detail_packet_seq_set(packet, data->counter);
+
+	/*
+	 *	Create / update accounting attributes.
+	 */
+	if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
+		/*
+		 *	Prefer the Event-Timestamp in the packet, if it
+		 *	exists.  That is when the event occurred, whereas the
+		 *	"Timestamp" field is when we wrote the packet to the
+		 *	detail file, which could have been much later.
+		 */
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_EVENT_TIMESTAMP, TAG_ANY);
+		if (vp) {
+			data->timestamp = vp->vp_integer;
+		}
+
+		/*
+		 *	Look for Acct-Delay-Time, and update
+		 *	based on Acct-Delay-Time += (time(NULL) - timestamp)
+		 */
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_ACCT_DELAY_TIME, TAG_ANY);
+		if (!vp) {
+			vp = fr_pair_afrom_num(packet, 0, PW_ACCT_DELAY_TIME);
+			rad_assert(vp != NULL);
+			fr_pair_add(&packet->vps, vp);
+		}
+		if (data->timestamp != 0) {
+			vp->vp_integer += time(NULL) - data->timestamp;
+		}
+	}
+
+	/*
+	 *	Set the transmission count.
+	 */
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TRANSMIT_COUNTER, TAG_ANY);
+	if (!vp) {
+		vp = fr_pair_afrom_num(packet, 0, PW_PACKET_TRANSMIT_COUNTER);
+		rad_assert(vp != NULL);
+		fr_pair_add(&packet->vps, vp);
+	}
+	vp->vp_integer = data->tries;
+
+	return packet;
+}
+
 static RADIUS_PACKET *detail_poll(rad_listen_t *listener)
 {
 	char		key[256], op[8], value[1024];
@@ -431,6 +889,35 @@ open_file:
 			fr_exit(1);
 		}
 
+		data->binary = false;
+		if (detail_map(data) < 0) {
+			fclose(data->fp);
+			data->fp = NULL;
+			data->work_fd = -1;
+			data->file_state = STATE_UNOPENED;
+			return NULL;
+		}
+
+		/*
+		 *	Skip the records which were done before the
+		 *	server was restarted.
+		 */
+		if (data->max_outstanding > 1) {
+			off_t offset;
+
+			offset = detail_checkpoint_open(data);
+			if ((offset > 0) && !data->binary && (fseek(data->fp, offset, SEEK_SET) < 0)) {
+				WARN("detail (%s): Failed seeking to checkpoint: %s", data->name, fr_syserror(errno));
+				rewind(data->fp);
+				offset = data->checkpoint = 0;
+			}
+			if (offset > 0) {
+				DEBUG("detail (%s): Resuming %s from checkpoint at offset %" PRIu64,
+				      data->name, data->filename_work, (uint64_t) offset);
+			}
+			data->offset = offset;
+		}
+
 		/*
 		 *	Look for the header
 		 */
@@ -460,6 +947,20 @@ open_file:
 			goto open_file;
 		}
 
+		/*
+		 *	Binary records are read directly from the
+		 *	mapping.  When we reach the end of it, check
+		 *	whether a writer appended more records before
+		 *	the file was renamed.
+		 */
+		if (data->binary) {
+			if ((size_t) data->offset < data->map_len) break;
+
+			if (detail_map(data) < 0) goto cleanup;
+			if ((size_t) data->offset == data->map_len) goto eof;
+			break;
+		}
+
 		{
 			struct stat buf;
 
@@ -470,7 +971,7 @@ open_file:
 				goto cleanup;
 			}
 			if (((off_t) ftell(data->fp)) == buf.st_size) {
-				goto cleanup;
+				goto eof;
 			}
 		}
 
@@ -479,9 +980,19 @@ open_file:
 		 *	everything.
 		 */
 		if (feof(data->fp)) {
+		eof:
+			/*
+			 *	Don't delete the file until every
+			 *	record we've read from it is done.
+			 */
+			if (data->outstanding > 0) return NULL;
+
 		cleanup:
+			if (data->entries) detail_checkpoint_close(data);
+
 			DEBUG("detail (%s): Unlinking %s", data->name, data->filename_work);
 			unlink(data->filename_work);
+			detail_unmap(data);
 			if (data->fp) fclose(data->fp);
 			data->fp = NULL;
 			data->work_fd = -1;
@@ -542,31 +1053,18 @@ open_file:
 	 *	request, and go read another one.
 	 */
 	case STATE_REPLIED:
-		if (data->track) {
-			rad_assert(data->fp != NULL);
-
-			if (fseek(data->fp, data->timestamp_offset, SEEK_SET) < 0) {
-				WARN("detail (%s): Failed seeking to timestamp offset: %s",
-				     data->name, fr_syserror(errno));
-			} else if (fwrite("\tDone", 1, 5, data->fp) < 5) {
-				WARN("detail (%s): Failed marking request as done: %s",
-				     data->name, fr_syserror(errno));
-			} else if (fflush(data->fp) != 0) {
-				WARN("detail (%s): Failed flushing marked detail file to disk: %s",
-				     data->name, fr_syserror(errno));
-			}
-
-			if (fseek(data->fp, data->offset, SEEK_SET) < 0) {
-				WARN("detail (%s): Failed seeking to next detail request: %s",
-				     data->name, fr_syserror(errno));
-			}
-		}
+		if (data->track) detail_mark_done(data, data->timestamp_offset);
 
 		fr_pair_list_free(&data->vps);
 		data->entry_state = STATE_HEADER;
 		goto do_header;
 	}
 
+	if (data->binary) {
+		if (detail_read_binary(data) < 0) goto cleanup;
+		goto read_done;
+	}
+
 	fr_cursor_init(&cursor, &data->vps);
 
 	/*
@@ -606,6 +1104,7 @@ open_file:
 
 			if (sscanf(buffer, "%*s %*s %*d %*d:%*d:%*d %d", &y)) {
 				data->entry_state = STATE_VPS;
+				data->record_offset = data->last_offset;
 			}
 			continue;
 		}
@@ -694,6 +1193,7 @@ open_file:
 	 */
 	if (ferror(data->fp)) goto cleanup;
 
+read_done:
 	data->tries = 0;
 	data->packets++;
 
@@ -729,126 +1229,11 @@ open_file:
 	 */
 	if (!data->vps) {
 		data->entry_state = STATE_HEADER;
-		if (!data->fp || feof(data->fp)) goto cleanup;
+		if (!data->fp || feof(data->fp)) goto eof;
 		return NULL;
 	}
 
-	/*
-	 *	Allocate the packet.  If we fail, it's a serious
-	 *	problem.
-	 */
-	packet = fr_radius_alloc(NULL, true);
-	if (!packet) {
-		ERROR("detail (%s): FATAL: Failed allocating memory for detail", data->name);
-		fr_exit(1);
-	}
-
-	memset(packet, 0, sizeof(*packet));
-	packet->sockfd = -1;
-	packet->src_ipaddr.af = AF_INET;
-	packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(INADDR_NONE);
-
-	/*
-	 *	If everything's OK, this is a waste of memory.
-	 *	Otherwise, it lets us re-send the original packet
-	 *	contents, unmolested.
-	 */
-	packet->vps = fr_pair_list_copy(packet, data->vps);
-
-	packet->code = PW_CODE_ACCOUNTING_REQUEST;
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TYPE, TAG_ANY);
-	if (vp) packet->code = vp->vp_integer;
-
-	gettimeofday(&packet->timestamp, NULL);
-
-	/*
-	 *	Remember where it came from, so that we don't
-	 *	proxy it to the place it came from...
-	 */
-	if (data->client_ip.af != AF_UNSPEC) {
-		packet->src_ipaddr = data->client_ip;
-	}
-
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IP_ADDRESS, TAG_ANY);
-	if (vp) {
-		packet->src_ipaddr.af = AF_INET;
-		packet->src_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
-		packet->src_ipaddr.prefix = 32;
-	} else {
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IPV6_ADDRESS, TAG_ANY);
-		if (vp) {
-			packet->src_ipaddr.af = AF_INET6;
-			memcpy(&packet->src_ipaddr.ipaddr.ip6addr,
-			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
-			packet->src_ipaddr.prefix = 128;
-		}
-	}
-
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IP_ADDRESS, TAG_ANY);
-	if (vp) {
-		packet->dst_ipaddr.af = AF_INET;
-		packet->dst_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
-		packet->dst_ipaddr.prefix = 32;
-	} else {
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IPV6_ADDRESS, TAG_ANY);
-		if (vp) {
-			packet->dst_ipaddr.af = AF_INET6;
-			memcpy(&packet->dst_ipaddr.ipaddr.ip6addr,
-			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
-			packet->dst_ipaddr.prefix = 128;
-		}
-	}
-
-	/*
-	 *	Generate packet ID, ports, IP via a counter.
-	 */
-	packet->id = data->counter & 0xff;
-	packet->src_port = 1024 + ((data->counter >> 8) & 0xff);
-	packet->dst_port = 1024 + ((data->counter >> 16) & 0xff);
-
-	packet->dst_ipaddr.af = AF_INET;
-	packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl((INADDR_LOOPBACK & ~0xffffff) | ((data->counter >> 24) & 0xff));
-
-	/*
-	 *	Create / update accounting attributes.
-	 */
-	if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
-		/*
-		 *	Prefer the Event-Timestamp in the packet, if it
-		 *	exists.  That is when the event occurred, whereas the
-		 *	"Timestamp" field is when we wrote the packet to the
-		 *	detail file, which could have been much later.
-		 */
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_EVENT_TIMESTAMP, TAG_ANY);
-		if (vp) {
-			data->timestamp = vp->vp_integer;
-		}
-
-		/*
-		 *	Look for Acct-Delay-Time, and update
-		 *	based on Acct-Delay-Time += (time(NULL) - timestamp)
-		 */
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_ACCT_DELAY_TIME, TAG_ANY);
-		if (!vp) {
-			vp = fr_pair_afrom_num(packet, 0, PW_ACCT_DELAY_TIME);
-			rad_assert(vp != NULL);
-			fr_pair_add(&packet->vps, vp);
-		}
-		if (data->timestamp != 0) {
-			vp->vp_integer += time(NULL) - data->timestamp;
-		}
-	}
-
-	/*
-	 *	Set the transmission count.
-	 */
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TRANSMIT_COUNTER, TAG_ANY);
-	if (!vp) {
-		vp = fr_pair_afrom_num(packet, 0, PW_PACKET_TRANSMIT_COUNTER);
-		rad_assert(vp != NULL);
-		fr_pair_add(&packet->vps, vp);
-	}
-	vp->vp_integer = data->tries;
+	packet = detail_packet_build(data);
 
 	data->entry_state = STATE_RUNNING;
 	data->running = packet->timestamp.tv_sec;
@@ -896,6 +1281,13 @@ static int _detail_free(listen_detail_t *data)
 		if (arg) pthread_join(data->pthread_id, &arg);
 	}
 
+	detail_unmap(data);
+
+	if (data->checkpoint_fd >= 0) {
+		close(data->checkpoint_fd);
+		data->checkpoint_fd = -1;
+	}
+
 	if (data->fp != NULL) {
 		fclose(data->fp);
 		data->fp = NULL;
@@ -1010,6 +1402,195 @@ static void *detail_handler_thread(void *arg)
 }
 
 
+/*
+ *	(Re-)send a record which is already being processed.
+ */
+static void detail_entry_send(listen_detail_t *data, detail_entry_t *entry)
+{
+	RADIUS_PACKET *packet;
+
+	data->vps = entry->vps;
+	data->client_ip = entry->client_ip;
+	data->timestamp = entry->timestamp;
+	data->code = entry->code;
+	data->tries = ++entry->tries;
+
+	packet = detail_packet_build(data);
+	data->vps = NULL;
+
+	entry->seq = data->counter++;
+	entry->running = true;
+	entry->retry = packet->timestamp.tv_sec + data->retry_interval;
+
+	if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+		ERROR("detail (%s): Failed passing detail packet pointer to master: %s",
+		      data->name, fr_syserror(errno));
+		fr_radius_free(&packet);
+		entry->running = false;
+	}
+}
+
+/*
+ *	Handle an ack from detail_send() or detail_recv().
+ */
+static void detail_entry_ack(listen_detail_t *data, detail_ack_t const *ack)
+{
+	uint32_t	i;
+	detail_entry_t	*entry = NULL;
+
+	for (i = 0; i < data->max_outstanding; i++) {
+		if (data->entries[i].in_use && data->entries[i].running &&
+		    (data->entries[i].seq == ack->seq)) {
+			entry = &data->entries[i];
+			break;
+		}
+	}
+
+	/*
+	 *	The ack for a packet we've since retransmitted.
+	 */
+	if (!entry) return;
+
+	entry->running = false;
+
+	if (!ack->replied) {
+		entry->retry = time(NULL) + data->retry_interval;
+		return;
+	}
+
+	if (data->track) detail_mark_done(data, entry->timestamp_offset);
+
+	fr_pair_list_free(&entry->vps);
+	entry->in_use = false;
+	data->outstanding--;
+
+	detail_checkpoint_update(data);
+}
+
+/*
+ *	Keep up to max_outstanding records in flight at once.  Each
+ *	one is tracked by its offset in the file, and the checkpoint
+ *	only moves past records which are done.  So if the server is
+ *	restarted, at most max_outstanding records are processed
+ *	twice.
+ *
+ *	The load factor isn't used.  max_outstanding limits the load
+ *	instead.
+ */
+static void *detail_pipeline_thread(void *arg)
+{
+	rad_listen_t	*this = arg;
+	listen_detail_t	*data = this->data;
+
+	while (data->child_pipe[0] >= 0) {
+		RADIUS_PACKET	*packet;
+		detail_entry_t	*entry;
+		detail_ack_t	ack;
+		fd_set		fds;
+		struct timeval	wake;
+		time_t		now;
+		uint32_t	i;
+		int		fd;
+
+		/*
+		 *	Retry the records which failed, or which
+		 *	took too long.
+		 */
+		now = time(NULL);
+		for (i = 0; i < data->max_outstanding; i++) {
+			entry = &data->entries[i];
+
+			if (!entry->in_use || (entry->retry > now)) continue;
+
+			if (entry->running) {
+				DEBUG("detail (%s): No response to detail request.  Retrying", data->name);
+			}
+			detail_entry_send(data, entry);
+		}
+
+		/*
+		 *	Read as many new records as we're allowed to
+		 *	have in flight.
+		 */
+		while (data->outstanding < data->max_outstanding) {
+			packet = detail_poll(this);
+			if (!packet) break;
+
+			for (i = 0; i < data->max_outstanding; i++) {
+				if (!data->entries[i].in_use) break;
+			}
+			rad_assert(i < data->max_outstanding);
+			entry = &data->entries[i];
+
+			memset(entry, 0, sizeof(*entry));
+			entry->in_use = true;
+			entry->running = true;
+			entry->seq = data->counter++;
+			entry->record_offset = data->record_offset;
+			entry->timestamp_offset = data->timestamp_offset;
+			entry->retry = packet->timestamp.tv_sec + data->retry_interval;
+			entry->tries = data->tries;
+			entry->client_ip = data->client_ip;
+			entry->timestamp = data->timestamp;
+			entry->code = data->code;
+
+			/*
+			 *	The entry owns the record now, and
+			 *	detail_poll() can read the next one.
+			 */
+			entry->vps = data->vps;
+			(void) talloc_steal(data->entries, entry->vps);
+			data->vps = NULL;
+			data->entry_state = STATE_HEADER;
+			data->outstanding++;
+
+			if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+				ERROR("detail (%s): Failed passing detail packet pointer to master: %s",
+				      data->name, fr_syserror(errno));
+				fr_radius_free(&packet);
+				entry->running = false;
+			}
+		}
+
+		if (data->outstanding == 0) {
+			usleep(detail_delay(data));
+			continue;
+		}
+
+		/*
+		 *	Wait for an ack.  Wake up every second to
+		 *	check for retries, and whether we're exiting.
+		 */
+		fd = data->child_pipe[0];
+		if (fd < 0) break;
+
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		wake.tv_sec = 1;
+		wake.tv_usec = 0;
+
+		if (select(fd + 1, &fds, NULL, NULL, &wake) <= 0) continue;
+
+		if (read(fd, &ack, sizeof(ack)) != sizeof(ack)) continue;
+
+		detail_entry_ack(data, &ack);
+	}
+
+	/*
+	 *	Tell the master thread we've exited.
+	 */
+	{
+		RADIUS_PACKET *packet = NULL;
+
+		if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+			ERROR("detail (%s): Failed writing exit status to master: %s",
+			      data->name, fr_syserror(errno));
+		}
+	}
+
+	return NULL;
+}
+
 static const CONF_PARSER detail_config[] = {
 	{ FR_CONF_OFFSET("detail", PW_TYPE_FILE_OUTPUT | PW_TYPE_DEPRECATED, listen_detail_t, filename) },
 	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_OUTPUT | PW_TYPE_REQUIRED, listen_detail_t, filename) },
@@ -1018,6 +1599,7 @@ static const CONF_PARSER detail_config[] = {
 	{ FR_CONF_OFFSET("retry_interval", PW_TYPE_INTEGER, listen_detail_t, retry_interval), .dflt = STRINGIFY(30) },
 	{ FR_CONF_OFFSET("one_shot", PW_TYPE_BOOLEAN, listen_detail_t, one_shot), .dflt = "no" },
 	{ FR_CONF_OFFSET("track", PW_TYPE_BOOLEAN, listen_detail_t, track), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_outstanding", PW_TYPE_INTEGER, listen_detail_t, max_outstanding), .dflt = STRINGIFY(1) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -1061,6 +1643,9 @@ int detail_parse(CONF_SECTION *cs, rad_listen_t *this)
 	FR_INTEGER_BOUND_CHECK("retry_interval", data->retry_interval, >=, 4);
 	FR_INTEGER_BOUND_CHECK("retry_interval", data->retry_interval, <=, 3600);
 
+	FR_INTEGER_BOUND_CHECK("max_outstanding", data->max_outstanding, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_outstanding", data->max_outstanding, <=, 1024);
+
 	/*
 	 *	Only checking the config.  Don't start threads or anything else.
 	 */
@@ -1104,9 +1689,17 @@ int detail_parse(CONF_SECTION *cs, rad_listen_t *this)
 
 	data->filename_work = talloc_strdup(data, buffer);
 
+	data->checkpoint_fd = -1;
+	if (data->max_outstanding > 1) {
+		data->filename_checkpoint = talloc_asprintf(data, "%s.checkpoint", data->filename_work);
+		data->entries = talloc_zero_array(data, detail_entry_t, data->max_outstanding);
+	}
+
 	data->work_fd = -1;
 	data->vps = NULL;
 	data->fp = NULL;
+	data->map = NULL;
+	data->map_len = 0;
 	data->file_state = STATE_UNOPENED;
 	data->entry_state = STATE_HEADER;
 	data->delay_time = data->poll_interval * USEC;
@@ -1150,7 +1743,8 @@ int detail_socket_open(UNUSED CONF_SECTION *cs, rad_listen_t *this)
 		fr_exit(1);
 	}
 
-	pthread_create(&data->pthread_id, NULL, detail_handler_thread, this);
+	pthread_create(&data->pthread_id, NULL,
+		       (data->max_outstanding > 1) ? detail_pipeline_thread : detail_handler_thread, this);
 
 	this->fd = data->master_pipe[0];
 
@@ -28,16 +28,50 @@
 #include <freeradius-devel/exfile.h>
 
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 typedef struct exfile_entry_t {
 	int			fd;			//!< File descriptor associated with an entry.
 	int			dup;
 	uint32_t		hash;			//!< Hash for cheap comparison.
 	time_t			last_used;		//!< Last time the entry was used.
 	char			*filename;		//!< Filename.
+	bool			dirty;			//!< Written to by the writer thread since the last fsync.
 } exfile_entry_t;
 
+/** A formatted record, waiting for the writer thread
+ *
+ * The record, its data and the filename are a single allocation.
+ */
+typedef struct exfile_record_t {
+	char const		*filename;		//!< File to append the record to.
+	uint32_t		hash;			//!< Hash of the filename.
+	mode_t			permissions;		//!< To use if the file has to be created.
+	uint8_t const		*data;			//!< The record.
+	size_t			len;			//!< Length of the record.
+} exfile_record_t;
+
+/** A slot in the record ring
+ *
+ * seq is the position in the ring the slot is next valid for.  Producers
+ * claim a slot by advancing the ring head, then publish the record by
+ * advancing seq, so no lock is needed between workers and the writer.
+ */
+typedef struct exfile_slot_t {
+	atomic_uint_fast64_t	seq;
+	exfile_record_t		*record;
+} exfile_slot_t;
+
+#define EXFILE_BATCH_MAX	1024		//!< Most records written per batch.  Also
+						//!< the smallest common IOV_MAX.
+
 
 struct exfile_t {
 	uint32_t		max_entries;		//!< How many file descriptors we keep track of.
@@ -49,6 +83,44 @@ struct exfile_t {
 	CONF_SECTION		*conf;			//!< Conf section to search for triggers.
 	char const		*trigger_prefix;	//!< Trigger path in the global trigger section.
 	VALUE_PAIR		*trigger_args;		//!< Arguments to pass to trigger.
+
+	struct {
+		bool			enabled;		//!< Records are written by the writer thread.
+		exfile_fsync_t		fsync;			//!< When to fsync files after writing.
+		uint32_t		fsync_interval;		//!< For EXFILE_FSYNC_INTERVAL.
+		time_t			last_synced;		//!< Last time dirty files were synced.
+
+		exfile_slot_t		*ring;			//!< Records waiting to be written.
+		uint64_t		mask;			//!< Size of the ring - 1.
+		atomic_uint_fast64_t	head;			//!< Next position a worker will claim.
+		atomic_uint_fast64_t	tail;			//!< Next position the writer will drain.
+
+		pthread_t		thread;			//!< The writer thread.
+		pthread_mutex_t		mutex;			//!< Only used to put the writer to sleep.
+		pthread_cond_t		cond;			//!< Signalled when a record is queued.
+		atomic_bool		sleeping;		//!< The writer is waiting on cond.
+		atomic_bool		stop;			//!< Drain the ring and exit.
+
+		exfile_record_t		**batch;		//!< Records being written.
+		struct iovec		*vector;		//!< Scratch space for writev().
+
+		atomic_uint_fast64_t	queued;			//!< Records queued by workers.
+		atomic_uint_fast64_t	written;		//!< Records written by the writer.
+		atomic_uint_fast64_t	failed;			//!< Records which couldn't be written.
+		atomic_uint_fast64_t	flushes;		//!< Calls to writev().
+		atomic_uint_fast64_t	bytes;			//!< Bytes written.
+		atomic_uint_fast64_t	fsyncs;			//!< Calls to fsync().
+		atomic_uint_fast64_t	stalls;			//!< Times a worker found the ring full.
+		atomic_uint_fast32_t	depth_max;		//!< Deepest the ring has been.
+	} async;
+};
+
+FR_NAME_NUMBER const exfile_fsync_table[] = {
+	{ "none",	EXFILE_FSYNC_NONE },
+	{ "always",	EXFILE_FSYNC_ALWAYS },
+	{ "interval",	EXFILE_FSYNC_INTERVAL },
+
+	{ NULL,		-1 }
 };
 
 #define MAX_TRY_LOCK 4			//!< How many times we attempt to acquire a lock
@@ -98,6 +170,14 @@ static void exfile_cleanup_entry(exfile_t *ef, REQUEST *request, exfile_entry_t
 {
 	TALLOC_FREE(entry->filename);
 
+	/*
+	 *	Don't let an idle file escape the fsync policy.
+	 */
+	if (entry->dirty) {
+		(void) fsync(entry->fd);
+		entry->dirty = false;
+	}
+
 	close(entry->fd);
 
 	entry->hash = 0;
@@ -115,6 +195,22 @@ static int _exfile_free(exfile_t *ef)
 {
 	uint32_t i;
 
+	/*
+	 *	The writer drains the ring before exiting, so
+	 *	nothing which was queued is lost.
+	 */
+	if (ef->async.enabled) {
+		pthread_mutex_lock(&ef->async.mutex);
+		atomic_store(&ef->async.stop, true);
+		pthread_cond_signal(&ef->async.cond);
+		pthread_mutex_unlock(&ef->async.mutex);
+
+		pthread_join(ef->async.thread, NULL);
+
+		pthread_cond_destroy(&ef->async.cond);
+		pthread_mutex_destroy(&ef->async.mutex);
+	}
+
 	pthread_mutex_lock(&ef->mutex);
 
 	for (i = 0; i < ef->max_entries; i++) {
@@ -500,3 +596,452 @@ int exfile_unlock(exfile_t *ef, REQUEST *request, int fd)
 	fr_strerror_printf("Attempt to unlock file which does not exist");
 	return -1;
 }
+
+/** Queue a record for the writer thread
+ *
+ * @param[in] ef	to queue the record for.
+ * @param[in] record	to queue.
+ * @return
+ *	- true if the record was queued.
+ *	- false if the ring is full.
+ */
+static bool exfile_async_push(exfile_t *ef, exfile_record_t *record)
+{
+	uint_fast64_t	pos;
+	exfile_slot_t	*slot;
+
+	pos = atomic_load_explicit(&ef->async.head, memory_order_relaxed);
+	for (;;) {
+		uint_fast64_t	seq;
+
+		slot = &ef->async.ring[pos & ef->async.mask];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+
+		/*
+		 *	The slot is free, try to claim it.  On failure
+		 *	pos is updated with the current head.
+		 */
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&ef->async.head, &pos, pos + 1,
+								  memory_order_seq_cst, memory_order_relaxed)) break;
+			continue;
+		}
+
+		/*
+		 *	The writer hasn't drained the slot yet.
+		 */
+		if (seq < pos) return false;
+
+		/*
+		 *	Another worker claimed the slot.
+		 */
+		pos = atomic_load_explicit(&ef->async.head, memory_order_relaxed);
+	}
+
+	slot->record = record;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+	return true;
+}
+
+/** Wake the writer thread, if it's waiting for records
+ *
+ * The mutex is only taken when the writer is asleep, so workers don't
+ * contend with each other when the server is busy.
+ */
+static void exfile_async_wake(exfile_t *ef)
+{
+	if (!atomic_exchange_explicit(&ef->async.sleeping, false, memory_order_seq_cst)) return;
+
+	pthread_mutex_lock(&ef->async.mutex);
+	pthread_cond_signal(&ef->async.cond);
+	pthread_mutex_unlock(&ef->async.mutex);
+}
+
+/** Take up to max records off the ring
+ *
+ * Only called from the writer thread, so the tail needs no protection.
+ */
+static int exfile_async_drain(exfile_t *ef, exfile_record_t **out, int max)
+{
+	uint_fast64_t	head, tail;
+	int		i;
+
+	head = atomic_load_explicit(&ef->async.head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ef->async.tail, memory_order_relaxed);
+	if ((head - tail) > atomic_load_explicit(&ef->async.depth_max, memory_order_relaxed)) {
+		atomic_store_explicit(&ef->async.depth_max, head - tail, memory_order_relaxed);
+	}
+
+	for (i = 0; i < max; i++) {
+		exfile_slot_t *slot = &ef->async.ring[tail & ef->async.mask];
+
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) != (tail + 1)) break;
+
+		out[i] = slot->record;
+		slot->record = NULL;
+		atomic_store_explicit(&slot->seq, tail + ef->async.mask + 1, memory_order_release);
+		tail++;
+	}
+
+	atomic_store_explicit(&ef->async.tail, tail, memory_order_relaxed);
+
+	return i;
+}
+
+/** Sync all the files the writer has written to since the last sync
+ *
+ */
+static void exfile_async_sync(exfile_t *ef)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&ef->mutex);
+	for (i = 0; i < ef->max_entries; i++) {
+		if (!ef->entries[i].filename || !ef->entries[i].dirty) continue;
+
+		if (fsync(ef->entries[i].fd) < 0) {
+			ERROR("Failed syncing %s: %s", ef->entries[i].filename, fr_syserror(errno));
+		}
+		ef->entries[i].dirty = false;
+		atomic_fetch_add_explicit(&ef->async.fsyncs, 1, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&ef->mutex);
+}
+
+/** Write a batch of records
+ *
+ * Records for the same file are written with one call to writev(), in
+ * the order they were queued.
+ */
+static void exfile_async_flush(exfile_t *ef, exfile_record_t **batch, int num)
+{
+	struct iovec	*vector = ef->async.vector;
+	int		i, j, cnt, fd;
+	ssize_t		len;
+
+	for (i = 0; i < num; i++) {
+		exfile_record_t *record = batch[i];
+
+		if (!record) continue;
+
+		cnt = 0;
+		for (j = i; j < num; j++) {
+			if (!batch[j] || (batch[j]->hash != record->hash) ||
+			    (strcmp(batch[j]->filename, record->filename) != 0)) continue;
+
+			/* iov_base is not declared as const *sigh* */
+			memcpy(&vector[cnt].iov_base, &batch[j]->data, sizeof(vector[cnt].iov_base));
+			vector[cnt].iov_len = batch[j]->len;
+			cnt++;
+		}
+
+		fd = exfile_open(ef, NULL, record->filename, record->permissions, true);
+		if (fd < 0) {
+			ERROR("Failed opening %s, discarding %i record(s): %s", record->filename, cnt, fr_strerror());
+			atomic_fetch_add_explicit(&ef->async.failed, cnt, memory_order_relaxed);
+			goto next;
+		}
+
+		len = fr_writev(fd, vector, cnt, NULL);
+		if (len < 0) {
+			ERROR("Failed writing %i record(s) to %s: %s", cnt, record->filename, fr_syserror(errno));
+			atomic_fetch_add_explicit(&ef->async.failed, cnt, memory_order_relaxed);
+		} else {
+			atomic_fetch_add_explicit(&ef->async.written, cnt, memory_order_relaxed);
+			atomic_fetch_add_explicit(&ef->async.bytes, len, memory_order_relaxed);
+		}
+		atomic_fetch_add_explicit(&ef->async.flushes, 1, memory_order_relaxed);
+
+		switch (ef->async.fsync) {
+		case EXFILE_FSYNC_NONE:
+			break;
+
+		case EXFILE_FSYNC_ALWAYS:
+			if (fsync(fd) < 0) ERROR("Failed syncing %s: %s", record->filename, fr_syserror(errno));
+			atomic_fetch_add_explicit(&ef->async.fsyncs, 1, memory_order_relaxed);
+			break;
+
+		case EXFILE_FSYNC_INTERVAL:
+			/*
+			 *	We still hold the mutex, so the entry
+			 *	can't go away.
+			 */
+			for (j = 0; j < (int) ef->max_entries; j++) {
+				if (ef->entries[j].dup != fd) continue;
+
+				ef->entries[j].dirty = true;
+				break;
+			}
+			break;
+		}
+
+		exfile_close(ef, NULL, fd);
+
+	next:
+		/*
+		 *	Free the records we wrote, including this one.
+		 */
+		for (j = i + 1; j < num; j++) {
+			if (!batch[j] || (batch[j]->hash != record->hash) ||
+			    (strcmp(batch[j]->filename, record->filename) != 0)) continue;
+
+			TALLOC_FREE(batch[j]);
+		}
+		TALLOC_FREE(batch[i]);
+	}
+}
+
+/** Write queued records until told to stop
+ *
+ */
+static void *exfile_async_writer(void *arg)
+{
+	exfile_t	*ef = arg;
+	struct timespec	when;
+
+	for (;;) {
+		int	num;
+		bool	stop;
+		time_t	now;
+
+		/*
+		 *	Check before draining, so that everything
+		 *	queued before we were told to stop is written.
+		 */
+		stop = atomic_load(&ef->async.stop);
+
+		num = exfile_async_drain(ef, ef->async.batch, EXFILE_BATCH_MAX);
+		if (num > 0) exfile_async_flush(ef, ef->async.batch, num);
+
+		if (ef->async.fsync == EXFILE_FSYNC_INTERVAL) {
+			now = time(NULL);
+			if (now >= (ef->async.last_synced + (time_t) ef->async.fsync_interval)) {
+				exfile_async_sync(ef);
+				ef->async.last_synced = now;
+			}
+		}
+
+		if (num > 0) continue;
+		if (stop) break;
+
+		/*
+		 *	Nothing to do.  Re-check the ring after telling
+		 *	workers we're asleep, or we could miss a record
+		 *	queued in between.
+		 */
+		pthread_mutex_lock(&ef->async.mutex);
+		atomic_store(&ef->async.sleeping, true);
+		if ((atomic_load(&ef->async.head) == atomic_load(&ef->async.tail)) && !atomic_load(&ef->async.stop)) {
+			clock_gettime(CLOCK_REALTIME, &when);
+			when.tv_sec += 1;
+
+			pthread_cond_timedwait(&ef->async.cond, &ef->async.mutex, &when);
+		}
+		atomic_store(&ef->async.sleeping, false);
+		pthread_mutex_unlock(&ef->async.mutex);
+	}
+
+	return NULL;
+}
+
+/** Write records from a dedicated thread
+ *
+ * Once enabled, exfile_write() copies each record into a ring and returns
+ * without touching the file.  A writer thread takes everything which has
+ * been queued, and appends the records for each file with a single call
+ * to writev(), so the cost of locking and seeking (and optionally syncing)
+ * the file is shared by every record in the batch.
+ *
+ * @param[in] ef		to enable asynchronous writes for.
+ * @param[in] queue_size	Maximum number of records waiting to be written.
+ *				Rounded up to a power of 2.
+ * @param[in] fsync		When to fsync() files after writing to them.
+ * @param[in] fsync_interval	How often to sync files, for EXFILE_FSYNC_INTERVAL.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int exfile_enable_async(exfile_t *ef, uint32_t queue_size, exfile_fsync_t fsync, uint32_t fsync_interval)
+{
+	uint64_t	size = 1, i;
+	int		rcode;
+
+	if (ef->async.enabled) return 0;
+
+	while (size < queue_size) size <<= 1;
+
+	ef->async.ring = talloc_zero_array(ef, exfile_slot_t, size);
+	ef->async.batch = talloc_zero_array(ef, exfile_record_t *, EXFILE_BATCH_MAX);
+	ef->async.vector = talloc_zero_array(ef, struct iovec, EXFILE_BATCH_MAX);
+	if (!ef->async.ring || !ef->async.batch || !ef->async.vector) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	for (i = 0; i < size; i++) atomic_init(&ef->async.ring[i].seq, i);
+	ef->async.mask = size - 1;
+
+	atomic_init(&ef->async.head, 0);
+	atomic_init(&ef->async.tail, 0);
+	atomic_init(&ef->async.sleeping, false);
+	atomic_init(&ef->async.stop, false);
+	atomic_init(&ef->async.queued, 0);
+	atomic_init(&ef->async.written, 0);
+	atomic_init(&ef->async.failed, 0);
+	atomic_init(&ef->async.flushes, 0);
+	atomic_init(&ef->async.bytes, 0);
+	atomic_init(&ef->async.fsyncs, 0);
+	atomic_init(&ef->async.stalls, 0);
+	atomic_init(&ef->async.depth_max, 0);
+
+	ef->async.fsync = fsync;
+	ef->async.fsync_interval = fsync_interval;
+	ef->async.last_synced = time(NULL);
+
+	if (pthread_mutex_init(&ef->async.mutex, NULL) != 0) {
+		fr_strerror_printf("Failed initialising mutex: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (pthread_cond_init(&ef->async.cond, NULL) != 0) {
+		fr_strerror_printf("Failed initialising condition variable: %s", fr_syserror(errno));
+		pthread_mutex_destroy(&ef->async.mutex);
+		return -1;
+	}
+
+	rcode = pthread_create(&ef->async.thread, NULL, exfile_async_writer, ef);
+	if (rcode != 0) {
+		fr_strerror_printf("Failed creating writer thread: %s", fr_syserror(rcode));
+		pthread_cond_destroy(&ef->async.cond);
+		pthread_mutex_destroy(&ef->async.mutex);
+		return -1;
+	}
+
+	ef->async.enabled = true;
+
+	return 0;
+}
+
+/** Append a record to a file
+ *
+ * If exfile_enable_async() has been called, the record is copied to the
+ * ring, and written later by the writer thread.  Otherwise the file is
+ * opened, locked, written to and released before returning.
+ *
+ * @param[in] ef		The logfile context returned from exfile_init().
+ * @param[in] request		The current request.
+ * @param[in] filename		the file to append to.
+ * @param[in] permissions	to use if the file has to be created.
+ * @param[in] vector		the record, which may be in several pieces.
+ * @param[in] iovcnt		number of elements in vector.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int exfile_write(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions,
+		 struct iovec const *vector, int iovcnt)
+{
+	exfile_record_t	*record;
+	size_t		len = 0, filename_len;
+	uint8_t		*p;
+	int		i;
+
+	if (!ef || !filename) return -1;
+
+	if (!ef->async.enabled) {
+		struct iovec	*copy;
+		int		fd;
+		ssize_t		ret;
+
+		/*
+		 *	fr_writev() modifies the vector on partial writes.
+		 */
+		copy = talloc_memdup(NULL, vector, sizeof(vector[0]) * iovcnt);
+		if (!copy) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+
+		fd = exfile_open(ef, request, filename, permissions, true);
+		if (fd < 0) {
+			talloc_free(copy);
+			return -1;
+		}
+
+		ret = fr_writev(fd, copy, iovcnt, NULL);
+		if (ret < 0) fr_strerror_printf("Failed writing to %s: %s", filename, fr_syserror(errno));
+		talloc_free(copy);
+
+		exfile_close(ef, request, fd);
+
+		return (ret < 0) ? -1 : 0;
+	}
+
+	for (i = 0; i < iovcnt; i++) len += vector[i].iov_len;
+	filename_len = strlen(filename);
+
+	record = talloc_size(NULL, sizeof(*record) + len + filename_len + 1);
+	if (!record) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+	talloc_set_type(record, exfile_record_t);
+
+	p = (uint8_t *)(record + 1);
+	record->data = p;
+	record->len = len;
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(p, vector[i].iov_base, vector[i].iov_len);
+		p += vector[i].iov_len;
+	}
+
+	memcpy(p, filename, filename_len + 1);
+	record->filename = (char const *) p;
+	record->hash = fr_hash_string(filename);
+	record->permissions = permissions;
+
+	/*
+	 *	Rather than lose the record, wait for the writer
+	 *	to catch up.
+	 */
+	if (!exfile_async_push(ef, record)) {
+		atomic_fetch_add_explicit(&ef->async.stalls, 1, memory_order_relaxed);
+		ROPTIONAL(RWDEBUG, WARN, "Write queue for %s is full, waiting for writer", filename);
+
+		do {
+			exfile_async_wake(ef);
+			usleep(1000);
+		} while (!exfile_async_push(ef, record));
+	}
+
+	atomic_fetch_add_explicit(&ef->async.queued, 1, memory_order_relaxed);
+	exfile_async_wake(ef);
+
+	return 0;
+}
+
+/** Get statistics for the writer thread
+ *
+ * @param[in] ef	to get statistics for.
+ * @param[out] stats	Where to write the statistics.  Zeroed if
+ *			asynchronous writes aren't enabled.
+ */
+void exfile_async_stats(exfile_t *ef, exfile_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (!ef->async.enabled) return;
+
+	stats->size = ef->async.mask + 1;
+	stats->depth = atomic_load_explicit(&ef->async.head, memory_order_relaxed) -
+		       atomic_load_explicit(&ef->async.tail, memory_order_relaxed);
+	stats->depth_max = atomic_load_explicit(&ef->async.depth_max, memory_order_relaxed);
+	stats->queued = atomic_load_explicit(&ef->async.queued, memory_order_relaxed);
+	stats->written = atomic_load_explicit(&ef->async.written, memory_order_relaxed);
+	stats->failed = atomic_load_explicit(&ef->async.failed, memory_order_relaxed);
+	stats->flushes = atomic_load_explicit(&ef->async.flushes, memory_order_relaxed);
+	stats->bytes = atomic_load_explicit(&ef->async.bytes, memory_order_relaxed);
+	stats->fsyncs = atomic_load_explicit(&ef->async.fsyncs, memory_order_relaxed);
+	stats->stalls = atomic_load_explicit(&ef->async.stalls, memory_order_relaxed);
+}
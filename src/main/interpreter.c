@@ -519,16 +519,34 @@ static unlang_action_t unlang_switch(REQUEST *request, unlang_stack_t *stack,
 	 */
 	if ((g->vpt->type == TMPL_TYPE_ATTR) && (tmpl_find_vp(NULL, request, g->vpt) < 0)) {
 	find_null_case:
-		for (this = g->children; this; this = this->next) {
-			rad_assert(this->type == MOD_CASE);
-
-			h = mod_callabletogroup(this);
-			if (h->vpt) continue;
+		found = g->default_case;
+		goto do_null_case;
+	}
 
-			found = this;
-			break;
+	/*
+	 *	Every 'case' is a literal value, so look up each
+	 *	instance of the attribute in the table built by the
+	 *	compiler.  If instances match different cases, the
+	 *	first case wins, as it would if we compared them in
+	 *	order.
+	 */
+	if (g->case_table) {
+		VALUE_PAIR	*vp;
+		vp_cursor_t	cursor;
+		modcase_t	my_case, *match, *best = NULL;
+		int		err;
+
+		for (vp = tmpl_cursor_init(&err, &cursor, request, g->vpt);
+		     vp;
+		     vp = tmpl_cursor_next(&cursor, g->vpt)) {
+			my_case.type = vp->da->type;
+			my_case.data = &vp->data;
+
+			match = fr_hash_table_finddata(g->case_table, &my_case);
+			if (match && (!best || (match->position < best->position))) best = match;
 		}
 
+		found = best ? best->c : g->default_case;
 		goto do_null_case;
 	}
 
@@ -1273,6 +1273,8 @@ int common_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 	int		rcode;
 	uint16_t	listen_port;
 	uint32_t	recv_buff;
+	uint32_t	recv_batch;
+	uint32_t	num_sockets;
 	fr_ipaddr_t	ipaddr;
 	listen_socket_t *sock = this->data;
 	char const	*section_name = NULL;
@@ -1314,6 +1316,16 @@ int common_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 		FR_INTEGER_BOUND_CHECK("recv_buff", recv_buff, <=, INT_MAX);
 	}
 
+	rcode = cf_pair_parse(cs, "recv_batch", FR_ITEM_POINTER(PW_TYPE_INTEGER, &recv_batch), "1", T_BARE_WORD);
+	if (rcode < 0) return -1;
+	FR_INTEGER_BOUND_CHECK("recv_batch", recv_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("recv_batch", recv_batch, <=, 1024);
+
+	rcode = cf_pair_parse(cs, "num_sockets", FR_ITEM_POINTER(PW_TYPE_INTEGER, &num_sockets), "1", T_BARE_WORD);
+	if (rcode < 0) return -1;
+	FR_INTEGER_BOUND_CHECK("num_sockets", num_sockets, >=, 1);
+	FR_INTEGER_BOUND_CHECK("num_sockets", num_sockets, <=, 256);
+
 	sock->proto = IPPROTO_UDP;
 
 	if (cf_pair_find(cs, "proto")) {
@@ -1424,6 +1436,55 @@ int common_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 	sock->my_port = listen_port;
 	sock->recv_buff = recv_buff;
 
+	/*
+	 *	Multiple sockets on the same IP/port rely on the
+	 *	kernel hashing each flow to one socket.  That's only
+	 *	true for UDP, and we only know how to run the request
+	 *	state machine for auth and acct packets in a listener
+	 *	thread.
+	 */
+	if (num_sockets > 1) {
+#ifndef SO_REUSEPORT
+		cf_log_err_cs(cs, "System does not support SO_REUSEPORT.  Delete \"num_sockets\" from the configuration file");
+		return -1;
+#else
+		if ((sock->proto != IPPROTO_UDP) ||
+		    ((this->type != RAD_LISTEN_AUTH)
+#  ifdef WITH_ACCOUNTING
+		     && (this->type != RAD_LISTEN_ACCT)
+#  endif
+			    )) {
+			cf_log_err_cs(cs, "\"num_sockets\" can only be used with UDP auth and acct listeners");
+			return -1;
+		}
+
+#  ifdef WITH_PROXY
+		if (main_config.proxy_requests) {
+			WARN("%s[%d]: Requests received on listeners with \"num_sockets\" cannot be proxied",
+			     cf_section_filename(cs), cf_section_lineno(cs));
+		}
+#  endif
+#endif
+	}
+	sock->num_sockets = num_sockets;
+
+	/*
+	 *	Only plain UDP authentication and accounting sockets
+	 *	know how to drain more than one packet per event.
+	 */
+	if ((recv_batch > 1) && (sock->proto == IPPROTO_UDP) &&
+	    ((this->type == RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+	     || (this->type == RAD_LISTEN_ACCT)
+#endif
+		    )) {
+		sock->batch = udp_mmsg_batch_alloc(sock, recv_batch);
+		if (!sock->batch) {
+			cf_log_err_cs(cs, "Failed allocating receive batch: %s", fr_strerror());
+			return -1;
+		}
+	}
+
 #ifdef WITH_PROXY
 	if (check_config) {
 		/*
@@ -1728,6 +1789,35 @@ static int proxy_socket_send(NDEBUG_UNUSED rad_listen_t *listener, REQUEST *requ
 }
 #endif
 
+/*
+ *	Discard the datagram we're looking at.  If it was read by
+ *	udp_recv_mmsg() it has already been removed from the socket.
+ */
+#define UDP_DISCARD(_listener, _msg) do { if (!_msg) udp_recv_discard((_listener)->fd); } while (0)
+
+typedef int (*udp_packet_recv_t)(rad_listen_t *listener, udp_mmsg_t *msg);
+
+/*
+ *	Read as many packets as are waiting (up to recv_batch), and
+ *	process each one.
+ */
+static int udp_socket_recv_batch(rad_listen_t *listener, udp_packet_recv_t recv_packet)
+{
+	int		i, num, received = 0;
+	udp_mmsg_t	*msgs;
+	listen_socket_t	*sock = listener->data;
+
+	num = udp_recv_mmsg(listener->fd, sock->batch, &msgs);
+	if (num < 0) {
+		if (DEBUG_ENABLED) ERROR("Receive - %s", fr_strerror());
+		return 0;
+	}
+
+	for (i = 0; i < num; i++) received += recv_packet(listener, &msgs[i]);
+
+	return received;
+}
+
 #ifdef WITH_STATS
 /*
  *	Check if an incoming request is "ok"
@@ -1803,7 +1893,7 @@ static int stats_socket_recv(rad_listen_t *listener)
  *	It takes packets, not requests.  It sees if the packet looks
  *	OK.  If so, it does a number of sanity checks on it.
   */
-static int auth_socket_recv(rad_listen_t *listener)
+static int auth_packet_recv(rad_listen_t *listener, udp_mmsg_t *msg)
 {
 	ssize_t		rcode;
 	unsigned int	code;
@@ -1814,7 +1904,13 @@ static int auth_socket_recv(rad_listen_t *listener)
 	fr_ipaddr_t	src_ipaddr;
 	TALLOC_CTX	*ctx;
 
-	rcode = fr_radius_recv_header(listener->fd, &src_ipaddr, &src_port, &code);
+	if (msg) {
+		rcode = fr_radius_recv_header_mmsg(msg, &code);
+		src_ipaddr = msg->src_ipaddr;
+		src_port = msg->src_port;
+	} else {
+		rcode = fr_radius_recv_header(listener->fd, &src_ipaddr, &src_port, &code);
+	}
 	if (rcode < 0) return 0;
 
 	FR_STATS_INC(auth, total_requests);
@@ -1827,7 +1923,7 @@ static int auth_socket_recv(rad_listen_t *listener)
 
 	client = client_listener_find(listener, &src_ipaddr, src_port);
 	if (!client) {
-		udp_recv_discard(listener->fd);
+		UDP_DISCARD(listener, msg);
 		FR_STATS_INC(auth, total_invalid_requests);
 		return 0;
 	}
@@ -1844,7 +1940,7 @@ static int auth_socket_recv(rad_listen_t *listener)
 
 	case PW_CODE_STATUS_SERVER:
 		if (!main_config.status_server) {
-			udp_recv_discard(listener->fd);
+			UDP_DISCARD(listener, msg);
 			FR_STATS_INC(auth, total_unknown_types);
 			WARN("Ignoring Status-Server request due to security configuration");
 			return 0;
@@ -1853,7 +1949,7 @@ static int auth_socket_recv(rad_listen_t *listener)
 		break;
 
 	default:
-		udp_recv_discard(listener->fd);
+		UDP_DISCARD(listener, msg);
 		FR_STATS_INC(auth, total_unknown_types);
 
 		if (DEBUG_ENABLED) ERROR("Receive - Invalid packet code %d sent to authentication port from "
@@ -1861,23 +1957,26 @@ static int auth_socket_recv(rad_listen_t *listener)
 		return 0;
 	} /* switch over packet types */
 
-	ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+	ctx = request_pool_alloc("auth_listener_pool");
 	if (!ctx) {
-		udp_recv_discard(listener->fd);
+		UDP_DISCARD(listener, msg);
 		FR_STATS_INC(auth, total_packets_dropped);
 		return 0;
 	}
-	talloc_set_name_const(ctx, "auth_listener_pool");
 
 	/*
 	 *	Now that we've sanity checked everything, receive the
 	 *	packet.
 	 */
-	packet = fr_radius_recv(ctx, listener->fd, UDP_FLAGS_NONE, client->message_authenticator);
+	if (msg) {
+		packet = fr_radius_recv_mmsg(ctx, listener->fd, msg, client->message_authenticator);
+	} else {
+		packet = fr_radius_recv(ctx, listener->fd, UDP_FLAGS_NONE, client->message_authenticator);
+	}
 	if (!packet) {
 		FR_STATS_INC(auth, total_malformed_requests);
 		if (DEBUG_ENABLED) ERROR("Receive - %s", fr_strerror());
-		talloc_free(ctx);
+		request_pool_free(ctx);
 		return 0;
 	}
 
@@ -1905,19 +2004,29 @@ static int auth_socket_recv(rad_listen_t *listener)
 
 	if (!request_receive(ctx, listener, packet, client, fun)) {
 		FR_STATS_INC(auth, total_packets_dropped);
-		talloc_free(ctx);
+		request_pool_free(ctx);
 		return 0;
 	}
 
 	return 1;
 }
 
+static int auth_socket_recv(rad_listen_t *listener)
+{
+	listen_socket_t *sock = listener->data;
+
+	if (sock->batch) return udp_socket_recv_batch(listener, auth_packet_recv);
+
+	return auth_packet_recv(listener, NULL);
+}
+
 
 #ifdef WITH_ACCOUNTING
 /*
- *	Receive packets from an accounting socket
+ *	Read, and sanity check a packet from an accounting socket.
  */
-static int acct_socket_recv(rad_listen_t *listener)
+static RADIUS_PACKET *acct_packet_read(rad_listen_t *listener, udp_mmsg_t *msg,
+				       RADCLIENT **client_p, RAD_REQUEST_FUNP *fun_p)
 {
 	ssize_t		rcode;
 	unsigned int	code;
@@ -1928,7 +2037,13 @@ static int acct_socket_recv(rad_listen_t *listener)
 	fr_ipaddr_t	src_ipaddr;
 	TALLOC_CTX	*ctx;
 
-	rcode = fr_radius_recv_header(listener->fd, &src_ipaddr, &src_port, &code);
+	if (msg) {
+		rcode = fr_radius_recv_header_mmsg(msg, &code);
+		src_ipaddr = msg->src_ipaddr;
+		src_port = msg->src_port;
+	} else {
+		rcode = fr_radius_recv_header(listener->fd, &src_ipaddr, &src_port, &code);
+	}
 	if (rcode < 0) return 0;
 
 	FR_STATS_INC(acct, total_requests);
@@ -1936,14 +2051,14 @@ static int acct_socket_recv(rad_listen_t *listener)
 	if (rcode < 20) {	/* RADIUS_HDR_LEN */
 		if (DEBUG_ENABLED) ERROR("Receive - %s", fr_strerror());
 		FR_STATS_INC(acct, total_malformed_requests);
-		return 0;
+		return NULL;
 	}
 
 	if ((client = client_listener_find(listener,
 					   &src_ipaddr, src_port)) == NULL) {
-		udp_recv_discard(listener->fd);
+		UDP_DISCARD(listener, msg);
 		FR_STATS_INC(acct, total_invalid_requests);
-		return 0;
+		return NULL;
 	}
 
 	FR_STATS_TYPE_INC(client->acct.total_requests);
@@ -1958,56 +2073,148 @@ static int acct_socket_recv(rad_listen_t *listener)
 
 	case PW_CODE_STATUS_SERVER:
 		if (!main_config.status_server) {
-			udp_recv_discard(listener->fd);
+			UDP_DISCARD(listener, msg);
 			FR_STATS_INC(acct, total_unknown_types);
 
 			WARN("Ignoring Status-Server request due to security configuration");
-			return 0;
+			return NULL;
 		}
 		fun = rad_status_server;
 		break;
 
 	default:
-		udp_recv_discard(listener->fd);
+		UDP_DISCARD(listener, msg);
 		FR_STATS_INC(acct, total_unknown_types);
 
 		DEBUG("Invalid packet code %d sent to a accounting port from client %s port %d : IGNORED",
 		      code, client->shortname, src_port);
-		return 0;
+		return NULL;
 	} /* switch over packet types */
 
-	ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+	ctx = request_pool_alloc("acct_listener_pool");
 	if (!ctx) {
-		udp_recv_discard(listener->fd);
+		UDP_DISCARD(listener, msg);
 		FR_STATS_INC(acct, total_packets_dropped);
-		return 0;
+		return NULL;
 	}
-	talloc_set_name_const(ctx, "acct_listener_pool");
 
 	/*
 	 *	Now that we've sanity checked everything, receive the
 	 *	packet.
 	 */
-	packet = fr_radius_recv(ctx, listener->fd, UDP_FLAGS_NONE, false);
+	if (msg) {
+		packet = fr_radius_recv_mmsg(ctx, listener->fd, msg, false);
+	} else {
+		packet = fr_radius_recv(ctx, listener->fd, UDP_FLAGS_NONE, false);
+	}
 	if (!packet) {
 		FR_STATS_INC(acct, total_malformed_requests);
 		if (DEBUG_ENABLED) ERROR("Receive - %s", fr_strerror());
-		talloc_free(ctx);
-		return 0;
+		request_pool_free(ctx);
+		return NULL;
 	}
 
+	*client_p = client;
+	*fun_p = fun;
+
+	return packet;
+}
+
+/*
+ *	Hand a packet from acct_packet_read() to the state machine.
+ */
+static int acct_packet_receive(rad_listen_t *listener, RADIUS_PACKET *packet,
+			       RADCLIENT *client, RAD_REQUEST_FUNP fun)
+{
+	TALLOC_CTX *ctx = talloc_parent(packet);
+
 	/*
 	 *	There can be no duplicate accounting packets.
 	 */
 	if (!request_receive(ctx, listener, packet, client, fun)) {
 		FR_STATS_INC(acct, total_packets_dropped);
 		fr_radius_free(&packet);
-		talloc_free(ctx);
+		request_pool_free(ctx);
 		return 0;
 	}
 
 	return 1;
 }
+
+/*
+ *	Receive packets from an accounting socket
+ */
+static int acct_packet_recv(rad_listen_t *listener, udp_mmsg_t *msg)
+{
+	RADIUS_PACKET		*packet;
+	RADCLIENT		*client;
+	RAD_REQUEST_FUNP	fun;
+
+	packet = acct_packet_read(listener, msg, &client, &fun);
+	if (!packet) return 0;
+
+	return acct_packet_receive(listener, packet, client, fun);
+}
+
+/*
+ *	The number of packets read from a batch before their Request
+ *	Authenticators are checked together.
+ */
+#define ACCT_VERIFY_BATCH	(64)
+
+/*
+ *	Read a batch of packets from an accounting socket.
+ *
+ *	The Request Authenticators of the whole batch are checked
+ *	with fr_radius_verify_batch() before any of the packets are
+ *	handed to the workers, so that the MD5 work can be spread
+ *	across SIMD lanes.  Any packet that isn't marked as verified
+ *	is checked by fr_radius_verify() as usual.
+ */
+static int acct_socket_recv_batch(rad_listen_t *listener)
+{
+	int			i, num, received = 0;
+	udp_mmsg_t		*msgs;
+	listen_socket_t		*sock = listener->data;
+
+	num = udp_recv_mmsg(listener->fd, sock->batch, &msgs);
+	if (num < 0) {
+		if (DEBUG_ENABLED) ERROR("Receive - %s", fr_strerror());
+		return 0;
+	}
+
+	for (i = 0; i < num; ) {
+		RADIUS_PACKET		*packets[ACCT_VERIFY_BATCH];
+		RADCLIENT		*clients[ACCT_VERIFY_BATCH];
+		RAD_REQUEST_FUNP	funs[ACCT_VERIFY_BATCH];
+		char const		*secrets[ACCT_VERIFY_BATCH];
+		unsigned int		j, todo = 0;
+
+		for (; (i < num) && (todo < ACCT_VERIFY_BATCH); i++) {
+			packets[todo] = acct_packet_read(listener, &msgs[i], &clients[todo], &funs[todo]);
+			if (!packets[todo]) continue;
+
+			secrets[todo] = clients[todo]->secret;
+			todo++;
+		}
+
+		fr_radius_verify_batch(packets, NULL, secrets, todo);
+
+		for (j = 0; j < todo; j++) received += acct_packet_receive(listener, packets[j], clients[j], funs[j]);
+	}
+
+	return received;
+}
+
+
+static int acct_socket_recv(rad_listen_t *listener)
+{
+	listen_socket_t *sock = listener->data;
+
+	if (sock->batch) return acct_socket_recv_batch(listener);
+
+	return acct_packet_recv(listener, NULL);
+}
 #endif
 
 
@@ -2253,13 +2460,12 @@ static int coa_socket_recv(rad_listen_t *listener)
 		return 0;
 	} /* switch over packet types */
 
-	ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+	ctx = request_pool_alloc("coa_socket_recv_pool");
 	if (!ctx) {
 		udp_recv_discard(listener->fd);
 		FR_STATS_INC(coa, total_packets_dropped);
 		return 0;
 	}
-	talloc_set_name_const(ctx, "coa_socket_recv_pool");
 
 	/*
 	 *	Now that we've sanity checked everything, receive the
@@ -2269,14 +2475,14 @@ static int coa_socket_recv(rad_listen_t *listener)
 	if (!packet) {
 		FR_STATS_INC(coa, total_malformed_requests);
 		if (DEBUG_ENABLED) ERROR("Receive - %s", fr_strerror());
-		talloc_free(ctx);
+		request_pool_free(ctx);
 		return 0;
 	}
 
 	if (!request_receive(ctx, listener, packet, client, fun)) {
 		FR_STATS_INC(coa, total_packets_dropped);
 		fr_radius_free(&packet);
-		talloc_free(ctx);
+		request_pool_free(ctx);
 		return 0;
 	}
 
@@ -2848,6 +3054,22 @@ static int listen_bind(rad_listen_t *this)
 		}
 	}
 
+#ifdef SO_REUSEPORT
+	/*
+	 *	Allow the other sockets for this listen section to
+	 *	bind to the same IP and port.
+	 */
+	if (sock->num_sockets > 1) {
+		int on = 1;
+
+		if (setsockopt(this->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			close(this->fd);
+			ERROR("Failed setting SO_REUSEPORT: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+#endif
+
 	/*
 	 *	Bind to the interface, IP address, and port.
 	 */
@@ -3162,15 +3384,12 @@ static rad_listen_t *listen_parse(listen_config_t *lc)
  *	- 0 on success.
  *	- -1 on failure.
  */
-int listen_init(rad_listen_t **head,
-#ifndef WITH_TLS
-		UNUSED
-#endif
-		bool spawn_workers)
+int listen_init(rad_listen_t **head, bool spawn_workers)
 {
 	rad_listen_t	**last;
 	rad_listen_t	*this;
 	listen_config_t	*lc;
+	uint32_t	i;
 	bool		incoming_sockets = false;
 
 	if (!listen_config) {
@@ -3223,6 +3442,31 @@ int listen_init(rad_listen_t **head,
 		this = lc->listener;
 		*last = this;
 		last = &(this->next);
+
+		if ((this->type != RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+		    && (this->type != RAD_LISTEN_ACCT)
+#endif
+			) continue;
+
+		/*
+		 *	Open the rest of the SO_REUSEPORT sockets.  The
+		 *	section is parsed again for each one, so that
+		 *	every socket has its own listen_socket_t.
+		 */
+		for (i = 1; i < ((listen_socket_t *) this->data)->num_sockets; i++) {
+			rad_listen_t *copy;
+
+			copy = listen_parse(lc);
+			if (!copy || (lc->proto->open(lc->cs, copy) < 0)) {
+				ERROR("Failed creating socket %u for server \"%s\"", i + 1, lc->server_name);
+				TALLOC_FREE(listen_ctx);
+				return -1;
+			}
+
+			*last = copy;
+			last = &(copy->next);
+		}
 	}
 
 	/*
@@ -3238,6 +3482,16 @@ int listen_init(rad_listen_t **head,
 			return -1;
 		}
 #endif
+		if (!spawn_workers &&
+		    ((this->type == RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+		     || (this->type == RAD_LISTEN_ACCT)
+#endif
+			    ) && (((listen_socket_t *) this->data)->num_sockets > 1)) {
+			cf_log_err_cs(this->cs, "Threading must be enabled for \"num_sockets\" to be used");
+			return -1;
+		}
+
 		radius_update_listener(this);
 	}
 
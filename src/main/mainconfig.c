@@ -180,6 +180,7 @@ static const CONF_PARSER resources[] = {
 	 *	it exists.
 	 */
 	{ FR_CONF_POINTER("talloc_pool_size", PW_TYPE_INTEGER, &main_config.talloc_pool_size) },
+	{ FR_CONF_POINTER("talloc_pool_cache", PW_TYPE_INTEGER, &main_config.talloc_pool_cache) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -802,6 +803,7 @@ int main_config_init(void)
 	 *	Which should be enough for many configurations.
 	 */
 	main_config.talloc_pool_size = 8 * 1024; /* default */
+	main_config.talloc_pool_cache = 64; /* default */
 
 	/*
 	 *	Read the distribution dictionaries first, then
@@ -1005,6 +1007,7 @@ do {\
 
 	FR_INTEGER_BOUND_CHECK("resources.talloc_pool_size", main_config.talloc_pool_size, >=, 2 * 1024);
 	FR_INTEGER_BOUND_CHECK("resources.talloc_pool_size", main_config.talloc_pool_size, <=, 1024 * 1024);
+	FR_INTEGER_BOUND_CHECK("resources.talloc_pool_cache", main_config.talloc_pool_cache, <=, 4096);
 
 	/*
 	 *	Set default initial request processing delay to 1/3 of a second.
@@ -1248,6 +1251,14 @@ void main_config_hup(void)
 	cc->next = cs_cache;
 	cs_cache = cc;
 
+	/*
+	 *	Free cached format strings which no configuration
+	 *	uses any more.  Modules which aren't re-parsed keep
+	 *	using the strings cached from their original
+	 *	configuration.
+	 */
+	xlat_cache_hup();
+
 	INFO("HUP - loading modules");
 
 	/*
@@ -1870,6 +1870,109 @@ static modcallable *compile_group(modcallable *parent, unlang_compile_t *unlang_
 	return compile_children(g, parent, unlang_ctx, grouptype, parentgrouptype);
 }
 
+static uint32_t case_hash(void const *data)
+{
+	modcase_t const *a = data;
+
+	if ((a->type == PW_TYPE_STRING) || (a->type == PW_TYPE_OCTETS)) {
+		return fr_hash(a->data->octets, a->data->length);
+	}
+
+	return fr_hash(a->data, value_data_field_sizes[a->type]);
+}
+
+static int case_cmp(void const *one, void const *two)
+{
+	modcase_t const *a = one;
+	modcase_t const *b = two;
+
+	return value_data_cmp(a->type, a->data, b->type, b->data);
+}
+
+/** Build a hash table of the values of the 'case' statements in a 'switch'
+ *
+ * If we're switching over an attribute, and every 'case' is a literal
+ * value, the interpreter can find the matching 'case' with a lookup
+ * for each instance of the attribute, instead of comparing every 'case'
+ * in turn.
+ *
+ * If any 'case' is dynamic (an attribute reference or xlat), or the
+ * type has equality semantics other than "same bytes" (prefixes), the
+ * table isn't built, and the cases are compared in order as before.
+ *
+ * @param g the 'switch' section, with its children compiled.
+ * @return
+ *	- 0 on success (including when no table was built).
+ *	- -1 on failure.
+ */
+static int compile_switch_table(modgroup *g)
+{
+	modcallable		*this;
+	fr_dict_attr_t const	*da;
+	int			position = 0;
+
+	if ((g->vpt->type != TMPL_TYPE_ATTR) || (g->vpt->tmpl_num == NUM_COUNT)) return 0;
+
+	da = g->vpt->tmpl_da;
+	switch (da->type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_OCTETS:
+	case PW_TYPE_IFID:
+	case PW_TYPE_IPV4_ADDR:
+	case PW_TYPE_IPV6_ADDR:
+	case PW_TYPE_BOOLEAN:
+	case PW_TYPE_BYTE:
+	case PW_TYPE_SHORT:
+	case PW_TYPE_INTEGER:
+	case PW_TYPE_INTEGER64:
+	case PW_TYPE_SIGNED:
+	case PW_TYPE_ETHERNET:
+	case PW_TYPE_DATE:
+		break;
+
+	default:
+		return 0;
+	}
+
+	for (this = g->children; this; this = this->next) {
+		modgroup *h = mod_callabletogroup(this);
+
+		if (!h->vpt) continue;
+
+		if ((h->vpt->type != TMPL_TYPE_DATA) || (h->vpt->tmpl_data_type != da->type)) return 0;
+	}
+
+	g->case_table = fr_hash_table_create(g, case_hash, case_cmp, NULL);
+	if (!g->case_table) return -1;
+
+	for (this = g->children; this; this = this->next, position++) {
+		modgroup	*h = mod_callabletogroup(this);
+		modcase_t	*entry;
+
+		if (!h->vpt) continue;
+
+		entry = talloc_zero(g->case_table, modcase_t);
+		if (!entry) return -1;
+
+		entry->type = h->vpt->tmpl_data_type;
+		entry->data = &h->vpt->tmpl_data_value;
+		entry->c = this;
+		entry->position = position;
+
+		/*
+		 *	Duplicate values can never be reached, as
+		 *	the earlier case always matches first.
+		 */
+		if (!fr_hash_table_insert(g->case_table, entry)) {
+			WARN("%s[%d]: 'case' can never match, as an earlier 'case' has the same value",
+			     cf_section_filename(h->cs), cf_section_lineno(h->cs));
+			talloc_free(entry);
+		}
+	}
+
+	return 0;
+}
+
 static modcallable *compile_switch(modcallable *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
 				   grouptype_t grouptype, grouptype_t parentgrouptype, mod_type_t mod_type)
 {
@@ -1966,7 +2069,23 @@ static modcallable *compile_switch(modcallable *parent, unlang_compile_t *unlang
 		return NULL;
 	}
 
-	return compile_children(g, parent, unlang_ctx, grouptype, parentgrouptype);
+	c = compile_children(g, parent, unlang_ctx, grouptype, parentgrouptype);
+	if (!c) return NULL;
+
+	for (c = g->children; c; c = c->next) {
+		if (!mod_callabletogroup(c)->vpt) {
+			g->default_case = c;
+			break;
+		}
+	}
+
+	if (compile_switch_table(g) < 0) {
+		cf_log_err_cs(cs, "Failed building table of 'case' values");
+		talloc_free(g);
+		return NULL;
+	}
+
+	return mod_grouptocallable(g);
 }
 
 static modcallable *compile_case(modcallable *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
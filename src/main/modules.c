@@ -1480,6 +1480,13 @@ exfile_t *module_exfile_init(TALLOC_CTX *ctx,
 
 	exfile_enable_triggers(handle, cf_section_sub_find(module, "file"), trigger_prefix, trigger_args);
 
+	/*
+	 *	So radmin can find the handle.  A HUP creates a new
+	 *	handle, which replaces the old one.
+	 */
+	cf_data_remove(module, MODULE_EXFILE_CF_KEY);
+	cf_data_add(module, MODULE_EXFILE_CF_KEY, handle, NULL);
+
 	return handle;
 }
 
@@ -56,12 +56,20 @@ extern fr_cond_t *debug_condition;
 static bool spawn_workers = false;
 static bool just_started = true;
 time_t fr_start_time = (time_t)-1;
-static rbtree_t *pl = NULL;
-static fr_event_list_t *el = NULL;
+
+/*
+ *	The request tree and event list of the thread we're running
+ *	in.  The main thread and each listener thread have their own.
+ *	Worker threads have neither, and so must not touch timers.
+ */
+static _Thread_local rbtree_t *pl = NULL;
+static _Thread_local fr_event_list_t *el = NULL;
+
+static fr_event_list_t *main_el = NULL;
 
 fr_event_list_t *radius_event_list_corral(UNUSED event_corral_t hint) {
 	/* Currently we do not run a second event loop for modules. */
-	return el;
+	return main_el;
 }
 
 static char const *action_codes[] = {
@@ -250,12 +258,14 @@ static bool proxy_no_new_sockets = false;
 static pthread_t NO_SUCH_CHILD_PID;
 #define NO_CHILD_THREAD request->child_pid = NO_SUCH_CHILD_PID
 
+/*
+ *	The "master" is whichever thread runs the event loop which
+ *	owns the request.  That's the main thread, or the listener
+ *	thread which read the packet.
+ */
 static bool we_are_master(void)
 {
-	if (spawn_workers &&
-	    (pthread_equal(pthread_self(), NO_SUCH_CHILD_PID) == 0)) {
-		return false;
-	}
+	if (spawn_workers && !el) return false;
 
 	return true;
 }
@@ -276,8 +286,30 @@ static bool we_are_master(void)
  */
 #define FINAL_STATE(_x) NO_CHILD_THREAD; request->component = "<" #_x ">"; request->module = ""; request->child_state = _x
 
+/*
+ *	Whether the request was read by a listener thread, rather
+ *	than by the main thread.
+ */
+static bool request_in_listen_thread(REQUEST *request)
+{
+	listen_socket_t *sock;
+
+	if (!request->listener) return false;
+
+	if ((request->listener->type != RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+	    && (request->listener->type != RAD_LISTEN_ACCT)
+#endif
+		) return false;
+
+	sock = request->listener->data;
+
+	return (sock->thread != NULL);
+}
+
 
 static int event_new_fd(rad_listen_t *this);
+static int listen_thread_alloc(rad_listen_t *this);
 
 /*
  *	We need mutexes around the event FD list *only* in certain
@@ -295,7 +327,7 @@ void radius_update_listener(rad_listen_t *this)
 	/*
 	 *	Just do it ourselves.
 	 */
-	if (we_are_master()) {
+	if (!spawn_workers || (el == main_el)) {
 		event_new_fd(this);
 		return;
 	}
@@ -486,7 +518,7 @@ static void request_free(REQUEST *request)
 
 	ptr = talloc_parent(request);
 	rad_assert(ptr != NULL);
-	talloc_free(ptr);
+	request_pool_free(ptr);
 }
 
 
@@ -1655,9 +1687,8 @@ int request_receive(TALLOC_CTX *ctx, rad_listen_t *listener, RADIUS_PACKET *pack
 	 *	Allocate a pool for the request.
 	 */
 	if (!ctx) {
-		ctx = talloc_pool(NULL, main_config.talloc_pool_size);
+		ctx = request_pool_alloc("request_receive_pool");
 		if (!ctx) return 0;
-		talloc_set_name_const(ctx, "request_receive_pool");
 
 		/*
 		 *	The packet is still allocated from a different
@@ -1668,7 +1699,7 @@ int request_receive(TALLOC_CTX *ctx, rad_listen_t *listener, RADIUS_PACKET *pack
 
 	request = request_setup(ctx, listener, packet, client, fun);
 	if (!request) {
-		talloc_free(ctx);
+		request_pool_free(ctx);
 		return 1;
 	}
 
@@ -2422,6 +2453,14 @@ int request_proxy_reply(RADIUS_PACKET *reply)
 	proxy->reply->count++;
 	request->priority = RAD_LISTEN_PROXY;
 
+	/*
+	 *	Status-Server responses don't tell us how busy the
+	 *	home server is.
+	 */
+	if (proxy->packet->code != PW_CODE_STATUS_SERVER) {
+		home_server_response_time(proxy->home_server, &proxy->packet->timestamp, &now);
+	}
+
 #ifdef WITH_STATS
 	/*
 	 *	Update the proxy listener stats here, because only one
@@ -2854,6 +2893,16 @@ static int request_will_proxy(REQUEST *request)
 	}
 
 do_home:
+	/*
+	 *	Replies from home servers are read by the main thread,
+	 *	which can't touch the timers of a request owned by a
+	 *	listener thread.
+	 */
+	if (request_in_listen_thread(request)) {
+		REDEBUG2("Requests received on listeners with \"num_sockets\" cannot be proxied: Cancelling proxy");
+		return 0;
+	}
+
 	home_server_update_request(home, request);
 
 #ifdef WITH_COA
@@ -3923,6 +3972,15 @@ static void request_coa_originate(REQUEST *request)
 		}
 	}
 
+	/*
+	 *	CoA packets go through the proxy code, see
+	 *	request_will_proxy().
+	 */
+	if (request_in_listen_thread(request)) {
+		RWDEBUG("Requests received on listeners with \"num_sockets\" cannot originate CoA packets");
+		goto fail;
+	}
+
 	coa = request->coa;
 
 	/*
@@ -4677,6 +4735,21 @@ static int event_new_fd(rad_listen_t *this)
 			break;
 		} /* switch over listener types */
 
+		/*
+		 *	Sockets opened with "num_sockets" are read by
+		 *	their own thread, not by the main event loop.
+		 */
+		if (((this->type == RAD_LISTEN_AUTH)
+#ifdef WITH_ACCOUNTING
+		     || (this->type == RAD_LISTEN_ACCT)
+#endif
+			    ) && (sock->num_sockets > 1)) {
+			if (listen_thread_alloc(this) < 0) fr_exit(1);
+
+			this->status = RAD_LISTEN_STATUS_KNOWN;
+			return 1;
+		}
+
 		/*
 		 *	All sockets: add the FD to the event handler.
 		 */
@@ -4999,6 +5072,7 @@ static void event_signal_handler(UNUSED fr_event_list_t *xel,
 int radius_event_init(TALLOC_CTX *ctx) {
 	el = fr_event_list_create(ctx, event_status);
 	if (!el) return 0;
+	main_el = el;
 
 	return 1;
 }
@@ -5323,10 +5397,160 @@ static int request_delete_cb(UNUSED void *ctx, void *data)
 }
 
 
+/*
+ *	A listen section with "num_sockets > 1" opens that many
+ *	SO_REUSEPORT sockets.  Each one is read by its own thread, with
+ *	its own event list and request tree.  The kernel hashes each
+ *	client IP/port to one socket, so all retransmissions of a
+ *	packet arrive at the same thread, and duplicate detection works
+ *	just as it does in the main thread.
+ */
+typedef struct listen_thread_t {
+	rad_listen_t		*listener;	//!< The socket this thread reads from.
+	fr_event_list_t		*el;		//!< Socket and request timer events.
+	rbtree_t		*pl;		//!< Requests read from the socket.
+
+	pthread_t		pthread_id;
+	bool			running;
+
+	int			exit_pipe[2];	//!< Written to by the main thread to stop us.
+
+	struct listen_thread_t	*next;
+} listen_thread_t;
+
+static listen_thread_t *listen_threads = NULL;
+
+static int _listen_thread_free(listen_thread_t *thread)
+{
+	if (thread->exit_pipe[0] >= 0) close(thread->exit_pipe[0]);
+	if (thread->exit_pipe[1] >= 0) close(thread->exit_pipe[1]);
+
+	return 0;
+}
+
+static void listen_thread_exit(fr_event_list_t *xel, int fd, UNUSED void *ctx)
+{
+	uint8_t buffer[16];
+
+	if (read(fd, buffer, sizeof(buffer)) <= 0) return;
+
+	fr_event_loop_exit(xel, 1);
+}
+
+/*
+ *	Called from event_new_fd().  The thread isn't started until
+ *	radius_event_process(), as the server isn't ready to process
+ *	requests before then.
+ */
+static int listen_thread_alloc(rad_listen_t *this)
+{
+	listen_socket_t *sock = this->data;
+	listen_thread_t *thread;
+
+	thread = talloc_zero(this, listen_thread_t);
+	if (!thread) return -1;
+
+	thread->listener = this;
+	thread->exit_pipe[0] = thread->exit_pipe[1] = -1;
+	talloc_set_destructor(thread, _listen_thread_free);
+
+	thread->el = fr_event_list_create(thread, NULL);
+	if (!thread->el) {
+		ERROR("Failed creating event list for listener thread");
+	error:
+		talloc_free(thread);
+		return -1;
+	}
+
+	MEM(thread->pl = rbtree_create(thread, packet_entry_cmp, NULL, 0));
+
+	if (pipe(thread->exit_pipe) < 0) {
+		ERROR("Error opening listener thread pipe: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if (!fr_event_fd_insert(thread->el, 0, this->fd, event_socket_handler, this) ||
+	    !fr_event_fd_insert(thread->el, 0, thread->exit_pipe[0], listen_thread_exit, thread)) {
+		ERROR("Failed adding event handler for listener thread: %s", fr_strerror());
+		goto error;
+	}
+
+	sock->thread = thread;
+
+	thread->next = listen_threads;
+	listen_threads = thread;
+
+	return 0;
+}
+
+static void *listen_thread_main(void *arg)
+{
+	listen_thread_t *thread = talloc_get_type_abort(arg, listen_thread_t);
+
+	el = thread->el;
+	pl = thread->pl;
+
+	(void) fr_event_loop(el);
+
+	/*
+	 *	Clean up the requests we own.  The ones still being
+	 *	processed by a worker are freed with the rest of the
+	 *	server.
+	 */
+	rbtree_walk(pl, RBTREE_DELETE_ORDER, request_delete_cb, NULL);
+
+	return NULL;
+}
+
+static int listen_threads_start(void)
+{
+	int		rcode;
+	listen_thread_t	*thread;
+
+	for (thread = listen_threads; thread != NULL; thread = thread->next) {
+		char buffer[256];
+
+		if (thread->running) continue;
+
+		thread_pool_shared_enqueue();
+
+		rcode = pthread_create(&thread->pthread_id, NULL, listen_thread_main, thread);
+		if (rcode != 0) {
+			ERROR("Failed creating listener thread: %s", fr_syserror(rcode));
+			return -1;
+		}
+		thread->running = true;
+
+		thread->listener->print(thread->listener, buffer, sizeof(buffer));
+		DEBUG2("Started listener thread for %s", buffer);
+	}
+
+	return 0;
+}
+
+static void listen_threads_stop(void)
+{
+	listen_thread_t *thread;
+
+	for (thread = listen_threads; thread != NULL; thread = thread->next) {
+		if (!thread->running) continue;
+
+		if (write(thread->exit_pipe[1], "", 1) < 0) {
+			ERROR("Failed signalling listener thread: %s", fr_syserror(errno));
+			continue;
+		}
+
+		pthread_join(thread->pthread_id, NULL);
+		thread->running = false;
+	}
+}
+
 void radius_event_free(void)
 {
 	ASSERT_MASTER;
 
+	listen_threads_stop();
+
 #ifdef WITH_PROXY
 	/*
 	 *	There are requests in the proxy hash that aren't
@@ -5376,13 +5600,41 @@ void radius_event_free(void)
 #endif
 
 	TALLOC_FREE(el);
+	main_el = NULL;
 
 	if (debug_condition) talloc_free(debug_condition);
 }
 
+/** Free a request which was still queued when the server stopped
+ *
+ * Called by thread_pool_stop() once the workers have exited.  The
+ * request and proxy hashes, and the event list, have already been
+ * freed by radius_event_free(), so all that's left is the request.
+ */
+void radius_event_discard(REQUEST *request)
+{
+	VERIFY_REQUEST(request);
+
+	RDEBUG2("Discarding queued request packet ID %u with timestamp +%d",
+		request->packet->id,
+		(unsigned int) (request->timestamp.tv_sec - fr_start_time));
+
+	request->master_state = REQUEST_STOP_PROCESSING;
+	request->child_state = REQUEST_DONE;
+	request->in_request_hash = false;
+#ifdef WITH_PROXY
+	request->in_proxy_hash = false;
+#endif
+	request->ev = NULL;
+
+	request_free(request);
+}
+
 int radius_event_process(void)
 {
 	if (!el) return 0;
 
+	if (listen_threads_start() < 0) return -1;
+
 	return fr_event_loop(el);
 }
@@ -34,6 +34,14 @@ RCSID("$Id$")
 
 #include <assert.h>
 
+#ifdef HAVE_PTHREAD_H
+#  ifdef HAVE_STDATOMIC_H
+#    include <stdatomic.h>
+#  else
+#    include <freeradius-devel/stdatomic.h>
+#  endif
+#endif
+
 typedef struct REQUEST REQUEST;	/* to shut up warnings about mschap.h */
 
 #include "smbdes.h"
@@ -72,6 +80,16 @@ static int sleep_time = -1;
 static rc_request_t *request_head = NULL;
 static rc_request_t *rc_request_tail = NULL;
 
+#ifdef HAVE_PTHREAD_H
+static uint32_t load_rate = 0;		//!< Requests/s to send across all threads.  0 for the normal mode.
+static bool load_poisson = false;	//!< Send with Poisson, rather than constant, arrivals.
+static int load_threads = 1;
+static int load_sockets = 1;		//!< Sockets per thread, each of which has 256 IDs.
+static int load_interval = 1;		//!< How often to print stats, in seconds.
+static int load_duration = 0;		//!< How long to send for, in seconds.  0 to send until interrupted.
+static atomic_bool load_stop = ATOMIC_VAR_INIT(false);
+#endif
+
 static char const *radclient_version = "radclient version " RADIUSD_VERSION_STRING
 #ifdef RADIUSD_VERSION_COMMIT
 " (git #" STRINGIFY(RADIUSD_VERSION_COMMIT) ")"
@@ -107,6 +125,18 @@ static void NEVER_RETURNS usage(void)
 	fprintf(stderr, "  -P <proto>             Use proto (tcp or udp) for transport.\n");
 #endif
 
+#ifdef HAVE_PTHREAD_H
+	fprintf(stderr, "load options:\n");
+	fprintf(stderr, "  -L <rate>              Send 'rate' requests/s, whether or not the server responds.\n");
+	fprintf(stderr, "                         Requests are not retried, and the stats are printed every interval.\n");
+	fprintf(stderr, "  -A <arrivals>          Time requests with 'constant' (default) or 'poisson' arrivals.\n");
+	fprintf(stderr, "  -T <threads>           Send from 'threads' threads (default 1).\n");
+	fprintf(stderr, "  -o <sockets>           Open 'sockets' sockets per thread, each allowing 256 requests\n");
+	fprintf(stderr, "                         to be outstanding (default 1).\n");
+	fprintf(stderr, "  -W <interval>          Print stats every 'interval' seconds (default 1).\n");
+	fprintf(stderr, "  -l <seconds>           Stop after 'seconds' seconds (default is to run until interrupted).\n");
+#endif
+
 	exit(1);
 }
 
@@ -805,6 +835,31 @@ static void deallocate_id(rc_request_t *request)
 	if (request->reply) fr_radius_free(&request->reply);
 }
 
+/*
+ *	Update the password, so it can be encrypted with the
+ *	new authentication vector.
+ */
+static void radclient_password_update(RADIUS_PACKET *packet, VALUE_PAIR *password)
+{
+	VALUE_PAIR *vp;
+
+	if ((vp = fr_pair_find_by_num(packet->vps, 0, PW_USER_PASSWORD, TAG_ANY)) != NULL) {
+		fr_pair_value_strcpy(vp, password->vp_strvalue);
+
+	} else if ((vp = fr_pair_find_by_num(packet->vps, 0, PW_CHAP_PASSWORD, TAG_ANY)) != NULL) {
+		uint8_t buffer[17];
+
+		fr_radius_encode_chap_password(buffer, packet, fr_rand() & 0xff, password);
+		fr_pair_value_memcpy(vp, buffer, 17);
+
+	} else if (fr_pair_find_by_num(packet->vps, 0, PW_MS_CHAP_PASSWORD, TAG_ANY) != NULL) {
+		mschapv1_encode(packet, &packet->vps, password->vp_strvalue);
+
+	} else {
+		DEBUG("WARNING: No password in the request");
+	}
+}
+
 /*
  *	Send one packet.
  */
@@ -866,29 +921,7 @@ static int send_one_packet(rc_request_t *request)
 			((uint32_t *) request->packet->vector)[i] = fr_rand();
 		}
 
-		/*
-		 *	Update the password, so it can be encrypted with the
-		 *	new authentication vector.
-		 */
-		if (request->password) {
-			VALUE_PAIR *vp;
-
-			if ((vp = fr_pair_find_by_num(request->packet->vps, 0, PW_USER_PASSWORD, TAG_ANY)) != NULL) {
-				fr_pair_value_strcpy(vp, request->password->vp_strvalue);
-
-			} else if ((vp = fr_pair_find_by_num(request->packet->vps, 0, PW_CHAP_PASSWORD, TAG_ANY)) != NULL) {
-				uint8_t buffer[17];
-
-				fr_radius_encode_chap_password(buffer, request->packet, fr_rand() & 0xff, request->password);
-				fr_pair_value_memcpy(vp, buffer, 17);
-
-			} else if (fr_pair_find_by_num(request->packet->vps, 0, PW_MS_CHAP_PASSWORD, TAG_ANY) != NULL) {
-				mschapv1_encode(request->packet, &request->packet->vps, request->password->vp_strvalue);
-
-			} else {
-				DEBUG("WARNING: No password in the request");
-			}
-		}
+		if (request->password) radclient_password_update(request->packet, request->password);
 
 		request->timestamp = time(NULL);
 		request->tries = 1;
@@ -1138,6 +1171,475 @@ fr_radius_free(&request->reply);
 	return 0;
 }
 
+#ifdef HAVE_PTHREAD_H
+/*
+ *	Open-loop load generation.
+ *
+ *	Unlike the normal mode, requests are sent at a fixed rate,
+ *	whether or not the server is keeping up.  Requests which
+ *	aren't answered within the timeout are counted as lost,
+ *	and are never retransmitted.
+ */
+static uint64_t rc_load_now(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return ((uint64_t) now.tv_sec * 1000000) + now.tv_usec;
+}
+
+/*
+ *	-ln(U) for U uniform in (0, 1], which is the gap between
+ *	Poisson arrivals with a mean of one.
+ *
+ *	ln(r / 2^32) = (msb - 32) * ln(2) + ln(m), with m in [1, 2).
+ *	ln(m) = 2 * atanh((m - 1) / (m + 1)), and the series converges
+ *	quickly as |z| <= 1/3.
+ */
+static double rc_load_exp_rand(void)
+{
+	uint32_t	r = fr_rand();
+	int		msb = 31;
+	double		m, z, z2, ln_m;
+
+	if (r == 0) r = 1;
+	while (!(r & ((uint32_t) 1 << msb))) msb--;
+
+	m = (double) r / (double) ((uint64_t) 1 << msb);
+	z = (m - 1) / (m + 1);
+	z2 = z * z;
+	ln_m = 2 * z * (1 + z2 * (1.0 / 3 + z2 * (1.0 / 5 + z2 * (1.0 / 7 + z2 * (1.0 / 9 + z2 / 11)))));
+
+	return -(((msb - 32) * 0.69314718055994530942) + ln_m);
+}
+
+static unsigned int rc_load_hist_index(uint64_t usec)
+{
+	int msb = RC_LOAD_HIST_MAX_BIT;
+
+	if (usec < (1 << RC_LOAD_HIST_SUB_BITS)) return usec;
+	if (usec >> (RC_LOAD_HIST_MAX_BIT + 1)) return RC_LOAD_HIST_BUCKETS - 1;
+
+	while (!(usec & ((uint64_t) 1 << msb))) msb--;
+
+	return ((msb - RC_LOAD_HIST_SUB_BITS + 1) << RC_LOAD_HIST_SUB_BITS) +
+	       ((usec >> (msb - RC_LOAD_HIST_SUB_BITS)) & ((1 << RC_LOAD_HIST_SUB_BITS) - 1));
+}
+
+/*
+ *	The smallest latency which lands in a bucket.
+ */
+static uint64_t rc_load_hist_value(unsigned int idx)
+{
+	unsigned int msb;
+
+	if (idx < (1 << RC_LOAD_HIST_SUB_BITS)) return idx;
+
+	msb = (idx >> RC_LOAD_HIST_SUB_BITS) + RC_LOAD_HIST_SUB_BITS - 1;
+
+	return ((uint64_t) ((1 << RC_LOAD_HIST_SUB_BITS) + (idx & ((1 << RC_LOAD_HIST_SUB_BITS) - 1))))
+	       << (msb - RC_LOAD_HIST_SUB_BITS);
+}
+
+/*
+ *	Latency (in milliseconds) below which 'percentile' of the
+ *	responses were received.
+ */
+static double rc_load_percentile(rc_load_stats_t const *counters, double percentile)
+{
+	uint64_t	want, seen = 0;
+	unsigned int	i;
+
+	if (!counters->received) return 0;
+
+	want = (uint64_t) (counters->received * percentile);
+	if (want == 0) want = 1;
+
+	for (i = 0; i < RC_LOAD_HIST_BUCKETS; i++) {
+		seen += counters->latency[i];
+		if (seen >= want) break;
+	}
+
+	return rc_load_hist_value(i) / 1000.0;
+}
+
+static void rc_load_stats_add(rc_load_stats_t *to, rc_load_stats_t const *from)
+{
+	unsigned int i;
+
+	to->sent += from->sent;
+	to->received += from->received;
+	to->timeouts += from->timeouts;
+	to->no_id += from->no_id;
+	to->errors += from->errors;
+
+	for (i = 0; i < RC_LOAD_HIST_BUCKETS; i++) to->latency[i] += from->latency[i];
+}
+
+static void rc_load_stats_print(char const *prefix, rc_load_stats_t const *counters, uint64_t elapsed)
+{
+	double secs = elapsed / 1000000.0;
+
+	if (secs <= 0) secs = 1;
+
+	INFO("%s sent %" PRIu64 " (%.1f/s), received %" PRIu64 " (%.1f/s), "
+	     "timeouts %" PRIu64 ", no free ID %" PRIu64 ", errors %" PRIu64 ", "
+	     "latency p50 %.3fms p99 %.3fms p999 %.3fms",
+	     prefix, counters->sent, counters->sent / secs, counters->received, counters->received / secs,
+	     counters->timeouts, counters->no_id, counters->errors,
+	     rc_load_percentile(counters, 0.50), rc_load_percentile(counters, 0.99), rc_load_percentile(counters, 0.999));
+}
+
+/*
+ *	Requests read from the input files, which are shared
+ *	(read only) between the threads.
+ */
+static rc_request_t const **load_base;
+static unsigned int load_base_num;
+
+static void rc_load_signal(UNUSED int sig)
+{
+	atomic_store(&load_stop, true);
+}
+
+static rc_load_request_t *rc_load_request_alloc(TALLOC_CTX *ctx, rc_load_request_t **free_list, unsigned int idx)
+{
+	rc_load_request_t	*request;
+	rc_request_t const	*base = load_base[idx];
+
+	request = free_list[idx];
+	if (request) {
+		free_list[idx] = request->next;
+		request->next = NULL;
+		return request;
+	}
+
+	request = talloc_zero(ctx, rc_load_request_t);
+	if (!request) return NULL;
+
+	request->packet = fr_radius_alloc(request, false);
+	if (!request->packet) {
+	error:
+		talloc_free(request);
+		return NULL;
+	}
+
+	request->packet->code = base->packet->code;
+	request->packet->dst_ipaddr = base->packet->dst_ipaddr;
+	request->packet->dst_port = base->packet->dst_port;
+	request->packet->src_ipaddr = client_ipaddr;
+	request->packet->src_port = 0;
+	request->packet->sockfd = -1;
+
+	request->packet->vps = fr_pair_list_copy(request->packet, base->packet->vps);
+	if (base->packet->vps && !request->packet->vps) goto error;
+
+	request->base = base;
+	request->base_idx = idx;
+
+	return request;
+}
+
+/*
+ *	Release the ID, and put the request back on the free list.
+ */
+static void rc_load_request_done(fr_packet_list_t *tpl, rc_load_request_t **head, rc_load_request_t **tail,
+				 rc_load_request_t **free_list, rc_load_request_t *request)
+{
+	fr_packet_list_id_free(tpl, request->packet, true);
+	request->packet->id = -1;
+	TALLOC_FREE(request->packet->data);
+
+	if (request->prev) {
+		request->prev->next = request->next;
+	} else {
+		*head = request->next;
+	}
+	if (request->next) {
+		request->next->prev = request->prev;
+	} else {
+		*tail = request->prev;
+	}
+
+	request->prev = NULL;
+	request->next = free_list[request->base_idx];
+	free_list[request->base_idx] = request;
+}
+
+static void *rc_load_thread(void *arg)
+{
+	rc_load_thread_t	*t = arg;
+	TALLOC_CTX		*ctx;
+	fr_packet_list_t	*tpl;
+	rc_load_request_t	*head = NULL, *tail = NULL, **free_list;
+	rc_load_stats_t		*counters = &t->stats;
+	unsigned int		next_base = 0;
+	uint64_t		now, next_send, tmo = (uint64_t) (timeout * 1000000);
+	double			gap, carry = 0;
+	int			i, *fds;
+
+	ctx = talloc_new(NULL);
+	free_list = talloc_zero_array(ctx, rc_load_request_t *, load_base_num);
+	fds = talloc_array(ctx, int, load_sockets);
+	tpl = fr_packet_list_create(1);
+	if (!free_list || !fds || !tpl) {
+		ERROR("Thread %i: Out of memory", t->id);
+		atomic_store(&load_stop, true);
+		fr_packet_list_free(tpl);
+		talloc_free(ctx);
+		return NULL;
+	}
+	for (i = 0; i < load_sockets; i++) fds[i] = -1;
+
+	/*
+	 *	Each socket gives us another 256 IDs.
+	 */
+	for (i = 0; i < load_sockets; i++) {
+		fds[i] = fr_socket(&client_ipaddr, 0);
+		if (fds[i] < 0) {
+			ERROR("Thread %i: Failed opening socket: %s", t->id, fr_strerror());
+			goto finish;
+		}
+		if ((fr_nonblock(fds[i]) < 0) ||
+		    !fr_packet_list_socket_add(tpl, fds[i], IPPROTO_UDP, &server_ipaddr, server_port, NULL)) {
+			ERROR("Thread %i: Failed adding socket", t->id);
+			goto finish;
+		}
+	}
+
+	/*
+	 *	Each thread sends its share of the total rate.
+	 */
+	gap = (1000000.0 * load_threads) / load_rate;
+	next_send = rc_load_now();
+
+	while (!atomic_load(&load_stop)) {
+		fd_set		set;
+		struct timeval	tv;
+		uint64_t	wake;
+		int		max_fd;
+		RADIUS_PACKET	*reply;
+
+		now = rc_load_now();
+
+		pthread_mutex_lock(&t->mutex);
+
+		/*
+		 *	Send everything which is due, even if we've
+		 *	fallen behind.
+		 */
+		for (i = 0; (next_send <= now) && (i < RC_LOAD_BURST); i++) {
+			rc_load_request_t	*request;
+			double			delay;
+			int			j;
+
+			delay = (load_poisson ? (gap * rc_load_exp_rand()) : gap) + carry;
+			next_send += (uint64_t) delay;
+			carry = delay - (uint64_t) delay;
+
+			request = rc_load_request_alloc(ctx, free_list, next_base);
+			if (!request) {
+				counters->errors++;
+				continue;
+			}
+			next_base = (next_base + 1) % load_base_num;
+
+			if (!fr_packet_list_id_alloc(tpl, IPPROTO_UDP, &request->packet, NULL)) {
+				request->next = free_list[request->base_idx];
+				free_list[request->base_idx] = request;
+				counters->no_id++;
+				continue;
+			}
+
+			for (j = 0; j < 4; j++) ((uint32_t *) request->packet->vector)[j] = fr_rand();
+			if (request->base->password) radclient_password_update(request->packet, request->base->password);
+
+			request->sent = now;
+			request->prev = tail;
+			request->next = NULL;
+			if (tail) {
+				tail->next = request;
+			} else {
+				head = request;
+			}
+			tail = request;
+
+			if (fr_radius_send(request->packet, NULL, secret) < 0) {
+				rc_load_request_done(tpl, &head, &tail, free_list, request);
+				counters->errors++;
+				continue;
+			}
+			counters->sent++;
+		}
+
+		/*
+		 *	The timeout is the same for every request, so the
+		 *	oldest outstanding requests are at the head.
+		 */
+		while (head && ((head->sent + tmo) <= now)) {
+			rc_load_request_done(tpl, &head, &tail, free_list, head);
+			counters->timeouts++;
+		}
+
+		pthread_mutex_unlock(&t->mutex);
+
+		/*
+		 *	Wait for responses until the next request is
+		 *	due, or the oldest one times out.  Don't wait too
+		 *	long, so we notice when we're told to stop.
+		 */
+		wake = now + 100000;
+		if (next_send < wake) wake = next_send;
+		if (head && ((head->sent + tmo) < wake)) wake = head->sent + tmo;
+
+		FD_ZERO(&set);
+		max_fd = fr_packet_list_fd_set(tpl, &set);
+		if (max_fd < 0) break;
+
+		tv.tv_sec = 0;
+		tv.tv_usec = (wake > now) ? (wake - now) : 0;
+		if (select(max_fd, &set, NULL, NULL, &tv) <= 0) continue;
+
+		now = rc_load_now();
+
+		pthread_mutex_lock(&t->mutex);
+		for (i = 0; (i < RC_LOAD_BURST) && (reply = fr_packet_list_recv(tpl, &set)); i++) {
+			RADIUS_PACKET		**packet_p;
+			rc_load_request_t	*request;
+
+			reply->dst_ipaddr = client_ipaddr;
+
+			packet_p = fr_packet_list_find_byreply(tpl, reply);
+			if (!packet_p) {
+				/*
+				 *	Probably a reply to a request
+				 *	which has already timed out.
+				 */
+				fr_radius_free(&reply);
+				continue;
+			}
+			request = fr_packet2myptr(rc_load_request_t, packet, packet_p);
+
+			if (fr_radius_verify(reply, request->packet, secret) < 0) {
+				counters->errors++;
+			} else {
+				counters->received++;
+				counters->latency[rc_load_hist_index(now - request->sent)]++;
+			}
+
+			fr_radius_free(&reply);
+			rc_load_request_done(tpl, &head, &tail, free_list, request);
+		}
+		pthread_mutex_unlock(&t->mutex);
+	}
+
+finish:
+	/*
+	 *	If we failed, the other threads should stop too.
+	 */
+	atomic_store(&load_stop, true);
+
+	fr_packet_list_free(tpl);
+	for (i = 0; i < load_sockets; i++) if (fds[i] >= 0) close(fds[i]);
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+/*
+ *	Start the threads, and print the stats until we're done.
+ */
+static int rc_load_run(void)
+{
+	rc_load_thread_t	*threads;
+	rc_load_stats_t		*total, *interval;
+	rc_request_t		*this;
+	uint64_t		start, last, now;
+	unsigned int		i;
+	int			ret = 0;
+
+	for (this = request_head; this != NULL; this = this->next) load_base_num++;
+
+	load_base = talloc_array(NULL, rc_request_t const *, load_base_num);
+	threads = talloc_zero_array(load_base, rc_load_thread_t, load_threads);
+	total = talloc_zero(load_base, rc_load_stats_t);
+	interval = talloc_zero(load_base, rc_load_stats_t);
+	if (!load_base || !threads || !total || !interval) {
+		ERROR("Out of memory");
+		talloc_free(load_base);
+		return -1;
+	}
+
+	for (this = request_head, i = 0; this != NULL; this = this->next, i++) load_base[i] = this;
+
+	fr_set_signal(SIGINT, rc_load_signal);
+	fr_set_signal(SIGTERM, rc_load_signal);
+
+	INFO("Sending %u requests/s (%s arrivals) from %i threads with %i sockets each",
+	     load_rate, load_poisson ? "poisson" : "constant", load_threads, load_sockets);
+
+	start = last = rc_load_now();
+
+	for (i = 0; i < (unsigned int) load_threads; i++) {
+		threads[i].id = i;
+		pthread_mutex_init(&threads[i].mutex, NULL);
+		if (pthread_create(&threads[i].thread, NULL, rc_load_thread, &threads[i]) != 0) {
+			ERROR("Failed creating thread: %s", fr_syserror(errno));
+			atomic_store(&load_stop, true);
+			ret = -1;
+			break;
+		}
+		threads[i].running = true;
+	}
+
+	while (!atomic_load(&load_stop)) {
+		struct timeval tv;
+
+		tv.tv_sec = load_interval;
+		tv.tv_usec = 0;
+		select(0, NULL, NULL, NULL, &tv);	/* A signal wakes us early */
+
+		now = rc_load_now();
+		if (load_duration && ((now - start) >= ((uint64_t) load_duration * 1000000))) {
+			atomic_store(&load_stop, true);
+		}
+
+		memset(interval, 0, sizeof(*interval));
+		for (i = 0; i < (unsigned int) load_threads; i++) {
+			if (!threads[i].running) continue;
+
+			pthread_mutex_lock(&threads[i].mutex);
+			rc_load_stats_add(interval, &threads[i].stats);
+			memset(&threads[i].stats, 0, sizeof(threads[i].stats));
+			pthread_mutex_unlock(&threads[i].mutex);
+		}
+		rc_load_stats_add(total, interval);
+
+		{
+			char prefix[32];
+
+			snprintf(prefix, sizeof(prefix), "%.1fs:", (now - start) / 1000000.0);
+			rc_load_stats_print(prefix, interval, now - last);
+		}
+		last = now;
+	}
+
+	for (i = 0; i < (unsigned int) load_threads; i++) {
+		if (!threads[i].running) continue;
+
+		pthread_join(threads[i].thread, NULL);
+		pthread_mutex_destroy(&threads[i].mutex);
+	}
+
+	rc_load_stats_print("Total:", total, rc_load_now() - start);
+
+	talloc_free(load_base);
+
+	return ret;
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	int		c;
@@ -1179,6 +1681,9 @@ int main(int argc, char **argv)
 	while ((c = getopt(argc, argv, "46c:d:D:f:Fhi:n:p:qr:sS:t:vx"
 #ifdef WITH_TCP
 		"P:"
+#endif
+#ifdef HAVE_PTHREAD_H
+		"A:l:L:o:T:W:"
 #endif
 			   )) != EOF) switch (c) {
 		case '4':
@@ -1330,6 +1835,44 @@ int main(int argc, char **argv)
 			fr_debug_lvl++;
 			break;
 
+#ifdef HAVE_PTHREAD_H
+		case 'A':
+			if (strcmp(optarg, "poisson") == 0) {
+				load_poisson = true;
+			} else if (strcmp(optarg, "constant") == 0) {
+				load_poisson = false;
+			} else {
+				usage();
+			}
+			break;
+
+		case 'l':
+			load_duration = atoi(optarg);
+			if (load_duration <= 0) usage();
+			break;
+
+		case 'L':
+			if (!isdigit((int) *optarg)) usage();
+			load_rate = strtoul(optarg, NULL, 10);
+			if (load_rate == 0) usage();
+			break;
+
+		case 'o':
+			load_sockets = atoi(optarg);
+			if ((load_sockets <= 0) || (load_sockets > 128)) usage();
+			break;
+
+		case 'T':
+			load_threads = atoi(optarg);
+			if ((load_threads <= 0) || (load_threads > 256)) usage();
+			break;
+
+		case 'W':
+			load_interval = atoi(optarg);
+			if (load_interval <= 0) usage();
+			break;
+#endif
+
 		case 'h':
 		default:
 			usage();
@@ -1341,6 +1884,21 @@ int main(int argc, char **argv)
 		ERROR("Insufficient arguments");
 		usage();
 	}
+
+#ifdef HAVE_PTHREAD_H
+	if (load_rate) {
+#  ifdef WITH_TCP
+		if (proto) {
+			ERROR("Load generation is only supported over UDP");
+			usage();
+		}
+#  endif
+		if (load_rate < (uint32_t) load_threads) {
+			ERROR("Rate must be at least one request/s per thread");
+			usage();
+		}
+	}
+#endif
 	/*
 	 *	Mismatch between the binary and the libraries it depends on
 	 */
@@ -1471,6 +2029,22 @@ int main(int argc, char **argv)
 		}
 	}
 
+#ifdef HAVE_PTHREAD_H
+	if (load_rate) {
+		int rcode;
+
+		rcode = rc_load_run();
+
+		rbtree_free(filename_tree);
+		fr_packet_list_free(pl);
+		while (request_head) TALLOC_FREE(request_head);
+		talloc_free(dict);
+		talloc_free(secret);
+
+		exit(rcode < 0 ? 1 : 0);
+	}
+#endif
+
 	/*
 	 *	Walk over the packets to send, until
 	 *	we're all done.
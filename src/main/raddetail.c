@@ -0,0 +1,564 @@
+/*
+ * raddetail.c	Convert and benchmark detail files.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2016  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/detail_binary.h>
+#include <freeradius-devel/radpaths.h>
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#	include <sys/mman.h>
+#endif
+
+#define USEC (1000000)
+
+/*
+ *	A detail record, read from either format.
+ */
+typedef struct detail_record_t {
+	uint8_t		code;
+	time_t		timestamp;
+	bool		done;
+	fr_ipaddr_t	src_ipaddr;
+	fr_ipaddr_t	dst_ipaddr;
+	uint16_t	src_port;
+	uint16_t	dst_port;
+	VALUE_PAIR	*vps;
+} detail_record_t;
+
+/*
+ *	An input file, in either format.  Binary files are mapped.
+ */
+typedef struct detail_file_t {
+	char const	*filename;
+	bool		binary;
+
+	FILE		*fp;		//!< For text files.
+
+	uint8_t		*map;		//!< For binary files.
+	size_t		map_len;
+	size_t		offset;
+} detail_file_t;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: raddetail [OPTS] -b|-t <input> <output>\n");
+	fprintf(stderr, "       raddetail [OPTS] -B <input>\n");
+	fprintf(stderr, "  -b                     Convert a text detail file to the binary format.\n");
+	fprintf(stderr, "  -t                     Convert a binary detail file to the text format.\n");
+	fprintf(stderr, "  -B                     Benchmark how fast records can be read from a detail file.\n");
+	fprintf(stderr, "  -n <count>             Read the file this many times when benchmarking (default 1).\n");
+	fprintf(stderr, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+static int detail_file_open(detail_file_t *file, char const *filename)
+{
+	int		fd;
+	struct stat	buf;
+	uint8_t		magic[4];
+	ssize_t		len;
+
+	memset(file, 0, sizeof(*file));
+	file->filename = filename;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &buf) < 0) {
+		fr_strerror_printf("Failed to stat %s: %s", filename, fr_syserror(errno));
+	error:
+		close(fd);
+		return -1;
+	}
+
+	len = read(fd, magic, sizeof(magic));
+	if (len < 0) {
+		fr_strerror_printf("Failed reading %s: %s", filename, fr_syserror(errno));
+		goto error;
+	}
+
+	if (!fr_detail_binary_is_binary(magic, len)) {
+		if (lseek(fd, 0, SEEK_SET) < 0) {
+			fr_strerror_printf("Failed seeking in %s: %s", filename, fr_syserror(errno));
+			goto error;
+		}
+
+		file->fp = fdopen(fd, "r");
+		if (!file->fp) {
+			fr_strerror_printf("Failed opening %s: %s", filename, fr_syserror(errno));
+			goto error;
+		}
+		return 0;
+	}
+
+#ifndef HAVE_SYS_MMAN_H
+	fr_strerror_printf("Binary detail files are not supported on this system");
+	goto error;
+#else
+	file->binary = true;
+	file->map_len = buf.st_size;
+	file->map = mmap(NULL, file->map_len, PROT_READ, MAP_SHARED, fd, 0);
+	if (file->map == MAP_FAILED) {
+		fr_strerror_printf("Failed mapping %s: %s", filename, fr_syserror(errno));
+		file->map = NULL;
+		goto error;
+	}
+	close(fd);
+
+	return 0;
+#endif
+}
+
+static void detail_file_rewind(detail_file_t *file)
+{
+	if (file->binary) {
+		file->offset = 0;
+	} else {
+		rewind(file->fp);
+	}
+}
+
+static void detail_file_close(detail_file_t *file)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (file->map) munmap(file->map, file->map_len);
+#endif
+	if (file->fp) fclose(file->fp);
+	memset(file, 0, sizeof(*file));
+}
+
+/*
+ *	Parse an IP address, port, or one of the other pseudo
+ *	attributes written by rlm_detail.  Returns true if the line
+ *	was one of those.
+ */
+static bool detail_text_special(detail_record_t *rec, char const *key, char const *value)
+{
+	int i;
+
+	if (strcasecmp(key, "Packet-Type") == 0) {
+		for (i = 1; i < FR_MAX_PACKET_CODE; i++) {
+			if (fr_packet_codes[i] && (strcasecmp(value, fr_packet_codes[i]) == 0)) {
+				rec->code = i;
+				return true;
+			}
+		}
+		rec->code = atoi(value);
+		return true;
+	}
+
+	if (strcasecmp(key, "Timestamp") == 0) {
+		rec->timestamp = atoi(value);
+		return true;
+	}
+
+	if (strcasecmp(key, "Donestamp") == 0) {
+		rec->timestamp = atoi(value);
+		rec->done = true;
+		return true;
+	}
+
+	if ((strcasecmp(key, "Client-IP-Address") == 0) ||
+	    (strcasecmp(key, "Packet-Src-IP-Address") == 0)) {
+		if (fr_inet_hton(&rec->src_ipaddr, AF_INET, value, false) < 0) rec->src_ipaddr.af = AF_UNSPEC;
+		return true;
+	}
+
+	if (strcasecmp(key, "Packet-Src-IPv6-Address") == 0) {
+		if (fr_inet_hton(&rec->src_ipaddr, AF_INET6, value, false) < 0) rec->src_ipaddr.af = AF_UNSPEC;
+		return true;
+	}
+
+	if (strcasecmp(key, "Packet-Dst-IP-Address") == 0) {
+		if (fr_inet_hton(&rec->dst_ipaddr, AF_INET, value, false) < 0) rec->dst_ipaddr.af = AF_UNSPEC;
+		return true;
+	}
+
+	if (strcasecmp(key, "Packet-Dst-IPv6-Address") == 0) {
+		if (fr_inet_hton(&rec->dst_ipaddr, AF_INET6, value, false) < 0) rec->dst_ipaddr.af = AF_UNSPEC;
+		return true;
+	}
+
+	if (strcasecmp(key, "Packet-Src-Port") == 0) {
+		rec->src_port = atoi(value);
+		return true;
+	}
+
+	if (strcasecmp(key, "Packet-Dst-Port") == 0) {
+		rec->dst_port = atoi(value);
+		return true;
+	}
+
+	if ((strcasecmp(key, "Request-Authenticator") == 0) ||
+	    (strcasecmp(key, "Freeradius-Proxied-To") == 0)) return true;
+
+	return false;
+}
+
+/*
+ *	Read a text record, the same way the detail listener does.
+ *
+ *	Returns 1 if a record was read, 0 on EOF, -1 on error.
+ */
+static int detail_text_read(TALLOC_CTX *ctx, detail_file_t *file, detail_record_t *rec)
+{
+	char		buffer[2048];
+	char		key[256], op[8], value[1024];
+	bool		in_record = false;
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->code = PW_CODE_ACCOUNTING_REQUEST;
+	fr_cursor_init(&cursor, &rec->vps);
+
+	while (fgets(buffer, sizeof(buffer), file->fp)) {
+		if (!strchr(buffer, '\n')) {
+			fr_strerror_printf("Line too long, or truncated record in %s", file->filename);
+			fr_pair_list_free(&rec->vps);
+			return -1;
+		}
+
+		if (!in_record) {
+			if ((buffer[0] != '\n') && !isspace((int) buffer[0])) in_record = true;
+			continue;
+		}
+
+		if (buffer[0] == '\n') return 1;
+
+		if (sscanf(buffer, "%255s %7s %1023s", key, op, value) != 3) continue;
+		if (!strchr(op, '=')) continue;
+
+		if (detail_text_special(rec, key, value)) continue;
+
+		vp = NULL;
+		if ((fr_pair_list_afrom_str(ctx, buffer, &vp) > 0) && (vp != NULL)) {
+			fr_cursor_merge(&cursor, vp);
+		}
+	}
+
+	if (ferror(file->fp)) {
+		fr_strerror_printf("Failed reading %s: %s", file->filename, fr_syserror(errno));
+		fr_pair_list_free(&rec->vps);
+		return -1;
+	}
+
+	return in_record ? 1 : 0;
+}
+
+/*
+ *	Returns 1 if a record was read, 0 on EOF, -1 on error.
+ */
+static int detail_binary_read(TALLOC_CTX *ctx, detail_file_t *file, detail_record_t *rec)
+{
+	ssize_t			len;
+	fr_detail_binary_t	record;
+
+	if (file->offset >= file->map_len) return 0;
+
+	len = fr_detail_binary_decode(ctx, &record, file->map + file->offset, file->map_len - file->offset);
+	if (len <= 0) {
+		if (len == 0) fr_strerror_printf("Truncated record at offset %zu", file->offset);
+		return -1;
+	}
+	file->offset += len;
+
+	rec->code = record.code;
+	rec->timestamp = record.timestamp;
+	rec->done = (record.flags & FR_DETAIL_BINARY_DONE) != 0;
+	rec->src_ipaddr = record.src_ipaddr;
+	rec->dst_ipaddr = record.dst_ipaddr;
+	rec->src_port = record.src_port;
+	rec->dst_port = record.dst_port;
+	rec->vps = record.vps;
+
+	return 1;
+}
+
+static int detail_read(TALLOC_CTX *ctx, detail_file_t *file, detail_record_t *rec)
+{
+	if (file->binary) return detail_binary_read(ctx, file, rec);
+
+	return detail_text_read(ctx, file, rec);
+}
+
+static int detail_write_binary(FILE *out, detail_record_t *rec)
+{
+	uint8_t			buffer[FR_DETAIL_BINARY_MAX_LEN];
+	ssize_t			len;
+	RADIUS_PACKET		packet;
+	fr_detail_binary_hdr_t	*hdr = (fr_detail_binary_hdr_t *) buffer;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.code = rec->code;
+	packet.vps = rec->vps;
+	packet.src_ipaddr = rec->src_ipaddr;
+	packet.dst_ipaddr = rec->dst_ipaddr;
+	packet.src_port = rec->src_port;
+	packet.dst_port = rec->dst_port;
+
+	/*
+	 *	Text files may have a source address without a
+	 *	destination.
+	 */
+	if (packet.dst_ipaddr.af != packet.src_ipaddr.af) {
+		memset(&packet.dst_ipaddr.ipaddr, 0, sizeof(packet.dst_ipaddr.ipaddr));
+		packet.dst_ipaddr.af = packet.src_ipaddr.af;
+	}
+
+	len = fr_detail_binary_encode(buffer, sizeof(buffer), &packet, rec->timestamp,
+				      (rec->src_ipaddr.af != AF_UNSPEC), NULL, NULL);
+	if (len < 0) return -1;
+
+	if (rec->done) hdr->flags |= FR_DETAIL_BINARY_DONE;
+
+	if (fwrite(buffer, 1, len, out) != (size_t) len) {
+		fr_strerror_printf("Failed writing record: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int detail_write_text(FILE *out, detail_record_t *rec)
+{
+	char		timestamp[64];
+	char		ipaddr[INET6_ADDRSTRLEN];
+	time_t		when = rec->timestamp;
+	VALUE_PAIR	*vp;
+	vp_cursor_t	cursor;
+
+	CTIME_R(&when, timestamp, sizeof(timestamp));
+	fputs(timestamp, out);		/* includes the newline */
+
+	if (is_radius_code(rec->code)) {
+		fprintf(out, "\tPacket-Type = %s\n", fr_packet_codes[rec->code]);
+	} else {
+		fprintf(out, "\tPacket-Type = %u\n", rec->code);
+	}
+
+	if (rec->src_ipaddr.af != AF_UNSPEC) {
+		bool v6 = (rec->src_ipaddr.af == AF_INET6);
+
+		inet_ntop(rec->src_ipaddr.af, &rec->src_ipaddr.ipaddr, ipaddr, sizeof(ipaddr));
+		fprintf(out, "\tPacket-Src-IP%s-Address = %s\n", v6 ? "v6" : "", ipaddr);
+		inet_ntop(rec->dst_ipaddr.af, &rec->dst_ipaddr.ipaddr, ipaddr, sizeof(ipaddr));
+		fprintf(out, "\tPacket-Dst-IP%s-Address = %s\n", v6 ? "v6" : "", ipaddr);
+		fprintf(out, "\tPacket-Src-Port = %u\n", rec->src_port);
+		fprintf(out, "\tPacket-Dst-Port = %u\n", rec->dst_port);
+	}
+
+	for (vp = fr_cursor_init(&cursor, &rec->vps);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		vp->op = T_OP_EQ;
+		fr_pair_fprint(out, vp);
+	}
+
+	fprintf(out, "\t%s = %ld\n\n", rec->done ? "Donestamp" : "Timestamp", (long) rec->timestamp);
+
+	if (ferror(out)) {
+		fr_strerror_printf("Failed writing record: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int detail_convert(detail_file_t *in, char const *filename, bool to_binary)
+{
+	FILE		*out;
+	detail_record_t	rec;
+	uint64_t	records = 0;
+	int		ret;
+
+	if (in->binary == to_binary) {
+		fr_strerror_printf("%s is already in %s format", in->filename, to_binary ? "binary" : "text");
+		return -1;
+	}
+
+	out = fopen(filename, "w");
+	if (!out) {
+		fr_strerror_printf("Failed opening %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	while ((ret = detail_read(NULL, in, &rec)) > 0) {
+		ret = to_binary ? detail_write_binary(out, &rec) : detail_write_text(out, &rec);
+		fr_pair_list_free(&rec.vps);
+		if (ret < 0) break;
+		records++;
+	}
+
+	if (fclose(out) != 0) {
+		fr_strerror_printf("Failed writing %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+	if (ret < 0) return -1;
+
+	printf("Converted %" PRIu64 " records\n", records);
+
+	return 0;
+}
+
+/*
+ *	Read every record in the file, decoding the attributes into
+ *	VALUE_PAIRs, as the detail listener does when replaying it.
+ */
+static int detail_benchmark(detail_file_t *in, unsigned int iterations)
+{
+	detail_record_t	rec;
+	uint64_t	records = 0, vps = 0;
+	struct timeval	start, end;
+	double		elapsed;
+	unsigned int	i;
+	int		ret = 0;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		detail_file_rewind(in);
+
+		while ((ret = detail_read(NULL, in, &rec)) > 0) {
+			VALUE_PAIR	*vp;
+			vp_cursor_t	cursor;
+
+			for (vp = fr_cursor_init(&cursor, &rec.vps); vp; vp = fr_cursor_next(&cursor)) vps++;
+			fr_pair_list_free(&rec.vps);
+			records++;
+		}
+		if (ret < 0) return -1;
+	}
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) + ((double) (end.tv_usec - start.tv_usec) / USEC);
+	if (elapsed <= 0) elapsed = 1.0 / USEC;
+
+	printf("format:     %s\n", in->binary ? "binary" : "text");
+	printf("records:    %" PRIu64 "\n", records);
+	printf("attributes: %" PRIu64 "\n", vps);
+	printf("elapsed:    %.3fs\n", elapsed);
+	printf("records/s:  %.0f\n", records / elapsed);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	char		mode = '\0';
+	unsigned int	iterations = 1;
+	char const	*radius_dir = RADDBDIR;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+	detail_file_t	in;
+	int		ret;
+
+#ifndef NDEBUG
+	if (fr_fault_setup(getenv("PANIC_ACTION"), argv[0]) < 0) {
+		fr_perror("raddetail");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	while ((c = getopt(argc, argv, "btBn:d:D:xh")) != EOF) switch (c) {
+		case 'b':
+		case 't':
+		case 'B':
+			mode = c;
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations == 0) usage();
+			break;
+		case 'd':
+			radius_dir = optarg;
+			break;
+		case 'D':
+			dict_dir = optarg;
+			break;
+		case 'x':
+			fr_debug_lvl++;
+			fr_log_fp = stdout;
+			break;
+		case 'h':
+		default:
+			usage();
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (!mode) usage();
+	if ((mode == 'B') ? (argc != 1) : (argc != 2)) usage();
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	if (fr_dict_init(NULL, &dict, dict_dir, RADIUS_DICTIONARY, "radius") < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	if (fr_dict_read(dict, radius_dir, RADIUS_DICTIONARY) == -1) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	if (detail_file_open(&in, argv[0]) < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	if (mode == 'B') {
+		ret = detail_benchmark(&in, iterations);
+	} else {
+		ret = detail_convert(&in, argv[1], (mode == 'b'));
+	}
+	detail_file_close(&in);
+
+	if (ret < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	return 0;
+}
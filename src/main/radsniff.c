@@ -41,17 +41,42 @@ RCSID("$Id$")
 #  include <collectd/client.h>
 #endif
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 #define RS_ASSERT(_x) if (!(_x) && !fr_cond_assert(_x)) exit(1)
 
 static rs_t *conf;
 static struct timeval start_pcap = {0, 0};
-static char timestr[50];
+static _Thread_local char timestr[50];
 
-static rbtree_t *request_tree = NULL;
-static rbtree_t *link_tree = NULL;
-static fr_event_list_t *events;
+/*
+ *	When using worker threads, each worker has its own set of these.
+ */
+static _Thread_local rbtree_t *request_tree = NULL;
+static _Thread_local rbtree_t *link_tree = NULL;
+static _Thread_local fr_event_list_t *events;
+static _Thread_local TALLOC_CTX *request_ctx;		//!< Where tracked requests are allocated.
 static bool cleanup;
 
+#ifdef HAVE_PTHREAD_H
+static rs_worker_t *workers = NULL;			//!< Array of conf->workers workers.
+static _Thread_local rs_worker_t *current_worker = NULL;	//!< Worker this thread is running, if any.
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;	//!< Serialises packet logging, and
+									//!< pcap output between workers.
+
+#  define RS_THREADED		(current_worker != NULL)
+#  define RS_LOCK(_mutex)	if (current_worker) pthread_mutex_lock(_mutex)
+#  define RS_UNLOCK(_mutex)	if (current_worker) pthread_mutex_unlock(_mutex)
+#else
+#  define RS_THREADED		false
+#  define RS_LOCK(_mutex)
+#  define RS_UNLOCK(_mutex)
+#endif
+
 static int self_pipe[2] = {-1, -1};		//!< Signals from sig handlers
 
 typedef int (*rbcmp)(void const *, void const *);
@@ -90,6 +115,11 @@ static const FR_NAME_NUMBER rs_events[] = {
 };
 
 static void NEVER_RETURNS usage(int status);
+static void rs_signal_self(int sig);
+#ifdef HAVE_PTHREAD_H
+static void rs_worker_dispatch(rs_event_t *event, uint64_t count, struct pcap_pkthdr const *header,
+			       uint8_t const *data);
+#endif
 
 /** Fork and kill the parent process, writing out our PID
  *
@@ -483,7 +513,10 @@ static inline void rs_packet_print(rs_request_t *request, uint64_t count, rs_sta
 	if (!conf->logger) return;
 
 	if (request) request->logged = true;
+
+	RS_LOCK(&output_mutex);
 	conf->logger(count, status, handle, packet, elapsed, latency, response, body);
+	RS_UNLOCK(&output_mutex);
 }
 
 /** Query libpcap to see if it dropped any packets
@@ -503,8 +536,8 @@ static int rs_check_pcap_drop(fr_pcap_t *in)
 	int ret = 0;
 	struct pcap_stat pstats;
 
-	if (pcap_stats(in->handle, &pstats) != 0) {
-		ERROR("%s failed retrieving pcap stats: %s", in->name, pcap_geterr(in->handle));
+	if (fr_pcap_stats(in, &pstats) != 0) {
+		ERROR("%s failed retrieving pcap stats: %s", in->name, fr_strerror());
 		return -1;
 	}
 
@@ -651,8 +684,8 @@ static void rs_stats_print_fancy(rs_update_t *this, rs_stats_t *stats, struct ti
 	     in_p = in_p->next) {
 		struct pcap_stat pstats;
 
-		if (pcap_stats(in_p->handle, &pstats) != 0) {
-			ERROR("%s failed retrieving pcap stats: %s", in_p->name, pcap_geterr(in_p->handle));
+		if (fr_pcap_stats(in_p, &pstats) != 0) {
+			ERROR("%s failed retrieving pcap stats: %s", in_p->name, fr_strerror());
 			return;
 		}
 
@@ -764,8 +797,8 @@ static void rs_stats_print_csv(rs_update_t *this, rs_stats_t *stats, UNUSED stru
 	     in_p = in_p->next) {
 		struct pcap_stat pstats;
 
-		if (pcap_stats(in_p->handle, &pstats) != 0) {
-			ERROR("%s failed retrieving pcap stats: %s", in_p->name, pcap_geterr(in_p->handle));
+		if (fr_pcap_stats(in_p, &pstats) != 0) {
+			ERROR("%s failed retrieving pcap stats: %s", in_p->name, fr_strerror());
 			return;
 		}
 
@@ -787,6 +820,68 @@ static void rs_stats_print_csv(rs_update_t *this, rs_stats_t *stats, UNUSED stru
 	fprintf(stdout , "%s\n", buffer);
 }
 
+#ifdef HAVE_PTHREAD_H
+/** Add the counters from each worker to the main stats, and reset them
+ *
+ * @param stats to add the worker counters to.
+ * @return
+ *	- 0 on success.
+ *	- -1 if any of the workers dropped packets.
+ */
+static int rs_stats_merge_workers(rs_stats_t *stats)
+{
+	size_t		i;
+	size_t		rs_codes_len = (sizeof(rs_useful_codes) / sizeof(*rs_useful_codes));
+	int		w, j, ret = 0;
+
+	for (w = 0; w < conf->workers; w++) {
+		rs_worker_t	*worker = &workers[w];
+		uint64_t	dropped;
+
+		pthread_mutex_lock(&worker->queue_mutex);
+		dropped = worker->queue_dropped;
+		worker->queue_dropped = 0;
+		pthread_mutex_unlock(&worker->queue_mutex);
+
+		if (dropped) {
+			ERROR("Worker %i dropped %" PRIu64 " packets: Queue full", worker->id, dropped);
+			ret = -1;
+		}
+
+		pthread_mutex_lock(&worker->stats_mutex);
+		for (i = 0; i < rs_codes_len; i++) {
+			rs_latency_t *to = &stats->exchange[rs_useful_codes[i]];
+			rs_latency_t *from = &worker->stats->exchange[rs_useful_codes[i]];
+
+			to->interval.received_total += from->interval.received_total;
+			to->interval.linked_total += from->interval.linked_total;
+			to->interval.unlinked_total += from->interval.unlinked_total;
+			to->interval.reused_total += from->interval.reused_total;
+			to->interval.lost_total += from->interval.lost_total;
+			for (j = 0; j <= RS_RETRANSMIT_MAX; j++) {
+				to->interval.rt_total[j] += from->interval.rt_total[j];
+			}
+
+			to->interval.latency_total += from->interval.latency_total;
+			if (from->interval.latency_high > to->interval.latency_high) {
+				to->interval.latency_high = from->interval.latency_high;
+			}
+			if (from->interval.latency_low &&
+			    (!to->interval.latency_low || (from->interval.latency_low < to->interval.latency_low))) {
+				to->interval.latency_low = from->interval.latency_low;
+			}
+
+			memset(&from->interval, 0, sizeof(from->interval));
+		}
+
+		if (timercmp(&worker->stats->quiet, &stats->quiet, >)) stats->quiet = worker->stats->quiet;
+		pthread_mutex_unlock(&worker->stats_mutex);
+	}
+
+	return ret;
+}
+#endif
+
 /** Process stats for a single interval
  *
  */
@@ -805,6 +900,15 @@ static void rs_stats_process(void *ctx, struct timeval *now)
 
 	stats->intervals++;
 
+#ifdef HAVE_PTHREAD_H
+	if (workers && (rs_stats_merge_workers(stats) < 0)) {
+		ERROR("Muting stats for the next %i milliseconds", conf->stats.timeout);
+
+		rs_tv_add_ms(now, conf->stats.timeout, &stats->quiet);
+		goto clear;
+	}
+#endif
+
 	for (in_p = this->in;
 	     in_p;
 	     in_p = in_p->next) {
@@ -1070,7 +1174,10 @@ static void _rs_event(void *ctx, UNUSED struct timeval *now)
 {
 	rs_request_t *request = talloc_get_type_abort(ctx, rs_request_t);
 	request->event = NULL;
+
+	RS_LOCK(&current_worker->stats_mutex);
 	rs_packet_cleanup(request);
+	RS_UNLOCK(&current_worker->stats_mutex);
 }
 
 /** Wrapper around fr_packet_cmp to strip off the outer request struct
@@ -1108,6 +1215,7 @@ static inline int rs_response_to_pcap(rs_event_t *event, rs_request_t *request,
 		 *	packet to the PCAP file, looping over the buffer until we
 		 *	hit our start point.
 		 */
+		RS_LOCK(&output_mutex);
 		if (request->capture_p->header) do {
 			pcap_dump((void *)event->out->dumper, request->capture_p->header,
 				  request->capture_p->data);
@@ -1121,12 +1229,15 @@ static inline int rs_response_to_pcap(rs_event_t *event, rs_request_t *request,
 				request->capture_p = request->capture;
 			}
 		} while (request->capture_p != start);
+		RS_UNLOCK(&output_mutex);
 	}
 
 	/*
 	 *	Now log the response
 	 */
+	RS_LOCK(&output_mutex);
 	pcap_dump((void *)event->out->dumper, header, data);
+	RS_UNLOCK(&output_mutex);
 
 	return 0;
 }
@@ -1163,7 +1274,9 @@ static inline int rs_request_to_pcap(rs_event_t *event, rs_request_t *request, s
 		return 0;
 	}
 
+	RS_LOCK(&output_mutex);
 	pcap_dump((void *)event->out->dumper, header, data);
+	RS_UNLOCK(&output_mutex);
 
 	return 0;
 }
@@ -1177,6 +1290,26 @@ static inline int rs_request_to_pcap(rs_event_t *event, rs_request_t *request, s
 		_x = NULL;\
 	} while (0)
 
+/** Decode the attributes in a packet
+ *
+ * The decoder's log messages are suppressed, unless there are multiple
+ * threads, as fr_log_fp is shared between them.
+ */
+static int rs_packet_decode(RADIUS_PACKET *packet, RADIUS_PACKET *original)
+{
+	int	ret;
+	FILE	*log_fp;
+
+	if (RS_THREADED) return fr_radius_decode(packet, original, conf->radius_secret);
+
+	log_fp = fr_log_fp;
+	fr_log_fp = NULL;
+	ret = fr_radius_decode(packet, original, conf->radius_secret);
+	fr_log_fp = log_fp;
+
+	return ret;
+}
+
 static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkthdr const *header, uint8_t const *data)
 {
 	rs_stats_t		*stats = event->stats;
@@ -1196,7 +1329,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	bool			response;		/* Was it a response code */
 
 	decode_fail_t		reason;			/* Why we failed decoding the packet */
-	static uint64_t		captured = 0;
+	static atomic_uint_fast64_t captured = ATOMIC_VAR_INIT(0);
 
 	rs_status_t		status = RS_NORMAL;	/* Any special conditions (RTX, Unlinked, ID-Reused) */
 	RADIUS_PACKET		*current;		/* Current packet were processing */
@@ -1206,10 +1339,6 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 
 	memset(&search, 0, sizeof(search));
 
-	if (!start_pcap.tv_sec) {
-		start_pcap = header->ts;
-	}
-
 	if (RIDEBUG_ENABLED()) {
 		rs_time_print(timestr, sizeof(timestr), &header->ts);
 	}
@@ -1301,7 +1430,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	 *	recover once some requests timeout, so make an effort to deal
 	 *	with allocation failures gracefully.
 	 */
-	current = fr_radius_alloc(conf, false);
+	current = fr_radius_alloc(request_ctx, false);
 	if (!current) {
 		REDEBUG("Failed allocating memory to hold decoded packet");
 		rs_tv_add_ms(&header->ts, conf->stats.timeout, &stats->quiet);
@@ -1379,13 +1508,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	fr_radius_ok( does checks to verify the packet is actually valid.
 		 */
 		if (conf->decode_attrs) {
-			int ret;
-			FILE *log_fp = fr_log_fp;
-
-			fr_log_fp = NULL;
-			ret = fr_radius_decode(current, original ? original->expect : NULL, conf->radius_secret);
-			fr_log_fp = log_fp;
-			if (ret != 0) {
+			if (rs_packet_decode(current, original ? original->expect : NULL) != 0) {
 				fr_radius_free(&current);
 				REDEBUG("Failed decoding");
 				return;
@@ -1486,14 +1609,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	fr_radius_ok( does checks to verify the packet is actually valid.
 		 */
 		if (conf->decode_attrs) {
-			int ret;
-			FILE *log_fp = fr_log_fp;
-
-			fr_log_fp = NULL;
-			ret = fr_radius_decode(current, NULL, conf->radius_secret);
-			fr_log_fp = log_fp;
-
-			if (ret != 0) {
+			if (rs_packet_decode(current, NULL) != 0) {
 				fr_radius_free(&current);
 				REDEBUG("Failed decoding");
 				return;
@@ -1604,7 +1720,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	...nope it's a new request.
 		 */
 		} else {
-			original = talloc_zero(conf, rs_request_t);
+			original = talloc_zero(request_ctx, rs_request_t);
 			talloc_set_destructor(original, _request_free);
 
 			original->id = count;
@@ -1740,13 +1856,21 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		fr_radius_free(&current);
 	}
 
-	captured++;
 	/*
 	 *	We've hit our capture limit, break out of the event loop
 	 */
-	if ((conf->limit > 0) && (captured >= conf->limit)) {
-		INFO("Captured %" PRIu64 " packets, exiting...", captured);
-		fr_event_loop_exit(events, 1);
+	if ((atomic_fetch_add_explicit(&captured, 1, memory_order_relaxed) + 1) == conf->limit) {
+		INFO("Captured %" PRIu64 " packets, exiting...", conf->limit);
+
+		/*
+		 *	Workers have their own event loops, so tell
+		 *	the main thread to exit.
+		 */
+		if (RS_THREADED) {
+			rs_signal_self(SIGTERM);
+		} else {
+			fr_event_loop_exit(events, 1);
+		}
 	}
 }
 
@@ -1754,7 +1878,6 @@ static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 {
 	static uint64_t	count = 0;	/* Packets seen */
 	rs_event_t	*event = ctx;
-	pcap_t		*handle = event->in->handle;
 
 	int i;
 	int ret;
@@ -1770,7 +1893,7 @@ static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 		while (!fr_event_loop_exiting(el)) {
 			struct timeval now;
 
-			ret = pcap_next_ex(handle, &header, &data);
+			ret = fr_pcap_next(event->in, &header, &data);
 			if (ret == 0) {
 				/* No more packets available at this time */
 				return;
@@ -1786,10 +1909,12 @@ static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 				return;
 			}
 			if (ret < 0) {
-				ERROR("Error requesting next packet, got (%i): %s", ret, pcap_geterr(handle));
+				ERROR("Error requesting next packet, got (%i): %s", ret, fr_strerror());
 				goto done_file;
 			}
 
+			if (!start_pcap.tv_sec) start_pcap = header->ts;
+
 			/*
 			 *	Insert the stats processor with the timestamp
 			 *	of the first packet in the trace.
@@ -1814,17 +1939,25 @@ static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 	 *	We occasionally need to yield to allow events to run.
 	 */
 	for (i = 0; i < RS_FORCE_YIELD; i++) {
-		ret = pcap_next_ex(handle, &header, &data);
+		ret = fr_pcap_next(event->in, &header, &data);
 		if (ret == 0) {
 			/* No more packets available at this time */
 			return;
 		}
 		if (ret < 0) {
-			ERROR("Error requesting next packet, got (%i): %s", ret, pcap_geterr(handle));
+			ERROR("Error requesting next packet, got (%i): %s", ret, fr_strerror());
 			return;
 		}
 
+		if (!start_pcap.tv_sec) start_pcap = header->ts;
+
 		count++;
+#ifdef HAVE_PTHREAD_H
+		if (workers) {
+			rs_worker_dispatch(event, count, header, data);
+			continue;
+		}
+#endif
 		rs_packet_process(count, event, header, data);
 	}
 }
@@ -1983,6 +2116,294 @@ static void _unmark_link(void *request)
 	this->in_link_tree = false;
 }
 
+#ifdef HAVE_PTHREAD_H
+/** Hash the flow a packet belongs to
+ *
+ * The hash is symmetric, so a request and its response hash to the same
+ * value.  If we're linking requests using attributes, retransmissions may
+ * come from a different port, so only the addresses are used.
+ *
+ * @param in handle the packet was read from.
+ * @param header of the packet.
+ * @param data of the packet.
+ * @return the hash.
+ */
+static uint32_t rs_flow_hash(fr_pcap_t *in, struct pcap_pkthdr const *header, uint8_t const *data)
+{
+	uint8_t const		*p = data, *end = data + header->caplen;
+	ip_header_t const	*ip;
+	ip_header6_t const	*ip6;
+	udp_header_t const	*udp;
+	uint32_t		src, dst, hash;
+	ssize_t			len;
+	size_t			ihl;
+
+	len = fr_link_layer_offset(data, header->caplen, in->link_layer);
+	if ((len < 0) || ((p + len) >= end)) return 0;
+	p += len;
+
+	switch ((p[0] & 0xf0) >> 4) {
+	case 4:
+		if ((size_t)(end - p) < sizeof(ip_header_t)) return 0;
+		ip = (ip_header_t const *)p;
+		src = fr_hash(&ip->ip_src, sizeof(ip->ip_src));
+		dst = fr_hash(&ip->ip_dst, sizeof(ip->ip_dst));
+
+		ihl = (0x0f & ip->ip_vhl) * 4;
+		if ((ihl < 20) || (ihl > (size_t)(end - p))) return 0;
+		p += ihl;
+		break;
+
+	case 6:
+		if ((size_t)(end - p) < sizeof(ip_header6_t)) return 0;
+		ip6 = (ip_header6_t const *)p;
+		src = fr_hash(&ip6->ip_src, sizeof(ip6->ip_src));
+		dst = fr_hash(&ip6->ip_dst, sizeof(ip6->ip_dst));
+		p += sizeof(ip_header6_t);
+		break;
+
+	default:
+		return 0;
+	}
+
+	hash = src ^ dst;
+	if (conf->link_da_num > 0) return hash;
+
+	/*
+	 *	Ports, then the RADIUS ID.
+	 */
+	if ((size_t)(end - p) < (sizeof(udp_header_t) + 2)) return hash;
+	udp = (udp_header_t const *)p;
+
+	src = udp->src ^ udp->dst;
+	hash = fr_hash_update(&src, sizeof(src), hash);
+
+	return fr_hash_update(p + sizeof(udp_header_t) + 1, 1, hash);
+}
+
+/** Queue a copy of a packet for the worker processing its flow
+ *
+ * If the worker's queue is full, the packet is dropped, and the drop is
+ * reported with the next stats interval.
+ */
+static void rs_worker_dispatch(rs_event_t *event, uint64_t count, struct pcap_pkthdr const *header,
+			       uint8_t const *data)
+{
+	rs_worker_t	*w;
+	rs_work_t	*work;
+	bool		wake = false;
+
+	w = &workers[rs_flow_hash(event->in, header, data) % conf->workers];
+
+	work = malloc(sizeof(*work) + header->caplen);
+	if (!work) {
+		ERROR("Out of memory");
+		return;
+	}
+	work->event = event;
+	work->count = count;
+	work->header = *header;
+	memcpy(work->data, data, header->caplen);
+
+	pthread_mutex_lock(&w->queue_mutex);
+	if (w->queue_num == RS_WORKER_QUEUE_LEN) {
+		w->queue_dropped++;
+		pthread_mutex_unlock(&w->queue_mutex);
+		free(work);
+		return;
+	}
+	w->queue[(w->queue_head + w->queue_num) % RS_WORKER_QUEUE_LEN] = work;
+	if (w->queue_num++ == 0) wake = true;
+	pthread_mutex_unlock(&w->queue_mutex);
+
+	if (wake && (write(w->wake[1], "", 1) < 0) && (errno != EAGAIN)) {
+		ERROR("Failed waking worker %i: %s", w->id, fr_syserror(errno));
+	}
+}
+
+/** Process the packets queued for a worker
+ *
+ */
+static void rs_worker_wake(fr_event_list_t *el, int fd, void *ctx)
+{
+	rs_worker_t	*w = ctx;
+	uint8_t		buff[64];
+
+	while (read(fd, buff, sizeof(buff)) > 0);
+
+	for (;;) {
+		rs_work_t	*work;
+		rs_event_t	event;
+
+		pthread_mutex_lock(&w->queue_mutex);
+		if (w->stop) {
+			pthread_mutex_unlock(&w->queue_mutex);
+			fr_event_loop_exit(el, 1);
+			return;
+		}
+		if (w->queue_num == 0) {
+			pthread_mutex_unlock(&w->queue_mutex);
+			return;
+		}
+		work = w->queue[w->queue_head];
+		w->queue_head = (w->queue_head + 1) % RS_WORKER_QUEUE_LEN;
+		w->queue_num--;
+		pthread_mutex_unlock(&w->queue_mutex);
+
+		/*
+		 *	Same input and output, but our own
+		 *	events and stats.
+		 */
+		event = *work->event;
+		event.list = w->list;
+		event.stats = w->stats;
+
+		pthread_mutex_lock(&w->stats_mutex);
+		rs_packet_process(work->count, &event, &work->header, work->data);
+		pthread_mutex_unlock(&w->stats_mutex);
+
+		free(work);
+	}
+}
+
+static void *rs_worker_thread(void *arg)
+{
+	rs_worker_t *w = arg;
+
+	current_worker = w;
+	events = w->list;
+	request_tree = w->request_tree;
+	link_tree = w->link_tree;
+	request_ctx = w->ctx;
+
+	fr_event_loop(w->list);
+
+	/*
+	 *	The destructors of the requests remove them
+	 *	from this thread's trees.
+	 */
+	talloc_free(w->ctx);
+	w->ctx = NULL;
+
+	return NULL;
+}
+
+/** Start the worker threads
+ *
+ * @param num of workers to start.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int rs_workers_start(int num)
+{
+	int i;
+
+	workers = talloc_zero_array(conf, rs_worker_t, num);
+	if (!workers) {
+		ERROR("Out of memory");
+		return -1;
+	}
+
+	for (i = 0; i < num; i++) {
+		rs_worker_t *w = &workers[i];
+
+		w->id = i;
+		w->wake[0] = w->wake[1] = -1;
+
+		w->stats = talloc_zero(workers, rs_stats_t);
+		w->ctx = talloc_new(workers);
+		w->queue = talloc_array(workers, rs_work_t *, RS_WORKER_QUEUE_LEN);
+		w->list = fr_event_list_create(workers, NULL);
+		if (!w->stats || !w->ctx || !w->queue || !w->list) {
+			ERROR("Out of memory");
+			return -1;
+		}
+
+		w->request_tree = rbtree_create(w->ctx, (rbcmp) rs_packet_cmp, _unmark_request, 0);
+		if (!w->request_tree) {
+			ERROR("Failed creating request tree");
+			return -1;
+		}
+		if (conf->link_da_num > 0) {
+			w->link_tree = rbtree_create(w->ctx, (rbcmp) rs_rtx_cmp, _unmark_link, 0);
+			if (!w->link_tree) {
+				ERROR("Failed creating link tree");
+				return -1;
+			}
+		}
+
+		pthread_mutex_init(&w->stats_mutex, NULL);
+		pthread_mutex_init(&w->queue_mutex, NULL);
+
+		if ((pipe(w->wake) < 0) || (fr_nonblock(w->wake[0]) < 0) || (fr_nonblock(w->wake[1]) < 0)) {
+			ERROR("Failed creating worker pipe: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		if (!fr_event_fd_insert(w->list, 0, w->wake[0], rs_worker_wake, w)) {
+			ERROR("Failed inserting worker pipe descriptor: %s", fr_strerror());
+			return -1;
+		}
+
+		if (pthread_create(&w->thread, NULL, rs_worker_thread, w) != 0) {
+			ERROR("Failed creating worker thread: %s", fr_syserror(errno));
+			return -1;
+		}
+		w->running = true;
+	}
+
+	DEBUG("Started %i worker threads", num);
+
+	return 0;
+}
+
+/** Stop the worker threads, discarding any packets still queued
+ *
+ */
+static void rs_workers_stop(void)
+{
+	int i;
+
+	if (!workers) return;
+
+	for (i = 0; i < conf->workers; i++) {
+		rs_worker_t *w = &workers[i];
+
+		if (!w->running) continue;
+
+		pthread_mutex_lock(&w->queue_mutex);
+		w->stop = true;
+		pthread_mutex_unlock(&w->queue_mutex);
+
+		if (write(w->wake[1], "", 1) < 0 && (errno != EAGAIN)) {
+			ERROR("Failed waking worker %i: %s", w->id, fr_syserror(errno));
+		}
+	}
+
+	for (i = 0; i < conf->workers; i++) {
+		rs_worker_t *w = &workers[i];
+
+		if (w->running) {
+			pthread_join(w->thread, NULL);
+			pthread_mutex_destroy(&w->stats_mutex);
+			pthread_mutex_destroy(&w->queue_mutex);
+		}
+
+		while (w->queue_num > 0) {
+			free(w->queue[w->queue_head]);
+			w->queue_head = (w->queue_head + 1) % RS_WORKER_QUEUE_LEN;
+			w->queue_num--;
+		}
+
+		if (w->wake[0] >= 0) close(w->wake[0]);
+		if (w->wake[1] >= 0) close(w->wake[1]);
+	}
+
+	TALLOC_FREE(workers);
+}
+#endif
+
 #ifdef HAVE_COLLECTDC_H
 /** Re-open the collectd socket
  *
@@ -2095,6 +2516,7 @@ static void NEVER_RETURNS usage(int status)
 	fprintf(output, "  -l <attr>[,<attr>]    Output packet sig and a list of attributes.\n");
 	fprintf(output, "  -L <attr>[,<attr>]    Detect retransmissions using these attributes to link requests.\n");
 	fprintf(output, "  -m                    Don't put interface(s) into promiscuous mode.\n");
+	fprintf(output, "  -M                    Capture using a memory mapped ring buffer (Linux only).\n");
 	fprintf(output, "  -p <port>             Filter packets by port (default is 1812).\n");
 	fprintf(output, "  -P <pidfile>          Daemonize and write out <pidfile>.\n");
 	fprintf(output, "  -q                    Print less debugging information.\n");
@@ -2102,6 +2524,7 @@ static void NEVER_RETURNS usage(int status)
 	fprintf(output, "  -R <filter>           RADIUS attribute response filter.\n");
 	fprintf(output, "  -s <secret>           RADIUS secret.\n");
 	fprintf(output, "  -S                    Write PCAP data to stdout.\n");
+	fprintf(output, "  -t <threads>          Process captured packets using this many threads.\n");
 	fprintf(output, "  -v                    Show program version information.\n");
 	fprintf(output, "  -w <file>             Write output packets to file.\n");
 	fprintf(output, "  -x                    Print more debugging information.\n");
@@ -2154,6 +2577,7 @@ int main(int argc, char *argv[])
 
 	conf = talloc_zero(NULL, rs_t);
 	RS_ASSERT(conf);
+	request_ctx = conf;
 
 	stats = talloc_zero(conf, rs_stats_t);
 
@@ -2186,7 +2610,7 @@ int main(int argc, char *argv[])
 	/*
 	 *  Get options
 	 */
-	while ((opt = getopt(argc, argv, "ab:c:Cd:D:e:EFf:hi:I:l:L:mp:P:qr:R:s:Svw:xXW:T:P:N:O:")) != EOF) {
+	while ((opt = getopt(argc, argv, "ab:c:Cd:D:e:EFf:hi:I:l:L:mMp:P:qr:R:s:St:vw:xXW:T:P:N:O:")) != EOF) {
 		switch (opt) {
 		case 'a':
 		{
@@ -2283,6 +2707,15 @@ int main(int argc, char *argv[])
 			conf->promiscuous = false;
 			break;
 
+		case 'M':
+#ifdef HAVE_PCAP_RING
+			conf->ring = true;
+			break;
+#else
+			ERROR("Memory mapped capture not supported on this platform");
+			usage(64);
+#endif
+
 		case 'p':
 			port = atoi(optarg);
 			break;
@@ -2315,6 +2748,19 @@ int main(int argc, char *argv[])
 			conf->to_stdout = true;
 			break;
 
+		case 't':
+#ifdef HAVE_PTHREAD_H
+			conf->workers = atoi(optarg);
+			if ((conf->workers < 1) || (conf->workers > RS_WORKER_MAX)) {
+				ERROR("Number of threads must be between 1-%i", RS_WORKER_MAX);
+				usage(64);
+			}
+			break;
+#else
+			ERROR("Threads not supported on this platform");
+			usage(64);
+#endif
+
 		case 'v':
 #ifdef HAVE_COLLECTDC_H
 			INFO("%s, %s, collectdclient version %s", radsniff_version, pcap_lib_version(),
@@ -2414,6 +2860,12 @@ int main(int argc, char *argv[])
 		conf->from_stdin = false;
 	}
 
+	/* Packets in a file must be processed in order */
+	if (conf->workers && (conf->from_file || conf->from_stdin)) {
+		ERROR("Threads can only be used when capturing from interfaces");
+		usage(64);
+	}
+
 	/* Writing to file overrides stdout */
 	if (conf->to_file && conf->to_stdout) {
 		conf->to_stdout = false;
@@ -2693,6 +3145,9 @@ int main(int argc, char *argv[])
 		     in_p = in_p->next) {
 			in_p->promiscuous = conf->promiscuous;
 			in_p->buffer_pkts = conf->buffer_pkts;
+#ifdef HAVE_PCAP_RING
+			in_p->ring = conf->ring;
+#endif
 			if (fr_pcap_open(in_p) < 0) {
 				ERROR("Failed opening pcap handle (%s): %s", in_p->name, fr_strerror());
 				if (conf->from_auto || (in_p->type == PCAP_FILE_IN)) {
@@ -2826,6 +3281,14 @@ int main(int argc, char *argv[])
 		rs_daemonize(conf->pidfile);
 	}
 
+	/*
+	 *	Threads don't survive the fork, so start them
+	 *	after daemonizing.
+	 */
+#ifdef HAVE_PTHREAD_H
+	if (conf->workers && (rs_workers_start(conf->workers) < 0)) goto finish;
+#endif
+
 	/*
 	 *	Setup signal handlers so we always exit gracefully, ensuring output buffers are always
 	 *	flushed.
@@ -2843,6 +3306,9 @@ int main(int argc, char *argv[])
 	DEBUG2("Done sniffing");
 
 finish:
+#ifdef HAVE_PTHREAD_H
+	rs_workers_stop();
+#endif
 	cleanup = true;
 
 	/*
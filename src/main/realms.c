@@ -1270,6 +1270,8 @@ static int server_pool_add(realm_config_t *rc,
 			{ "client-balance", HOME_POOL_CLIENT_BALANCE },
 			{ "client-port-balance", HOME_POOL_CLIENT_PORT_BALANCE },
 			{ "keyed-balance", HOME_POOL_KEYED_BALANCE },
+			{ "consistent-hash", HOME_POOL_CONSISTENT_HASH },
+			{ "least-outstanding", HOME_POOL_LEAST_OUTSTANDING },
 			{ NULL, 0 }
 		};
 
@@ -2416,6 +2418,84 @@ void home_server_update_request(home_server_t *home, REQUEST *request)
 	request->proxy->home_server = home;
 }
 
+/** Update the moving average of a home server's response time
+ *
+ * @param[in] home server which responded.
+ * @param[in] sent when the request was sent.
+ * @param[in] received when the response was received.
+ */
+void home_server_response_time(home_server_t *home, struct timeval const *sent, struct timeval const *received)
+{
+	struct timeval	rtt;
+	uint32_t	usec;
+
+	if (timercmp(received, sent, <)) return;
+
+	timersub(received, sent, &rtt);
+
+	/*
+	 *	Anything over a minute is just "very slow".
+	 */
+	if (rtt.tv_sec >= 60) {
+		usec = 60 * 1000000;
+	} else {
+		usec = (rtt.tv_sec * 1000000) + rtt.tv_usec;
+	}
+	if (!usec) usec = 1;
+
+	/*
+	 *	The first response sets the average.  After that
+	 *	each response has a weight of 1/8.
+	 */
+	if (!home->response_time) {
+		home->response_time = usec << 3;
+		return;
+	}
+
+	home->response_time += usec - (home->response_time >> 3);
+}
+
+/*
+ *	Mix the bits of a hash, so that similar inputs give
+ *	unrelated outputs.  This is the MurmurHash3 finalizer.
+ */
+static inline uint32_t hash_mix(uint32_t hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+/*
+ *	Rendezvous (highest random weight) hashing.  Each home server
+ *	gets a score for the key, and the live server with the highest
+ *	score wins.  If a server goes away, only the keys for which it
+ *	had the highest score move to another server.
+ */
+static inline uint32_t home_server_hrw(home_server_t const *home, uint32_t hash)
+{
+	return hash_mix(hash ^ fr_hash_string(home->name ? home->name : home->log_name));
+}
+
+/*
+ *	The expected time for a new request to complete, i.e. the
+ *	number of requests ahead of it, multiplied by how long each
+ *	one takes.
+ *
+ *	If we don't know how long the server takes to respond, send
+ *	it one request to find out, but no more until it responds.
+ */
+static inline uint64_t home_server_cost(home_server_t const *home)
+{
+	if (!home->response_time) return home->currently_outstanding ? UINT64_MAX : 0;
+
+	return ((uint64_t) home->currently_outstanding + 1) * home->response_time;
+}
+
 home_server_t *home_server_ldb(char const *realmname,
 			     home_pool_t *pool, REQUEST *request)
 {
@@ -2424,7 +2504,9 @@ home_server_t *home_server_ldb(char const *realmname,
 	home_server_t	*found = NULL;
 	home_server_t	*zombie = NULL;
 	VALUE_PAIR	*vp;
-	uint32_t	hash;
+	uint32_t	hash = 0;
+	uint32_t	found_score = 0;
+	uint64_t	found_cost = 0;
 
 	/*
 	 *	Determine how to pick choose the home server.
@@ -2490,6 +2572,33 @@ home_server_t *home_server_ldb(char const *realmname,
 
 	case HOME_POOL_LOAD_BALANCE:
 	case HOME_POOL_FAIL_OVER:
+	case HOME_POOL_LEAST_OUTSTANDING:
+		start = 0;
+		break;
+
+		/*
+		 *	Hash the Load-Balance-Key if there is one, and
+		 *	the client IP address otherwise.  The server is
+		 *	chosen in the loop below.
+		 */
+	case HOME_POOL_CONSISTENT_HASH:
+		if ((vp = fr_pair_find_by_num(request->control, 0, PW_LOAD_BALANCE_KEY, TAG_ANY)) != NULL) {
+			hash = fr_hash(vp->vp_strvalue, vp->vp_length);
+
+		} else switch (request->packet->src_ipaddr.af) {
+		case AF_INET:
+			hash = fr_hash(&request->packet->src_ipaddr.ipaddr.ip4addr,
+					 sizeof(request->packet->src_ipaddr.ipaddr.ip4addr));
+			break;
+
+		case AF_INET6:
+			hash = fr_hash(&request->packet->src_ipaddr.ipaddr.ip6addr,
+					 sizeof(request->packet->src_ipaddr.ipaddr.ip6addr));
+			break;
+
+		default:
+			break;
+		}
 		start = 0;
 		break;
 
@@ -2575,6 +2684,47 @@ home_server_t *home_server_ldb(char const *realmname,
 			continue;
 		}
 
+		/*
+		 *	Use the live server with the highest score for
+		 *	this key.
+		 */
+		if (pool->type == HOME_POOL_CONSISTENT_HASH) {
+			uint32_t score = home_server_hrw(home, hash);
+
+			if (!found || (score > found_score)) {
+				found = home;
+				found_score = score;
+			}
+			continue;
+		}
+
+		/*
+		 *	Use the live server which should respond
+		 *	soonest.
+		 */
+		if (pool->type == HOME_POOL_LEAST_OUTSTANDING) {
+			uint64_t cost = home_server_cost(home);
+
+			if (found) RDEBUG3("PROXY %s %" PRIu64 "\t%s %" PRIu64,
+					   found->log_name, found_cost, home->log_name, cost);
+
+			if (!found || (cost < found_cost)) {
+				found = home;
+				found_cost = cost;
+				continue;
+			}
+
+			/*
+			 *	From the servers with the same cost,
+			 *	choose one at random.
+			 */
+			if ((cost == found_cost) &&
+			    (((count + 1) * (fr_rand() & 0xffff)) < (uint32_t) 0x10000)) {
+				found = home;
+			}
+			continue;
+		}
+
 		/*
 		 *	We've found the first "live" one.  Use that.
 		 */
@@ -27,6 +27,12 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 /** Per-request opaque data, added by modules
  *
  */
@@ -255,6 +261,216 @@ REQUEST *request_alloc_proxy(REQUEST *request)
 	return request->proxy;
 }
 
+/*
+ *	Every REQUEST_POOL_SAMPLE'th pool a thread frees has its
+ *	footprint measured.  talloc_total_size() walks every chunk in
+ *	the pool, so we don't want to do it for every request.
+ */
+#define REQUEST_POOL_SAMPLE		(16)
+
+/*
+ *	Approximate size of a talloc chunk header, plus alignment.
+ */
+#define REQUEST_POOL_CHUNK_OVERHEAD	(112)
+
+#define REQUEST_POOL_MIN		(2 * 1024)
+#define REQUEST_POOL_MAX		(1024 * 1024)
+
+/** Header at the start of every request pool
+ *
+ * talloc_get_size() returns 0 for a plain talloc_pool(), so the pool
+ * is allocated as a pooled object, and its size is recorded here.
+ */
+typedef struct request_pool_t {
+	uint32_t	size;				//!< Size of the pool, excluding this header.
+} request_pool_t;
+
+/** Empty pools kept by a thread, for re-use by the next request
+ *
+ */
+typedef struct request_pool_cache_t {
+	uint32_t	num;				//!< Number of pools in the cache.
+	request_pool_t	**pools;			//!< Pools with no children.
+} request_pool_cache_t;
+
+fr_thread_local_setup(request_pool_cache_t *, request_pool_cache)	/* macro */
+
+static _Thread_local uint32_t request_pool_sample;
+
+static atomic_uint_fast64_t request_pool_created = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t request_pool_reused = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t request_pool_sampled = ATOMIC_VAR_INIT(0);
+static atomic_uint_fast64_t request_pool_overflowed = ATOMIC_VAR_INIT(0);
+
+static atomic_uint_fast32_t request_pool_size = ATOMIC_VAR_INIT(0);	//!< 0 means talloc_pool_size.
+static atomic_uint_fast32_t request_pool_hwm = ATOMIC_VAR_INIT(0);	//!< Decaying high water mark of footprints.
+
+static uint32_t request_pool_size_get(void)
+{
+	uint32_t size;
+
+	size = atomic_load_explicit(&request_pool_size, memory_order_relaxed);
+	if (!size) size = main_config.talloc_pool_size;
+
+	return size;
+}
+
+/** Free the cached pools when the thread exits
+ *
+ */
+static void _request_pool_cache_free(void *arg)
+{
+	request_pool_cache_t	*cache = arg;
+	uint32_t		i;
+
+	for (i = 0; i < cache->num; i++) talloc_free(cache->pools[i]);
+	talloc_free(cache);
+}
+
+/** Measure how much of a pool a request used, and adjust the size of new pools to match
+ *
+ * Pools are sized from a high water mark of recent footprints, which
+ * decays slowly so that one unusually large request doesn't inflate
+ * the size of every pool forever.  New pools are allocated with 25%
+ * headroom over the mark.
+ *
+ * @param[in] ctx the pool, before its children are freed.
+ * @param[in] size of the pool.
+ */
+static void request_pool_measure(TALLOC_CTX *ctx, size_t size)
+{
+	size_t		used;
+	uint32_t	hwm, target, current;
+
+	used = talloc_total_size(ctx) - talloc_get_size(ctx);
+	used += (talloc_total_blocks(ctx) - 1) * REQUEST_POOL_CHUNK_OVERHEAD;
+
+	atomic_fetch_add_explicit(&request_pool_sampled, 1, memory_order_relaxed);
+	if (used > size) atomic_fetch_add_explicit(&request_pool_overflowed, 1, memory_order_relaxed);
+
+	/*
+	 *	Races between threads just lose a sample.
+	 */
+	hwm = atomic_load_explicit(&request_pool_hwm, memory_order_relaxed);
+	hwm -= hwm / 64;
+	if (used > hwm) hwm = (used > REQUEST_POOL_MAX) ? REQUEST_POOL_MAX : used;
+	atomic_store_explicit(&request_pool_hwm, hwm, memory_order_relaxed);
+
+	target = ((hwm + (hwm / 4)) + 1023) & ~1023;
+	if (target < REQUEST_POOL_MIN) target = REQUEST_POOL_MIN;
+	if (target > REQUEST_POOL_MAX) target = REQUEST_POOL_MAX;
+
+	/*
+	 *	Grow as soon as requests don't fit, but only shrink
+	 *	when pools are more than twice as big as they need
+	 *	to be.  Changing the size empties every cache.
+	 */
+	current = request_pool_size_get();
+	if ((target > current) || (target < (current / 2))) {
+		atomic_store_explicit(&request_pool_size, target, memory_order_relaxed);
+	}
+}
+
+/** Allocate a pool to hold a request, its packets and attributes
+ *
+ * Pools released by this thread with request_pool_free() are re-used
+ * if there are any, otherwise a new pool is allocated.
+ *
+ * @param[in] name to give the pool.
+ * @return
+ *	- A new, or recycled pool.
+ *	- NULL on error.
+ */
+TALLOC_CTX *request_pool_alloc(char const *name)
+{
+	request_pool_cache_t	*cache;
+	request_pool_t		*pool;
+	uint32_t		size;
+
+	cache = fr_thread_local_get(request_pool_cache);
+	if (cache && cache->num) {
+		pool = cache->pools[--cache->num];
+		atomic_fetch_add_explicit(&request_pool_reused, 1, memory_order_relaxed);
+	} else {
+		size = request_pool_size_get();
+
+		pool = talloc_pooled_object(NULL, request_pool_t, 1, size);
+		if (!pool) return NULL;
+		pool->size = size;
+		atomic_fetch_add_explicit(&request_pool_created, 1, memory_order_relaxed);
+	}
+	talloc_set_name_const(pool, name);
+
+	return pool;
+}
+
+/** Release a pool allocated by request_pool_alloc()
+ *
+ * Everything in the pool is freed.  If the pool is still the right
+ * size, and this thread's cache isn't full, the empty pool is kept
+ * for re-use.  talloc resets a pool once its last child is freed, so
+ * a recycled pool costs nothing to set up again.
+ *
+ * @param[in] ctx to release.
+ */
+void request_pool_free(TALLOC_CTX *ctx)
+{
+	request_pool_cache_t	*cache;
+	request_pool_t		*pool = ctx;
+	size_t			size;
+
+	if (!ctx) return;
+
+	size = pool->size;
+
+	if (request_pool_sample-- == 0) {
+		request_pool_sample = REQUEST_POOL_SAMPLE - 1;
+		request_pool_measure(ctx, size);
+	}
+
+	if (!main_config.talloc_pool_cache || (size != request_pool_size_get())) goto free;
+
+	cache = fr_thread_local_init(request_pool_cache, _request_pool_cache_free);
+	if (!cache) {
+		cache = talloc_zero(NULL, request_pool_cache_t);
+		if (!cache) goto free;
+
+		cache->pools = talloc_array(cache, request_pool_t *, main_config.talloc_pool_cache);
+		if (!cache->pools) {
+			talloc_free(cache);
+			goto free;
+		}
+		(void) fr_thread_local_set(request_pool_cache, cache);
+	}
+	if (cache->num >= talloc_array_length(cache->pools)) goto free;
+
+	/*
+	 *	If anything refused to be freed, the pool can't be
+	 *	reset, so don't re-use it.
+	 */
+	talloc_free_children(ctx);
+	if (talloc_total_blocks(ctx) != 1) goto free;
+
+	cache->pools[cache->num++] = pool;
+	return;
+
+free:
+	talloc_free(ctx);
+}
+
+/** Get statistics for request pools
+ *
+ * @param[out] stats to fill in.
+ */
+void request_pool_stats(request_pool_stats_t *stats)
+{
+	stats->created = atomic_load_explicit(&request_pool_created, memory_order_relaxed);
+	stats->reused = atomic_load_explicit(&request_pool_reused, memory_order_relaxed);
+	stats->sampled = atomic_load_explicit(&request_pool_sampled, memory_order_relaxed);
+	stats->overflowed = atomic_load_explicit(&request_pool_overflowed, memory_order_relaxed);
+	stats->size = request_pool_size_get();
+}
+
 
 /** Ensure opaque data is freed by binding its lifetime to the request_data_t
  *
@@ -42,6 +42,10 @@
           \-> reply                 \-> reply                 \-> access-reject/access-accept
  * @endverbatim
  *
+ * Entries are spread over #STATE_SHARDS shards by a hash of the State
+ * value, each with its own mutex, tree and cleanup list, so that
+ * concurrent authentications rarely contend for the same lock.
+ *
  * @copyright 2014 The FreeRADIUS server project
  */
 RCSID("$Id$")
@@ -50,6 +54,12 @@ RCSID("$Id$")
 #include <freeradius-devel/state.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 /** Holds a state value, and associated VALUE_PAIRs and data
  *
  */
@@ -94,8 +104,8 @@ typedef struct state_entry {
 
 	uint64_t		seq_start;			//!< Number of first request in this sequence.
 	time_t			cleanup;			//!< When this entry should be cleaned up.
-	struct state_entry	*prev;				//!< Previous entry in the cleanup list.
-	struct state_entry	*next;				//!< Next entry in the cleanup list.
+	struct state_entry	*prev;				//!< Previous entry in the shard's cleanup list.
+	struct state_entry	*next;				//!< Next entry in the shard's cleanup list.
 
 	int			tries;
 
@@ -106,16 +116,32 @@ typedef struct state_entry {
 	request_data_t		*data;				//!< Persistable request data, also parented ctx.
 } fr_state_entry_t;
 
-struct fr_state_tree_t {
-	uint64_t		id;				//!< Next ID to assign.
-	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
-								//!< timeout.
-	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
+/*
+ *	Must be a power of 2.
+ */
+#define STATE_SHARDS	(32)
+
+/** One partition of the state tree
+ *
+ * Every entry has the same timeout, so each shard's cleanup list is
+ * ordered by expiry time simply by appending new entries to the tail.
+ */
+typedef struct state_shard {
 	rbtree_t		*tree;				//!< rbtree used to lookup state value.
 
 	fr_state_entry_t	*head, *tail;			//!< Entries to expire.
-	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
 	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+} fr_state_shard_t;
+
+struct fr_state_tree_t {
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
+	atomic_uint_fast64_t	timed_out;			//!< Number of states that were cleaned up due to
+								//!< timeout.
+	atomic_uint_fast32_t	tracked;			//!< Number of entries in all shards.
+	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
+	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
+
+	fr_state_shard_t	shards[STATE_SHARDS];
 };
 
 fr_state_tree_t *global_state = NULL;
@@ -123,7 +149,7 @@ fr_state_tree_t *global_state = NULL;
 #define PTHREAD_MUTEX_LOCK if (main_config.spawn_workers) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (main_config.spawn_workers) pthread_mutex_unlock
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_tree_t *state, fr_state_shard_t *shard, fr_state_entry_t *entry);
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -136,34 +162,49 @@ static int state_entry_cmp(void const *one, void const *two)
 	return memcmp(a->state, b->state, sizeof(a->state));
 }
 
+/** Return the shard a state value lives in
+ *
+ * State values are usually random, but modules such as rlm_otp can
+ * provide their own, so we hash the whole value.
+ */
+static inline fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	return &state->shards[fr_hash(entry->state, sizeof(entry->state)) & (STATE_SHARDS - 1)];
+}
+
 /** Free the state tree
  *
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *this;
-
-	if (main_config.spawn_workers) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*this;
+	int			i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while (state->head) {
-		this = state->head;
-		state_entry_unlink(state, this);
-		talloc_free(this);
-	}
+	for (i = 0; i < STATE_SHARDS; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	for (this = state->head; this; this = this->next) DEBUG4("State %" PRIu64 " needs freeing prev was %" PRIu64 "", this->id, this->prev ? this->prev->id : 100000);
+		if (!shard->tree) continue;
 
-	/*
-	 *	Ensure we got *all* the entries
-	 */
-	rad_assert(!state->head);
+		if (main_config.spawn_workers) pthread_mutex_destroy(&shard->mutex);
 
-	/*
-	 *	Free the rbtree
-	 */
-	rbtree_free(state->tree);
+		while (shard->head) {
+			this = shard->head;
+			state_entry_unlink(state, shard, this);
+			talloc_free(this);
+		}
+
+		/*
+		 *	Ensure we got *all* the entries
+		 */
+		rad_assert(!shard->head);
+
+		/*
+		 *	Free the rbtree
+		 */
+		rbtree_free(shard->tree);
+	}
 
 	if (state == global_state) global_state = NULL;
 
@@ -180,12 +221,16 @@ static int _state_tree_free(fr_state_tree_t *state)
 fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, uint32_t max_sessions, uint32_t timeout)
 {
 	fr_state_tree_t *state;
+	int		i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	atomic_init(&state->id, 0);
+	atomic_init(&state->timed_out, 0);
+	atomic_init(&state->tracked, 0);
 
 	/*
 	 *	Create a break in the contexts.
@@ -196,31 +241,39 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, uint32_t max_sessions, uint
 	 */
 	fr_talloc_link_ctx(ctx, state);
 
-	if (main_config.spawn_workers && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
-		talloc_free(state);
-		return NULL;
-	}
+	talloc_set_destructor(state, _state_tree_free);
 
-	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
-	 */
-	state->tree = rbtree_create(NULL, state_entry_cmp, NULL, 0);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+	for (i = 0; i < STATE_SHARDS; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = rbtree_create(NULL, state_entry_cmp, NULL, 0);
+		if (!shard->tree) {
+			talloc_free(state);
+			return NULL;
+		}
+
+		if (main_config.spawn_workers && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			rbtree_free(shard->tree);
+			shard->tree = NULL;
+			talloc_free(state);
+			return NULL;
+		}
 	}
-	talloc_set_destructor(state, _state_tree_free);
 
 	return state;
 }
 
 /** Unlink an entry and remove if from the tree
  *
+ * @note Called with the shard's mutex held.
  */
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+static void state_entry_unlink(fr_state_tree_t *state, fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	fr_state_entry_t *prev, *next;
 
@@ -228,24 +281,26 @@ static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
 	next = entry->next;
 
 	if (prev) {
-		rad_assert(state->head != entry);
+		rad_assert(shard->head != entry);
 		prev->next = next;
-	} else if (state->head) {
-		rad_assert(state->head == entry);
-		state->head = next;
+	} else if (shard->head) {
+		rad_assert(shard->head == entry);
+		shard->head = next;
 	}
 
 	if (next) {
-		rad_assert(state->tail != entry);
+		rad_assert(shard->tail != entry);
 		next->prev = prev;
-	} else if (state->tail) {
-		rad_assert(state->tail == entry);
-		state->tail = prev;
+	} else if (shard->tail) {
+		rad_assert(shard->tail == entry);
+		shard->tail = prev;
 	}
 	entry->next = NULL;
 	entry->prev = NULL;
 
-	rbtree_deletebydata(state->tree, entry);
+	if (rbtree_deletebydata(shard->tree, entry)) {
+		atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+	}
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -288,46 +343,141 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	return 0;
 }
 
-/** Create a new state entry
+/** Unlink expired entries from a shard
+ *
+ * @note Called with the shard's mutex held.
  *
- * @note Called with the mutex held.
+ * @param[in] state tree the shard belongs to.
+ * @param[in] shard to clean up.
+ * @param[in] now the current time.
+ * @param[in] skip an entry which mustn't be unlinked.
+ * @param[in,out] free_next where to link the unlinked entries, so they can be freed
+ *	once the mutex is released.
+ * @return where to link the next entry to be freed.
  */
-static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request,
-					    RADIUS_PACKET *packet, fr_state_entry_t *old)
+static fr_state_entry_t **state_shard_expire(fr_state_tree_t *state, fr_state_shard_t *shard, time_t now,
+					     fr_state_entry_t *skip, fr_state_entry_t **free_next)
 {
-	size_t			i;
-	uint32_t		x;
-	time_t			now = time(NULL);
-	VALUE_PAIR		*vp;
-	fr_state_entry_t	*entry, *next;
-	fr_state_entry_t	*free_head = NULL, **free_next = &free_head;
+	fr_state_entry_t *entry, *next;
 
-	uint8_t			old_state[sizeof(old->state)];
-	int			old_tries = 0;
-
-	/*
-	 *	Clean up old entries.
-	 */
-	for (entry = state->head; entry != NULL; entry = next) {
+	for (entry = shard->head; entry != NULL; entry = next) {
 		next = entry->next;
 
-		if (entry == old) continue;
+		if (entry == skip) continue;
 
 		/*
 		 *	Too old, we can delete it.
 		 */
 		if (entry->cleanup < now) {
-			state_entry_unlink(state, entry);
+			state_entry_unlink(state, shard, entry);
 			*free_next = entry;
 			free_next = &(entry->next);
-			state->timed_out++;
+			atomic_fetch_add_explicit(&state->timed_out, 1, memory_order_relaxed);
 			continue;
 		}
 
 		break;
 	}
 
-	if (rbtree_num_elements(state->tree) >= (uint32_t) state->max_sessions) return NULL;
+	return free_next;
+}
+
+/** Free a list of entries unlinked by state_shard_expire()
+ *
+ * We do it outside of the mutex as freeing may involve significantly
+ * more work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed
+ * also, and it may have complex destructors associated with it.
+ */
+static void state_entry_free_list(fr_state_entry_t *head)
+{
+	fr_state_entry_t *entry, *next;
+
+	for (next = head; next;) {
+		entry = next;
+		next = entry->next;
+		talloc_free(entry);
+	}
+}
+
+/** Reserve a slot for a new entry
+ *
+ * The slot is taken atomically, so concurrent creates can't take us
+ * past max_sessions.  If we're full, expired entries may be sitting in
+ * shards which haven't seen a new entry for a while, so clean up every
+ * shard and try once more.
+ *
+ * The reservation becomes the count for the entry once it's inserted,
+ * and must be given back with #state_tree_release if it isn't.
+ *
+ * @note Called with no mutexes held.
+ *
+ * @return
+ *	- true if a slot was reserved.
+ *	- false if we're tracking too many sessions.
+ */
+static bool state_tree_reserve(fr_state_tree_t *state, time_t now)
+{
+	int i;
+
+	if (atomic_fetch_add_explicit(&state->tracked, 1, memory_order_relaxed) < state->max_sessions) return true;
+	atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+
+	for (i = 0; i < STATE_SHARDS; i++) {
+		fr_state_entry_t *free_head = NULL;
+
+		PTHREAD_MUTEX_LOCK(&state->shards[i].mutex);
+		(void) state_shard_expire(state, &state->shards[i], now, NULL, &free_head);
+		PTHREAD_MUTEX_UNLOCK(&state->shards[i].mutex);
+
+		state_entry_free_list(free_head);
+	}
+
+	if (atomic_fetch_add_explicit(&state->tracked, 1, memory_order_relaxed) < state->max_sessions) return true;
+	atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+
+	return false;
+}
+
+/** Give back a slot taken by #state_tree_reserve which wasn't used
+ *
+ */
+static inline void state_tree_release(fr_state_tree_t *state)
+{
+	atomic_fetch_sub_explicit(&state->tracked, 1, memory_order_relaxed);
+}
+
+/** Create a new state entry
+ *
+ * @note Called with the mutex of the old entry's shard held, if there is an old entry.
+ *	Returns with the mutex of the new entry's shard held, or with no mutexes held
+ *	on error.
+ *
+ * @param[in] state tree to insert the new entry into.
+ * @param[in] request the entry is being created for.
+ * @param[in] packet to add the State attribute to.
+ * @param[in] old_shard the shard containing old.
+ * @param[in] old entry (if any) to base the new entry on.
+ * @param[out] shard_p where to write the new entry's (locked) shard.
+ * @return
+ *	- A new entry.
+ *	- NULL on error.
+ */
+static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request,
+					    RADIUS_PACKET *packet, fr_state_shard_t *old_shard,
+					    fr_state_entry_t *old, fr_state_shard_t **shard_p)
+{
+	size_t			i;
+	uint32_t		x;
+	time_t			now = time(NULL);
+	VALUE_PAIR		*vp;
+	fr_state_entry_t	*entry;
+	fr_state_entry_t	*free_head = NULL, **free_next = &free_head;
+	fr_state_shard_t	*shard;
+
+	uint8_t			old_state[sizeof(old->state)];
+	int			old_tries = 0;
 
 	/*
 	 *	Record the information from the old state, we may base the
@@ -336,36 +486,34 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 *	Once we release the mutex, the state of old becomes indeterminate
 	 *	so we have to grab the values now.
 	 */
-	if (old) {
-		old_tries = old->tries;
-
-		memcpy(old_state, old->state, sizeof(old_state));
-
+	if (old_shard) {
 		/*
-		 *	The old one isn't used any more, so we can free it.
+		 *	Clean up old entries.
 		 */
-		if (!old->data) {
-			state_entry_unlink(state, old);
-			*free_next = old;
+		free_next = state_shard_expire(state, old_shard, now, old, free_next);
+
+		if (old) {
+			old_tries = old->tries;
+
+			memcpy(old_state, old->state, sizeof(old_state));
+
+			/*
+			 *	The old one isn't used any more, so we can free it.
+			 */
+			if (!old->data) {
+				state_entry_unlink(state, old_shard, old);
+				*free_next = old;
+			}
 		}
+		PTHREAD_MUTEX_UNLOCK(&old_shard->mutex);
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	/*
 	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
 	 */
-	for (next = free_head; next;) {
-		entry = next;
-		next = entry->next;
-		talloc_free(entry);
-	}
+	state_entry_free_list(free_head);
+
+	if (!state_tree_reserve(state, now)) return NULL;
 
 	/*
 	 *	Allocation doesn't need to occur inside the critical region
@@ -376,11 +524,11 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 */
 	entry = talloc_zero(NULL, fr_state_entry_t);
 	if (!entry) {
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
+		state_tree_release(state);
 		return NULL;
 	}
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -452,12 +600,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		       entry->id, hex, (uint64_t)entry->cleanup - now);
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (rbtree_num_elements(state->tree) >= (uint32_t)state->max_sessions) {
-		talloc_free(entry);
-		return NULL;
-	}
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -466,7 +608,30 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 */
 	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(request->server);
 
-	if (!rbtree_insert(state->tree, entry)) {
+	/*
+	 *	The shard depends on the final value, so we can
+	 *	only pick it now.
+	 */
+	shard = state_shard(state, entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+
+	/*
+	 *	Clean up old entries in the shard we're inserting into.
+	 */
+	if (shard->head && (shard->head->cleanup < now)) {
+		free_head = NULL;
+		(void) state_shard_expire(state, shard, now, NULL, &free_head);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+		state_entry_free_list(free_head);
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+	}
+
+	if (!rbtree_insert(shard->tree, entry)) {
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+		state_tree_release(state);
 		talloc_free(entry);
 		return NULL;
 	}
@@ -475,43 +640,63 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 *	Link it to the end of the list, which is implicitely
 	 *	ordered by cleanup time.
 	 */
-	if (!state->head) {
+	if (!shard->head) {
 		entry->prev = entry->next = NULL;
-		state->head = state->tail = entry;
+		shard->head = shard->tail = entry;
 	} else {
-		rad_assert(state->tail != NULL);
+		rad_assert(shard->tail != NULL);
 
-		entry->prev = state->tail;
-		state->tail->next = entry;
+		entry->prev = shard->tail;
+		shard->tail->next = entry;
 
 		entry->next = NULL;
-		state->tail = entry;
+		shard->tail = entry;
 	}
 
+	*shard_p = shard;
+
 	return entry;
 }
 
-/** Find the entry, based on the State attribute
+/** Find the shard for the State attribute in a packet, and build a key to search for
  *
+ * @param[in] state tree to search.
+ * @param[in] request the packet belongs to.
+ * @param[in] packet containing the State attribute.
+ * @param[out] key to pass to state_entry_find().
+ * @return
+ *	- The shard the entry would be in.
+ *	- NULL if the packet has no (valid) State attribute.
  */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet)
+static fr_state_shard_t *state_entry_key(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet,
+					 fr_state_entry_t *key)
 {
 	VALUE_PAIR *vp;
-	fr_state_entry_t *entry, my_entry;
 
 	vp = fr_pair_find_by_num(packet->vps, 0, PW_STATE, TAG_ANY);
 	if (!vp) return NULL;
 
-	if (vp->vp_length != sizeof(my_entry.state)) return NULL;
+	if (vp->vp_length != sizeof(key->state)) return NULL;
 
-	memcpy(my_entry.state, vp->vp_octets, sizeof(my_entry.state));
+	memcpy(key->state, vp->vp_octets, sizeof(key->state));
 
 	/*
 	 *	Make it unique for different virtual servers handling the same request
 	 */
-	my_entry.state_comp.server_hash ^= fr_hash_string(request->server);
+	key->state_comp.server_hash ^= fr_hash_string(request->server);
+
+	return state_shard(state, key);
+}
+
+/** Find the entry, based on the State attribute
+ *
+ * @note Called with the shard's mutex held.
+ */
+static fr_state_entry_t *state_entry_find(fr_state_shard_t *shard, fr_state_entry_t *key)
+{
+	fr_state_entry_t *entry;
 
-	entry = rbtree_finddata(state->tree, &my_entry);
+	entry = rbtree_finddata(shard->tree, key);
 
 #ifdef WITH_VERIFY_PTR
 	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
@@ -525,16 +710,20 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *reque
  */
 void fr_state_discard(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *original)
 {
-	fr_state_entry_t *entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, original);
+	shard = state_entry_key(state, request, original, &my_entry);
+	if (!shard) return;
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = state_entry_find(shard, &my_entry);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 		return;
 	}
-	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_entry_unlink(state, shard, entry);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	/*
 	 *	The state and request must be in the same state
@@ -561,8 +750,9 @@ void fr_state_discard(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *o
  */
 void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *packet)
 {
-	fr_state_entry_t *entry;
-	TALLOC_CTX *old_ctx = NULL;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
+	TALLOC_CTX		*old_ctx = NULL;
 
 	rad_assert(request->state == NULL);
 
@@ -575,23 +765,26 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
+	shard = state_entry_key(state, request, packet, &my_entry);
+	if (shard) {
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
 
-	entry = state_entry_find(state, request, packet);
-	if (entry) {
-		if (request->state_ctx) old_ctx = request->state_ctx;
+		entry = state_entry_find(shard, &my_entry);
+		if (entry) {
+			if (request->state_ctx) old_ctx = request->state_ctx;
 
-		request->seq_start = entry->seq_start;
-		request->state_ctx = entry->ctx;
-		request->state = entry->vps;
-		request_data_restore(request, entry->data);
+			request->seq_start = entry->seq_start;
+			request->state_ctx = entry->ctx;
+			request->state = entry->vps;
+			request_data_restore(request, entry->data);
 
-		entry->ctx = NULL;
-		entry->vps = NULL;
-		entry->data = NULL;
-	}
+			entry->ctx = NULL;
+			entry->vps = NULL;
+			entry->data = NULL;
+		}
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
 
 	if (request->state) {
 		RDEBUG2("Restored &session-state");
@@ -619,8 +812,9 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
  */
 bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET *original, RADIUS_PACKET *packet)
 {
-	fr_state_entry_t *entry, *old;
-	request_data_t *data;
+	fr_state_entry_t	*entry, *old = NULL, my_entry;
+	fr_state_shard_t	*shard, *old_shard = NULL;
+	request_data_t		*data;
 
 	request_data_by_persistance(&data, request, true);
 
@@ -631,17 +825,15 @@ bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 		rdebug_pair_list(L_DBG_LVL_2, request, request->state, "&session-state:");
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
-	old = original ? state_entry_find(state, request, original) :
-			 NULL;
-
-	entry = state_entry_create(state, request, packet, old);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
-		return false;
+	if (original) old_shard = state_entry_key(state, request, original, &my_entry);
+	if (old_shard) {
+		PTHREAD_MUTEX_LOCK(&old_shard->mutex);
+		old = state_entry_find(old_shard, &my_entry);
 	}
 
+	entry = state_entry_create(state, request, packet, old_shard, old, &shard);
+	if (!entry) return false;
+
 	rad_assert(entry->ctx == NULL);
 	rad_assert(request->state_ctx);
 
@@ -653,7 +845,7 @@ bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
 	request->state_ctx = NULL;
 	request->state = NULL;
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	rad_assert(request->state == NULL);
 	VERIFY_REQUEST(request);
@@ -665,7 +857,7 @@ bool fr_request_to_state(fr_state_tree_t *state, REQUEST *request, RADIUS_PACKET
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -673,7 +865,7 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	return atomic_load_explicit(&state->timed_out, memory_order_relaxed);
 }
 
 /** Return number of entries we're currently tracking
@@ -681,5 +873,5 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return (uint32_t)rbtree_num_elements(state->tree);
+	return atomic_load_explicit(&state->tracked, memory_order_relaxed);
 }
@@ -29,6 +29,12 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/heap.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 /*
  *	Other OS's have sem_init, OS X doesn't.
  */
@@ -100,6 +106,15 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
  *	needed, marking old "idle" threads as cancelled, etc.  That
  *	work is done with the mutex released (if at all possible).
  *	This practice minimizes contention on the mutex.
+ *
+ *	With "scheduler = sharded", there is no global mutex or heap.
+ *	A fixed number of threads (max_servers) is started, and each
+ *	thread has its own priority heap, protected by its own mutex.
+ *	The main thread places each request onto the least loaded of
+ *	two candidate threads.  A thread which runs out of work steals
+ *	the highest priority request from another thread's heap before
+ *	going to sleep.  The only shared state is an atomic count of
+ *	queued requests, which is used to enforce max_queue_size.
  */
 #  define THREAD_IDLE		(1)
 #  define THREAD_ACTIVE		(2)
@@ -122,6 +137,12 @@ typedef struct THREAD_HANDLE {
 	REQUEST			*request;
 
 	sem_t			semaphore;	//!< used to signal the thread when there are new requests
+
+	uint32_t		worker_id;	//!< Index into thread_pool.workers (sharded scheduler only).
+	pthread_mutex_t		queue_mutex;	//!< Protects the fields below (sharded scheduler only).
+	fr_heap_t		*queue;		//!< Requests waiting to be processed by this thread.
+	uint32_t		num_queued;	//!< Number of requests in the queue.
+	bool			sleeping;	//!< Thread is waiting on the semaphore, and needs a sem_post().
 } THREAD_HANDLE;
 
 #endif	/* WITH_GCD */
@@ -168,7 +189,7 @@ typedef struct THREAD_POOL {
 	uint32_t	request_count;
 	time_t		time_last_spawned;
 	uint32_t	cleanup_delay;
-	bool		stop_flag;
+	atomic_bool	stop_flag;		//!< Read by the workers without holding a lock.
 
 #ifdef WITH_STATS
 	fr_pps_t	pps_in, pps_out;
@@ -178,6 +199,7 @@ typedef struct THREAD_POOL {
 #endif
 
 	char const	*queue_priority;
+	char const	*scheduler;
 
 	/*
 	 *	To ensure only one thread at a time touches the scheduler.
@@ -213,6 +235,26 @@ typedef struct THREAD_POOL {
 
 	THREAD_HANDLE	*exited_head;
 	THREAD_HANDLE	*exited_tail;
+
+	/*
+	 *	For the sharded scheduler.  The workers array is fixed
+	 *	after thread_pool_init(), so it can be read without
+	 *	holding any lock.
+	 */
+	bool		sharded;
+	uint32_t	num_workers;
+	THREAD_HANDLE	**workers;
+	bool		shared_enqueue;		//!< request_enqueue() is called from more
+						//!< than one thread.
+#ifdef WITH_STATS
+	pthread_mutex_t	pps_mutex;		//!< Protects pps_in, if shared_enqueue is set.
+#endif
+
+	atomic_uint_fast32_t	next_worker;
+
+	atomic_uint_fast32_t	num_queued_sharded;
+	atomic_uint_fast32_t	num_sleeping;
+	atomic_uint_fast64_t	num_stolen;
 #endif	/* WITH_GCD */
 } THREAD_POOL;
 
@@ -238,6 +280,7 @@ static const CONF_PARSER thread_config[] = {
 	{ FR_CONF_POINTER("cleanup_delay", PW_TYPE_INTEGER, &thread_pool.cleanup_delay), .dflt = "5" },
 	{ FR_CONF_POINTER("max_queue_size", PW_TYPE_INTEGER, &thread_pool.max_queue_size), .dflt = "65536" },
 	{ FR_CONF_POINTER("queue_priority", PW_TYPE_STRING, &thread_pool.queue_priority), .dflt = NULL },
+	{ FR_CONF_POINTER("scheduler", PW_TYPE_STRING, &thread_pool.scheduler), .dflt = "global" },
 #ifdef WITH_STATS
 #ifdef WITH_ACCOUNTING
 	{ FR_CONF_POINTER("auto_limit_acct", PW_TYPE_BOOLEAN, &thread_pool.auto_limit_acct) },
@@ -293,17 +336,116 @@ static void reap_children(void)
 #endif /* WNOHANG */
 
 #ifndef WITH_GCD
-static REQUEST *request_dequeue(void);
+static REQUEST *request_dequeue(THREAD_HANDLE *worker);
+
+/*
+ *	The number of requests waiting to be processed.
+ */
+static inline uint32_t request_queue_len(void)
+{
+	if (thread_pool.sharded) return atomic_load_explicit(&thread_pool.num_queued_sharded, memory_order_relaxed);
+
+	return thread_pool.num_queued;
+}
+
+/*
+ *	Wake up a sleeping worker.  Returns true if the worker was
+ *	sleeping, and has been signalled.
+ */
+static bool worker_wake(THREAD_HANDLE *thread)
+{
+	bool wake;
+
+	pthread_mutex_lock(&thread->queue_mutex);
+	wake = thread->sleeping;
+	if (wake) {
+		thread->sleeping = false;
+		atomic_fetch_sub_explicit(&thread_pool.num_sleeping, 1, memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&thread->queue_mutex);
+
+	if (wake) sem_post(&thread->semaphore);
+
+	return wake;
+}
+
+/*
+ *	Add a request to one of the per-thread queues.
+ *
+ *	Called ONLY from request_enqueue().  Only the queue mutex of
+ *	the chosen thread is taken, so listener threads can call this
+ *	concurrently.
+ */
+static void request_enqueue_sharded(REQUEST *request)
+{
+	THREAD_HANDLE	*thread, *other;
+	uint32_t	i, start, load, other_load;
+
+	/*
+	 *	Pick two threads, and use the one with the shorter
+	 *	queue.  A busy thread counts as having one more
+	 *	request queued than a sleeping one.  The counters are
+	 *	read without locks, as a stale value only means a
+	 *	slightly worse choice.
+	 */
+	start = atomic_fetch_add_explicit(&thread_pool.next_worker, 1, memory_order_relaxed) % thread_pool.num_workers;
+	thread = thread_pool.workers[start];
+	other = thread_pool.workers[fr_rand() % thread_pool.num_workers];
+
+	load = thread->num_queued + !thread->sleeping;
+	other_load = other->num_queued + !other->sleeping;
+	if (other_load < load) thread = other;
+
+	pthread_mutex_lock(&thread->queue_mutex);
+	if (!fr_heap_insert(thread->queue, request)) {
+		pthread_mutex_unlock(&thread->queue_mutex);
+		request->process(request, FR_ACTION_DONE);
+		return;
+	}
+	thread->num_queued++;
+	atomic_fetch_add_explicit(&thread_pool.num_queued_sharded, 1, memory_order_relaxed);
+	pthread_mutex_unlock(&thread->queue_mutex);
+
+	if (worker_wake(thread)) return;
+
+	/*
+	 *	The owner of the queue is busy.  Wake up a sleeping
+	 *	thread (if any), so that it can steal the request.
+	 */
+	if (atomic_load_explicit(&thread_pool.num_sleeping, memory_order_relaxed) == 0) return;
+
+	for (i = 0; i < thread_pool.num_workers; i++) {
+		other = thread_pool.workers[(start + i) % thread_pool.num_workers];
+		if ((other == thread) || !other->sleeping) continue;
+
+		if (worker_wake(other)) return;
+	}
+}
+
+/** Note that request_enqueue() will be called from more than one thread
+ *
+ * Listener threads each run their own event loop, and enqueue the
+ * requests they read directly.  The global scheduler already locks
+ * around everything.  The sharded scheduler only locks the queue it
+ * adds the request to, plus the packet rate counters when
+ * auto_limit_acct is enabled.
+ */
+void thread_pool_shared_enqueue(void)
+{
+	thread_pool.shared_enqueue = true;
+}
 
 /*
  *	Add a request to the list of waiting requests.
- *	This function gets called ONLY from the main handler thread...
+ *	This function gets called ONLY from threads which run an
+ *	event loop (the main thread, and any listener threads).
  *
  *	This function should never fail.
  */
 void request_enqueue(REQUEST *request)
 {
 	THREAD_HANDLE *thread;
+	bool locked;
 
 	request->component = "<core>";
 
@@ -333,14 +475,19 @@ void request_enqueue(REQUEST *request)
 	/*
 	 *	Give the request to a thread, doing as little work as
 	 *	possible in the contended region.
+	 *
+	 *	The sharded scheduler has no global mutex.  It only
+	 *	locks the queue of the thread it picks, so enqueueing
+	 *	from listener threads doesn't serialise them.
 	 */
-	pthread_mutex_lock(&thread_pool.mutex);
+	locked = !thread_pool.sharded;
+	if (locked) pthread_mutex_lock(&thread_pool.mutex);
 
 	/*
 	 *	If we're too busy, don't do anything.
 	 */
-	if ((thread_pool.num_queued + 1) >= thread_pool.max_queue_size) {
-		pthread_mutex_unlock(&thread_pool.mutex);
+	if ((request_queue_len() + 1) >= thread_pool.max_queue_size) {
+		if (locked) pthread_mutex_unlock(&thread_pool.mutex);
 
 		/*
 		 *	Mark the request as done.
@@ -389,7 +536,7 @@ void request_enqueue(REQUEST *request)
 		 *	SOME of the new accounting packets.
 		 */
 		if ((request->packet->code == PW_CODE_ACCOUNTING_REQUEST) &&
-		    (thread_pool.num_queued > (thread_pool.max_queue_size / 2)) &&
+		    (request_queue_len() > (thread_pool.max_queue_size / 2)) &&
 		    (thread_pool.pps_in.pps_now > thread_pool.pps_out.pps_now)) {
 			uint32_t prob;
 			uint32_t keep;
@@ -410,8 +557,8 @@ void request_enqueue(REQUEST *request)
 			 *	If the queue is larger than our dice
 			 *	roll, we throw the packet away.
 			 */
-			if (thread_pool.num_queued > keep) {
-				pthread_mutex_unlock(&thread_pool.mutex);
+			if (request_queue_len() > keep) {
+				if (locked) pthread_mutex_unlock(&thread_pool.mutex);
 				goto done;
 			}
 		}
@@ -422,16 +569,23 @@ void request_enqueue(REQUEST *request)
 		 *	Calculate the instantaneous arrival rate into
 		 *	the queue.
 		 */
+		if (!locked && thread_pool.shared_enqueue) pthread_mutex_lock(&thread_pool.pps_mutex);
 		thread_pool.pps_in.pps = rad_pps(&thread_pool.pps_in.pps_old,
 						 &thread_pool.pps_in.pps_now,
 						 &thread_pool.pps_in.time_old,
 						 &now);
 
 		thread_pool.pps_in.pps_now++;
+		if (!locked && thread_pool.shared_enqueue) pthread_mutex_unlock(&thread_pool.pps_mutex);
 	}
 #endif	/* WITH_ACCOUNTING */
 #endif
 
+	if (thread_pool.sharded) {
+		request_enqueue_sharded(request);
+		return;
+	}
+
 	/*
 	 *	If there's a queue, OR no idle threads, put the
 	 *	request into the queue, in priority order.
@@ -458,7 +612,7 @@ void request_enqueue(REQUEST *request)
 		 *	idle thread.
 		 */
 		thread = thread_pool.idle_head;
-		request = request_dequeue();
+		request = request_dequeue(NULL);
 		if (!request) {
 			pthread_mutex_unlock(&thread_pool.mutex);
 			return;
@@ -522,28 +676,38 @@ void request_enqueue(REQUEST *request)
 /*
  *	Remove a request from the queue.
  *
- *	Called with the thread mutex held.
+ *	If worker is NULL, the global queue is used, and this function
+ *	must be called with the thread pool mutex held.  Otherwise, the
+ *	worker's queue is used, and the worker's queue_mutex must be
+ *	held.
  */
-static REQUEST *request_dequeue(void)
+static REQUEST *request_dequeue(THREAD_HANDLE *worker)
 {
 	time_t blocked;
 	static time_t last_complained = 0;
 	static time_t total_blocked = 0;
 	int num_blocked = 0;
 	REQUEST *request = NULL;
+	fr_heap_t *heap = worker ? worker->queue : thread_pool.idle_heap;
 
 retry:
 	/*
 	 *	Grab the first entry.
 	 */
-	request = fr_heap_peek(thread_pool.idle_heap);
+	request = fr_heap_peek(heap);
 	if (!request) {
-		rad_assert(thread_pool.num_queued == 0);
+		rad_assert(!worker || (worker->num_queued == 0));
+		rad_assert(worker || (thread_pool.num_queued == 0));
 		return NULL;
 	}
 
-	(void) fr_heap_extract(thread_pool.idle_heap, request);
-	thread_pool.num_queued--;
+	(void) fr_heap_extract(heap, request);
+	if (worker) {
+		worker->num_queued--;
+		atomic_fetch_sub_explicit(&thread_pool.num_queued_sharded, 1, memory_order_relaxed);
+	} else {
+		thread_pool.num_queued--;
+	}
 
 	VERIFY_REQUEST(request);
 
@@ -588,6 +752,65 @@ retry:
 }
 
 
+/*
+ *	Process one request in the current thread.
+ */
+static void request_run(THREAD_HANDLE *thread, REQUEST *request)
+{
+	thread->request = request;
+
+#ifdef WITH_ACCOUNTING
+	if ((request->packet->code == PW_CODE_ACCOUNTING_REQUEST) &&
+	    thread_pool.auto_limit_acct) {
+		VALUE_PAIR *vp;
+
+		vp = radius_pair_create(request, &request->control,
+				       181, VENDORPEC_FREERADIUS);
+		if (vp) vp->vp_integer = thread_pool.pps_in.pps;
+
+		vp = radius_pair_create(request, &request->control,
+				       182, VENDORPEC_FREERADIUS);
+		if (vp) vp->vp_integer = thread_pool.pps_in.pps;
+
+		vp = radius_pair_create(request, &request->control,
+				       183, VENDORPEC_FREERADIUS);
+		if (vp) {
+			vp->vp_integer = thread_pool.max_queue_size - request_queue_len();
+			vp->vp_integer *= 100;
+			vp->vp_integer /= thread_pool.max_queue_size;
+		}
+	}
+#endif
+
+	thread->request_count++;
+
+	DEBUG2("Thread %d handling request %" PRIu64 ", (%d handled so far)",
+	       thread->thread_num, request->number,
+	       thread->request_count);
+
+	request->child_pid = thread->pthread_id;
+	request->component = "<core>";
+	request->module = NULL;
+	request->child_state = REQUEST_RUNNING;
+	request->log.unlang_indent = 0;
+
+	request->process(request, FR_ACTION_RUN);
+
+	thread->request = NULL;
+
+	/*
+	 *	Clean up any children we exec'd.
+	 */
+	reap_children();
+
+#  ifdef HAVE_OPENSSL_ERR_H
+	/*
+	 *	Clear the error queue for the current thread.
+	 */
+	ERR_clear_error();
+#  endif
+}
+
 /*
  *	The main thread handler for requests.
  *
@@ -680,61 +903,10 @@ static void *request_handler_thread(void *arg)
 		 *	The server is exiting.  Don't dequeue any
 		 *	requests.
 		 */
-		if (thread_pool.stop_flag) break;
+		if (atomic_load(&thread_pool.stop_flag)) break;
 
 		rad_assert(thread->request != NULL);
-		request = thread->request;
-
-#ifdef WITH_ACCOUNTING
-		if ((thread->request->packet->code == PW_CODE_ACCOUNTING_REQUEST) &&
-		    thread_pool.auto_limit_acct) {
-			VALUE_PAIR *vp;
-
-			vp = radius_pair_create(request, &request->control,
-					       181, VENDORPEC_FREERADIUS);
-			if (vp) vp->vp_integer = thread_pool.pps_in.pps;
-
-			vp = radius_pair_create(request, &request->control,
-					       182, VENDORPEC_FREERADIUS);
-			if (vp) vp->vp_integer = thread_pool.pps_in.pps;
-
-			vp = radius_pair_create(request, &request->control,
-					       183, VENDORPEC_FREERADIUS);
-			if (vp) {
-				vp->vp_integer = thread_pool.max_queue_size - thread_pool.num_queued;
-				vp->vp_integer *= 100;
-				vp->vp_integer /= thread_pool.max_queue_size;
-			}
-		}
-#endif
-
-		thread->request_count++;
-
-		DEBUG2("Thread %d handling request %" PRIu64 ", (%d handled so far)",
-		       thread->thread_num, request->number,
-		       thread->request_count);
-
-		request->child_pid = thread->pthread_id;
-		request->component = "<core>";
-		request->module = NULL;
-		request->child_state = REQUEST_RUNNING;
-		request->log.unlang_indent = 0;
-
-		request->process(thread->request, FR_ACTION_RUN);
-
-		thread->request = NULL;
-
-		/*
-		 *	Clean up any children we exec'd.
-		 */
-		reap_children();
-
-#  ifdef HAVE_OPENSSL_ERR_H
-		/*
-		 *	Clear the error queue for the current thread.
-		 */
-		ERR_clear_error();
-#  endif
+		request_run(thread, thread->request);
 
 		pthread_mutex_lock(&thread_pool.mutex);
 
@@ -755,7 +927,7 @@ static void *request_handler_thread(void *arg)
 		 *	grab one and process it.
 		 */
 		if (thread_pool.num_queued) {
-			request = request_dequeue();
+			request = request_dequeue(NULL);
 			if (request) {
 				pthread_mutex_unlock(&thread_pool.mutex);
 				thread->request = request;
@@ -828,6 +1000,116 @@ static void *request_handler_thread(void *arg)
 	return NULL;
 }
 
+/*
+ *	Find the next request for a worker in the sharded scheduler.
+ *
+ *	The worker's own queue is checked first.  If it's empty, we
+ *	try to steal the highest priority request from another
+ *	worker.  Queues which are locked are skipped, as their owner
+ *	(or another thief) is already servicing them.
+ */
+static REQUEST *request_dequeue_sharded(THREAD_HANDLE *thread)
+{
+	REQUEST		*request;
+	THREAD_HANDLE	*victim;
+	uint32_t	i;
+
+	pthread_mutex_lock(&thread->queue_mutex);
+	request = request_dequeue(thread);
+	pthread_mutex_unlock(&thread->queue_mutex);
+	if (request) return request;
+
+	for (i = 1; i < thread_pool.num_workers; i++) {
+		victim = thread_pool.workers[(thread->worker_id + i) % thread_pool.num_workers];
+		if (!victim->num_queued) continue;
+
+		if (pthread_mutex_trylock(&victim->queue_mutex) != 0) continue;
+		request = request_dequeue(victim);
+		pthread_mutex_unlock(&victim->queue_mutex);
+
+		if (request) {
+			atomic_fetch_add_explicit(&thread_pool.num_stolen, 1, memory_order_relaxed);
+			return request;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ *	The thread handler for the sharded scheduler.
+ *
+ *	Sleep on the semaphore until we're woken up, and then process
+ *	requests until there are none left to process or steal.
+ */
+static void *request_worker_thread(void *arg)
+{
+	THREAD_HANDLE	*thread = (THREAD_HANDLE *) arg;
+	REQUEST		*request;
+
+#  ifdef HAVE_GPERFTOOLS_PROFILER_H
+	ProfilerRegisterThread();
+#  endif
+
+	while (true) {
+		DEBUG2("Thread %d waiting to be assigned a request",
+		       thread->thread_num);
+
+		while (sem_wait(&thread->semaphore) != 0) {
+			if (errno == EINTR) continue;
+
+			ERROR("Thread %d failed waiting for semaphore: %s: Exiting\n",
+			      thread->thread_num, fr_syserror(errno));
+			thread->status = THREAD_CANCELLED;
+			break;
+		}
+
+		/*
+		 *	Process requests until there's nothing left.
+		 */
+		while (true) {
+			if ((thread->status == THREAD_CANCELLED) || atomic_load(&thread_pool.stop_flag)) goto done;
+
+			request = request_dequeue_sharded(thread);
+			if (request) {
+				thread->status = THREAD_ACTIVE;
+				request_run(thread, request);
+				continue;
+			}
+
+			/*
+			 *	A request may have been added to our
+			 *	queue after we checked it.  If so, go
+			 *	process it.  Otherwise mark ourselves
+			 *	as sleeping, so that request_enqueue()
+			 *	knows to wake us up.
+			 */
+			pthread_mutex_lock(&thread->queue_mutex);
+			if (thread->num_queued) {
+				pthread_mutex_unlock(&thread->queue_mutex);
+				continue;
+			}
+			thread->status = THREAD_IDLE;
+			thread->sleeping = true;
+			atomic_fetch_add_explicit(&thread_pool.num_sleeping, 1, memory_order_relaxed);
+			pthread_mutex_unlock(&thread->queue_mutex);
+			break;
+		}
+	}
+
+done:
+	DEBUG2("Thread %d exiting...", thread->thread_num);
+
+#ifdef HAVE_OPENSSL_ERR_H
+	FR_TLS_REMOVE_THREAD_STATE();
+#endif
+
+	trigger_exec(NULL, NULL, "server.thread.stop", true, NULL);
+	thread->status = THREAD_EXITED;
+
+	return NULL;
+}
+
 /*
  *	Spawn a new thread, and place it in the thread pool.
  *	Called with the thread mutex locked...
@@ -865,8 +1147,33 @@ static THREAD_HANDLE *spawn_thread(time_t now, int do_trigger)
 	 *	Note that the function returns non-zero on error, NOT
 	 *	-1.  The return code is the error, and errno isn't set.
 	 */
-	rcode = pthread_create(&thread->pthread_id, 0, request_handler_thread, thread);
+	if (thread_pool.sharded) {
+		thread->worker_id = thread->thread_num - 1;
+		thread->sleeping = true;
+
+		rcode = pthread_mutex_init(&thread->queue_mutex, NULL);
+		if (rcode != 0) {
+			ERROR("Failed to initialize queue mutex: %s", fr_syserror(rcode));
+			talloc_free(thread);
+			return NULL;
+		}
+
+		thread->queue = fr_heap_create(thread_pool.heap_cmp, offsetof(REQUEST, heap_id));
+		if (!thread->queue) {
+			ERROR("Failed to initialize the queue for thread %d", thread->thread_num);
+			pthread_mutex_destroy(&thread->queue_mutex);
+			talloc_free(thread);
+			return NULL;
+		}
+	}
+
+	rcode = pthread_create(&thread->pthread_id, 0,
+			       thread_pool.sharded ? request_worker_thread : request_handler_thread, thread);
 	if (rcode != 0) {
+		if (thread->queue) {
+			fr_heap_delete(thread->queue);
+			pthread_mutex_destroy(&thread->queue_mutex);
+		}
 		talloc_free(thread);
 		ERROR("Thread create failed: %s",
 		       fr_syserror(rcode));
@@ -974,7 +1281,7 @@ int thread_pool_bootstrap(CONF_SECTION *cs, bool *spawn_workers)
 	thread_pool.total_threads = 0;
 	thread_pool.max_thread_num = 1;
 	thread_pool.cleanup_delay = 5;
-	thread_pool.stop_flag = false;
+	atomic_init(&thread_pool.stop_flag, false);
 
 	/*
 	 *	No configuration, don't spawn anything.
@@ -1022,6 +1329,20 @@ int thread_pool_bootstrap(CONF_SECTION *cs, bool *spawn_workers)
 		return -1;
 	}
 
+	if (strcmp(thread_pool.scheduler, "sharded") == 0) {
+		/*
+		 *	The sharded scheduler doesn't spawn or reap
+		 *	threads on demand.  It starts max_servers
+		 *	threads, and keeps them.
+		 */
+		thread_pool.sharded = true;
+		thread_pool.num_workers = thread_pool.max_threads;
+
+	} else if (strcmp(thread_pool.scheduler, "global") != 0) {
+		ERROR("FATAL: Invalid scheduler '%s'", thread_pool.scheduler);
+		return -1;
+	}
+
 	/*
 	 *	Patch these in because we're threaded.
 	 */
@@ -1090,6 +1411,35 @@ int thread_pool_init(void)
 		return -1;
 	}
 
+#ifdef WITH_STATS
+	pthread_mutex_init(&thread_pool.pps_mutex, NULL);
+#endif
+
+	if (thread_pool.sharded) {
+		atomic_init(&thread_pool.next_worker, 0);
+		atomic_init(&thread_pool.num_queued_sharded, 0);
+		atomic_init(&thread_pool.num_sleeping, 0);
+		atomic_init(&thread_pool.num_stolen, 0);
+
+		MEM(thread_pool.workers = talloc_zero_array(NULL, THREAD_HANDLE *, thread_pool.num_workers));
+
+		for (i = 0; i < thread_pool.num_workers; i++) {
+			THREAD_HANDLE *thread;
+
+			thread = spawn_thread(now, 0);
+			if (!thread) return -1;
+
+			thread_pool.workers[i] = thread;
+			thread_pool.idle_threads++;
+			thread_pool.total_threads++;
+			atomic_fetch_add_explicit(&thread_pool.num_sleeping, 1, memory_order_relaxed);
+		}
+
+		DEBUG2("Thread pool initialized with %u sharded workers", thread_pool.num_workers);
+		pool_initialized = true;
+		return 0;
+	}
+
 	thread_pool.idle_heap = fr_heap_create(thread_pool.heap_cmp, offsetof(REQUEST, heap_id));
 	if (!thread_pool.idle_heap) {
 		ERROR("FATAL: Failed to initialize the incoming queue.");
@@ -1151,8 +1501,53 @@ void thread_pool_stop(void)
 	/*
 	 *	Set pool stop flag.
 	 */
-	thread_pool.stop_flag = true;
+	atomic_store(&thread_pool.stop_flag, true);
 
+	if (thread_pool.sharded) {
+		uint32_t	i;
+		REQUEST		*request;
+
+		/*
+		 *	Wake all of the workers before joining any of
+		 *	them.  A worker which hasn't exited yet may
+		 *	still steal from any other worker's queue, so
+		 *	no queue can be freed until every worker has
+		 *	exited.
+		 */
+		for (i = 0; i < thread_pool.num_workers; i++) {
+			thread = thread_pool.workers[i];
+
+			thread->status = THREAD_CANCELLED;
+			sem_post(&thread->semaphore);
+		}
+
+		for (i = 0; i < thread_pool.num_workers; i++) {
+			pthread_join(thread_pool.workers[i]->pthread_id, NULL);
+		}
+
+		/*
+		 *	Requests which are still queued will never be
+		 *	run.  radius_event_free() skipped them because
+		 *	they were queued, so free them here.
+		 */
+		for (i = 0; i < thread_pool.num_workers; i++) {
+			thread = thread_pool.workers[i];
+
+			while ((request = fr_heap_peek(thread->queue)) != NULL) {
+				(void) fr_heap_extract(thread->queue, request);
+				thread->num_queued--;
+				atomic_fetch_sub_explicit(&thread_pool.num_queued_sharded, 1, memory_order_relaxed);
+
+				radius_event_discard(request);
+			}
+
+			fr_heap_delete(thread->queue);
+			pthread_mutex_destroy(&thread->queue_mutex);
+			talloc_free(thread);
+		}
+		talloc_free(thread_pool.workers);
+		thread_pool.workers = NULL;
+	}
 
 	/*
 	 *	Join and free all threads.
@@ -1194,6 +1589,11 @@ void thread_pool_stop(void)
 
 
 #ifdef WITH_GCD
+void thread_pool_shared_enqueue(void)
+{
+	/* dispatch_async() can be called from any thread */
+}
+
 void request_enqueue(REQUEST *request)
 {
 	dispatch_block_t block;
@@ -1469,6 +1869,21 @@ static pid_t thread_waitpid(pid_t pid, int *status)
  */
 #endif
 
+/** Return how many requests workers have stolen from each other's queues
+ *
+ * Always 0 unless the sharded scheduler is in use.
+ */
+uint64_t thread_pool_num_stolen(void)
+{
+#ifndef WITH_GCD
+	if (pool_initialized && thread_pool.sharded) {
+		return atomic_load_explicit(&thread_pool.num_stolen, memory_order_relaxed);
+	}
+#endif
+
+	return 0;
+}
+
 void thread_pool_queue_stats(int array[RAD_LISTEN_MAX], int pps[2])
 {
 	int i;
@@ -1482,7 +1897,11 @@ void thread_pool_queue_stats(int array[RAD_LISTEN_MAX], int pps[2])
 		 *	fixed in size.
 		 */
 		memset(array, 0, sizeof(array[0]) * RAD_LISTEN_MAX);
-		array[0] = fr_heap_num_elements(thread_pool.idle_heap);
+		if (thread_pool.sharded) {
+			array[0] = request_queue_len();
+		} else {
+			array[0] = fr_heap_num_elements(thread_pool.idle_heap);
+		}
 
 		gettimeofday(&now, NULL);
 
@@ -39,6 +39,14 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/rad_assert.h>
 
+static CONF_PARSER ticket_config[] = {
+	{ FR_CONF_OFFSET("enable", PW_TYPE_BOOLEAN, fr_tls_conf_t, session_ticket), .dflt = "no" },
+	{ FR_CONF_OFFSET("key_file", PW_TYPE_FILE_INPUT, fr_tls_conf_t, session_ticket_key_file) },
+	{ FR_CONF_OFFSET("rotate", PW_TYPE_INTEGER, fr_tls_conf_t, session_ticket_rotate), .dflt = "3600" },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static CONF_PARSER cache_config[] = {
 	{ FR_CONF_OFFSET("virtual_server", PW_TYPE_STRING, fr_tls_conf_t, session_cache_server) },
 	{ FR_CONF_OFFSET("name", PW_TYPE_STRING, fr_tls_conf_t, session_id_name) },
@@ -50,6 +58,8 @@ static CONF_PARSER cache_config[] = {
 	{ FR_CONF_OFFSET("require_perfect_forward_secrecy", PW_TYPE_BOOLEAN, fr_tls_conf_t, session_cache_require_pfs), .dflt = "no" },
 #endif
 
+	{ FR_CONF_POINTER("ticket", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) ticket_config },
+
 	{ FR_CONF_DEPRECATED("enable", PW_TYPE_BOOLEAN, fr_tls_conf_t, NULL) },
 	{ FR_CONF_DEPRECATED("max_entries", PW_TYPE_INTEGER, fr_tls_conf_t, NULL) },
 	{ FR_CONF_DEPRECATED("persist_dir", PW_TYPE_STRING, fr_tls_conf_t, NULL) },
@@ -75,6 +85,10 @@ static CONF_PARSER ocsp_config[] = {
 	{ FR_CONF_OFFSET("timeout", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, timeout), .dflt = "yes" },
 	{ FR_CONF_OFFSET("softfail", PW_TYPE_BOOLEAN, fr_tls_ocsp_conf_t, softfail), .dflt = "no" },
 
+	{ FR_CONF_OFFSET("cache", PW_TYPE_BOOLEAN, fr_tls_ocsp_conf_t, cache), .dflt = "no" },
+	{ FR_CONF_OFFSET("cache_refresh", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, cache_refresh), .dflt = "300" },
+	{ FR_CONF_OFFSET("cache_max_entries", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, cache_max_entries), .dflt = "4096" },
+
 	CONF_PARSER_TERMINATOR
 };
 #endif
@@ -270,6 +284,15 @@ static int _conf_server_free(fr_tls_conf_t *conf)
 {
 	uint32_t i;
 
+#ifdef HAVE_OPENSSL_OCSP_H
+	/*
+	 *	The caches refer to the stores and contexts, so
+	 *	they have to be freed first.
+	 */
+	TALLOC_FREE(conf->ocsp.response_cache);
+	TALLOC_FREE(conf->staple.response_cache);
+#endif
+
 	for (i = 0; i < conf->ctx_count; i++) SSL_CTX_free(conf->ctx[i]);
 
 #ifdef HAVE_OPENSSL_OCSP_H
@@ -331,7 +354,7 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 	/*
 	 *	Setup session caching
 	 */
-	if (conf->session_cache_server) {
+	if (conf->session_cache_server || conf->session_ticket) {
 		/*
 		 *	Create a unique context Id per EAP-TLS configuration.
 		 */
@@ -355,6 +378,23 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 		rad_assert(conf->ctx_count > 0);
 	}
 
+	/*
+	 *	The ticket keys are shared by all of the contexts, so
+	 *	a ticket issued by one can be decrypted by the others.
+	 */
+	if (conf->session_ticket) {
+		FR_INTEGER_BOUND_CHECK("rotate", conf->session_ticket_rotate, >=, 60);
+
+		if (conf->session_ticket_key_file && !conf->session_id_name) {
+			WARN("Session tickets can only be shared with other servers if cache.name is set");
+		}
+
+		conf->session_ticket_keys = tls_ticket_keys_alloc(conf, conf->session_ticket_key_file,
+								  conf->session_ticket_rotate,
+								  conf->session_cache_lifetime);
+		if (!conf->session_ticket_keys) goto error;
+	}
+
 	/*
 	 *	Initialize TLS
 	 */
@@ -378,11 +418,38 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 	if (conf->ocsp.enable) {
 		conf->ocsp.store = conf_ocsp_revocation_store(conf);
 		if (conf->ocsp.store == NULL) goto error;
+
+		if (conf->ocsp.cache) {
+			/*
+			 *	A cached response is reused for many
+			 *	checks, so it can't contain the nonce
+			 *	each of them would send.
+			 */
+			if (conf->ocsp.use_nonce) {
+				ERROR("ocsp.cache requires ocsp.use_nonce = no, as cached responses "
+				      "don't contain the nonce of the request they're used for");
+				goto error;
+			}
+
+			conf->ocsp.response_cache = tls_ocsp_cache_alloc(conf, &conf->ocsp);
+			if (!conf->ocsp.response_cache) goto error;
+		}
 	}
 
 	if (conf->staple.enable) {
 		conf->staple.store = conf_ocsp_revocation_store(conf);
 		if (conf->staple.store == NULL) goto error;
+
+		if (conf->staple.cache) {
+			if (conf->staple.use_nonce) {
+				ERROR("staple.cache requires staple.use_nonce = no, as cached responses "
+				      "don't contain the nonce of the request they're used for");
+				goto error;
+			}
+
+			conf->staple.response_cache = tls_ocsp_cache_alloc(conf, &conf->staple);
+			if (!conf->staple.response_cache) goto error;
+		}
 	}
 #endif /*HAVE_OPENSSL_OCSP_H*/
 
@@ -319,7 +319,11 @@ post_ca:
 	}
 
 #ifdef SSL_OP_NO_TICKET
-	ctx_options |= SSL_OP_NO_TICKET;
+	/*
+	 *	Only issue session tickets if we have keys to
+	 *	protect them with.
+	 */
+	if (client || !conf->session_ticket_keys) ctx_options |= SSL_OP_NO_TICKET;
 #endif
 
 	if (!conf->disable_single_dh_use) {
@@ -458,6 +462,24 @@ post_ca:
 	 */
 	tls_cache_init(ctx, (bool)conf->session_cache_server, conf->session_context_id, conf->session_cache_lifetime);
 
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+	/*
+	 *	Setup session tickets.  These don't need the session
+	 *	cache, as the session state is sent to the client,
+	 *	encrypted with keys all our servers can share.
+	 */
+	if (!client && conf->session_ticket_keys) {
+		SSL_CTX_set_tlsext_ticket_key_cb(ctx, tls_ticket_key_cb);
+		SSL_CTX_set_timeout(ctx, conf->session_cache_lifetime);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		SSL_CTX_set_not_resumable_session_callback(ctx, tls_cache_disable_cb);
+#endif
+		SSL_CTX_set_session_id_context(ctx,
+					       (unsigned char const *) conf->session_context_id,
+					       (unsigned int) strlen(conf->session_context_id));
+	}
+#endif
+
 	/*
 	 *	Load dh params
 	 */
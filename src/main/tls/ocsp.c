@@ -300,33 +300,691 @@ int tls_ocsp_staple_cb(SSL *ssl, void *data)
 	return ret;
 }
 
+/** Send an OCSP request to a responder, and verify the response
+ *
+ * @param[in] request	The current request, used for logging.
+ * @param[out] out	Where to write the verified response.
+ * @param[in] certid	of the certificate to check.
+ * @param[in] host	of the responder.
+ * @param[in] port	of the responder.
+ * @param[in] path	of the responder.
+ * @param[in] store	to verify the response with.
+ * @param[in] conf	OCSP configuration.
+ * @param[in] ssl_log	to accumulate OpenSSL messages in.
+ * @return
+ *	- OCSP_STATUS_OK if we got a response, and it's signed by someone we trust.
+ *	- OCSP_STATUS_SKIPPED if we couldn't get a response.
+ *	- OCSP_STATUS_FAILED if the response was bad.
+ */
+static ocsp_status_t ocsp_query(REQUEST *request, OCSP_RESPONSE **out, OCSP_CERTID *certid,
+				char const *host, char const *port, char const *path,
+				X509_STORE *store, fr_tls_ocsp_conf_t *conf, BIO *ssl_log)
+{
+	OCSP_REQUEST	*req = NULL;
+	OCSP_RESPONSE	*resp = NULL;
+	OCSP_BASICRESP	*bresp = NULL;
+	OCSP_CERTID	*id;
+	char		host_header[1024];
+	BIO		*conn = NULL;
+	ocsp_status_t	ocsp_status = OCSP_STATUS_FAILED;
+	int		status;
+#if OPENSSL_VERSION_NUMBER >= 0x1000003f
+	OCSP_REQ_CTX	*ctx;
+	int		rc;
+	struct timeval	when, now;
+#endif
+
+	*out = NULL;
+
+	/*
+	 *	Create OCSP Request
+	 */
+	req = OCSP_REQUEST_new();
+	id = OCSP_CERTID_dup(certid);
+	if (!req || !id || !OCSP_request_add0_id(req, id)) {
+		OCSP_CERTID_free(id);
+		REDEBUG("Couldn't create OCSP request");
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+	if (conf->use_nonce) OCSP_request_add1_nonce(req, NULL, 8);
+
+	/* Check host and port length are sane, then create Host: HTTP header */
+	if ((strlen(host) + strlen(port) + 2) > sizeof(host_header)) {
+		RWDEBUG("Host and port too long");
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+	snprintf(host_header, sizeof(host_header), "%s:%s", host, port);
+
+	/* Setup BIO socket to OCSP responder */
+	conn = BIO_new_connect(host);
+	BIO_set_conn_port(conn, port);
+
+#if OPENSSL_VERSION_NUMBER < 0x1000003f
+	BIO_do_connect(conn);
+
+	/* Send OCSP request and wait for response */
+	resp = OCSP_sendreq_bio(conn, path, req);
+	if (!resp) {
+		REDEBUG("Couldn't get OCSP response");
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+#else
+	if (conf->timeout) BIO_set_nbio(conn, 1);
+
+	rc = BIO_do_connect(conn);
+	if ((rc <= 0) && ((!conf->timeout) || !BIO_should_retry(conn))) {
+		REDEBUG("Couldn't connect to OCSP responder");
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+
+	ctx = OCSP_sendreq_new(conn, path, NULL, -1);
+	if (!ctx) {
+		REDEBUG("Couldn't create OCSP request");
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+
+	if (!OCSP_REQ_CTX_add1_header(ctx, "Host", host_header)) {
+		REDEBUG("Couldn't set Host header");
+		OCSP_REQ_CTX_free(ctx);
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+
+	if (!OCSP_REQ_CTX_set1_req(ctx, req)) {
+		REDEBUG("Couldn't add data to OCSP request");
+		OCSP_REQ_CTX_free(ctx);
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+
+	gettimeofday(&when, NULL);
+	when.tv_sec += conf->timeout;
+
+	do {
+		rc = OCSP_sendreq_nbio(&resp, ctx);
+		if (conf->timeout) {
+			gettimeofday(&now, NULL);
+			if (!timercmp(&now, &when, <)) break;
+		}
+	} while ((rc == -1) && BIO_should_retry(conn));
+
+	if (conf->timeout && (rc == -1) && BIO_should_retry(conn)) {
+		REDEBUG("Response timed out");
+		OCSP_REQ_CTX_free(ctx);
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+
+	OCSP_REQ_CTX_free(ctx);
+
+	if (rc == 0) {
+		REDEBUG("Couldn't get OCSP response");
+		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+#endif /* OPENSSL_VERSION_NUMBER < 0x1000003f */
+
+	/* Verify OCSP response status */
+	status = OCSP_response_status(resp);
+	if (status != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+		REDEBUG("Response status: %s", OCSP_response_status_str(status));
+		goto finish;
+	}
+	bresp = OCSP_response_get1_basic(resp);
+	if (!bresp) {
+		REDEBUG("Couldn't get basic response");
+		goto finish;
+	}
+	if (conf->use_nonce && OCSP_check_nonce(req, bresp) != 1) {
+		REDEBUG("Response has wrong nonce value");
+		goto finish;
+	}
+	if (OCSP_basic_verify(bresp, NULL, store, 0) != 1){
+		REDEBUG("Couldn't verify OCSP basic response");
+		goto finish;
+	}
+
+	*out = resp;
+	resp = NULL;
+	ocsp_status = OCSP_STATUS_OK;
+
+finish:
+	OCSP_REQUEST_free(req);
+	OCSP_BASICRESP_free(bresp);
+	OCSP_RESPONSE_free(resp);
+	BIO_free_all(conn);
+
+	return ocsp_status;
+}
+
+/** Get the time at which the responder will have new information about a certificate
+ *
+ * @param[out] out	Where to write the time.
+ * @param[in] resp	to get the time from.
+ * @param[in] certid	of the certificate.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the response has no nextUpdate for the certificate.
+ */
+static int ocsp_next_update(time_t *out, OCSP_RESPONSE *resp, OCSP_CERTID *certid)
+{
+	OCSP_BASICRESP		*bresp;
+	ASN1_GENERALIZEDTIME	*rev, *this_update, *next_update = NULL;
+	int			status, reason, ret = -1;
+
+	bresp = OCSP_response_get1_basic(resp);
+	if (!bresp) return -1;
+
+	if (OCSP_resp_find_status(bresp, certid, &status, &reason, &rev, &this_update, &next_update) &&
+	    next_update && (ocsp_asn1time_to_epoch(out, next_update) == 0)) ret = 0;
+
+	OCSP_BASICRESP_free(bresp);
+
+	return ret;
+}
+
+/** A cached OCSP response
+ *
+ */
+typedef struct tls_ocsp_cache_entry {
+	uint8_t				*key;		//!< DER encoded OCSP_CERTID.
+	size_t				key_len;	//!< Length of the key.
+
+	OCSP_CERTID			*certid;	//!< To build refresh requests.
+	char				*host;		//!< Responder the response came from.
+	char				*port;
+	char				*path;
+	X509_STORE			*store;		//!< To verify refreshed responses.  We hold a
+							//!< reference, as the refresh thread may use it
+							//!< after the SSL_CTX it came from is gone.
+
+	uint8_t				*resp;		//!< DER encoded, verified, OCSP_RESPONSE.
+							//!< NULL if we don't have a response yet.
+	size_t				resp_len;	//!< Length of the response.
+	time_t				next_update;	//!< When the response expires.
+	time_t				retry;		//!< Don't try refreshing again before this time.
+	ocsp_status_t			status;		//!< Result of the last query.
+
+	bool				pending;	//!< A query to the responder is in progress.
+	unsigned int			waiters;	//!< Number of threads waiting for the query.
+	pthread_cond_t			cond;		//!< Signalled when the query completes.
+
+	struct tls_ocsp_cache_entry	*next;		//!< Next entry to refresh.
+
+	struct tls_ocsp_cache_entry	*lru_prev;	//!< More recently used entry.
+	struct tls_ocsp_cache_entry	*lru_next;	//!< Less recently used entry.
+} tls_ocsp_cache_entry_t;
+
+/** In-memory cache of OCSP responses
+ *
+ * Responses are keyed by the OCSP_CERTID of the certificate they're for, and are
+ * used until their nextUpdate time.  Concurrent lookups for the same certificate
+ * result in a single query to the responder, which the other threads wait for.
+ *
+ * When a response is used within conf->cache_refresh seconds of its nextUpdate
+ * time, it's queued for the refresh thread, which queries the responder again.
+ * The cached response is used until the new one arrives, so handshakes don't wait
+ * for the responder as long as the certificate is seen regularly.
+ *
+ * Entries are also kept on a list in the order they were last used, so when the
+ * cache is full we can find the least recently used entry without walking the
+ * hash table.
+ */
+struct tls_ocsp_cache {
+	fr_tls_ocsp_conf_t		*conf;		//!< Configuration for querying the responder.
+	fr_hash_table_t			*ht;		//!< Cached responses.
+	pthread_mutex_t			mutex;		//!< Protects all of the entries.
+
+	pthread_t			thread;		//!< Thread performing refreshes.
+	pthread_cond_t			cond;		//!< Signalled when there are entries to refresh.
+	tls_ocsp_cache_entry_t		*refresh;	//!< Entries waiting to be refreshed.
+	tls_ocsp_cache_entry_t		**refresh_tail;	//!< Where to add the next entry to refresh.
+	bool				stop;		//!< Tell the refresh thread to exit.
+
+	tls_ocsp_cache_entry_t		*lru_head;	//!< Most recently used entry.
+	tls_ocsp_cache_entry_t		*lru_tail;	//!< Least recently used entry.
+};
+
+/** How long to wait before refreshing again after a failed refresh
+ *
+ */
+#define OCSP_CACHE_RETRY_DELAY	10
+
+static uint32_t ocsp_cache_hash(void const *data)
+{
+	tls_ocsp_cache_entry_t const *entry = data;
+
+	return fr_hash(entry->key, entry->key_len);
+}
+
+static int ocsp_cache_cmp(void const *one, void const *two)
+{
+	tls_ocsp_cache_entry_t const *a = one, *b = two;
+
+	if (a->key_len < b->key_len) return -1;
+	if (a->key_len > b->key_len) return +1;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+static int _ocsp_cache_entry_free(tls_ocsp_cache_entry_t *entry)
+{
+	OCSP_CERTID_free(entry->certid);
+	if (entry->store) X509_STORE_free(entry->store);
+	pthread_cond_destroy(&entry->cond);
+
+	return 0;
+}
+
+static void ocsp_cache_entry_free(void *data)
+{
+	talloc_free(data);
+}
+
+/** Remove an entry from the LRU list
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void ocsp_cache_lru_unlink(tls_ocsp_cache_t *cache, tls_ocsp_cache_entry_t *entry)
+{
+	if (entry->lru_prev) {
+		entry->lru_prev->lru_next = entry->lru_next;
+	} else {
+		cache->lru_head = entry->lru_next;
+	}
+
+	if (entry->lru_next) {
+		entry->lru_next->lru_prev = entry->lru_prev;
+	} else {
+		cache->lru_tail = entry->lru_prev;
+	}
+
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+/** Mark an entry as the most recently used
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void ocsp_cache_lru_touch(tls_ocsp_cache_t *cache, tls_ocsp_cache_entry_t *entry)
+{
+	if (cache->lru_head == entry) return;
+
+	if (entry->lru_prev || entry->lru_next || (cache->lru_tail == entry)) ocsp_cache_lru_unlink(cache, entry);
+
+	entry->lru_next = cache->lru_head;
+	if (cache->lru_head) cache->lru_head->lru_prev = entry;
+	cache->lru_head = entry;
+	if (!cache->lru_tail) cache->lru_tail = entry;
+}
+
+/** Free the least recently used entry nobody is using
+ *
+ * Entries with queries in progress, or with threads waiting on them, are skipped.
+ * There are at most a handful of those, and as they've just been used they're
+ * near the head of the list, so this rarely looks at more than one entry.
+ *
+ * @note Must be called with the cache mutex held.
+ *
+ * @return
+ *	- 0 if an entry was freed.
+ *	- -1 if every entry is in use.
+ */
+static int ocsp_cache_evict(tls_ocsp_cache_t *cache)
+{
+	tls_ocsp_cache_entry_t	*entry;
+
+	for (entry = cache->lru_tail; entry; entry = entry->lru_prev) {
+		if (entry->pending || entry->waiters) continue;
+
+		ocsp_cache_lru_unlink(cache, entry);
+		fr_hash_table_delete(cache->ht, entry);
+
+		return 0;
+	}
+
+	return -1;
+}
+
+/** Store the result of a query in a cache entry, and wake anyone waiting for it
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void ocsp_cache_entry_update(tls_ocsp_cache_entry_t *entry, ocsp_status_t status, OCSP_RESPONSE *resp)
+{
+	time_t	now = time(NULL);
+	time_t	next_update;
+	uint8_t	*p;
+	int	len;
+
+	entry->pending = false;
+	entry->status = status;
+	pthread_cond_broadcast(&entry->cond);
+
+	/*
+	 *	Keep using the old response, if we have one, and
+	 *	it's still valid.
+	 */
+	if ((status != OCSP_STATUS_OK) || (ocsp_next_update(&next_update, resp, entry->certid) < 0) ||
+	    (next_update <= now)) {
+		entry->retry = now + OCSP_CACHE_RETRY_DELAY;
+		return;
+	}
+
+	len = i2d_OCSP_RESPONSE(resp, NULL);
+	if (len <= 0) return;
+
+	p = talloc_array(entry, uint8_t, len);
+	if (!p) return;
+
+	talloc_free(entry->resp);
+	entry->resp = p;
+	entry->resp_len = i2d_OCSP_RESPONSE(resp, &p);
+	entry->next_update = next_update;
+	entry->retry = 0;
+}
+
+/** Refresh cached responses before they expire
+ *
+ */
+static void *ocsp_cache_refresh_thread(void *arg)
+{
+	tls_ocsp_cache_t	*cache = arg;
+	tls_ocsp_cache_entry_t	*entry;
+
+	pthread_mutex_lock(&cache->mutex);
+	while (!cache->stop) {
+		REQUEST		*request;
+		OCSP_RESPONSE	*resp = NULL;
+		BIO		*ssl_log;
+		ocsp_status_t	status = OCSP_STATUS_SKIPPED;
+
+		entry = cache->refresh;
+		if (!entry) {
+			pthread_cond_wait(&cache->cond, &cache->mutex);
+			continue;
+		}
+		cache->refresh = entry->next;
+		if (!cache->refresh) cache->refresh_tail = &cache->refresh;
+		entry->next = NULL;
+
+		/*
+		 *	Entries aren't freed while they're pending,
+		 *	so it's safe to use this one without the mutex.
+		 */
+		pthread_mutex_unlock(&cache->mutex);
+
+		request = request_alloc(NULL);
+		ssl_log = BIO_new(BIO_s_mem());
+		if (request && ssl_log) {
+			request->component = "ocsp-cache";
+
+			RDEBUG2("Refreshing cached OCSP response from \"http://%s:%s%s\"",
+				entry->host, entry->port, entry->path);
+			status = ocsp_query(request, &resp, entry->certid, entry->host, entry->port, entry->path,
+					    entry->store, cache->conf, ssl_log);
+			if (status != OCSP_STATUS_OK) {
+				SSL_DRAIN_ERROR_QUEUE(RWDEBUG, "", ssl_log);
+				RWDEBUG("Failed refreshing cached OCSP response, will retry");
+			}
+		}
+		while (ERR_get_error());	/* Don't leave errors for the next handshake */
+
+		pthread_mutex_lock(&cache->mutex);
+		ocsp_cache_entry_update(entry, status, resp);
+
+		OCSP_RESPONSE_free(resp);
+		BIO_free(ssl_log);
+		talloc_free(request);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return NULL;
+}
+
+/** Find a response in the cache, or query the responder and cache the result
+ *
+ * @param[in] request	The current request.
+ * @param[out] out	Where to write a copy of the response.
+ * @param[in] cache	to search.
+ * @param[in] certid	of the certificate.
+ * @param[in] host	of the responder.
+ * @param[in] port	of the responder.
+ * @param[in] path	of the responder.
+ * @param[in] store	to verify the response with.
+ * @param[in] ssl_log	to accumulate OpenSSL messages in.
+ * @return the same as #ocsp_query.
+ */
+static ocsp_status_t ocsp_cache_find(REQUEST *request, OCSP_RESPONSE **out, tls_ocsp_cache_t *cache,
+				     OCSP_CERTID *certid, char const *host, char const *port, char const *path,
+				     X509_STORE *store, BIO *ssl_log)
+{
+	tls_ocsp_cache_entry_t	my_entry, *entry;
+	OCSP_RESPONSE		*resp;
+	uint8_t			*key = NULL;
+	uint8_t const		*p;
+	int			key_len;
+	time_t			now;
+	ocsp_status_t		status;
+
+	*out = NULL;
+
+	key_len = i2d_OCSP_CERTID(certid, &key);
+	if (key_len <= 0) {
+		RWDEBUG("Failed encoding certificate ID, not using OCSP cache");
+		return ocsp_query(request, out, certid, host, port, path, store, cache->conf, ssl_log);
+	}
+
+	my_entry.key = key;
+	my_entry.key_len = key_len;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_hash_table_finddata(cache->ht, &my_entry);
+	OPENSSL_free(key);
+
+	if (!entry) {
+		if (((uint32_t) fr_hash_table_num_elements(cache->ht) >= cache->conf->cache_max_entries) &&
+		    (ocsp_cache_evict(cache) < 0)) {
+			pthread_mutex_unlock(&cache->mutex);
+
+			RWDEBUG("OCSP cache is full, not caching response");
+			return ocsp_query(request, out, certid, host, port, path, store, cache->conf, ssl_log);
+		}
+
+		entry = talloc_zero(cache, tls_ocsp_cache_entry_t);
+		if (!entry) {
+		oom:
+			pthread_mutex_unlock(&cache->mutex);
+			talloc_free(entry);
+			REDEBUG("Out of memory");
+			return OCSP_STATUS_SKIPPED;
+		}
+		pthread_cond_init(&entry->cond, NULL);
+		talloc_set_destructor(entry, _ocsp_cache_entry_free);
+
+		entry->certid = OCSP_CERTID_dup(certid);
+		entry->key_len = i2d_OCSP_CERTID(entry->certid, NULL);
+		entry->key = talloc_array(entry, uint8_t, entry->key_len);
+		entry->host = talloc_typed_strdup(entry, host);
+		entry->port = talloc_typed_strdup(entry, port);
+		entry->path = talloc_typed_strdup(entry, path);
+		if (!entry->certid || !entry->key || !entry->host || !entry->port || !entry->path) goto oom;
+
+		key = entry->key;
+		i2d_OCSP_CERTID(entry->certid, &key);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		X509_STORE_up_ref(store);
+#else
+		CRYPTO_add(&store->references, 1, CRYPTO_LOCK_X509_STORE);
+#endif
+		entry->store = store;
+
+		if (!fr_hash_table_insert(cache->ht, entry)) goto oom;
+	}
+	ocsp_cache_lru_touch(cache, entry);
+
+	/*
+	 *	Someone else is asking the responder, wait for
+	 *	them, unless we already have a valid response.
+	 */
+	now = time(NULL);
+	if (entry->pending && !(entry->resp && (entry->next_update > now))) {
+		RDEBUG2("Waiting for OCSP query from another request");
+
+		entry->waiters++;
+		while (entry->pending) pthread_cond_wait(&entry->cond, &cache->mutex);
+		entry->waiters--;
+
+		now = time(NULL);
+		if (!entry->resp || (entry->next_update <= now)) {
+			status = entry->status;
+			pthread_mutex_unlock(&cache->mutex);
+
+			REDEBUG("OCSP query from another request failed");
+			return (status == OCSP_STATUS_OK) ? OCSP_STATUS_SKIPPED : status;
+		}
+	}
+
+	/*
+	 *	Use the cached response, and refresh it in the
+	 *	background if it's due to expire.
+	 */
+	if (entry->resp && (entry->next_update > now)) {
+		if (!entry->pending && (now >= entry->retry) &&
+		    ((entry->next_update - now) <= (time_t) cache->conf->cache_refresh)) {
+			RDEBUG2("Cached OCSP response expires in %li seconds, refreshing",
+				(long) (entry->next_update - now));
+
+			entry->pending = true;
+			*cache->refresh_tail = entry;
+			cache->refresh_tail = &entry->next;
+			pthread_cond_signal(&cache->cond);
+		}
+
+		p = entry->resp;
+		resp = d2i_OCSP_RESPONSE(NULL, &p, entry->resp_len);
+		pthread_mutex_unlock(&cache->mutex);
+
+		if (!resp) {
+			REDEBUG("Failed decoding cached OCSP response");
+			return OCSP_STATUS_SKIPPED;
+		}
+
+		RDEBUG2("Using cached OCSP response");
+		*out = resp;
+
+		return OCSP_STATUS_OK;
+	}
+
+	/*
+	 *	We're the first to ask, everyone else waits for us.
+	 */
+	entry->pending = true;
+	pthread_mutex_unlock(&cache->mutex);
+
+	status = ocsp_query(request, &resp, certid, host, port, path, store, cache->conf, ssl_log);
+
+	pthread_mutex_lock(&cache->mutex);
+	ocsp_cache_entry_update(entry, status, resp);
+	pthread_mutex_unlock(&cache->mutex);
+
+	*out = resp;
+
+	return status;
+}
+
+static int _ocsp_cache_free(tls_ocsp_cache_t *cache)
+{
+	pthread_mutex_lock(&cache->mutex);
+	cache->stop = true;
+	pthread_cond_signal(&cache->cond);
+	pthread_mutex_unlock(&cache->mutex);
+
+	pthread_join(cache->thread, NULL);
+
+	fr_hash_table_free(cache->ht);
+	pthread_cond_destroy(&cache->cond);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate an OCSP response cache, and start its refresh thread
+ *
+ * @param[in] ctx	to allocate the cache in.
+ * @param[in] conf	OCSP configuration, used to refresh responses.
+ * @return
+ *	- A new cache.
+ *	- NULL on error.
+ */
+tls_ocsp_cache_t *tls_ocsp_cache_alloc(TALLOC_CTX *ctx, fr_tls_ocsp_conf_t *conf)
+{
+	tls_ocsp_cache_t	*cache;
+	int			ret;
+
+	if (conf->cache_max_entries == 0) {
+		ERROR("cache_max_entries must be greater than 0");
+		return NULL;
+	}
+
+	cache = talloc_zero(ctx, tls_ocsp_cache_t);
+	if (!cache) return NULL;
+
+	cache->conf = conf;
+	cache->refresh_tail = &cache->refresh;
+
+	cache->ht = fr_hash_table_create(NULL, ocsp_cache_hash, ocsp_cache_cmp, ocsp_cache_entry_free);
+	if (!cache->ht) {
+		ERROR("Failed creating OCSP cache");
+		talloc_free(cache);
+		return NULL;
+	}
+
+	pthread_mutex_init(&cache->mutex, NULL);
+	pthread_cond_init(&cache->cond, NULL);
+
+	ret = pthread_create(&cache->thread, NULL, ocsp_cache_refresh_thread, cache);
+	if (ret != 0) {
+		ERROR("Failed creating OCSP cache refresh thread: %s", fr_syserror(ret));
+		fr_hash_table_free(cache->ht);
+		pthread_cond_destroy(&cache->cond);
+		pthread_mutex_destroy(&cache->mutex);
+		talloc_free(cache);
+		return NULL;
+	}
+	talloc_set_destructor(cache, _ocsp_cache_free);
+
+	return cache;
+}
+
 /** Sends a OCSP request to a defined OCSP responder
  *
+ * If the in-memory cache is enabled, the response may come from the cache instead.
  */
 int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		   X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
 		   fr_tls_ocsp_conf_t *conf, bool staple_response)
 {
-	OCSP_CERTID	*certid;
-	OCSP_REQUEST	*req = NULL;
+	OCSP_CERTID	*certid = NULL;
 	OCSP_RESPONSE	*resp = NULL;
 	OCSP_BASICRESP	*bresp = NULL;
 	char		*host = NULL;
 	char		*port = NULL;
 	char		*path = NULL;
-	char		host_header[1024];
 	int		use_ssl = -1;
 	long		this_fudge = OCSP_MAX_VALIDITY_PERIOD, this_max_age = -1;
-	BIO		*conn = NULL, *ssl_log = NULL;
+	BIO		*ssl_log = NULL;
 	ocsp_status_t   ocsp_status = OCSP_STATUS_FAILED;
-	ocsp_status_t	status;
+	int		status;
 	ASN1_GENERALIZEDTIME *rev, *this_update, *next_update;
 	int		reason;
-#if OPENSSL_VERSION_NUMBER >= 0x1000003f
-	OCSP_REQ_CTX	*ctx;
-	int		rc;
-	struct timeval	when;
-#endif
 	struct timeval	now = { 0, 0 };
 	time_t		next;
 	VALUE_PAIR	*vp;
@@ -401,17 +1059,12 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		goto finish;
 	}
 
-	/*
-	 *	Create OCSP Request
-	 */
 	certid = OCSP_cert_to_id(NULL, client_cert, issuer_cert);
-	req = OCSP_REQUEST_new();
-	OCSP_request_add0_id(req, certid);
-	if (conf->use_nonce) OCSP_request_add1_nonce(req, NULL, 8);
-
-	/*
-	 *	Send OCSP Request and get OCSP Response
-	 */
+	if (!certid) {
+		REDEBUG("Couldn't create OCSP certificate ID");
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
 
 	/* Get OCSP responder URL */
 	if (conf->override_url) {
@@ -432,7 +1085,7 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		switch (ret) {
 		case -1:
 			RWDEBUG("Invalid URL in certificate.  Not doing OCSP");
-			break;
+			goto skipped;
 
 		case 0:
 			if (conf->url) {
@@ -450,101 +1103,26 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 
 	RDEBUG2("Using responder URL \"http://%s:%s%s\"", host, port, path);
 
-	/* Check host and port length are sane, then create Host: HTTP header */
-	if ((strlen(host) + strlen(port) + 2) > sizeof(host_header)) {
-		RWDEBUG("Host and port too long");
-		goto skipped;
-	}
-	snprintf(host_header, sizeof(host_header), "%s:%s", host, port);
-
-	/* Setup BIO socket to OCSP responder */
-	conn = BIO_new_connect(host);
-	BIO_set_conn_port(conn, port);
-
-#if OPENSSL_VERSION_NUMBER < 0x1000003f
-	BIO_do_connect(conn);
-
-	/* Send OCSP request and wait for response */
-	resp = OCSP_sendreq_bio(conn, path, req);
-	if (!resp) {
-		REDEBUG("Couldn't get OCSP response");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-#else
-	if (conf->timeout) BIO_set_nbio(conn, 1);
-
-	rc = BIO_do_connect(conn);
-	if ((rc <= 0) && ((!conf->timeout) || !BIO_should_retry(conn))) {
-		REDEBUG("Couldn't connect to OCSP responder");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	ctx = OCSP_sendreq_new(conn, path, NULL, -1);
-	if (!ctx) {
-		REDEBUG("Couldn't create OCSP request");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	if (!OCSP_REQ_CTX_add1_header(ctx, "Host", host_header)) {
-		REDEBUG("Couldn't set Host header");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	if (!OCSP_REQ_CTX_set1_req(ctx, req)) {
-		REDEBUG("Couldn't add data to OCSP request");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	gettimeofday(&when, NULL);
-	when.tv_sec += conf->timeout;
-
-	do {
-		rc = OCSP_sendreq_nbio(&resp, ctx);
-		if (conf->timeout) {
-			gettimeofday(&now, NULL);
-			if (!timercmp(&now, &when, <)) break;
-		}
-	} while ((rc == -1) && BIO_should_retry(conn));
-
-	if (conf->timeout && (rc == -1) && BIO_should_retry(conn)) {
-		REDEBUG("Response timed out");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	OCSP_REQ_CTX_free(ctx);
-
-	if (rc == 0) {
-		REDEBUG("Couldn't get OCSP response");
-		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
+	/*
+	 *	Send OCSP Request and get OCSP Response
+	 */
+	if (conf->response_cache) {
+		ocsp_status = ocsp_cache_find(request, &resp, conf->response_cache, certid,
+					      host, port, path, store, ssl_log);
+	} else {
+		ocsp_status = ocsp_query(request, &resp, certid, host, port, path, store, conf, ssl_log);
 	}
-#endif /* OPENSSL_VERSION_NUMBER < 0x1000003f */
+	if (ocsp_status != OCSP_STATUS_OK) goto finish;
 
-	/* Verify OCSP response status */
-	status = OCSP_response_status(resp);
-	if (status != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
-		REDEBUG("Response status: %s", OCSP_response_status_str(status));
-		goto finish;
-	}
+	ocsp_status = OCSP_STATUS_FAILED;
 	bresp = OCSP_response_get1_basic(resp);
-	if (conf->use_nonce && OCSP_check_nonce(req, bresp) != 1) {
-		REDEBUG("Response has wrong nonce value");
-		goto finish;
-	}
-	if (OCSP_basic_verify(bresp, NULL, store, 0) != 1){
-		REDEBUG("Couldn't verify OCSP basic response");
+	if (!bresp) {
+		REDEBUG("Couldn't get basic response");
 		goto finish;
 	}
 
 	/*	Verify OCSP cert status */
-	if (!OCSP_resp_find_status(bresp, certid, (int *)&status, &reason, &rev, &this_update, &next_update)) {
+	if (!OCSP_resp_find_status(bresp, certid, &status, &reason, &rev, &this_update, &next_update)) {
 		REDEBUG("No Status found");
 		goto finish;
 	}
@@ -711,13 +1289,12 @@ finish:
 	}
 
 	/* Free OCSP Stuff */
-	OCSP_REQUEST_free(req);
+	OCSP_CERTID_free(certid);
 	OCSP_BASICRESP_free(bresp);
 	OCSP_RESPONSE_free(resp);
 	OPENSSL_free(host);
 	OPENSSL_free(port);
 	OPENSSL_free(path);
-	BIO_free_all(conn);
 	BIO_free(ssl_log);
 
 	return ocsp_status;
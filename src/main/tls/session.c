@@ -1311,6 +1311,14 @@ int tls_session_handshake(REQUEST *request, tls_session_t *session)
 		}
 #endif
 
+		/*
+		 *	OpenSSL checks the ticket's HMAC and expiry after
+		 *	the key callback, and falls back to a full
+		 *	handshake if they fail.  Only now do we know
+		 *	whether the ticket was actually used.
+		 */
+		session->ticket_resumed = session->ticket_key_found && SSL_session_reused(session->ssl);
+
 		/*
 		 *	Session was resumed, add attribute to mark it as such.
 		 */
@@ -1620,7 +1628,8 @@ tls_session_t *tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *conf, REQ
 		session->mtu = vp->vp_integer;
 	}
 
-	if (conf->session_cache_server) session->allow_session_resumption = true; /* otherwise it's false */
+	if (conf->session_cache_server || conf->session_ticket_keys) session->allow_session_resumption = true; /* otherwise it's false */
+	if (conf->session_ticket_keys) session->allow_ticket_resumption = true;
 
 	return session;
 }
@@ -0,0 +1,445 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/ticket.c
+ * @brief Manage the keys used to encrypt and decrypt session tickets.
+ *
+ * @copyright 2016 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls - "
+
+#include <openssl/rand.h>
+
+#include <sys/stat.h>
+
+#include <freeradius-devel/radiusd.h>
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+#define TICKET_KEY_NAME_LEN	16
+#define TICKET_KEY_HMAC_LEN	32
+#define TICKET_KEY_AES_LEN	32
+#define TICKET_KEY_LEN		(TICKET_KEY_NAME_LEN + TICKET_KEY_HMAC_LEN + TICKET_KEY_AES_LEN)
+#define TICKET_MAX_KEYS		32
+
+/** A key used to protect session tickets
+ *
+ * The layout matches the 80 byte keys used by other TLS servers,
+ * so a key file can be shared with them.
+ */
+typedef struct tls_ticket_key {
+	uint8_t			name[TICKET_KEY_NAME_LEN];	//!< Sent in the ticket to identify the key.
+	uint8_t			hmac[TICKET_KEY_HMAC_LEN];	//!< HMAC-SHA256 key.
+	uint8_t			aes[TICKET_KEY_AES_LEN];	//!< AES-256-CBC key.
+	time_t			retired;			//!< When the key stopped encrypting new
+								//!< tickets, or 0 if it still does.
+} tls_ticket_key_t;
+
+/** Session ticket keys shared by all the SSL_CTX of a TLS configuration
+ *
+ */
+struct tls_ticket_keys {
+	char const		*file;				//!< File to load keys from, or NULL to
+								//!< generate them.
+	uint32_t		rotate;				//!< Seconds between rotations (or reloads).
+	uint32_t		lifetime;			//!< How long tickets remain valid for.
+
+	time_t			mtime;				//!< Modification time of the key file.
+	time_t			next_rotate;			//!< When we next rotate the keys.
+
+	pthread_mutex_t		mutex;				//!< Protects the keys and the counters.
+	tls_ticket_key_t	keys[TICKET_MAX_KEYS];		//!< The first key encrypts new tickets,
+								//!< all of them decrypt.
+	unsigned int		num_keys;			//!< Number of keys in use.
+
+	tls_ticket_stats_t	stats;				//!< Hits, misses and renewals.
+};
+
+/** Load ticket keys from a file
+ *
+ * The file is a concatenation of 80 byte keys, e.g. the output of
+ * "openssl rand 80".  The first key is used to encrypt tickets, the
+ * remainder are used only to decrypt tickets issued before the file
+ * was updated.
+ *
+ * @param keys to load.
+ * @return
+ *	- 1 if new keys were loaded.
+ *	- 0 if the file hasn't changed.
+ *	- -1 on error (the existing keys are left alone).
+ */
+static int ticket_keys_load(tls_ticket_keys_t *keys)
+{
+	FILE			*fp;
+	struct stat		buf;
+	uint8_t			data[TICKET_KEY_LEN];
+	tls_ticket_key_t	loaded[TICKET_MAX_KEYS];
+	unsigned int		num = 0;
+	size_t			len;
+	int			ret = -1;
+
+	fp = fopen(keys->file, "r");
+	if (!fp) {
+		ERROR("Failed opening session ticket key file \"%s\": %s", keys->file, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fstat(fileno(fp), &buf) < 0) {
+		ERROR("Failed reading session ticket key file \"%s\": %s", keys->file, fr_syserror(errno));
+		goto finish;
+	}
+
+	if (keys->num_keys && (buf.st_mtime == keys->mtime)) {
+		ret = 0;
+		goto finish;
+	}
+
+	while ((len = fread(data, 1, sizeof(data), fp)) == sizeof(data)) {
+		if (num == TICKET_MAX_KEYS) {
+			WARN("Session ticket key file \"%s\" contains more than %u keys, ignoring the remainder",
+			     keys->file, TICKET_MAX_KEYS);
+			len = 0;
+			break;
+		}
+
+		memcpy(loaded[num].name, data, TICKET_KEY_NAME_LEN);
+		memcpy(loaded[num].hmac, data + TICKET_KEY_NAME_LEN, TICKET_KEY_HMAC_LEN);
+		memcpy(loaded[num].aes, data + TICKET_KEY_NAME_LEN + TICKET_KEY_HMAC_LEN, TICKET_KEY_AES_LEN);
+		loaded[num].retired = 0;
+		num++;
+	}
+
+	if (ferror(fp)) {
+		ERROR("Failed reading session ticket key file \"%s\": %s", keys->file, fr_syserror(errno));
+		goto finish;
+	}
+
+	if (len != 0) {
+		ERROR("Session ticket key file \"%s\" must contain a multiple of %u bytes",
+		      keys->file, TICKET_KEY_LEN);
+		goto finish;
+	}
+
+	if (!num) {
+		ERROR("Session ticket key file \"%s\" contains no keys", keys->file);
+		goto finish;
+	}
+
+	memcpy(keys->keys, loaded, sizeof(loaded[0]) * num);
+	keys->num_keys = num;
+	keys->mtime = buf.st_mtime;
+
+	DEBUG2("Loaded %u session ticket key(s) from \"%s\"", num, keys->file);
+	ret = 1;
+
+finish:
+	memset(data, 0, sizeof(data));
+	memset(loaded, 0, sizeof(loaded));
+	fclose(fp);
+
+	return ret;
+}
+
+/** Rotate the ticket keys
+ *
+ * If we were given a key file, it's reloaded if it has changed.
+ * Otherwise a new random key is generated, and the old keys are
+ * kept for as long as tickets they encrypted may still be valid.
+ *
+ * @note Must be called with the mutex held (or before the keys are shared).
+ *
+ * @param keys to rotate.
+ * @param now the current time.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure (the existing keys are left alone).
+ */
+static int ticket_keys_rotate(tls_ticket_keys_t *keys, time_t now)
+{
+	tls_ticket_key_t	key;
+
+	keys->next_rotate = now + keys->rotate;
+
+	if (keys->num_keys) {
+		DEBUG2("Session tickets: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " renewals",
+		       keys->stats.hits, keys->stats.misses, keys->stats.renewals);
+	}
+
+	if (keys->file) return (ticket_keys_load(keys) < 0) ? -1 : 0;
+
+	if ((RAND_bytes(key.name, sizeof(key.name)) != 1) ||
+	    (RAND_bytes(key.hmac, sizeof(key.hmac)) != 1) ||
+	    (RAND_bytes(key.aes, sizeof(key.aes)) != 1)) {
+		tls_log_error(NULL, "Failed generating session ticket key");
+		memset(&key, 0, sizeof(key));
+		return -1;
+	}
+	key.retired = 0;
+
+	/*
+	 *	Rotation only happens when a ticket is next issued or
+	 *	presented, so the current key may have been encrypting
+	 *	tickets for much longer than "rotate" seconds.  Record
+	 *	when it was actually replaced.
+	 */
+	if (keys->num_keys) keys->keys[0].retired = now;
+
+	/*
+	 *	Tickets encrypted with a key are valid until
+	 *	"lifetime" seconds after it was replaced.
+	 */
+	while (keys->num_keys &&
+	       ((keys->keys[keys->num_keys - 1].retired + keys->lifetime) < now)) {
+		keys->num_keys--;
+	}
+	if (keys->num_keys == TICKET_MAX_KEYS) keys->num_keys--;
+
+	memmove(&keys->keys[1], &keys->keys[0], sizeof(keys->keys[0]) * keys->num_keys);
+	memcpy(&keys->keys[0], &key, sizeof(keys->keys[0]));
+	keys->num_keys++;
+
+	memset(&key, 0, sizeof(key));
+	memset(&keys->keys[keys->num_keys], 0, sizeof(keys->keys[0]) * (TICKET_MAX_KEYS - keys->num_keys));
+
+	DEBUG2("Rotated session ticket keys, %u key(s) in use", keys->num_keys);
+
+	return 0;
+}
+
+/** Encrypt or decrypt a session ticket
+ *
+ * Called by OpenSSL when issuing a new ticket (enc == 1), or when a
+ * client presents a ticket to resume a session (enc == 0).
+ *
+ * @return
+ *	- 2 if the ticket was decrypted with an old key, and should be replaced.
+ *	- 1 on success.
+ *	- 0 if there's no key, in which case a full handshake is performed.
+ *	- -1 on error.
+ */
+int tls_ticket_key_cb(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+		      EVP_CIPHER_CTX *cipher_ctx, HMAC_CTX *hmac_ctx, int enc)
+{
+	fr_tls_conf_t		*conf;
+	tls_session_t		*session;
+	REQUEST			*request;
+	tls_ticket_keys_t	*keys;
+	tls_ticket_key_t	*key;
+	time_t			now;
+	unsigned int		i;
+	int			ret;
+
+	conf = talloc_get_type_abort(SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF), fr_tls_conf_t);
+	session = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TLS_SESSION);
+	request = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST);
+
+	keys = conf->session_ticket_keys;
+	if (!keys) return 0;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	/*
+	 *	Older versions of OpenSSL don't let us refuse to
+	 *	issue a ticket.
+	 */
+	if (enc && session && (!session->allow_session_resumption || !session->allow_ticket_resumption)) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Session resumption is disabled, not issuing session ticket");
+		return 0;
+	}
+#endif
+
+	/*
+	 *	Tickets can't be revoked, so this is the only place
+	 *	we can apply policy to them.  Anything that disabled
+	 *	resumption before the client presented its ticket
+	 *	forces a full handshake.
+	 */
+	if (!enc && session) {
+		VALUE_PAIR *vp;
+
+		vp = request ? fr_pair_find_by_num(request->control, 0, PW_ALLOW_SESSION_RESUMPTION, TAG_ANY) : NULL;
+		if (!session->allow_session_resumption || !session->allow_ticket_resumption ||
+		    (vp && (vp->vp_integer == 0))) {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Session resumption is disabled, ignoring session ticket");
+			return 0;
+		}
+	}
+
+	now = time(NULL);
+
+	pthread_mutex_lock(&keys->mutex);
+	if (now >= keys->next_rotate) ticket_keys_rotate(keys, now);
+
+	if (enc) {
+		if (!keys->num_keys) {
+			pthread_mutex_unlock(&keys->mutex);
+			ROPTIONAL(RWARN, WARN, "No session ticket keys available, not issuing session ticket");
+			return 0;
+		}
+		key = &keys->keys[0];
+
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) {
+			pthread_mutex_unlock(&keys->mutex);
+			tls_log_error(request, "Failed generating session ticket IV");
+			return -1;
+		}
+
+		memcpy(key_name, key->name, TICKET_KEY_NAME_LEN);
+		EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key->aes, iv);
+		HMAC_Init_ex(hmac_ctx, key->hmac, sizeof(key->hmac), EVP_sha256(), NULL);
+		pthread_mutex_unlock(&keys->mutex);
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "Issuing session ticket");
+
+		return 1;
+	}
+
+	for (i = 0; i < keys->num_keys; i++) {
+		if (memcmp(key_name, keys->keys[i].name, TICKET_KEY_NAME_LEN) == 0) break;
+	}
+
+	if (i == keys->num_keys) {
+		keys->stats.misses++;
+		pthread_mutex_unlock(&keys->mutex);
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "No key for session ticket, performing full handshake");
+
+		return 0;
+	}
+	key = &keys->keys[i];
+
+	HMAC_Init_ex(hmac_ctx, key->hmac, sizeof(key->hmac), EVP_sha256(), NULL);
+	EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key->aes, iv);
+
+	if (i == 0) {
+		keys->stats.hits++;
+		ret = 1;
+	} else {
+		keys->stats.renewals++;
+		ret = 2;
+	}
+	pthread_mutex_unlock(&keys->mutex);
+
+	if (session) session->ticket_key_found = true;
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Decrypting session ticket%s", (ret == 2) ? ", and issuing replacement" : "");
+
+	return ret;
+}
+
+static int _ticket_keys_free(tls_ticket_keys_t *keys)
+{
+	pthread_mutex_destroy(&keys->mutex);
+	memset(keys->keys, 0, sizeof(keys->keys));
+
+	return 0;
+}
+#endif
+
+/** Allocate the keys used to encrypt and decrypt session tickets
+ *
+ * @param ctx to allocate the keys in.
+ * @param file to load keys from.  If NULL keys are generated, and so
+ *	can't be shared with other servers.
+ * @param rotate how often to generate a new key, or to check the file
+ *	for new keys.
+ * @param lifetime of a session.  Old keys are discarded when no tickets
+ *	they encrypted can still be valid.
+ * @return
+ *	- New ticket keys on success.
+ *	- NULL on failure.
+ */
+tls_ticket_keys_t *tls_ticket_keys_alloc(TALLOC_CTX *ctx, char const *file, uint32_t rotate, uint32_t lifetime)
+{
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+	tls_ticket_keys_t *keys;
+
+	keys = talloc_zero(ctx, tls_ticket_keys_t);
+	if (!keys) {
+		ERROR("Out of memory");
+		return NULL;
+	}
+
+	keys->file = file;
+	keys->rotate = rotate;
+	keys->lifetime = lifetime;
+
+	if (ticket_keys_rotate(keys, time(NULL)) < 0) {
+		talloc_free(keys);
+		return NULL;
+	}
+
+	pthread_mutex_init(&keys->mutex, NULL);
+	talloc_set_destructor(keys, _ticket_keys_free);
+
+	return keys;
+#else
+	ERROR("Session tickets are not supported by this version of OpenSSL");
+	return NULL;
+#endif
+}
+
+/** Rotate the ticket keys now, or reload them if they're read from a file
+ *
+ * This normally happens when the first ticket is issued or presented
+ * after the rotation interval has passed.
+ *
+ * @param keys to rotate.
+ * @param now the current time.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure (the existing keys are left alone).
+ */
+int tls_ticket_keys_rotate(tls_ticket_keys_t *keys, time_t now)
+{
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+	int ret;
+
+	pthread_mutex_lock(&keys->mutex);
+	ret = ticket_keys_rotate(keys, now);
+	pthread_mutex_unlock(&keys->mutex);
+
+	return ret;
+#else
+	return -1;
+#endif
+}
+
+/** Retrieve the session ticket counters
+ *
+ * @param[out] stats Where to write the counters.  Zeroed if session
+ *	tickets aren't enabled.
+ * @param[in] keys to get the counters for.  May be NULL.
+ */
+void tls_ticket_stats(tls_ticket_stats_t *stats, tls_ticket_keys_t *keys)
+{
+	memset(stats, 0, sizeof(*stats));
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+	if (!keys) return;
+
+	pthread_mutex_lock(&keys->mutex);
+	memcpy(stats, &keys->stats, sizeof(*stats));
+	stats->keys = keys->num_keys;
+	pthread_mutex_unlock(&keys->mutex);
+#endif
+}
+#endif /* WITH_TLS */
@@ -541,6 +541,7 @@ static bool do_xlats(char const *filename, FILE *fp)
 	char		input[8192];
 	char		output[8192];
 	REQUEST		*request;
+	TALLOC_CTX	*cache_owner = NULL;
 	struct timeval	now;
 
 	/*
@@ -611,6 +612,146 @@ static bool do_xlats(char const *filename, FILE *fp)
 			continue;
 		}
 
+		/*
+		 *	Look for "pairs", which adds attributes to the
+		 *	request, for use by later expansions.
+		 */
+		if (strncmp(input, "pairs ", 6) == 0) {
+			if (!request->packet) {
+				request->packet = fr_radius_alloc(request, false);
+				if (!request->packet) {
+					fprintf(stderr, "No memory\n");
+					TALLOC_FREE(request);
+					return false;
+				}
+				request->packet->timestamp = now;
+			}
+
+			if (fr_pair_list_afrom_str(request->packet, input + 6, &request->packet->vps) == T_INVALID) {
+				fprintf(stderr, "Failed parsing pairs at line %d of %s: %s\n",
+					lineno, filename, fr_strerror());
+				TALLOC_FREE(request);
+				return false;
+			}
+			continue;
+		}
+
+		/*
+		 *	Look for "bench <count> <fmt>", which times
+		 *	expansions of the format string, first parsing
+		 *	it every time and expanding into a new buffer,
+		 *	as xlat_expand() did before it had a cache, and
+		 *	then with the cached tree.
+		 */
+		if (strncmp(input, "bench ", 6) == 0) {
+			unsigned long	i, count;
+			char const	*fmt;
+			char const	*error = NULL;
+			char		uncached[8192];
+			struct timeval	start, end;
+			uint64_t	usec[2];
+			int		lvl = request->log.lvl;
+
+			count = strtoul(input + 6, &p, 10);
+			if (!count || (*p != ' ')) {
+				fprintf(stderr, "Invalid count at line %d of %s\n", lineno, filename);
+				TALLOC_FREE(request);
+				return false;
+			}
+			fmt = p + 1;
+
+			request->log.lvl = L_DBG_LVL_OFF;
+
+			gettimeofday(&start, NULL);
+			for (i = 0; i < count; i++) {
+				char		*tokens, *expanded = NULL;
+				xlat_exp_t	*head = NULL;
+
+				tokens = talloc_typed_strdup(request, fmt);	/* modified by xlat_tokenize */
+				len = xlat_tokenize(tokens, tokens, &head, &error);
+				if (len > 0) len = radius_axlat_struct(&expanded, request, head, NULL, NULL);
+				if ((len >= 0) && (i == 0)) strlcpy(uncached, expanded ? expanded : "", sizeof(uncached));
+				talloc_free(expanded);
+				talloc_free(tokens);
+				if (len < 0) break;
+			}
+			gettimeofday(&end, NULL);
+			usec[0] = ((uint64_t) (end.tv_sec - start.tv_sec) * 1000000) + (end.tv_usec - start.tv_usec);
+
+			if ((len < 0) || (xlat_cache_add(request, fmt, &error) < 0)) {
+				request->log.lvl = lvl;
+				snprintf(output, sizeof(output), "ERROR expanding xlat: %s", error ? error : fr_strerror());
+				continue;
+			}
+
+			gettimeofday(&start, NULL);
+			for (i = 0; i < count; i++) {
+				len = radius_xlat(output, sizeof(output), request, fmt, NULL, NULL);
+			}
+			gettimeofday(&end, NULL);
+			usec[1] = ((uint64_t) (end.tv_sec - start.tv_sec) * 1000000) + (end.tv_usec - start.tv_usec);
+
+			request->log.lvl = lvl;
+
+			INFO("bench %s", fmt);
+			INFO("  uncached %" PRIu64 " ns/expansion", (usec[0] * 1000) / count);
+			INFO("  cached   %" PRIu64 " ns/expansion", (usec[1] * 1000) / count);
+
+			if (strcmp(output, uncached) != 0) {
+				fprintf(stderr, "Cached expansion differs at line %d of %s\n\tuncached : %s\n\tcached   : %s\n",
+					lineno, filename, uncached, output);
+				TALLOC_FREE(request);
+				return false;
+			}
+			continue;
+		}
+
+		/*
+		 *	Look for "cache <fmt>", which caches the format
+		 *	string as if it had been read from a configuration
+		 *	item, until "release".
+		 */
+		if (strncmp(input, "cache ", 6) == 0) {
+			char const *error = NULL;
+
+			if (!cache_owner) cache_owner = talloc_named_const(NULL, 0, "cache_owner");
+
+			if (xlat_cache_add(cache_owner, input + 6, &error) < 0) {
+				snprintf(output, sizeof(output), "ERROR caching xlat: %s", error);
+			}
+			continue;
+		}
+
+		if (strcmp(input, "release") == 0) {
+			TALLOC_FREE(cache_owner);
+			continue;
+		}
+
+		if (strcmp(input, "hup") == 0) {
+			xlat_cache_hup();
+			continue;
+		}
+
+		/*
+		 *	Look for "cached <fmt>", which expands the format
+		 *	string, and says whether the cached tree was used.
+		 */
+		if (strncmp(input, "cached ", 7) == 0) {
+			char	buff[sizeof(output) - 8];
+			bool	hit;
+
+			hit = (xlat_cache_find(input + 7) != NULL);
+
+			len = radius_xlat(buff, sizeof(buff), request, input + 7, NULL, NULL);
+			if (len < 0) {
+				snprintf(output, sizeof(output), "ERROR expanding xlat: %s", fr_strerror());
+				continue;
+			}
+
+			snprintf(output, sizeof(output), "%s %s", hit ? "hit" : "miss", buff);
+			continue;
+		}
+
 		/*
 		 *	Look for "data".
 		 */
@@ -625,10 +766,12 @@ static bool do_xlats(char const *filename, FILE *fp)
 		}
 
 		fprintf(stderr, "Unknown keyword in %s[%d]\n", filename, lineno);
+		TALLOC_FREE(cache_owner);
 		TALLOC_FREE(request);
 		return false;
 	}
 
+	TALLOC_FREE(cache_owner);
 	TALLOC_FREE(request);
 	return true;
 }
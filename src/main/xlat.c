@@ -78,6 +78,167 @@ typedef struct xlat_out {
 
 static rbtree_t *xlat_root = NULL;
 
+/** A format string which has been tokenized once, and can be reused
+ *
+ */
+typedef struct xlat_cache_entry_t {
+	char const			*fmt;		//!< The original format string (the key).
+	xlat_exp_t			*head;		//!< Tokenized form of fmt.
+
+	uint32_t			refs;		//!< Number of owners (usually CONF_PAIRs) of fmt.
+	time_t				retired;	//!< When the entry was removed from the cache.
+							//!< 0 if it's still in the cache.
+	struct xlat_cache_entry_t	*next;		//!< Next retired entry.
+} xlat_cache_entry_t;
+
+/** Ties a cache entry to the lifetime of its owner
+ *
+ */
+typedef struct xlat_cache_ref_t {
+	xlat_cache_entry_t		*entry;
+} xlat_cache_ref_t;
+
+/*
+ *	Compiled format strings, keyed by the text of the format.
+ *	Entries are only ever added when the configuration is
+ *	loaded, so the lock is almost never taken for writing.
+ *
+ *	Each entry is referenced by the configuration items it
+ *	was parsed from, and stays in the cache until they're all
+ *	freed.  Configurations which aren't re-parsed on HUP keep
+ *	their entries.  Entries are also removed when an xlat
+ *	function their tree uses is unregistered.
+ *
+ *	Removed entries are retired rather than freed, as another
+ *	thread may still be walking the tree.  They're freed 60
+ *	seconds later, the same as old module instances after a
+ *	HUP, or when their last reference goes if that's later.
+ */
+static fr_hash_table_t *xlat_cache = NULL;
+static TALLOC_CTX *xlat_cache_ctx = NULL;
+static xlat_cache_entry_t *xlat_cache_retired = NULL;
+static pthread_rwlock_t xlat_cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/** Remove an entry from the cache, so it's not used for new expansions
+ *
+ * @note Must be called with the cache lock held for writing.
+ */
+static void xlat_cache_retire(xlat_cache_entry_t *entry, time_t now)
+{
+	fr_hash_table_delete(xlat_cache, entry);
+
+	entry->retired = now;
+	entry->next = xlat_cache_retired;
+	xlat_cache_retired = entry;
+}
+
+/** Free retired entries which nobody can be using
+ *
+ * @note Must be called with the cache lock held for writing.
+ */
+static void xlat_cache_sweep(time_t now)
+{
+	xlat_cache_entry_t *entry, **last;
+
+	last = &xlat_cache_retired;
+	while (*last) {
+		entry = *last;
+
+		if (entry->refs || ((now - entry->retired) < 60)) {
+			last = &(entry->next);
+			continue;
+		}
+
+		*last = entry->next;
+		talloc_free(entry);
+	}
+}
+
+/** Check whether a tree calls a particular xlat, or any xlat registered by a module instance
+ *
+ */
+static bool xlat_cache_uses(xlat_exp_t const *node, void *mod_inst, xlat_t const *xlat)
+{
+	for (; node; node = node->next) {
+		if (node->xlat) {
+			if (xlat ? (node->xlat == xlat) : (node->xlat->mod_inst == mod_inst)) return true;
+		}
+
+		if (xlat_cache_uses(node->child, mod_inst, xlat) ||
+		    xlat_cache_uses(node->alternate, mod_inst, xlat)) return true;
+	}
+
+	return false;
+}
+
+typedef struct xlat_cache_unregister_t {
+	void			*mod_inst;
+	xlat_t const		*xlat;
+	time_t			now;
+} xlat_cache_unregister_t;
+
+static int xlat_cache_unregister_walk(void *ctx, void *data)
+{
+	xlat_cache_unregister_t	*uctx = ctx;
+	xlat_cache_entry_t	*entry = data;
+
+	if (xlat_cache_uses(entry->head, uctx->mod_inst, uctx->xlat)) xlat_cache_retire(entry, uctx->now);
+
+	return 0;
+}
+
+/** Remove entries whose trees point to xlats which are being unregistered
+ *
+ * @param[in] mod_inst	whose xlats are being unregistered, if xlat is NULL.
+ * @param[in] xlat	being unregistered.
+ */
+static void xlat_cache_unregister(void *mod_inst, xlat_t const *xlat)
+{
+	xlat_cache_unregister_t uctx = { .mod_inst = mod_inst, .xlat = xlat, .now = time(NULL) };
+
+	pthread_rwlock_wrlock(&xlat_cache_lock);
+	if (xlat_cache) fr_hash_table_walk(xlat_cache, xlat_cache_unregister_walk, &uctx);
+	xlat_cache_sweep(uctx.now);
+	pthread_rwlock_unlock(&xlat_cache_lock);
+}
+
+static int _xlat_cache_ref_free(xlat_cache_ref_t *ref)
+{
+	xlat_cache_entry_t	*entry = ref->entry;
+	time_t			now = time(NULL);
+
+	pthread_rwlock_wrlock(&xlat_cache_lock);
+
+	/*
+	 *	xlat_free() has already freed all of the entries.
+	 */
+	if (!xlat_cache_ctx) {
+		pthread_rwlock_unlock(&xlat_cache_lock);
+		return 0;
+	}
+
+	rad_assert(entry->refs > 0);
+	entry->refs--;
+	if (!entry->refs && !entry->retired) xlat_cache_retire(entry, now);
+	xlat_cache_sweep(now);
+
+	pthread_rwlock_unlock(&xlat_cache_lock);
+
+	return 0;
+}
+
+/** Free cached format strings which are no longer used
+ *
+ * Called when the configuration is reloaded.  Entries still referenced by
+ * any configuration, old or new, are kept.
+ */
+void xlat_cache_hup(void)
+{
+	pthread_rwlock_wrlock(&xlat_cache_lock);
+	xlat_cache_sweep(time(NULL));
+	pthread_rwlock_unlock(&xlat_cache_lock);
+}
+
 #ifdef WITH_UNLANG
 static char const * const xlat_foreach_names[] = {"Foreach-Variable-0",
 						  "Foreach-Variable-1",
@@ -872,6 +1033,7 @@ void xlat_unregister(void *mod_inst, char const *name, UNUSED xlat_func_t func)
 
 	if (c->mod_inst != mod_inst) return;
 
+	xlat_cache_unregister(mod_inst, c);
 	rbtree_deletebydata(xlat_root, c);
 }
 
@@ -888,6 +1050,7 @@ void xlat_unregister_module(void *instance)
 {
 	if (!xlat_root) return;	/* All xlats have already been freed */
 
+	xlat_cache_unregister(instance, NULL);
 	rbtree_walk(xlat_root, RBTREE_DELETE_ORDER, xlat_unregister_callback, instance);
 }
 
@@ -1121,6 +1284,12 @@ bool xlat_register_redundant(CONF_SECTION *cs)
  */
 void xlat_free(void)
 {
+	pthread_rwlock_wrlock(&xlat_cache_lock);
+	xlat_cache = NULL;
+	xlat_cache_retired = NULL;
+	TALLOC_FREE(xlat_cache_ctx);
+	pthread_rwlock_unlock(&xlat_cache_lock);
+
 	TALLOC_FREE(xlat_root);
 }
 
@@ -1824,6 +1993,131 @@ static ssize_t xlat_tokenize_request(REQUEST *request, char const *fmt, xlat_exp
 	return slen;
 }
 
+static uint32_t xlat_cache_hash(void const *data)
+{
+	xlat_cache_entry_t const *entry = data;
+
+	return fr_hash_string(entry->fmt);
+}
+
+static int xlat_cache_cmp(void const *one, void const *two)
+{
+	xlat_cache_entry_t const *a = one, *b = two;
+
+	return strcmp(a->fmt, b->fmt);
+}
+
+/** Tokenize a format string once, so that later expansions of it can skip the parser
+ *
+ * This should be called when the configuration is loaded, for format strings
+ * which are expanded for every request.  Later calls to #radius_xlat and
+ * #radius_axlat with an identical format string use the cached tree.
+ *
+ * The format string is only parsed once, so callers which need to validate
+ * it should use the return value of this function, rather than calling
+ * #xlat_tokenize as well.
+ *
+ * The cached tree is kept until owner is freed.  If the same string is added
+ * by several owners, it's kept until they've all been freed.
+ *
+ * @param[in] owner of the format string, usually the CONF_PAIR it came from.
+ *	If NULL, the tree is kept until the xlats it calls are unregistered.
+ * @param[in] fmt the format string to cache.
+ * @param[out] error Where to write the reason the format string couldn't be parsed.
+ * @return
+ *	- >= 0 on success, or if the string is already cached.
+ *	- < 0 on failure, as with #xlat_tokenize, the negative offset of the error in fmt.
+ */
+ssize_t xlat_cache_add(TALLOC_CTX *owner, char const *fmt, char const **error)
+{
+	xlat_cache_entry_t	*entry, my_entry;
+	xlat_cache_ref_t	*ref = NULL;
+	char			*tokens;
+	ssize_t			slen = 0;
+
+	if (!fmt || !*fmt) return 0;
+
+	pthread_rwlock_wrlock(&xlat_cache_lock);
+	if (!xlat_cache_ctx) {
+		xlat_cache_ctx = talloc_named_const(NULL, 0, "xlat_cache");
+		if (!xlat_cache_ctx) goto oom;
+	}
+
+	if (!xlat_cache) {
+		xlat_cache = fr_hash_table_create(xlat_cache_ctx, xlat_cache_hash, xlat_cache_cmp, NULL);
+		if (!xlat_cache) goto oom;
+	}
+
+	xlat_cache_sweep(time(NULL));
+
+	if (owner) {
+		ref = talloc_zero(owner, xlat_cache_ref_t);
+		if (!ref) goto oom;
+	}
+
+	my_entry.fmt = fmt;
+	entry = fr_hash_table_finddata(xlat_cache, &my_entry);
+	if (!entry) {
+		entry = talloc_zero(xlat_cache_ctx, xlat_cache_entry_t);
+		if (!entry) goto oom;
+
+		entry->fmt = talloc_typed_strdup(entry, fmt);
+		tokens = talloc_typed_strdup(entry, fmt);	/* modified by xlat_tokenize */
+		if (!entry->fmt || !tokens) {
+			talloc_free(entry);
+			goto oom;
+		}
+
+		slen = xlat_tokenize_literal(entry, tokens, &entry->head, false, error);
+		if ((slen <= 0) || !fr_hash_table_insert(xlat_cache, entry)) {
+			talloc_free(entry);
+			talloc_free(ref);
+			pthread_rwlock_unlock(&xlat_cache_lock);
+			return slen;
+		}
+	}
+
+	/*
+	 *	Without an owner, the reference is never released.
+	 */
+	entry->refs++;
+	if (ref) {
+		ref->entry = entry;
+		talloc_set_destructor(ref, _xlat_cache_ref_free);
+	}
+	pthread_rwlock_unlock(&xlat_cache_lock);
+
+	return slen;
+
+oom:
+	talloc_free(ref);
+	pthread_rwlock_unlock(&xlat_cache_lock);
+	*error = "Out of memory";
+	return -1;
+}
+
+/** Find the cached tree for a format string
+ *
+ * @param[in] fmt the format string to look up.
+ * @return the tokenized format string, or NULL if it hasn't been cached.
+ */
+xlat_exp_t const *xlat_cache_find(char const *fmt)
+{
+	xlat_cache_entry_t	*entry, my_entry;
+
+	pthread_rwlock_rdlock(&xlat_cache_lock);
+	if (!xlat_cache) {
+		pthread_rwlock_unlock(&xlat_cache_lock);
+		return NULL;
+	}
+
+	my_entry.fmt = fmt;
+	entry = fr_hash_table_finddata(xlat_cache, &my_entry);
+	pthread_rwlock_unlock(&xlat_cache_lock);
+
+	return entry ? entry->head : NULL;
+}
+
 
 static char *xlat_getvp(TALLOC_CTX *ctx, REQUEST *request, vp_tmpl_t const *vpt,
 			bool escape, bool return_null)
@@ -2487,6 +2781,168 @@ static size_t xlat_process(char **out, REQUEST *request, xlat_exp_t const * cons
 }
 
 
+/** Print a simple attribute reference directly into a buffer
+ *
+ * Handles the common cases of string and integer attributes without any
+ * intermediary allocations.  The output is identical to #xlat_getvp.
+ *
+ * @param[out] out Where to write the value.
+ * @param[in] outlen Size of out.
+ * @param[in] request current request.
+ * @param[in] vpt the attribute reference.
+ * @param[in] quote whether strings should be escaped, as with #fr_pair_value_asprint.
+ * @return
+ *	- The length of the value written to out.
+ *	- -1 if the reference must be expanded with #xlat_aprint instead.
+ */
+static ssize_t xlat_attr_snprint(char *out, size_t outlen, REQUEST *request, vp_tmpl_t const *vpt, bool quote)
+{
+	VALUE_PAIR		*vp;
+	vp_cursor_t		cursor;
+	fr_dict_enum_t const	*dv;
+	unsigned int		i;
+	size_t			len;
+
+	if ((vpt->type != TMPL_TYPE_ATTR) || (vpt->tmpl_num == NUM_COUNT) || (vpt->tmpl_num == NUM_ALL)) return -1;
+
+	vp = tmpl_cursor_init(NULL, &cursor, request, vpt);
+	if (!vp) {
+		if (vpt->tmpl_da->flags.virtual) return -1;
+
+		*out = '\0';
+		return 0;
+	}
+
+	if (vp->type == VT_XLAT) return -1;
+
+	switch (vp->da->type) {
+	case PW_TYPE_STRING:
+		if (quote) {
+			if (fr_snprint_len(vp->vp_strvalue, vp->vp_length, '"') > outlen) return -1;
+			return fr_snprint(out, outlen, vp->vp_strvalue, vp->vp_length, '"');
+		}
+
+		if (vp->vp_length >= outlen) return -1;
+		memcpy(out, vp->vp_strvalue, vp->vp_length);
+		out[vp->vp_length] = '\0';
+		return strlen(out);
+
+	case PW_TYPE_INTEGER:
+		i = vp->vp_integer;
+		goto print_int;
+
+	case PW_TYPE_SHORT:
+		i = vp->vp_short;
+		goto print_int;
+
+	case PW_TYPE_BYTE:
+		i = vp->vp_byte;
+
+	print_int:
+		dv = fr_dict_enum_by_da(NULL, vp->da, i);
+		if (dv) {
+			len = strlcpy(out, dv->name, outlen);
+		} else {
+			len = snprintf(out, outlen, "%u", i);
+		}
+		break;
+
+	case PW_TYPE_SIGNED:
+		len = snprintf(out, outlen, "%d", vp->vp_signed);
+		break;
+
+	case PW_TYPE_INTEGER64:
+		len = snprintf(out, outlen, "%" PRIu64, vp->vp_integer64);
+		break;
+
+	default:
+		return -1;
+	}
+
+	if (len >= outlen) return -1;
+
+	return len;
+}
+
+/** Expand a tokenized format string into a caller supplied buffer
+ *
+ * Literals and simple attribute references are written straight into the
+ * output buffer.  Everything else goes through #xlat_aprint, and is copied.
+ *
+ * @param[out] out Where to write the expansion.
+ * @param[in] outlen Size of out, must be greater than zero.
+ * @param[in] request current request.
+ * @param[in] head the xlat structure to expand.
+ * @param[in] escape function to escape final value e.g. SQL quoting.
+ * @param[in] escape_ctx pointer to pass to escape function.
+ * @return the length of the full expansion, which may be larger than outlen.
+ */
+static size_t xlat_process_buf(char *out, size_t outlen, REQUEST *request, xlat_exp_t const * const head,
+			       xlat_escape_t escape, void *escape_ctx)
+{
+	char			*p = out, *end = out + outlen - 1;
+	size_t			total = 0;
+	xlat_exp_t const	*node;
+	char			buffer[FR_MAX_STRING_LEN + 1];
+
+	for (node = head; node != NULL; node = node->next) {
+		char const	*str;
+		char		*answer = NULL;
+		ssize_t		slen;
+		size_t		len;
+
+		if (node->type == XLAT_LITERAL) {
+			str = node->fmt;
+			len = strlen(str);
+
+		} else if ((node->type == XLAT_ATTRIBUTE) &&
+			   ((slen = xlat_attr_snprint(buffer, sizeof(buffer), request, &node->attr, !escape)) >= 0)) {
+			if (slen == 0) continue;
+
+			str = buffer;
+			len = slen;
+
+			/*
+			 *	Escape straight into the output buffer
+			 *	if there's guaranteed to be room.
+			 */
+			if (escape) {
+				size_t escaped_len = (len + 1) * 3;
+
+				if (escaped_len <= (size_t) (end - p) + 1) {
+					escape(request, p, escaped_len, buffer, escape_ctx);
+					len = strlen(p);
+					p += len;
+					total += len;
+					continue;
+				}
+
+				answer = talloc_array(request, char, escaped_len);
+				if (!answer) continue;
+				escape(request, answer, escaped_len, buffer, escape_ctx);
+				str = answer;
+				len = strlen(str);
+			}
+
+		} else {
+			answer = xlat_aprint(request, request, node, escape, escape_ctx, 0);
+			if (!answer) continue;
+
+			str = answer;
+			len = strlen(str);
+		}
+
+		total += len;
+		if (len > (size_t) (end - p)) len = end - p;
+		memcpy(p, str, len);
+		p += len;
+		talloc_free(answer);
+	}
+	*p = '\0';
+
+	return total;
+}
+
 /** Replace %whatever in a string.
  *
  * See 'doc/configuration/variables.rst' for more information.
@@ -2507,6 +2963,11 @@ static ssize_t xlat_expand_struct(char **out, size_t outlen, REQUEST *request, x
 
 	rad_assert(node != NULL);
 
+	/*
+	 *	Write directly to the caller's buffer.
+	 */
+	if (*out && (outlen > 0)) return xlat_process_buf(*out, outlen, request, node, escape, escape_ctx);
+
 	len = xlat_process(&buff, request, node, escape, escape_ctx);
 	if ((len < 0) || !buff) {
 		rad_assert(buff == NULL);
@@ -2553,10 +3014,24 @@ static ssize_t xlat_expand(char **out, size_t outlen, REQUEST *request, char con
 {
 	ssize_t len;
 	xlat_exp_t *node;
+	xlat_exp_t const *cached;
 
 	RDEBUG2("EXPAND %s", fmt);
 	RINDENT();
 
+	/*
+	 *	Use the pre-compiled version if we have one.
+	 */
+	cached = xlat_cache_find(fmt);
+	if (cached) {
+		len = xlat_expand_struct(out, outlen, request, cached, escape, escape_ctx);
+
+		REXDENT();
+		RDEBUG2("--> %s", *out);
+
+		return len;
+	}
+
 	/*
 	 *	Give better errors than the old code.
 	 */
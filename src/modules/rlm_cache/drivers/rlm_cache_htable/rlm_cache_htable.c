@@ -0,0 +1,558 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_htable.c
+ * @brief Sharded hash table based cache, with CLOCK eviction.
+ *
+ * Entries are spread over a number of shards by the hash of their key.
+ * Each shard has its own lock, hash table and CLOCK ring, so workers
+ * accessing different keys don't contend with each other.
+ *
+ * Expired entries are removed lazily, when they're looked up, when
+ * the CLOCK hand passes over them, or by a short expiry sweep on
+ * insert.
+ *
+ * @copyright 2016 The FreeRADIUS server project
+ */
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+#include "../../rlm_cache.h"
+
+/*
+ *	How many entries the expiry sweep looks at on insert when the
+ *	shard isn't full.  This is just to reclaim expired entries,
+ *	so the cache doesn't grow without bound when max_entries is 0.
+ */
+#define EXPIRY_SWEEP	2
+
+typedef struct rlm_cache_htable_entry rlm_cache_htable_entry_t;
+
+struct rlm_cache_htable_entry {
+	rlm_cache_entry_t		fields;		//!< Entry data.
+
+	uint32_t			hash;		//!< Hash of the entry's key.
+	bool				referenced;	//!< Entry has been retrieved since the CLOCK
+							//!< hand last passed over it.
+
+	rlm_cache_htable_entry_t	*next;		//!< Next entry in the hash bucket.
+	rlm_cache_htable_entry_t	*clock_prev;	//!< Previous entry in the CLOCK ring.
+	rlm_cache_htable_entry_t	*clock_next;	//!< Next entry in the CLOCK ring.
+};
+
+typedef struct rlm_cache_htable_shard {
+	pthread_mutex_t			mutex;		//!< Protects everything in the shard.
+
+	rlm_cache_htable_entry_t	**buckets;	//!< Hash buckets.
+	uint32_t			num_buckets;	//!< Always a power of two.
+	uint32_t			num;		//!< Number of entries in the shard.
+	uint32_t			max_entries;	//!< Maximum entries in the shard, or 0 for no limit.
+
+	rlm_cache_htable_entry_t	*hand;		//!< CLOCK hand.  Entries are inserted just
+							//!< behind it.
+	rlm_cache_htable_entry_t	*sweep;		//!< Where the expiry sweep continues from.
+							//!< Separate from the hand, so it doesn't
+							//!< clear reference bits.
+} rlm_cache_htable_shard_t;
+
+typedef struct rlm_cache_htable {
+	uint32_t			num_shards;	//!< How many shards to split the cache into.
+	uint32_t			shard_bits;	//!< log2(num_shards).
+	uint32_t			num_buckets;	//!< Initial number of buckets per shard.
+
+	rlm_cache_htable_shard_t	*shards;	//!< Array of shards.
+} rlm_cache_htable_t;
+
+/** Per-request handle
+ *
+ * The shard for the request's key is locked on the first operation, and stays
+ * locked until the handle is released.  This means entries we return from
+ * #cache_entry_find can't be freed by another thread while rlm_cache is merging them.
+ */
+typedef struct rlm_cache_htable_handle {
+	rlm_cache_htable_t		*driver;	//!< Driver instance.
+	rlm_cache_htable_shard_t	*shard;		//!< Shard we currently hold the lock for.
+} rlm_cache_htable_handle_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", PW_TYPE_INTEGER, rlm_cache_htable_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("buckets", PW_TYPE_INTEGER, rlm_cache_htable_t, num_buckets), .dflt = "64" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Get the shard an entry lives in
+ *
+ * Uses the top bits of the hash, so the bottom bits are free to select the bucket.
+ */
+static inline rlm_cache_htable_shard_t *cache_shard(rlm_cache_htable_t *driver, uint32_t hash)
+{
+	if (driver->shard_bits == 0) return &driver->shards[0];
+
+	return &driver->shards[hash >> (32 - driver->shard_bits)];
+}
+
+/** Lock the shard for a key, if we don't already hold it
+ *
+ */
+static rlm_cache_htable_shard_t *cache_shard_lock(rlm_cache_htable_handle_t *handle, uint32_t hash)
+{
+	rlm_cache_htable_shard_t *shard;
+
+	shard = cache_shard(handle->driver, hash);
+	if (handle->shard == shard) return shard;
+
+	/*
+	 *	rlm_cache only ever uses one key per handle, so we
+	 *	shouldn't be switching shards.
+	 */
+	if (handle->shard) {
+		rad_assert(0);
+		pthread_mutex_unlock(&handle->shard->mutex);
+	}
+
+	pthread_mutex_lock(&shard->mutex);
+	handle->shard = shard;
+
+	return shard;
+}
+
+/** Find an entry in a shard
+ *
+ */
+static rlm_cache_htable_entry_t *cache_shard_find(rlm_cache_htable_shard_t *shard, uint32_t hash,
+						  uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htable_entry_t *c;
+
+	for (c = shard->buckets[hash & (shard->num_buckets - 1)]; c; c = c->next) {
+		if ((c->hash == hash) && (c->fields.key_len == key_len) &&
+		    (memcmp(c->fields.key, key, key_len) == 0)) return c;
+	}
+
+	return NULL;
+}
+
+/** Double the number of buckets in a shard
+ *
+ * If we can't allocate the new buckets, we keep using the old ones.
+ */
+static void cache_shard_grow(rlm_cache_htable_shard_t *shard)
+{
+	rlm_cache_htable_entry_t	**buckets, *c, *next;
+	uint32_t			i, num_buckets = shard->num_buckets * 2;
+
+	buckets = talloc_zero_array(talloc_parent(shard->buckets), rlm_cache_htable_entry_t *, num_buckets);
+	if (!buckets) return;
+
+	for (i = 0; i < shard->num_buckets; i++) {
+		for (c = shard->buckets[i]; c; c = next) {
+			next = c->next;
+			c->next = buckets[c->hash & (num_buckets - 1)];
+			buckets[c->hash & (num_buckets - 1)] = c;
+		}
+	}
+
+	talloc_free(shard->buckets);
+	shard->buckets = buckets;
+	shard->num_buckets = num_buckets;
+}
+
+/** Unlink an entry from its bucket and the CLOCK ring, and free it
+ *
+ */
+static void cache_shard_remove(rlm_cache_htable_shard_t *shard, rlm_cache_htable_entry_t *c)
+{
+	rlm_cache_htable_entry_t **last;
+
+	for (last = &shard->buckets[c->hash & (shard->num_buckets - 1)]; *last; last = &(*last)->next) {
+		if (*last != c) continue;
+
+		*last = c->next;
+		break;
+	}
+
+	if (c->clock_next == c) {
+		shard->hand = NULL;
+		shard->sweep = NULL;
+	} else {
+		c->clock_prev->clock_next = c->clock_next;
+		c->clock_next->clock_prev = c->clock_prev;
+		if (shard->hand == c) shard->hand = c->clock_next;
+		if (shard->sweep == c) shard->sweep = c->clock_next;
+	}
+
+	shard->num--;
+	talloc_free(c);
+}
+
+/** Advance the CLOCK hand until an entry has been freed
+ *
+ * Expired entries are freed in preference.  Otherwise the first
+ * unreferenced entry is evicted, and referenced entries the hand
+ * passes over get a second chance.
+ *
+ * @param[in] shard to evict an entry from.
+ * @param[in] now current time.
+ */
+static void cache_shard_evict(rlm_cache_htable_shard_t *shard, time_t now)
+{
+	rlm_cache_htable_entry_t *c;
+
+	while ((c = shard->hand)) {
+		if ((c->fields.expires < now) || !c->referenced) {
+			cache_shard_remove(shard, c);
+			return;
+		}
+
+		c->referenced = false;
+		shard->hand = c->clock_next;
+	}
+}
+
+/** Remove expired entries, without affecting the CLOCK hand
+ *
+ * @param[in] shard to sweep.
+ * @param[in] now current time.
+ * @param[in] max number of entries to look at.
+ */
+static void cache_shard_expire(rlm_cache_htable_shard_t *shard, time_t now, uint32_t max)
+{
+	rlm_cache_htable_entry_t *c;
+
+	while ((max-- > 0) && (c = shard->sweep ? shard->sweep : shard->hand)) {
+		shard->sweep = c->clock_next;
+		if (c->fields.expires < now) cache_shard_remove(shard, c);
+	}
+}
+
+/** Free all entries in a shard
+ *
+ */
+static void cache_shard_free(rlm_cache_htable_shard_t *shard)
+{
+	while (shard->hand) cache_shard_remove(shard, shard->hand);
+}
+
+/** Cleanup a cache_htable instance
+ *
+ */
+static int _mod_detach(rlm_cache_htable_t *driver)
+{
+	uint32_t i;
+
+	if (!driver->shards) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		cache_shard_free(&driver->shards[i]);
+		pthread_mutex_destroy(&driver->shards[i].mutex);
+	}
+
+	return 0;
+}
+
+/** Create a new cache_htable instance
+ *
+ * @copydetails cache_instantiate_t
+ */
+static int mod_instantiate(CONF_SECTION *conf, rlm_cache_config_t const *config, void *driver_inst)
+{
+	rlm_cache_htable_t	*driver = driver_inst;
+	uint32_t		i;
+
+	if (cf_section_parse(conf, driver, driver_config) < 0) return -1;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, 1024);
+	FR_INTEGER_BOUND_CHECK("buckets", driver->num_buckets, >=, 1);
+	FR_INTEGER_BOUND_CHECK("buckets", driver->num_buckets, <=, (1 << 24));
+
+	/*
+	 *	Each shard gets an equal share of max_entries, so
+	 *	there can't be more shards than entries.
+	 */
+	if (config->max_entries && (driver->num_shards > config->max_entries)) {
+		WARN("%s[%d]: Reducing shards from %u to max_entries (%u)",
+		     cf_section_filename(conf), cf_section_lineno(conf), driver->num_shards, config->max_entries);
+		driver->num_shards = config->max_entries;
+	}
+
+	/*
+	 *	Round down to a power of two, so the shard can be
+	 *	picked from the top bits of the hash.
+	 */
+	while (driver->num_shards & (driver->num_shards - 1)) driver->num_shards &= driver->num_shards - 1;
+	while ((1U << driver->shard_bits) < driver->num_shards) driver->shard_bits++;
+
+	while (driver->num_buckets & (driver->num_buckets - 1)) driver->num_buckets &= driver->num_buckets - 1;
+
+	driver->shards = talloc_zero_array(driver, rlm_cache_htable_shard_t, driver->num_shards);
+	if (!driver->shards) {
+		ERROR("Failed allocating cache shards");
+		return -1;
+	}
+	talloc_set_destructor(driver, _mod_detach);
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_htable_shard_t *shard = &driver->shards[i];
+
+		shard->max_entries = config->max_entries / driver->num_shards;
+		shard->num_buckets = driver->num_buckets;
+		shard->buckets = talloc_zero_array(driver->shards, rlm_cache_htable_entry_t *, shard->num_buckets);
+		if (!shard->buckets) {
+			ERROR("Failed allocating cache buckets");
+		error:
+			driver->num_shards = i;
+			return -1;
+		}
+
+		if (pthread_mutex_init(&shard->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			goto error;
+		}
+	}
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *driver_inst,
+					    REQUEST *request)
+{
+	rlm_cache_htable_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_htable_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * Expired entries are removed, and reported as a miss.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, UNUSED void *driver_inst,
+				       REQUEST *request, void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htable_shard_t	*shard;
+	rlm_cache_htable_entry_t	*c;
+	uint32_t			hash;
+
+	hash = fr_hash(key, key_len);
+	shard = cache_shard_lock(handle, hash);
+
+	c = cache_shard_find(shard, hash, key, key_len);
+	if (c && (c->fields.expires < request->timestamp.tv_sec)) {
+		cache_shard_remove(shard, c);
+		c = NULL;
+	}
+
+	if (!c) {
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	c->referenced = true;
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, UNUSED void *driver_inst,
+					 REQUEST *request, void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htable_shard_t	*shard;
+	rlm_cache_htable_entry_t	*c;
+	uint32_t			hash;
+
+	if (!request) return CACHE_ERROR;
+
+	hash = fr_hash(key, key_len);
+	shard = cache_shard_lock(handle, hash);
+
+	c = cache_shard_find(shard, hash, key, key_len);
+	if (!c) return CACHE_MISS;
+
+	cache_shard_remove(shard, c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * If the shard is full, the CLOCK hand is advanced until an entry is evicted.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, UNUSED void *driver_inst,
+					 REQUEST *request, void *handle,
+					 rlm_cache_entry_t const *c)
+{
+	rlm_cache_htable_shard_t	*shard;
+	rlm_cache_htable_entry_t	*my_c, *old;
+	uint32_t			hash;
+
+	if (!request) return CACHE_ERROR;
+
+	memcpy(&my_c, &c, sizeof(my_c));
+
+	hash = fr_hash(c->key, c->key_len);
+	shard = cache_shard_lock(handle, hash);
+
+	/*
+	 *	Allow overwriting
+	 */
+	old = cache_shard_find(shard, hash, c->key, c->key_len);
+	if (old) cache_shard_remove(shard, old);
+
+	if (shard->max_entries && (shard->num >= shard->max_entries)) {
+		RDEBUG3("Shard full, evicting an entry");
+		cache_shard_evict(shard, request->timestamp.tv_sec);
+	} else {
+		cache_shard_expire(shard, request->timestamp.tv_sec, EXPIRY_SWEEP);
+	}
+
+	if (shard->num >= (shard->num_buckets * 2)) cache_shard_grow(shard);
+
+	my_c->hash = hash;
+	my_c->referenced = false;
+
+	my_c->next = shard->buckets[hash & (shard->num_buckets - 1)];
+	shard->buckets[hash & (shard->num_buckets - 1)] = my_c;
+
+	/*
+	 *	Insert behind the hand, so it's the last entry the
+	 *	hand will look at.
+	 */
+	if (!shard->hand) {
+		my_c->clock_prev = my_c->clock_next = my_c;
+		shard->hand = my_c;
+	} else {
+		my_c->clock_next = shard->hand;
+		my_c->clock_prev = shard->hand->clock_prev;
+		my_c->clock_prev->clock_next = my_c;
+		shard->hand->clock_prev = my_c;
+	}
+	shard->num++;
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * Expiry is lazy, so there's nothing to do other than checking the entry still exists.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, UNUSED void *driver_inst,
+					  REQUEST *request, void *handle,
+					  rlm_cache_entry_t *c)
+{
+	rlm_cache_htable_handle_t	*h = handle;
+	rlm_cache_htable_entry_t	*my_c = (rlm_cache_htable_entry_t *)c;
+
+	if (!request) return CACHE_ERROR;
+
+	rad_assert(h->shard == cache_shard(h->driver, my_c->hash));
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * The other shards aren't locked, so this is only approximate.
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *driver_inst,
+				  REQUEST *request, UNUSED void *handle)
+{
+	rlm_cache_htable_t	*driver = driver_inst;
+	uint32_t		i, count = 0;
+
+	if (!request) return CACHE_ERROR;
+
+	for (i = 0; i < driver->num_shards; i++) count += driver->shards[i].num;
+
+	return count;
+}
+
+/** Allocate a handle
+ *
+ * The shard isn't locked until we know the key.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *driver_inst,
+			 REQUEST *request)
+{
+	rlm_cache_htable_handle_t *h;
+
+	h = talloc_zero(request, rlm_cache_htable_handle_t);
+	if (!h) return -1;
+
+	h->driver = driver_inst;
+	*handle = h;
+
+	return 0;
+}
+
+/** Release a handle, unlocking the shard
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *driver_inst, UNUSED REQUEST *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_htable_handle_t *h = handle;
+
+	if (h->shard) pthread_mutex_unlock(&h->shard->mutex);
+
+	talloc_free(h);
+}
+
+extern cache_driver_t rlm_cache_htable;
+cache_driver_t rlm_cache_htable = {
+	.name		= "rlm_cache_htable",
+	.instantiate	= mod_instantiate,
+	.inst_size	= sizeof(rlm_cache_htable_t),
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
@@ -30,6 +30,7 @@ RCSID("$Id$")
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/rad_assert.h>
 #include <freeradius-devel/detail.h>
+#include <freeradius-devel/detail_binary.h>
 #include <freeradius-devel/exfile.h>
 
 #include <ctype.h>
@@ -67,6 +68,14 @@ typedef struct detail_instance {
 
 	bool		escape;		//!< do filename escaping, yes / no
 
+	char const	*format;	//!< "text" or "binary".
+	bool		binary;		//!< Write length prefixed RADIUS encoded records.
+
+	bool		async;		//!< Queue entries for the exfile writer thread.
+	uint32_t	queue_size;	//!< Maximum number of entries waiting to be written.
+	char const	*fsync_str;	//!< "none", "always" or "interval".
+	uint32_t	fsync_interval;	//!< How often to sync files with fsync = interval.
+
 	xlat_escape_t	escape_func; //!< escape function
 
 	exfile_t    	*ef;		//!< Log file handler
@@ -82,6 +91,11 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("locking", PW_TYPE_BOOLEAN, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", PW_TYPE_BOOLEAN, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", PW_TYPE_BOOLEAN, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("format", PW_TYPE_STRING, rlm_detail_t, format), .dflt = "text" },
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, rlm_detail_t, async), .dflt = "no" },
+	{ FR_CONF_OFFSET("queue_size", PW_TYPE_INTEGER, rlm_detail_t, queue_size), .dflt = "65536" },
+	{ FR_CONF_OFFSET("fsync", PW_TYPE_STRING, rlm_detail_t, fsync_str), .dflt = "none" },
+	{ FR_CONF_OFFSET("fsync_interval", PW_TYPE_INTEGER, rlm_detail_t, fsync_interval), .dflt = "1" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -131,12 +145,46 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		inst->escape_func = rad_filename_make_safe;
 	}
 
+	if (strcmp(inst->format, "binary") == 0) {
+		inst->binary = true;
+	} else if (strcmp(inst->format, "text") != 0) {
+		cf_log_err_cs(conf, "Invalid format \"%s\", expected \"text\" or \"binary\"", inst->format);
+		return -1;
+	}
+
 	inst->ef = module_exfile_init(inst, conf, 256, 30, inst->locking, NULL, NULL);
 	if (!inst->ef) {
 		cf_log_err_cs(conf, "Failed creating log file context");
 		return -1;
 	}
 
+	if (inst->async) {
+		int fsync;
+
+#ifndef HAVE_OPEN_MEMSTREAM
+		if (!inst->binary) {
+			cf_log_err_cs(conf, "'async = yes' requires 'format = binary' on this platform");
+			return -1;
+		}
+#endif
+
+		fsync = fr_str2int(exfile_fsync_table, inst->fsync_str, -1);
+		if (fsync < 0) {
+			cf_log_err_cs(conf, "Invalid fsync \"%s\", expected \"none\", \"always\" or \"interval\"",
+				      inst->fsync_str);
+			return -1;
+		}
+
+		FR_INTEGER_BOUND_CHECK("queue_size", inst->queue_size, >=, 64);
+		FR_INTEGER_BOUND_CHECK("queue_size", inst->queue_size, <=, 1048576);
+		FR_INTEGER_BOUND_CHECK("fsync_interval", inst->fsync_interval, >=, 1);
+
+		if (exfile_enable_async(inst->ef, inst->queue_size, fsync, inst->fsync_interval) < 0) {
+			cf_log_err_cs(conf, "Failed starting writer thread: %s", fr_strerror());
+			return -1;
+		}
+	}
+
 	/*
 	 *	Suppress certain attributes.
 	 */
@@ -336,6 +384,134 @@ static int detail_write(FILE *out, rlm_detail_t *inst, REQUEST *request, RADIUS_
 	return 0;
 }
 
+typedef struct detail_binary_skip_ctx_t {
+	rlm_detail_t	*inst;
+	bool		compat;
+} detail_binary_skip_ctx_t;
+
+/*
+ *	Apply the same filters as detail_write().
+ */
+static bool detail_binary_skip(VALUE_PAIR const *vp, void *uctx)
+{
+	detail_binary_skip_ctx_t *skip_ctx = uctx;
+
+	if (skip_ctx->inst->ht && fr_hash_table_finddata(skip_ctx->inst->ht, vp->da)) return true;
+
+	if (skip_ctx->compat && !vp->da->vendor && (vp->da->attr == PW_USER_PASSWORD)) return true;
+
+	return false;
+}
+
+/** Write a single binary detail entry to a file descriptor
+ *
+ * @param[in] outfd Where to write entry.
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] packet associated with the request (request, reply, proxy-request, proxy-reply...).
+ * @param[in] compat Write out entry in compatibility mode.
+ */
+static int detail_write_binary(int outfd, rlm_detail_t *inst, REQUEST *request, RADIUS_PACKET *packet, bool compat)
+{
+	uint8_t				buffer[FR_DETAIL_BINARY_MAX_LEN];
+	uint8_t				*p;
+	ssize_t				len, ret;
+	detail_binary_skip_ctx_t	skip_ctx = { .inst = inst, .compat = compat };
+
+	len = fr_detail_binary_encode(buffer, sizeof(buffer), packet, request->timestamp.tv_sec,
+				      inst->log_srcdst, detail_binary_skip, &skip_ctx);
+	if (len < 0) {
+		REDEBUG("Failed encoding detail record: %s", fr_strerror());
+		return -1;
+	}
+
+	/*
+	 *	Write the whole record, or the reader will see a
+	 *	truncated record, and stop.
+	 */
+	for (p = buffer; len > 0; p += ret, len -= ret) {
+		ret = write(outfd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			RERROR("Failed writing to detail file: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Queue a detail entry for the exfile writer thread
+ *
+ * The entry is formatted in memory, so the worker never touches the file.
+ *
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] filename to append the entry to.
+ * @param[in] packet associated with the request (request, reply, proxy-request, proxy-reply...).
+ * @param[in] compat Write out entry in compatibility mode.
+ */
+static int detail_queue(rlm_detail_t *inst, REQUEST *request, char const *filename,
+			RADIUS_PACKET *packet, bool compat)
+{
+	struct iovec	vector;
+	int		ret;
+
+	if (inst->binary) {
+		uint8_t				buffer[FR_DETAIL_BINARY_MAX_LEN];
+		ssize_t				len;
+		detail_binary_skip_ctx_t	skip_ctx = { .inst = inst, .compat = compat };
+
+		len = fr_detail_binary_encode(buffer, sizeof(buffer), packet, request->timestamp.tv_sec,
+					      inst->log_srcdst, detail_binary_skip, &skip_ctx);
+		if (len < 0) {
+			REDEBUG("Failed encoding detail record: %s", fr_strerror());
+			return -1;
+		}
+
+		vector.iov_base = buffer;
+		vector.iov_len = len;
+		ret = exfile_write(inst->ef, request, filename, inst->perm, &vector, 1);
+	} else {
+#ifdef HAVE_OPEN_MEMSTREAM
+		FILE	*fp;
+		char	*text = NULL;
+		size_t	len = 0;
+
+		fp = open_memstream(&text, &len);
+		if (!fp) {
+			RERROR("Failed formatting detail entry: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		if (detail_write(fp, inst, request, packet, compat) < 0) {
+			fclose(fp);
+			free(text);
+			return -1;
+		}
+		fclose(fp);
+
+		vector.iov_base = text;
+		vector.iov_len = len;
+		ret = exfile_write(inst->ef, request, filename, inst->perm, &vector, 1);
+		free(text);
+#else
+		rad_assert(0);		/* Checked in mod_instantiate */
+		return -1;
+#endif
+	}
+
+	if (ret < 0) {
+		RERROR("Failed writing detail entry to %s: %s", filename, fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
@@ -381,10 +557,21 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void *instance, REQUEST *request,
 #endif
 #endif
 
-	outfd = exfile_open(inst->ef, request, buffer, inst->perm, true);
-	if (outfd < 0) {
-		RERROR("Couldn't open file %s: %s", buffer, fr_strerror());
-		return RLM_MODULE_FAIL;
+	if (inst->async) {
+		if (detail_queue(inst, request, buffer, packet, compat) < 0) return RLM_MODULE_FAIL;
+
+		/*
+		 *	The writer thread creates the file, so it may
+		 *	not exist yet.  The group is set on a later
+		 *	entry.
+		 */
+		outfd = -1;
+	} else {
+		outfd = exfile_open(inst->ef, request, buffer, inst->perm, true);
+		if (outfd < 0) {
+			RERROR("Couldn't open file %s: %s", buffer, fr_strerror());
+			return RLM_MODULE_FAIL;
+		}
 	}
 
 	if (inst->group != NULL) {
@@ -402,6 +589,16 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void *instance, REQUEST *request,
 	}
 
 skip_group:
+	if (inst->async) return RLM_MODULE_OK;
+
+	if (inst->binary) {
+		outfp = NULL;
+		if (detail_write_binary(outfd, inst, request, packet, compat) < 0) goto fail;
+
+		exfile_unlock(inst->ef, request, outfd);
+		return RLM_MODULE_OK;
+	}
+
 	/*
 	 *	Open the output fp for buffering.
 	 */
@@ -112,6 +112,13 @@ static int mod_session_init(void *type_arg, eap_session_t *eap_session)
 	eap_tls_session->include_length = inst->include_length;
 	eap_tls_session->tls_session->prf_label = "client EAP encryption";
 
+	/*
+	 *	Session tickets don't carry the TLS-Client-Cert-*
+	 *	attributes, so the virtual server couldn't check
+	 *	the certificate of a resumed session.
+	 */
+	if (inst->virtual_server) eap_tls_session->tls_session->allow_ticket_resumption = false;
+
 	/*
 	 *	TLS session initialization is over.  Now handle TLS
 	 *	related handshaking or application data.
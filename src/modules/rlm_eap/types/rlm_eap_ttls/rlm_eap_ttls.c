@@ -201,7 +201,12 @@ static int mod_process(void *arg, eap_session_t *eap_session)
 	 *	an EAP-TLS-Success packet here.
 	 */
 	case EAP_TLS_ESTABLISHED:
-		if (SSL_session_reused(tls_session->ssl)) {
+		/*
+		 *	Session tickets are issued before Phase2
+		 *	completes, and can't be revoked if it fails,
+		 *	so sessions resumed from tickets still run it.
+		 */
+		if (SSL_session_reused(tls_session->ssl) && !tls_session->ticket_resumed) {
 			RDEBUG("Skipping Phase2 due to session resumption");
 			goto do_keys;
 		}
@@ -26,44 +26,110 @@ RCSID("$Id$")
 
 #include	<freeradius-devel/radiusd.h>
 #include	<freeradius-devel/modules.h>
+#include	<freeradius-devel/rad_assert.h>
 
 #include	<ctype.h>
 #include	<fcntl.h>
 
+/*
+ *	Maximum number of sorted lists of DEFAULT entries we merge
+ *	for a single request.  If a request needs more, we fall back
+ *	to checking every DEFAULT entry.
+ */
+#define MAX_DEFAULT_LISTS	16
+
+/** An entry in a users file, compiled for faster matching
+ *
+ */
+typedef struct rlm_files_entry rlm_files_entry_t;
+struct rlm_files_entry {
+	PAIR_LIST		*pl;		//!< The entry as read from the file.
+	uint32_t		order;		//!< Position of the entry in the file, after
+						//!< any $INCLUDEs have been expanded.
+
+	bool			xlat;		//!< One or more check items need expanding,
+						//!< so the check items must be copied.
+	xlat_exp_t		**check_xlat;	//!< Pre-parsed expansions, one per check item.
+						//!< NULL for items which aren't expanded, or
+						//!< which couldn't be parsed at load time.
+	bool			fall_through;	//!< Reply list contains Fall-Through = Yes.
+
+	rlm_files_entry_t	*next;		//!< Next entry with the same name.
+};
+
+/** Sorted list of entries
+ *
+ */
+typedef struct rlm_files_array {
+	rlm_files_entry_t	**entry;	//!< Entries, ordered by rlm_files_entry_t.order.
+	uint32_t		num;		//!< Number of entries.
+} rlm_files_array_t;
+
+/** DEFAULT entries whose first comparison is Attr == value, for a given value
+ *
+ */
+typedef struct rlm_files_value {
+	VALUE_PAIR const	*vp;		//!< Value being compared.
+	rlm_files_array_t	entries;	//!< Entries with this value.
+} rlm_files_value_t;
+
+/** DEFAULT entries whose first comparison is Attr == value, for a given attribute
+ *
+ */
+typedef struct rlm_files_index rlm_files_index_t;
+struct rlm_files_index {
+	fr_dict_attr_t const	*da;		//!< Attribute being compared.
+	rbtree_t		*values;	//!< Tree of #rlm_files_value_t.
+	rlm_files_array_t	all;		//!< All entries for this attribute, used if a
+						//!< paircompare function has been registered
+						//!< for the attribute.
+	rlm_files_index_t	*next;		//!< Next indexed attribute.
+};
+
+/** A compiled users file
+ *
+ */
+typedef struct rlm_files_list {
+	rbtree_t		*users;		//!< Tree of named entries, by name.
+	rlm_files_array_t	defaults;	//!< All DEFAULT entries.
+	rlm_files_array_t	unindexed;	//!< DEFAULT entries which can't be indexed.
+	rlm_files_index_t	*index;		//!< DEFAULT entries indexed by their first comparison.
+} rlm_files_list_t;
+
 typedef struct rlm_files_t {
 	char const *compat_mode;
 
 	char const *key;
 
 	char const *filename;
-	rbtree_t *common;
+	rlm_files_list_t *common;
 
 	/* autz */
 	char const *usersfile;
-	rbtree_t *users;
+	rlm_files_list_t *users;
 
 
 	/* authenticate */
 	char const *auth_usersfile;
-	rbtree_t *auth_users;
+	rlm_files_list_t *auth_users;
 
 	/* preacct */
 	char const *acct_usersfile;
-	rbtree_t *acct_users;
+	rlm_files_list_t *acct_users;
 
 #ifdef WITH_PROXY
 	/* pre-proxy */
 	char const *preproxy_usersfile;
-	rbtree_t *preproxy_users;
+	rlm_files_list_t *preproxy_users;
 
 	/* post-proxy */
 	char const *postproxy_usersfile;
-	rbtree_t *postproxy_users;
+	rlm_files_list_t *postproxy_users;
 #endif
 
 	/* post-authenticate */
 	char const *postauth_usersfile;
-	rbtree_t *postauth_users;
+	rlm_files_list_t *postauth_users;
 } rlm_files_t;
 
 
@@ -94,22 +160,225 @@ static const CONF_PARSER module_config[] = {
 };
 
 
-static int pairlist_cmp(void const *a, void const *b)
+static int entry_cmp(void const *a, void const *b)
+{
+	return strcmp(((rlm_files_entry_t const *)a)->pl->name,
+		      ((rlm_files_entry_t const *)b)->pl->name);
+}
+
+/*
+ *	Order values the same way radius_compare_vps() does, so that
+ *	values which are equal here are equal there.
+ */
+static int value_cmp(void const *a, void const *b)
+{
+	VALUE_PAIR const *one = ((rlm_files_value_t const *)a)->vp;
+	VALUE_PAIR const *two = ((rlm_files_value_t const *)b)->vp;
+
+	switch (one->da->type) {
+	case PW_TYPE_STRING:
+		return strcmp(one->vp_strvalue, two->vp_strvalue);
+
+	case PW_TYPE_OCTETS:
+		if (one->vp_length < two->vp_length) return -1;
+		if (one->vp_length > two->vp_length) return +1;
+		return memcmp(one->vp_octets, two->vp_octets, one->vp_length);
+
+	case PW_TYPE_BYTE:
+		return ((int) one->vp_byte) - ((int) two->vp_byte);
+
+	case PW_TYPE_SHORT:
+		return ((int) one->vp_short) - ((int) two->vp_short);
+
+	case PW_TYPE_INTEGER:
+		if (one->vp_integer < two->vp_integer) return -1;
+		if (one->vp_integer > two->vp_integer) return +1;
+		return 0;
+
+	default:
+		rad_assert(0);
+		return 0;
+	}
+}
+
+static int array_add(TALLOC_CTX *ctx, rlm_files_array_t *array, rlm_files_entry_t *entry)
+{
+	rlm_files_entry_t **entries;
+
+	entries = talloc_realloc(ctx, array->entry, rlm_files_entry_t *, array->num + 1);
+	if (!entries) return -1;
+
+	array->entry = entries;
+	array->entry[array->num++] = entry;
+
+	return 0;
+}
+
+/*
+ *	Find the first check item paircompare() will compare, and
+ *	return it if we can index on it.
+ *
+ *	That's only if the comparison is a simple '==' against a
+ *	fixed value, where the entry can't match unless the request
+ *	contains an attribute with exactly that value.
+ */
+static VALUE_PAIR *entry_index_vp(PAIR_LIST *pl)
 {
-	return strcmp(((PAIR_LIST const *)a)->name,
-		      ((PAIR_LIST const *)b)->name);
+	vp_cursor_t cursor;
+	VALUE_PAIR *vp;
+
+	for (vp = fr_cursor_init(&cursor, &pl->check); vp; vp = fr_cursor_next(&cursor)) {
+		if ((vp->op == T_OP_SET) || (vp->op == T_OP_ADD)) continue;
+
+		if (!vp->da->vendor) switch (vp->da->attr) {
+		case PW_CRYPT_PASSWORD:
+		case PW_AUTH_TYPE:
+		case PW_AUTZ_TYPE:
+		case PW_ACCT_TYPE:
+		case PW_SESSION_TYPE:
+		case PW_STRIP_USER_NAME:
+			continue;
+
+		/*
+		 *	paircompare() skips this if it's not in the request.
+		 */
+		case PW_USER_PASSWORD:
+			return NULL;
+
+		default:
+			break;
+		}
+
+		break;
+	}
+	if (!vp) return NULL;
+
+	if ((vp->op != T_OP_CMP_EQ) || (vp->type != VT_DATA) || vp->da->flags.has_tag) return NULL;
+
+	switch (vp->da->type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_OCTETS:
+	case PW_TYPE_BYTE:
+	case PW_TYPE_SHORT:
+	case PW_TYPE_INTEGER:
+		return vp;
+
+	default:
+		return NULL;
+	}
+}
+
+/*
+ *	Pre-parse any expansions in the check items.
+ */
+static int entry_compile(char const *filename, rlm_files_entry_t *entry)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	int		i, num = 0;
+
+	entry->fall_through = fall_through(entry->pl->reply);
+
+	for (vp = fr_cursor_init(&cursor, &entry->pl->check); vp; vp = fr_cursor_next(&cursor)) {
+		if (vp->type == VT_XLAT) entry->xlat = true;
+		num++;
+	}
+	if (!entry->xlat) return 0;
+
+	entry->check_xlat = talloc_zero_array(entry, xlat_exp_t *, num);
+	if (!entry->check_xlat) return -1;
+
+	for (vp = fr_cursor_init(&cursor, &entry->pl->check), i = 0;
+	     vp;
+	     vp = fr_cursor_next(&cursor), i++) {
+		ssize_t		slen;
+		char		*fmt;
+		char const	*error = NULL;
+
+		if (vp->type != VT_XLAT) continue;
+
+		fmt = talloc_typed_strdup(entry, vp->xlat);	/* modified by xlat_tokenize */
+		if (!fmt) return -1;
+
+		/*
+		 *	The expansion may refer to xlats registered by
+		 *	modules which haven't been instantiated yet.
+		 *	Those get parsed at run time, as before.
+		 */
+		slen = xlat_tokenize(entry, fmt, &entry->check_xlat[i], &error);
+		if (slen <= 0) {
+			DEBUG3("[%s]:%d Expansion for %s will be parsed at run time: %s",
+			       filename, entry->pl->lineno, vp->da->name, error ? error : "empty string");
+			TALLOC_FREE(entry->check_xlat[i]);
+			talloc_free(fmt);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *	Add a DEFAULT entry to the list, and to the index if we can.
+ */
+static int entry_add_default(rlm_files_list_t *list, rlm_files_entry_t *entry)
+{
+	VALUE_PAIR		*vp;
+	rlm_files_index_t	*index;
+	rlm_files_value_t	*value, my_value;
+
+	if (array_add(list, &list->defaults, entry) < 0) return -1;
+
+	vp = entry_index_vp(entry->pl);
+	if (!vp) return array_add(list, &list->unindexed, entry);
+
+	for (index = list->index; index; index = index->next) {
+		if (index->da == vp->da) break;
+	}
+
+	if (!index) {
+		index = talloc_zero(list, rlm_files_index_t);
+		if (!index) return -1;
+
+		index->da = vp->da;
+		index->values = rbtree_create(index, value_cmp, NULL, RBTREE_FLAG_NONE);
+		if (!index->values) {
+			talloc_free(index);
+			return -1;
+		}
+
+		index->next = list->index;
+		list->index = index;
+	}
+
+	if (array_add(index, &index->all, entry) < 0) return -1;
+
+	my_value.vp = vp;
+	value = rbtree_finddata(index->values, &my_value);
+	if (!value) {
+		value = talloc_zero(index, rlm_files_value_t);
+		if (!value) return -1;
+
+		value->vp = vp;
+		if (!rbtree_insert(index->values, value)) {
+			talloc_free(value);
+			return -1;
+		}
+	}
+
+	return array_add(value, &value->entries, entry);
 }
 
-static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree, char const *compat_mode_str)
+static int getusersfile(TALLOC_CTX *ctx, char const *filename, rlm_files_list_t **plist, char const *compat_mode_str)
 {
 	int rcode;
 	PAIR_LIST *users = NULL;
 	PAIR_LIST *entry, *next;
-	PAIR_LIST *user_list, *default_list, **default_tail;
-	rbtree_t *tree;
+	rlm_files_entry_t *node, *user_list;
+	rlm_files_list_t *list;
+	uint32_t order;
 
 	if (!filename) {
-		*ptree = NULL;
+		*plist = NULL;
 		return 0;
 	}
 
@@ -235,67 +504,62 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree,
 		}
 	}
 
-	tree = rbtree_create(ctx, pairlist_cmp, NULL, RBTREE_FLAG_NONE);
-	if (!tree) {
+	list = talloc_zero(ctx, rlm_files_list_t);
+	if (!list) {
 		pairlist_free(&users);
 		return -1;
 	}
 
-	default_list = NULL;
-	default_tail = &default_list;
+	list->users = rbtree_create(list, entry_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!list->users) {
+		pairlist_free(&users);
+		talloc_free(list);
+		return -1;
+	}
 
 	/*
 	 *	We've read the entries in linearly, but putting them
 	 *	into an indexed data structure would be much faster.
 	 *	Let's go fix that now.
 	 */
-	for (entry = users; entry != NULL; entry = next) {
+	for (entry = users, order = 0; entry != NULL; entry = next, order++) {
 		/*
 		 *	Remove this entry from the input list.
 		 */
 		next = entry->next;
 		entry->next = NULL;
-		(void) talloc_steal(tree, entry);
+
+		node = talloc_zero(list, rlm_files_entry_t);
+		if (!node) {
+		error:
+			pairlist_free(&next);
+			talloc_free(list);
+			return -1;
+		}
+		(void) talloc_steal(node, entry);
+		node->pl = entry;
+		node->order = order;
+
+		if (entry_compile(filename, node) < 0) goto error;
 
 		/*
-		 *	DEFAULT entries get their own list.
+		 *	DEFAULT entries get their own list, and are
+		 *	indexed by their first comparison.
 		 */
 		if (strcmp(entry->name, "DEFAULT") == 0) {
-			if (!default_list) {
-				default_list = entry;
-
-				/*
-				 *	Insert the first DEFAULT into the tree.
-				 */
-				if (!rbtree_insert(tree, entry)) {
-				error:
-					pairlist_free(&entry);
-					pairlist_free(&next);
-					rbtree_free(tree);
-					return -1;
-				}
-
-			} else {
-				/*
-				 *	Tack this entry onto the tail
-				 *	of the DEFAULT list.
-				 */
-				*default_tail = entry;
-			}
-
-			default_tail = &entry->next;
+			if (entry_add_default(list, node) < 0) goto error;
 			continue;
 		}
 
 		/*
 		 *	Not DEFAULT, must be a normal user.
 		 */
-		user_list = rbtree_finddata(tree, entry);
+		user_list = rbtree_finddata(list->users, node);
 		if (!user_list) {
 			/*
 			 *	Insert the first one.
 			 */
-			if (!rbtree_insert(tree, entry)) goto error;
+			if (!rbtree_insert(list->users, node)) goto error;
 		} else {
 			/*
 			 *	Find the tail of this list, and add it
@@ -303,11 +567,11 @@ static int getusersfile(TALLOC_CTX *ctx, char const *filename, rbtree_t **ptree,
 			 */
 			while (user_list->next) user_list = user_list->next;
 
-			user_list->next = entry;
+			user_list->next = node;
 		}
 	}
 
-	*ptree = tree;
+	*plist = list;
 
 	return 0;
 }
@@ -339,19 +603,136 @@ static int mod_instantiate(UNUSED CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+/*
+ *	Expand a check item using an expansion we parsed at load time.
+ *
+ *	This is radius_xlat_do(), without the parsing.
+ */
+static int files_xlat_do(REQUEST *request, VALUE_PAIR *vp, xlat_exp_t const *xlat)
+{
+	ssize_t slen;
+	char *expanded = NULL;
+
+	vp->type = VT_DATA;
+
+	slen = radius_axlat_struct(&expanded, request, xlat, NULL, NULL);
+	rad_const_free(vp->xlat);
+	vp->xlat = NULL;
+	if (slen < 0) return -1;
+
+	if ((vp->op == T_OP_REG_EQ) || (vp->op == T_OP_REG_NE)) {
+		fr_pair_value_strsteal(vp, expanded);
+		return 0;
+	}
+
+	if (fr_pair_value_from_str(vp, expanded, -1) < 0) {
+		talloc_free(expanded);
+		return -2;
+	}
+
+	talloc_free(expanded);
+
+	return 0;
+}
+
+/*
+ *	Expand the check items in a copy of an entry's check list.
+ */
+static int files_xlat_check(REQUEST *request, rlm_files_entry_t const *entry, VALUE_PAIR *check)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR	*vp;
+	int		i;
+
+	for (vp = fr_cursor_init(&cursor, &check), i = 0;
+	     vp;
+	     vp = fr_cursor_next(&cursor), i++) {
+		int ret;
+
+		if (vp->type != VT_XLAT) continue;
+
+		if (entry->check_xlat[i]) {
+			ret = files_xlat_do(request, vp, entry->check_xlat[i]);
+		} else {
+			ret = radius_xlat_do(request, vp);
+		}
+		if (ret < 0) return -1;
+	}
+
+	return 0;
+}
+
+/*
+ *	Find the lists of DEFAULT entries which could match the
+ *	request.  Each list is ordered, and no entry is in more than
+ *	one list.
+ */
+static int files_default_lists(rlm_files_array_t const **out, rlm_files_list_t const *list, VALUE_PAIR *vps)
+{
+	rlm_files_index_t	*index;
+	VALUE_PAIR		*vp;
+	int			i, start, num = 0;
+
+	if (list->unindexed.num) out[num++] = &list->unindexed;
+
+	for (index = list->index; index; index = index->next) {
+		/*
+		 *	A module has registered a comparison function
+		 *	for the attribute, so we don't know what
+		 *	values it will match.
+		 */
+		if (radius_find_compare(index->da)) {
+			if (num == MAX_DEFAULT_LISTS) goto all;
+			out[num++] = &index->all;
+			continue;
+		}
+
+		start = num;
+		for (vp = vps; vp; vp = vp->next) {
+			rlm_files_value_t *value, my_value;
+
+			if (vp->da != index->da) continue;
+
+			my_value.vp = vp;
+			value = rbtree_finddata(index->values, &my_value);
+			if (!value) continue;
+
+			/*
+			 *	The request may contain the same
+			 *	value more than once.
+			 */
+			for (i = start; i < num; i++) if (out[i] == &value->entries) break;
+			if (i < num) continue;
+
+			if (num == MAX_DEFAULT_LISTS) goto all;
+			out[num++] = &value->entries;
+		}
+	}
+
+	return num;
+
+all:
+	out[0] = &list->defaults;
+
+	return 1;
+}
+
 /*
  *	Common code called by everything below.
  */
-static rlm_rcode_t file_common(rlm_files_t *inst, REQUEST *request, char const *filename, rbtree_t *tree,
+static rlm_rcode_t file_common(rlm_files_t *inst, REQUEST *request, char const *filename, rlm_files_list_t *list,
 			       RADIUS_PACKET *request_packet, RADIUS_PACKET *reply_packet)
 {
-	char const	*name, *match;
-	VALUE_PAIR	*check_tmp;
-	VALUE_PAIR	*reply_tmp;
-	PAIR_LIST const *user_pl, *default_pl;
-	bool		found = false;
-	PAIR_LIST	my_pl;
-	char		buffer[256];
+	char const		*name, *match;
+	VALUE_PAIR		*check_tmp;
+	VALUE_PAIR		*reply_tmp;
+	rlm_files_entry_t	*user_entry, my_entry;
+	rlm_files_array_t const	*default_lists[MAX_DEFAULT_LISTS];
+	uint32_t		default_pos[MAX_DEFAULT_LISTS];
+	int			i, num_default_lists;
+	bool			found = false;
+	PAIR_LIST		my_pl;
+	char			buffer[256];
 
 	if (!inst->key) {
 		VALUE_PAIR	*namepair;
@@ -369,73 +750,88 @@ static rlm_rcode_t file_common(rlm_files_t *inst, REQUEST *request, char const *
 		name = len ? buffer : "NONE";
 	}
 
-	if (!tree) return RLM_MODULE_NOOP;
+	if (!list) return RLM_MODULE_NOOP;
 
 	my_pl.name = name;
-	user_pl = rbtree_finddata(tree, &my_pl);
-	my_pl.name = "DEFAULT";
-	default_pl = rbtree_finddata(tree, &my_pl);
+	my_entry.pl = &my_pl;
+	user_entry = rbtree_finddata(list->users, &my_entry);
+
+	num_default_lists = files_default_lists(default_lists, list, request_packet->vps);
+	memset(default_pos, 0, sizeof(default_pos));
 
 	/*
 	 *	Find the entry for the user.
 	 */
-	while (user_pl || default_pl) {
-		vp_cursor_t cursor;
-		VALUE_PAIR *vp;
-		PAIR_LIST const *pl;
+	for (;;) {
+		rlm_files_entry_t	*entry;
+		VALUE_PAIR		*check;
+		int			from = -1;
 
 		/*
-		 *	Figure out which entry to match on.
+		 *	Figure out which entry to match on.  That's
+		 *	whichever comes first in the file.
 		 */
+		entry = user_entry;
+		for (i = 0; i < num_default_lists; i++) {
+			rlm_files_entry_t *default_entry;
 
-		if (!default_pl && user_pl) {
-			pl = user_pl;
-			match = name;
-			user_pl = user_pl->next;
+			if (default_pos[i] == default_lists[i]->num) continue;
 
-		} else if (!user_pl && default_pl) {
-			pl = default_pl;
-			match = "DEFAULT";
-			default_pl = default_pl->next;
+			default_entry = default_lists[i]->entry[default_pos[i]];
+			if (!entry || (default_entry->order < entry->order)) {
+				entry = default_entry;
+				from = i;
+			}
+		}
+		if (!entry) break;
 
-		} else if (user_pl->lineno < default_pl->lineno) {
-			pl = user_pl;
+		if (from < 0) {
 			match = name;
-			user_pl = user_pl->next;
-
+			user_entry = user_entry->next;
 		} else {
-			pl = default_pl;
 			match = "DEFAULT";
-			default_pl = default_pl->next;
+			default_pos[from]++;
 		}
 
-		check_tmp = fr_pair_list_copy(request, pl->check);
-		for (vp = fr_cursor_init(&cursor, &check_tmp);
-		     vp;
-		     vp = fr_cursor_next(&cursor)) {
-			if (radius_xlat_do(request, vp) < 0) {
+		/*
+		 *	Only copy the check items if they need
+		 *	expanding.  Otherwise we can compare against
+		 *	the entry directly.
+		 */
+		if (entry->xlat) {
+			check_tmp = fr_pair_list_copy(request, entry->pl->check);
+			if (files_xlat_check(request, entry, check_tmp) < 0) {
 				RWARN("Failed parsing expanded value for check item, skipping entry: %s", fr_strerror());
 				fr_pair_list_free(&check_tmp);
 				continue;
 			}
+			check = check_tmp;
+		} else {
+			check_tmp = NULL;
+			check = entry->pl->check;
 		}
 
-		if (paircompare(request, request_packet->vps, check_tmp, &reply_packet->vps) == 0) {
-			RDEBUG2("Found match \"%s\" one line %d of %s", match, pl->lineno, filename);
-			found = true;
-
-			/* ctx may be reply or proxy */
-			reply_tmp = fr_pair_list_copy(reply_packet, pl->reply);
-			radius_pairmove(request, &reply_packet->vps, reply_tmp, true);
-			fr_pair_list_move(request, &request->control, &check_tmp);
+		if (paircompare(request, request_packet->vps, check, &reply_packet->vps) != 0) {
 			fr_pair_list_free(&check_tmp);
-
-			/*
-			 *	Fallthrough?
-			 */
-			if (!fall_through(pl->reply))
-				break;
+			continue;
 		}
+
+		RDEBUG2("Found match \"%s\" one line %d of %s", match, entry->pl->lineno, filename);
+		found = true;
+
+		/* ctx may be reply or proxy */
+		reply_tmp = fr_pair_list_copy(reply_packet, entry->pl->reply);
+		radius_pairmove(request, &reply_packet->vps, reply_tmp, true);
+
+		if (!check_tmp) check_tmp = fr_pair_list_copy(request, entry->pl->check);
+		fr_pair_list_move(request, &request->control, &check_tmp);
+		fr_pair_list_free(&check_tmp);
+
+		/*
+		 *	Fallthrough?
+		 */
+		if (!entry->fall_through)
+			break;
 	}
 
 	/*
@@ -106,6 +106,11 @@ typedef struct linelog_instance_t {
 		exfile_t		*ef;			//!< Exclusive file access handle.
 		bool			escape;			//!< Do filename escaping, yes / no.
 		xlat_escape_t		escape_func;		//!< Escape function.
+
+		bool			async;			//!< Queue lines for the exfile writer thread.
+		uint32_t		queue_size;		//!< Maximum number of lines waiting to be written.
+		char const		*fsync_str;		//!< "none", "always" or "interval".
+		uint32_t		fsync_interval;		//!< How often to sync files with fsync = interval.
 	} file;
 
 	struct {
@@ -129,6 +134,10 @@ static const CONF_PARSER file_config[] = {
 	{ FR_CONF_OFFSET("permissions", PW_TYPE_INTEGER, linelog_instance_t, file.permissions), .dflt = "0600" },
 	{ FR_CONF_OFFSET("group", PW_TYPE_STRING, linelog_instance_t, file.group_str) },
 	{ FR_CONF_OFFSET("escape_filenames", PW_TYPE_BOOLEAN, linelog_instance_t, file.escape), .dflt = "no" },
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, linelog_instance_t, file.async), .dflt = "no" },
+	{ FR_CONF_OFFSET("queue_size", PW_TYPE_INTEGER, linelog_instance_t, file.queue_size), .dflt = "65536" },
+	{ FR_CONF_OFFSET("fsync", PW_TYPE_STRING, linelog_instance_t, file.fsync_str), .dflt = "none" },
+	{ FR_CONF_OFFSET("fsync_interval", PW_TYPE_INTEGER, linelog_instance_t, file.fsync_interval), .dflt = "1" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -342,6 +351,27 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 			return -1;
 		}
 
+		if (inst->file.async) {
+			int fsync;
+
+			fsync = fr_str2int(exfile_fsync_table, inst->file.fsync_str, -1);
+			if (fsync < 0) {
+				cf_log_err_cs(conf, "Invalid fsync \"%s\", expected \"none\", \"always\" or \"interval\"",
+					      inst->file.fsync_str);
+				return -1;
+			}
+
+			FR_INTEGER_BOUND_CHECK("queue_size", inst->file.queue_size, >=, 64);
+			FR_INTEGER_BOUND_CHECK("queue_size", inst->file.queue_size, <=, 1048576);
+			FR_INTEGER_BOUND_CHECK("fsync_interval", inst->file.fsync_interval, >=, 1);
+
+			if (exfile_enable_async(inst->file.ef, inst->file.queue_size, fsync,
+						inst->file.fsync_interval) < 0) {
+				cf_log_err_cs(conf, "Failed starting writer thread: %s", fr_strerror());
+				return -1;
+			}
+		}
+
 		if (inst->file.group_str) {
 			char *endptr;
 
@@ -521,7 +551,6 @@ static size_t linelog_escape_func(UNUSED REQUEST *request,
 static rlm_rcode_t mod_do_linelog(void *instance, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t mod_do_linelog(void *instance, REQUEST *request)
 {
-	int			fd = -1;
 	linelog_conn_t		*conn;
 	struct timeval		*timeout = NULL;
 
@@ -721,28 +750,23 @@ build_vector:
 			*p = '/';
 		}
 
-		fd = exfile_open(inst->file.ef, request, path, inst->file.permissions, true);
-		if (fd < 0) {
-			RERROR("Failed to open %s: %s", path, fr_syserror(errno));
+		/*
+		 *	With async = yes, this only queues the line for
+		 *	the writer thread.
+		 */
+		if (exfile_write(inst->file.ef, request, path, inst->file.permissions, vector_p, vector_len) < 0) {
+			RERROR("Failed writing to \"%s\": %s", path, fr_strerror());
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
 
-		if (inst->file.group_str && (chown(path, -1, inst->file.group) == -1)) {
-			RWARN("Unable to change system group of \"%s\": %s", path, fr_strerror());
-		}
-
-		if (writev(fd, vector_p, vector_len) < 0) {
-			RERROR("Failed writing to \"%s\": %s", path, fr_syserror(errno));
-			exfile_close(inst->file.ef, request, fd);
-
-			/* Assert on the extra fatal errors */
-			rad_assert((errno != EINVAL) && (errno != EFAULT));
-
-			return RLM_MODULE_FAIL;
+		/*
+		 *	The writer thread may not have created the file yet.
+		 */
+		if (inst->file.group_str && (chown(path, -1, inst->file.group) == -1) &&
+		    (!inst->file.async || (errno != ENOENT))) {
+			RWARN("Unable to change system group of \"%s\": %s", path, fr_syserror(errno));
 		}
-
-		exfile_close(inst->file.ef, request, fd);
 	}
 		break;
 
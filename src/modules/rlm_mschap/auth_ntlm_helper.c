@@ -0,0 +1,477 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file auth_ntlm_helper.c
+ * @brief NTLM authentication using a pool of long running ntlm_auth helpers
+ *
+ * Each connection in the pool is an ntlm_auth process started with
+ * --helper-protocol=ntlm-server-1.  Requests are written to its stdin
+ * as "key: value" lines terminated by a line containing only ".", and
+ * the response is read back from its stdout in the same format.
+ *
+ * The protocol has no request identifiers, so a helper answers one
+ * request at a time.  A request reserves a helper from the pool for the
+ * duration of the exchange, then returns it for the next request.
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/base64.h>
+
+#include <poll.h>
+
+#include "rlm_mschap.h"
+#include "mschap.h"
+#include "auth_ntlm_helper.h"
+
+#define NT_LENGTH 24
+
+/** A running ntlm_auth helper
+ *
+ */
+typedef struct ntlm_helper_conn {
+	rlm_mschap_t const *inst;	//!< That started the helper.
+	pid_t		pid;		//!< Of the helper.
+	int		to_child;	//!< Helper's stdin.
+	int		from_child;	//!< Helper's stdout.
+	uint64_t	uses;		//!< Requests answered by this helper.
+} ntlm_helper_conn_t;
+
+/** Stop the helper
+ *
+ * Called when the connection pool closes a helper, either because it
+ * failed, or because it reached "uses" or "lifetime" and is being
+ * recycled.
+ *
+ * Closing stdin is enough to make ntlm_auth exit, SIGTERM is for helpers
+ * which are stuck talking to winbind.
+ */
+static int _ntlm_helper_conn_free(ntlm_helper_conn_t *conn)
+{
+	int status;
+
+	if (conn->pid > 0) {
+		DEBUG2("rlm_mschap (%s): Stopping ntlm_auth helper (PID %u) after %" PRIu64 " requests",
+		       conn->inst->xlat_name, (unsigned int) conn->pid, conn->uses);
+	}
+
+	if (conn->to_child >= 0) close(conn->to_child);
+	if (conn->from_child >= 0) close(conn->from_child);
+
+	if (conn->pid > 0) {
+		kill(conn->pid, SIGTERM);
+		rad_waitpid(conn->pid, &status);
+	}
+
+	return 0;
+}
+
+/** Start a new ntlm_auth helper
+ *
+ * Called by the connection pool when it needs a new helper, including
+ * when it replaces one which has failed.
+ */
+void *ntlm_helper_conn_create(TALLOC_CTX *ctx, void *instance, UNUSED struct timeval const *timeout)
+{
+	rlm_mschap_t		*inst = instance;
+	ntlm_helper_conn_t	*conn;
+	pid_t			pid;
+	int			to_child = -1, from_child = -1;
+
+	/*
+	 *	The command line is the same for every helper, so
+	 *	there's no request to expand it for.
+	 */
+	pid = radius_start_program(inst->ntlm_auth_helper, NULL, true, &to_child, &from_child, NULL, false);
+	if (pid < 0) {
+		ERROR("rlm_mschap (%s): Failed starting ntlm_auth helper", inst->xlat_name);
+		return NULL;
+	}
+
+	conn = talloc_zero(ctx, ntlm_helper_conn_t);
+	conn->inst = inst;
+	conn->pid = pid;
+	conn->to_child = to_child;
+	conn->from_child = from_child;
+	talloc_set_destructor(conn, _ntlm_helper_conn_free);
+
+	if ((fr_nonblock(to_child) < 0) || (fr_nonblock(from_child) < 0)) {
+		ERROR("rlm_mschap (%s): Failed setting ntlm_auth helper pipes non-blocking: %s",
+		      inst->xlat_name, fr_syserror(errno));
+		talloc_free(conn);
+		return NULL;
+	}
+
+	DEBUG2("rlm_mschap (%s): Started ntlm_auth helper (PID %u)", inst->xlat_name, (unsigned int) pid);
+
+	return conn;
+}
+
+/** Check an idle helper is still usable
+ *
+ * An idle helper has nothing to say.  If its stdout is readable, then
+ * it has either exited, or it's out of step with us.
+ */
+static bool ntlm_helper_alive(ntlm_helper_conn_t *conn)
+{
+	struct pollfd pfd;
+
+	if (kill(conn->pid, 0) < 0) return false;
+
+	pfd.fd = conn->from_child;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return (poll(&pfd, 1, 0) == 0);
+}
+
+/** Send a request to the helper, and read the response
+ *
+ * @param[in] request	The current request.
+ * @param[in] conn	to use.
+ * @param[in] query	to send, including the terminating ".\n" line.
+ * @param[in] query_len	of query.
+ * @param[out] answer	Where to write the response.
+ * @param[in] answer_len	of answer.
+ * @param[in] timeout	Seconds to wait for the response.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the helper failed, and should be replaced.
+ */
+static int ntlm_helper_exchange(REQUEST *request, ntlm_helper_conn_t *conn,
+				char const *query, size_t query_len,
+				char *answer, size_t answer_len, uint32_t timeout)
+{
+	struct iovec	vector[1];
+	struct timeval	start, now, elapsed, wait = { timeout, 0 };
+	size_t		len = 0;
+
+	memcpy(&vector[0].iov_base, &query, sizeof(vector[0].iov_base));
+	vector[0].iov_len = query_len;
+
+	if (fr_writev(conn->to_child, vector, 1, &wait) < 0) {
+		REDEBUG("Failed writing to ntlm_auth helper: %s", fr_strerror());
+		return -1;
+	}
+
+	gettimeofday(&start, NULL);
+	for (;;) {
+		struct pollfd	pfd;
+		ssize_t		slen;
+		int		remaining, ret;
+
+		/*
+		 *	The response ends with a line containing only "."
+		 */
+		if (len >= 2) {
+			answer[len] = '\0';
+			if ((len == 2) ? (strcmp(answer, ".\n") == 0) :
+			    (strcmp(answer + len - 3, "\n.\n") == 0)) break;
+		}
+
+		if (len >= (answer_len - 1)) {
+			REDEBUG("Response from ntlm_auth helper is too long");
+			return -1;
+		}
+
+		gettimeofday(&now, NULL);
+		fr_timeval_subtract(&elapsed, &now, &start);
+		remaining = (timeout * 1000) - ((elapsed.tv_sec * 1000) + (elapsed.tv_usec / 1000));
+		if (remaining <= 0) {
+			REDEBUG("Timeout waiting for ntlm_auth helper (PID %u)", (unsigned int) conn->pid);
+			return -1;
+		}
+
+		pfd.fd = conn->from_child;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		ret = poll(&pfd, 1, remaining);
+		if (ret == 0) continue;
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			REDEBUG("Failed waiting for ntlm_auth helper: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		slen = read(conn->from_child, answer + len, answer_len - 1 - len);
+		if (slen == 0) {
+			REDEBUG("ntlm_auth helper (PID %u) exited", (unsigned int) conn->pid);
+			return -1;
+		}
+		if (slen < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK)) continue;
+			REDEBUG("Failed reading from ntlm_auth helper: %s", fr_syserror(errno));
+			return -1;
+		}
+		len += slen;
+	}
+
+	conn->uses++;
+
+	return 0;
+}
+
+/** Fields we care about in a helper response
+ *
+ */
+typedef struct ntlm_helper_answer {
+	char const	*authenticated;		//!< "Yes" or "No".
+	char const	*auth_error;		//!< Why authentication failed.
+	char const	*session_key;		//!< Hex encoded NT hash hash.
+	char const	*error;			//!< Protocol error.
+} ntlm_helper_answer_t;
+
+/** Split a response into "key: value" lines
+ *
+ * Lines are terminated in place, unknown keys are ignored.
+ */
+static void ntlm_helper_parse(ntlm_helper_answer_t *out, char *answer)
+{
+	char *p = answer;
+
+	memset(out, 0, sizeof(*out));
+
+	while (p && *p) {
+		char *eol, *value;
+
+		eol = strchr(p, '\n');
+		if (eol) *eol++ = '\0';
+
+		value = strstr(p, ": ");
+		if (value) {
+			*value = '\0';
+			value += 2;
+
+			if (strcmp(p, "Authenticated") == 0) {
+				out->authenticated = value;
+			} else if (strcmp(p, "Authentication-Error") == 0) {
+				out->auth_error = value;
+			} else if (strcmp(p, "User-Session-Key") == 0) {
+				out->session_key = value;
+			} else if (strcmp(p, "Error") == 0) {
+				out->error = value;
+			}
+		}
+
+		p = eol;
+	}
+}
+
+/** Append "key:: base64(value)\n" to the query
+ *
+ * Names are base64 encoded, so they can't break the line protocol.
+ */
+static char *ntlm_helper_add_b64(char *p, char const *end, char const *key, char const *value)
+{
+	size_t len;
+
+	len = snprintf(p, end - p, "%s:: ", key);
+	if (len >= (size_t)(end - p)) return NULL;
+	p += len;
+
+	if ((size_t)(end - p) < (FR_BASE64_ENC_LENGTH(strlen(value)) + 2)) return NULL;
+	p += fr_base64_encode(p, end - p, (uint8_t const *) value, strlen(value));
+	*p++ = '\n';
+
+	return p;
+}
+
+/*
+ *	Check NTLM authentication with a pooled ntlm_auth helper
+ *
+ *	Returns:
+ *	 0    success
+ *	 -1   auth failure
+ *	 -647 account locked out
+ *	 -648 password expired
+ *	 -691 account disabled
+ */
+int do_auth_ntlm_helper(rlm_mschap_t *inst, REQUEST *request,
+			uint8_t const *challenge, uint8_t const *response,
+			uint8_t nthashhash[NT_DIGEST_LENGTH])
+{
+	ntlm_helper_conn_t	*conn;
+	ntlm_helper_answer_t	fields;
+	char const		*username, *domain = NULL, *value;
+	char			user_name_buf[256];
+	char			domain_name_buf[256];
+	char			query[1024], answer[2048];
+	char			*p, *end;
+	int			tries;
+	ssize_t			len;
+
+	/*
+	 *	ntlm_auth_helper_username must be set for this function
+	 *	to be called.
+	 */
+	rad_assert(inst->ntlm_helper_username);
+
+	len = tmpl_expand(&username, user_name_buf, sizeof(user_name_buf),
+			  request, inst->ntlm_helper_username, NULL, NULL);
+	if (len < 0) {
+		REDEBUG2("Unable to expand ntlm_auth_helper_username");
+		return -1;
+	}
+
+	if (inst->ntlm_helper_domain) {
+		len = tmpl_expand(&domain, domain_name_buf, sizeof(domain_name_buf),
+				  request, inst->ntlm_helper_domain, NULL, NULL);
+		if (len < 0) {
+			REDEBUG2("Unable to expand ntlm_auth_helper_domain");
+			return -1;
+		}
+	} else {
+		RWDEBUG2("No domain specified; authentication may fail because of this");
+	}
+
+	/*
+	 *	Build the request.  The challenge is the one MS-CHAPv2
+	 *	has already hashed, so the helper must be started with
+	 *	--allow-mschapv2.
+	 */
+	p = query;
+	end = query + sizeof(query);
+
+	p = ntlm_helper_add_b64(p, end, "Username", username);
+	if (p && domain) p = ntlm_helper_add_b64(p, end, "NT-Domain", domain);
+	if (!p || ((end - p) < (int)(sizeof("LANMAN-Challenge: \n") + 16 + sizeof("NT-Response: \n") + (NT_LENGTH * 2) +
+				      sizeof("Request-User-Session-Key: Yes\n.\n")))) {
+		REDEBUG("User-Name or NT-Domain too long for ntlm_auth helper");
+		return -1;
+	}
+
+	p += sprintf(p, "LANMAN-Challenge: ");
+	p += fr_bin2hex(p, challenge, 8);
+	p += sprintf(p, "\nNT-Response: ");
+	p += fr_bin2hex(p, response, NT_LENGTH);
+	p += sprintf(p, "\nRequest-User-Session-Key: Yes\n.\n");
+
+	conn = fr_connection_get(inst->helper_pool, request);
+	if (!conn) {
+		RERROR("Unable to get ntlm_auth helper from pool");
+		return -1;
+	}
+
+	/*
+	 *	If the helper we were given has died since it was last
+	 *	used, or the exchange fails before we get an answer,
+	 *	replace it and try once more.  A second failure means
+	 *	there's something wrong with ntlm_auth or winbind, and
+	 *	restarting more helpers won't fix it.
+	 */
+	for (tries = 0; ; tries++) {
+		if (ntlm_helper_alive(conn)) {
+			RDEBUG2("Sending authentication request user='%s' domain='%s' to ntlm_auth helper (PID %u)",
+				username, domain ? domain : "", (unsigned int) conn->pid);
+
+			if (ntlm_helper_exchange(request, conn, query, p - query,
+						 answer, sizeof(answer), inst->ntlm_auth_timeout) == 0) break;
+		} else {
+			RWDEBUG("ntlm_auth helper (PID %u) is no longer running", (unsigned int) conn->pid);
+		}
+
+		if (tries > 0) {
+			fr_connection_close(inst->helper_pool, request, conn);
+			return -1;
+		}
+
+		conn = fr_connection_reconnect(inst->helper_pool, request, conn);
+		if (!conn) {
+			RERROR("Unable to restart ntlm_auth helper");
+			return -1;
+		}
+	}
+
+	fr_connection_release(inst->helper_pool, request, conn);
+
+	ntlm_helper_parse(&fields, answer);
+
+	/*
+	 *	A protocol error means we sent something ntlm_auth
+	 *	didn't understand, not that the user is wrong.
+	 */
+	if (fields.error) {
+		REDEBUG("ntlm_auth helper error: %s", fields.error);
+		return -1;
+	}
+
+	if (!fields.authenticated) {
+		REDEBUG("Invalid output from ntlm_auth helper: expecting 'Authenticated: ' line");
+		return -1;
+	}
+
+	if (strcasecmp(fields.authenticated, "Yes") != 0) {
+		value = fields.auth_error;
+		if (!value) {
+			REDEBUG2("Authentication failed");
+			return -1;
+		}
+
+		/*
+		 *	ntlm_auth may give either the friendly message,
+		 *	or the NT_STATUS name, depending on the version.
+		 */
+		if (strcasestr(value, "Password expired") ||
+		    strcasestr(value, "Must change password") ||
+		    strcasestr(value, "NT_STATUS_PASSWORD_EXPIRED") ||
+		    strcasestr(value, "NT_STATUS_PASSWORD_MUST_CHANGE")) {
+			REDEBUG2("%s", value);
+			return -648;
+		}
+
+		if (strcasestr(value, "Account locked out") ||
+		    strcasestr(value, "NT_STATUS_ACCOUNT_LOCKED_OUT") ||
+		    strcasestr(value, "0xC0000234")) {
+			REDEBUG2("%s", value);
+			return -647;
+		}
+
+		if (strcasestr(value, "Account disabled") ||
+		    strcasestr(value, "NT_STATUS_ACCOUNT_DISABLED") ||
+		    strcasestr(value, "0xC0000072")) {
+			REDEBUG2("%s", value);
+			return -691;
+		}
+
+		REDEBUG2("Authentication failed: %s", value);
+		return -1;
+	}
+
+	RDEBUG2("Authenticated successfully");
+
+	/*
+	 *	Grab the nthashhash from the user session key.
+	 */
+	if (!fields.session_key) {
+		REDEBUG("Invalid output from ntlm_auth helper: expecting 'User-Session-Key: ' line");
+		return -1;
+	}
+
+	if (fr_hex2bin(nthashhash, NT_DIGEST_LENGTH, fields.session_key,
+		       strlen(fields.session_key)) != NT_DIGEST_LENGTH) {
+		REDEBUG("Invalid output from ntlm_auth helper: User-Session-Key has non-hex values");
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+/* Copyright 2016 The FreeRADIUS server project */
+
+#ifndef _AUTH_NTLM_HELPER_H
+#define _AUTH_NTLM_HELPER_H
+
+RCSIDH(auth_ntlm_helper_h, "$Id$")
+
+void *ntlm_helper_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *timeout);
+
+int do_auth_ntlm_helper(rlm_mschap_t *inst, REQUEST *request,
+			uint8_t const *challenge, uint8_t const *response,
+			uint8_t nthashhash[NT_DIGEST_LENGTH]);
+
+#endif /*_AUTH_NTLM_HELPER_H*/
@@ -40,6 +40,7 @@ RCSID("$Id$")
 #ifdef WITH_AUTH_WINBIND
 #include "auth_wbclient.h"
 #endif
+#include "auth_ntlm_helper.h"
 
 #ifdef HAVE_OPENSSL_CRYPTO_H
 USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
@@ -558,6 +559,9 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("with_ntdomain_hack", PW_TYPE_BOOLEAN, rlm_mschap_t, with_ntdomain_hack), .dflt = "yes" },
 	{ FR_CONF_OFFSET("ntlm_auth", PW_TYPE_STRING | PW_TYPE_XLAT, rlm_mschap_t, ntlm_auth) },
 	{ FR_CONF_OFFSET("ntlm_auth_timeout", PW_TYPE_INTEGER, rlm_mschap_t, ntlm_auth_timeout) },
+	{ FR_CONF_OFFSET("ntlm_auth_helper", PW_TYPE_STRING, rlm_mschap_t, ntlm_auth_helper) },
+	{ FR_CONF_OFFSET("ntlm_auth_helper_username", PW_TYPE_TMPL, rlm_mschap_t, ntlm_helper_username) },
+	{ FR_CONF_OFFSET("ntlm_auth_helper_domain", PW_TYPE_TMPL, rlm_mschap_t, ntlm_helper_domain) },
 	{ FR_CONF_POINTER("passchange", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) passchange_config },
 	{ FR_CONF_OFFSET("allow_retry", PW_TYPE_BOOLEAN, rlm_mschap_t, allow_retry), .dflt = "yes" },
 	{ FR_CONF_OFFSET("retry_msg", PW_TYPE_STRING, rlm_mschap_t, retry_msg) },
@@ -611,23 +615,59 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	if (inst->wb_username) {
 #ifdef WITH_AUTH_WINBIND
 		inst->method = AUTH_WBCLIENT;
-
-		inst->wb_pool = module_connection_pool_init(conf, inst, mod_conn_create, NULL, NULL, NULL, NULL);
-		if (!inst->wb_pool) {
-			cf_log_err_cs(conf, "Unable to initialise winbind connection pool");
-			return -1;
-		}
 #else
 		cf_log_err_cs(conf, "'winbind' auth not enabled at compiled time");
 		return -1;
 #endif
 	}
 
+	if (inst->ntlm_auth_helper) {
+		if (inst->ntlm_auth) {
+			cf_log_err_cs(conf, "'ntlm_auth' and 'ntlm_auth_helper' cannot both be set");
+			return -1;
+		}
+
+		if (!inst->ntlm_helper_username) {
+			cf_log_err_cs(conf, "'ntlm_auth_helper_username' must be set when using 'ntlm_auth_helper'");
+			return -1;
+		}
+
+		inst->method = AUTH_NTLMAUTH_HELPER;
+	}
+
 	/* preserve existing behaviour: this option overrides all */
 	if (inst->ntlm_auth) {
 		inst->method = AUTH_NTLMAUTH_EXEC;
 	}
 
+	/*
+	 *	Both pooled methods use the module's "pool" section,
+	 *	so only the one we're going to use gets a pool.
+	 */
+	switch (inst->method) {
+#ifdef WITH_AUTH_WINBIND
+	case AUTH_WBCLIENT:
+		inst->wb_pool = module_connection_pool_init(conf, inst, mod_conn_create, NULL, NULL, NULL, NULL);
+		if (!inst->wb_pool) {
+			cf_log_err_cs(conf, "Unable to initialise winbind connection pool");
+			return -1;
+		}
+		break;
+#endif
+
+	case AUTH_NTLMAUTH_HELPER:
+		inst->helper_pool = module_connection_pool_init(conf, inst, ntlm_helper_conn_create, NULL,
+								NULL, NULL, NULL);
+		if (!inst->helper_pool) {
+			cf_log_err_cs(conf, "Unable to initialise ntlm_auth helper pool");
+			return -1;
+		}
+		break;
+
+	default:
+		break;
+	}
+
 	switch (inst->method) {
 	case AUTH_INTERNAL:
 		DEBUG("%s: using internal authentication", inst->xlat_name);
@@ -635,6 +675,9 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	case AUTH_NTLMAUTH_EXEC:
 		DEBUG("%s : authenticating by calling 'ntlm_auth'", inst->xlat_name);
 		break;
+	case AUTH_NTLMAUTH_HELPER:
+		DEBUG("%s : authenticating with a pool of 'ntlm_auth' helpers", inst->xlat_name);
+		break;
 #ifdef WITH_AUTH_WINBIND
 	case AUTH_WBCLIENT:
 		DEBUG("%s : authenticating directly to winbind", inst->xlat_name);
@@ -665,13 +708,14 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 /*
  *	Tidy up instance
  */
-static int mod_detach(UNUSED void *instance)
+static int mod_detach(void *instance)
 {
-#ifdef WITH_AUTH_WINBIND
 	rlm_mschap_t *inst = instance;
 
+#ifdef WITH_AUTH_WINBIND
 	fr_connection_pool_free(inst->wb_pool);
 #endif
+	fr_connection_pool_free(inst->helper_pool);
 
 	return 0;
 }
@@ -1228,6 +1272,11 @@ static int CC_HINT(nonnull (1, 2, 4, 5 ,6)) do_mschap(rlm_mschap_t *inst, REQUES
 	 */
 		return do_auth_wbclient(inst, request, challenge, response, nthashhash);
 #endif
+	case AUTH_NTLMAUTH_HELPER:
+	/*
+	 *	Ask one of the pooled ntlm_auth helpers
+	 */
+		return do_auth_ntlm_helper(inst, request, challenge, response, nthashhash);
 	default:
 		/* We should never reach this line */
 		RERROR("Internal error: Unknown mschap auth method (%d)", method);
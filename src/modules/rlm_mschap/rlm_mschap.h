@@ -7,19 +7,20 @@ RCSIDH(rlm_mschap_h, "$Id$")
 
 #include "config.h"
 
+#include <freeradius-devel/connection.h>
+
 #ifdef WITH_AUTH_WINBIND
 #  include <wbclient.h>
-
-#include <freeradius-devel/connection.h>
 #endif
 
 /* Method of authentication we are going to use */
 typedef enum {
 	AUTH_INTERNAL		= 0,
-	AUTH_NTLMAUTH_EXEC	= 1
+	AUTH_NTLMAUTH_EXEC	= 1,
 #ifdef WITH_AUTH_WINBIND
-	,AUTH_WBCLIENT       	= 2
+	AUTH_WBCLIENT       	= 2,
 #endif
+	AUTH_NTLMAUTH_HELPER	= 3
 } MSCHAP_AUTH_METHOD;
 
 typedef struct rlm_mschap_t {
@@ -30,6 +31,10 @@ typedef struct rlm_mschap_t {
 	char const		*xlat_name;
 	char const		*ntlm_auth;
 	uint32_t		ntlm_auth_timeout;
+	char const		*ntlm_auth_helper;
+	vp_tmpl_t		*ntlm_helper_username;
+	vp_tmpl_t		*ntlm_helper_domain;
+	fr_connection_pool_t	*helper_pool;
 	char const		*ntlm_cpw;
 	char const		*ntlm_cpw_username;
 	char const		*ntlm_cpw_domain;
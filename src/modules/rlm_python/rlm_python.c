@@ -53,18 +53,10 @@ typedef struct python_func_def {
 	char const	*function_name;		//!< String name of function in module.
 } python_func_def_t;
 
-/** An instance of the rlm_python module
+/** The functions called for each section, loaded into one interpreter
  *
  */
-typedef struct rlm_python_t {
-	char const	*name;			//!< Name of the module instance
-	PyThreadState	*sub_interpreter;	//!< The main interpreter/thread used for this instance.
-	char const	*python_path;		//!< Path to search for python files in.
-	PyObject	*module;		//!< Local, interpreter specific module, containing
-						//!< FreeRADIUS functions.
-	bool		cext_compat;		//!< Whether or not to create sub-interpreters per module
-						//!< instance.
-
+typedef struct python_funcs {
 	python_func_def_t
 	instantiate,
 	authorize,
@@ -80,6 +72,25 @@ typedef struct rlm_python_t {
 	send_coa,
 #endif
 	detach;
+} python_funcs_t;
+
+/** An instance of the rlm_python module
+ *
+ */
+typedef struct rlm_python_t {
+	char const	*name;			//!< Name of the module instance
+	PyThreadState	*sub_interpreter;	//!< The main interpreter/thread used for this instance.
+	char const	*python_path;		//!< Path to search for python files in.
+	PyObject	*module;		//!< Local, interpreter specific module, containing
+						//!< FreeRADIUS functions.
+	bool		cext_compat;		//!< Whether or not to create sub-interpreters per module
+						//!< instance.
+	bool		pass_request;		//!< Pass functions a radiusd.Request object instead of
+						//!< a tuple of (name, value) tuples.
+	bool		thread_interpreters;	//!< Create a separate interpreter for each thread.
+	CONF_SECTION	*cs;			//!< Module configuration, for setting up thread interpreters.
+
+	python_funcs_t	funcs;			//!< Functions loaded into sub_interpreter.
 
 	PyObject	*pythonconf_dict;	//!< Configuration parameters defined in the module
 						//!< made available to the python script.
@@ -89,19 +100,49 @@ typedef struct rlm_python_t {
  *
  * Multiple instances of python create multiple interpreters and each
  * thread must have a PyThreadState per interpreter, to track execution.
+ *
+ * With thread_interpreters, each thread also gets its own interpreter,
+ * with its own copy of the radiusd module, and of the user's modules.
  */
 typedef struct python_thread_state {
 	PyThreadState		*state;		//!< Module instance/thread specific state.
 	rlm_python_t		*inst;		//!< Module instance that created this thread state.
+
+	bool			interpreter;	//!< state is the main thread of an interpreter
+						//!< created for this thread.
+	PyObject		*module;	//!< radiusd module in this thread's interpreter.
+	PyObject		*pythonconf_dict;	//!< radiusd.config in this thread's interpreter.
+	python_funcs_t		funcs;		//!< Functions loaded into this thread's interpreter.
 } python_thread_state_t;
 
+/** A request, as seen by python code
+ *
+ * Only valid for the duration of the call it was passed to.  After that
+ * request is NULL, and any access raises an exception.
+ */
+typedef struct python_request {
+	PyObject_HEAD
+	REQUEST			*request;	//!< The request, or NULL once the call has returned.
+} python_request_t;
+
+/** One of the pair lists of a request, as seen by python code
+ *
+ * Attributes are looked up in the list when accessed, nothing is copied
+ * in advance.
+ */
+typedef struct python_pair_list {
+	PyObject_HEAD
+	python_request_t	*owner;		//!< Request the list belongs to.
+	pair_lists_t		list;		//!< Which list.
+} python_pair_list_t;
+
 /*
  *	A mapping of configuration file names to internal variables.
  */
 static CONF_PARSER module_config[] = {
 
-#define A(x) { FR_CONF_OFFSET("mod_" #x, PW_TYPE_STRING, rlm_python_t, x.module_name), .dflt = "${.module}" }, \
-	{ FR_CONF_OFFSET("func_" #x, PW_TYPE_STRING, rlm_python_t, x.function_name) },
+#define A(x) { FR_CONF_OFFSET("mod_" #x, PW_TYPE_STRING, rlm_python_t, funcs.x.module_name), .dflt = "${.module}" }, \
+	{ FR_CONF_OFFSET("func_" #x, PW_TYPE_STRING, rlm_python_t, funcs.x.function_name) },
 
 	A(instantiate)
 	A(authorize)
@@ -122,6 +163,8 @@ static CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("python_path", PW_TYPE_STRING, rlm_python_t, python_path) },
 	{ FR_CONF_OFFSET("cext_compat", PW_TYPE_BOOLEAN, rlm_python_t, cext_compat), .dflt = false },
+	{ FR_CONF_OFFSET("pass_request", PW_TYPE_BOOLEAN, rlm_python_t, pass_request), .dflt = "no" },
+	{ FR_CONF_OFFSET("thread_interpreters", PW_TYPE_BOOLEAN, rlm_python_t, thread_interpreters), .dflt = "no" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -330,66 +373,45 @@ static void mod_vptuple(TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **vps, PyO
 }
 
 
-/*
- *	This is the core Python function that the others wrap around.
- *	Pass the value-pair print strings in a tuple.
+/** Convert the value of a VALUE_PAIR to a python object
  *
- *	FIXME: We're not checking the errors. If we have errors, what
- *	do we do?
+ * Numbers are converted directly.  Types python has no equivalent for
+ * are printed, and passed as strings.
+ *
+ * @param[in] vp	to convert.
+ * @return
+ *	- New reference to a python object.
+ *	- NULL on error, with a python exception set.
  */
-static int mod_populate_vptuple(PyObject *pp, VALUE_PAIR *vp)
+static PyObject *python_value_from_vp(VALUE_PAIR const *vp)
 {
-	PyObject *attribute = NULL;
-	PyObject *value = NULL;
-
-	/* Look at the fr_pair_fprint_name? */
-
-	if (vp->da->flags.has_tag) {
-		attribute = PyString_FromFormat("%s:%d", vp->da->name, vp->tag);
-	} else {
-		attribute = PyString_FromString(vp->da->name);
-	}
-
-	if (!attribute) return -1;
-
-	PyTuple_SET_ITEM(pp, 0, attribute);
-
 	switch (vp->da->type) {
 	case PW_TYPE_STRING:
-		value = PyUnicode_FromStringAndSize(vp->vp_strvalue, vp->vp_length);
-		break;
+		return PyUnicode_FromStringAndSize(vp->vp_strvalue, vp->vp_length);
 
 	case PW_TYPE_OCTETS:
-		value = PyString_FromStringAndSize((char const *)vp->vp_octets, vp->vp_length);
-		break;
+		return PyString_FromStringAndSize((char const *)vp->vp_octets, vp->vp_length);
 
 	case PW_TYPE_INTEGER:
-		value = PyLong_FromUnsignedLong(vp->vp_integer);
-		break;
+		return PyLong_FromUnsignedLong(vp->vp_integer);
 
 	case PW_TYPE_BYTE:
-		value = PyLong_FromUnsignedLong(vp->vp_byte);
-		break;
+		return PyLong_FromUnsignedLong(vp->vp_byte);
 
 	case PW_TYPE_SHORT:
-		value =  PyLong_FromUnsignedLong(vp->vp_short);
-		break;
+		return PyLong_FromUnsignedLong(vp->vp_short);
 
 	case PW_TYPE_SIGNED:
-		value = PyLong_FromLong(vp->vp_signed);
-		break;
+		return PyLong_FromLong(vp->vp_signed);
 
 	case PW_TYPE_INTEGER64:
-		value = PyLong_FromUnsignedLongLong(vp->vp_integer64);
-		break;
+		return PyLong_FromUnsignedLongLong(vp->vp_integer64);
 
 	case PW_TYPE_DECIMAL:
-		value = PyFloat_FromDouble(vp->vp_decimal);
-		break;
+		return PyFloat_FromDouble(vp->vp_decimal);
 
 	case PW_TYPE_BOOLEAN:
-		value = PyBool_FromLong(vp->vp_bool);
-		break;
+		return PyBool_FromLong(vp->vp_bool);
 
 	case PW_TYPE_TIMEVAL:
 	case PW_TYPE_IPV4_ADDR:
@@ -407,209 +429,1135 @@ static int mod_populate_vptuple(PyObject *pp, VALUE_PAIR *vp)
 		char buffer[256];
 
 		len = fr_pair_value_snprint(buffer, sizeof(buffer), vp, '\0');
-		value = PyString_FromStringAndSize(buffer, len);
+		return PyString_FromStringAndSize(buffer, len);
 	}
-		break;
 
 	case PW_TYPE_STRUCTURAL:
 	case PW_TYPE_BAD:
-		rad_assert(0);
-		return -1;
+		break;
 	}
 
-	if (value == NULL) return -1;
-
-	PyTuple_SET_ITEM(pp, 1, value);
-
-	return 0;
+	rad_assert(0);
+	PyErr_Format(PyExc_TypeError, "Attribute %s has no python equivalent", vp->da->name);
+	return NULL;
 }
 
-static rlm_rcode_t do_python_single(REQUEST *request, PyObject *pFunc, char const *funcname)
+/*
+ *	This is the core Python function that the others wrap around.
+ *	Pass the value-pair print strings in a tuple.
+ *
+ *	FIXME: We're not checking the errors. If we have errors, what
+ *	do we do?
+ */
+static int mod_populate_vptuple(PyObject *pp, VALUE_PAIR *vp)
 {
-	vp_cursor_t	cursor;
-	VALUE_PAIR      *vp;
-	PyObject	*pRet = NULL;
-	PyObject	*pArgs = NULL;
-	int		tuplelen;
-	int		ret;
+	PyObject *attribute = NULL;
+	PyObject *value = NULL;
 
-	/* Default return value is "OK, continue" */
-	ret = RLM_MODULE_OK;
+	/* Look at the fr_pair_fprint_name? */
 
-	/*
-	 *	We will pass a tuple containing (name, value) tuples
-	 *	We can safely use the Python function to build up a
-	 *	tuple, since the tuple is not used elsewhere.
-	 *
-	 *	Determine the size of our tuple by walking through the packet.
-	 *	If request is NULL, pass None.
-	 */
-	tuplelen = 0;
-	if (request != NULL) {
-		for (vp = fr_cursor_init(&cursor, &request->packet->vps);
-		     vp;
-		     vp = fr_cursor_next(&cursor)) tuplelen++;
+	if (vp->da->flags.has_tag) {
+		attribute = PyString_FromFormat("%s:%d", vp->da->name, vp->tag);
+	} else {
+		attribute = PyString_FromString(vp->da->name);
 	}
 
-	if (tuplelen == 0) {
-		Py_INCREF(Py_None);
-		pArgs = Py_None;
-	} else {
-		int i = 0;
-		if ((pArgs = PyTuple_New(tuplelen)) == NULL) {
-			ret = RLM_MODULE_FAIL;
-			goto finish;
-		}
+	if (!attribute) return -1;
 
-		for (vp = fr_cursor_init(&cursor, &request->packet->vps);
-		     vp;
-		     vp = fr_cursor_next(&cursor), i++) {
-			PyObject *pp;
+	PyTuple_SET_ITEM(pp, 0, attribute);
 
-			/* The inside tuple has two only: */
-			if ((pp = PyTuple_New(2)) == NULL) {
-				ret = RLM_MODULE_FAIL;
-				goto finish;
-			}
+	value = python_value_from_vp(vp);
+	if (value == NULL) return -1;
 
-			if (mod_populate_vptuple(pp, vp) == 0) {
-				/* Put the tuple inside the container */
-				PyTuple_SET_ITEM(pArgs, i, pp);
-			} else {
-				Py_INCREF(Py_None);
-				PyTuple_SET_ITEM(pArgs, i, Py_None);
-				Py_DECREF(pp);
-			}
-		}
-	}
+	PyTuple_SET_ITEM(pp, 1, value);
 
-	/* Call Python function. */
-	pRet = PyObject_CallFunctionObjArgs(pFunc, pArgs, NULL);
-	if (!pRet) {
-		ret = RLM_MODULE_FAIL;
-		goto finish;
+	return 0;
+}
+
+/** Set the value of a VALUE_PAIR from a python object
+ *
+ * Numbers are copied directly into numeric attributes.  Strings are
+ * copied into string and octets attributes, and parsed for everything
+ * else.
+ *
+ * @param[in] vp	to set the value of.
+ * @param[in] value	to set.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error, with a python exception set.
+ */
+static int python_vp_from_value(VALUE_PAIR *vp, PyObject *value)
+{
+	if (PyBool_Check(value) && (vp->da->type == PW_TYPE_BOOLEAN)) {
+		vp->vp_bool = (value == Py_True);
+		return 0;
 	}
 
-	if (!request) {
-		// check return code at module instantiation time
-		if (PyInt_CheckExact(pRet)) ret = PyInt_AsLong(pRet);
-		goto finish;
+	if (PyFloat_Check(value) && (vp->da->type == PW_TYPE_DECIMAL)) {
+		vp->vp_decimal = PyFloat_AS_DOUBLE(value);
+		return 0;
 	}
 
-	/*
-	 *	The function returns either:
-	 *  1. (returnvalue, replyTuple, configTuple), where
-	 *   - returnvalue is one of the constants RLM_*
-	 *   - replyTuple and configTuple are tuples of string
-	 *      tuples of size 2
-	 *
-	 *  2. the function return value alone
-	 *
-	 *  3. None - default return value is set
-	 *
-	 * xxx This code is messy!
-	 */
-	if (PyTuple_CheckExact(pRet)) {
-		PyObject *pTupleInt;
+	if (PyInt_Check(value) || PyLong_Check(value)) {
+		PyObject		*num;
+		unsigned PY_LONG_LONG	uvalue = 0;
+		PY_LONG_LONG		svalue = 0;
 
-		if (PyTuple_GET_SIZE(pRet) != 3) {
-			ERROR("%s - Tuple must be (return, replyTuple, configTuple)", funcname);
-			ret = RLM_MODULE_FAIL;
-			goto finish;
-		}
+		num = PyNumber_Long(value);
+		if (!num) return -1;
 
-		pTupleInt = PyTuple_GET_ITEM(pRet, 0);
-		if (!PyInt_CheckExact(pTupleInt)) {
-			ERROR("%s - First tuple element not an integer", funcname);
-			ret = RLM_MODULE_FAIL;
-			goto finish;
+		if ((vp->da->type == PW_TYPE_SIGNED) || (vp->da->type == PW_TYPE_DECIMAL)) {
+			svalue = PyLong_AsLongLong(num);
+		} else {
+			uvalue = PyLong_AsUnsignedLongLong(num);
+		}
+		Py_DECREF(num);
+		if (PyErr_Occurred()) return -1;
+
+		switch (vp->da->type) {
+		case PW_TYPE_BYTE:
+			if (uvalue > UINT8_MAX) goto range;
+			vp->vp_byte = uvalue;
+			return 0;
+
+		case PW_TYPE_SHORT:
+			if (uvalue > UINT16_MAX) goto range;
+			vp->vp_short = uvalue;
+			return 0;
+
+		case PW_TYPE_INTEGER:
+			if (uvalue > UINT32_MAX) goto range;
+			vp->vp_integer = uvalue;
+			return 0;
+
+		case PW_TYPE_DATE:
+			if (uvalue > UINT32_MAX) goto range;
+			vp->vp_date = uvalue;
+			return 0;
+
+		case PW_TYPE_INTEGER64:
+			vp->vp_integer64 = uvalue;
+			return 0;
+
+		case PW_TYPE_SIGNED:
+			if ((svalue < INT32_MIN) || (svalue > INT32_MAX)) goto range;
+			vp->vp_signed = svalue;
+			return 0;
+
+		case PW_TYPE_DECIMAL:
+			vp->vp_decimal = svalue;
+			return 0;
+
+		case PW_TYPE_BOOLEAN:
+			vp->vp_bool = (uvalue != 0);
+			return 0;
+
+		default:
+			break;
 		}
-		/* Now have the return value */
-		ret = PyInt_AsLong(pTupleInt);
-		/* Reply item tuple */
-		mod_vptuple(request->reply, request, &request->reply->vps,
-			    PyTuple_GET_ITEM(pRet, 1), funcname, "reply");
-		/* Config item tuple */
-		mod_vptuple(request, request, &request->control,
-			    PyTuple_GET_ITEM(pRet, 2), funcname, "config");
 
-	} else if (PyInt_CheckExact(pRet)) {
-		/* Just an integer */
-		ret = PyInt_AsLong(pRet);
+		PyErr_Format(PyExc_TypeError, "Can't assign a number to %s", vp->da->name);
+		return -1;
 
-	} else if (pRet == Py_None) {
-		/* returned 'None', return value defaults to "OK, continue." */
-		ret = RLM_MODULE_OK;
-	} else {
-		/* Not tuple or None */
-		ERROR("%s - Function did not return a tuple or None", funcname);
-		ret = RLM_MODULE_FAIL;
-		goto finish;
+	range:
+		PyErr_Format(PyExc_OverflowError, "Value out of range for %s", vp->da->name);
+		return -1;
 	}
 
+	if (PyUnicode_Check(value)) {
+		PyObject	*utf8;
+		int		ret;
 
-finish:
-	Py_XDECREF(pArgs);
-	Py_XDECREF(pRet);
+		utf8 = PyUnicode_AsUTF8String(value);
+		if (!utf8) return -1;
 
-	return ret;
-}
+		ret = python_vp_from_value(vp, utf8);
+		Py_DECREF(utf8);
 
-static void python_interpreter_free(PyThreadState *interp)
-{
-	PyEval_AcquireLock();
-	PyThreadState_Swap(interp);
-	Py_EndInterpreter(interp);
-	PyEval_ReleaseLock();
-}
+		return ret;
+	}
 
-/** Destroy a thread state
- *
- * @param thread to destroy.
- * @return 0
- */
-static int _python_thread_free(python_thread_state_t *thread)
-{
-	PyEval_RestoreThread(thread->state);	/* Swap in our local thread state */
-	PyThreadState_Clear(thread->state);
-	PyEval_SaveThread();
+	if (PyString_Check(value)) {
+		char		*str;
+		Py_ssize_t	len;
 
-	PyThreadState_Delete(thread->state);	/* Don't need to hold lock for this */
+		if (PyString_AsStringAndSize(value, &str, &len) < 0) return -1;
 
-	return 0;
-}
+		switch (vp->da->type) {
+		case PW_TYPE_STRING:
+			fr_pair_value_bstrncpy(vp, str, len);
+			return 0;
 
-/** Callback for rbtree delete walker
- *
- */
-static void _python_thread_entry_free(void *arg)
-{
-	talloc_free(arg);
+		case PW_TYPE_OCTETS:
+			fr_pair_value_memcpy(vp, (uint8_t const *) str, len);
+			return 0;
+
+		default:
+			if (fr_pair_value_from_str(vp, str, len) < 0) {
+				PyErr_Format(PyExc_ValueError, "%s", fr_strerror());
+				return -1;
+			}
+			return 0;
+		}
+	}
+
+	PyErr_Format(PyExc_TypeError, "Can't assign a %s to %s", Py_TYPE(value)->tp_name, vp->da->name);
+	return -1;
 }
 
-/** Cleanup any thread local storage on pthread_exit()
+static PyTypeObject python_request_type;
+static PyTypeObject python_pair_list_type;
+
+/** Resolve a pair list object to the list in the request
  *
- * @param arg The thread currently exiting.
+ * @param[in] pl	to resolve.
+ * @param[out] ctx	Where to write the talloc ctx for new pairs in the list.  May be NULL.
+ * @return
+ *	- The head of the list.
+ *	- NULL on error, with a python exception set.
  */
-static void _python_thread_tree_free(void *arg)
+static VALUE_PAIR **python_pair_list_head(python_pair_list_t *pl, TALLOC_CTX **ctx)
 {
-	rad_assert(arg == local_thread_state);
+	VALUE_PAIR **head;
 
-	rbtree_t *tree = talloc_get_type_abort(arg, rbtree_t);
-	rbtree_free(tree);	/* Needs to be this not talloc_free to execute delete walker */
+	if (!pl->owner->request) {
+		PyErr_SetString(PyExc_RuntimeError, "Request is no longer valid");
+		return NULL;
+	}
 
-	local_thread_state = NULL;	/* Prevent double free in unittest env */
+	head = radius_list(pl->owner->request, pl->list);
+	if (!head) {
+		PyErr_Format(PyExc_LookupError, "List \"%s\" is not available for this request",
+			     fr_int2str(pair_lists, pl->list, "<INVALID>"));
+		return NULL;
+	}
+
+	if (ctx) *ctx = radius_list_ctx(pl->owner->request, pl->list);
+
+	return head;
 }
 
-/** Compare instance pointers
+/** Convert a python key to an attribute, and an optional tag
  *
+ * Keys are attribute names, with an optional ":<tag>" suffix.
  */
-static int _python_inst_cmp(const void *a, const void *b)
+static fr_dict_attr_t const *python_key_to_da(PyObject *key, int8_t *tag)
 {
-	python_thread_state_t const *a_p = a, *b_p = b;
+	char const		*name;
+	char const		*p;
+	char			buffer[FR_DICT_ATTR_MAX_NAME_LEN + 1];
+	fr_dict_attr_t const	*da;
 
-	if (a_p->inst < b_p->inst) return -1;
-	if (a_p->inst > b_p->inst) return +1;
+	*tag = TAG_ANY;
+
+	if (!PyString_Check(key)) {
+		PyErr_SetString(PyExc_TypeError, "Attribute names must be strings");
+		return NULL;
+	}
+	name = PyString_AS_STRING(key);
+
+	p = strchr(name, ':');
+	if (p) {
+		char	*end;
+		long	num;
+
+		if ((size_t)(p - name) >= sizeof(buffer)) goto unknown;
+
+		num = strtol(p + 1, &end, 10);
+		if ((*end != '\0') || (end == (p + 1)) || (num < 0) || !TAG_VALID_ZERO(num)) {
+			PyErr_Format(PyExc_KeyError, "Invalid tag in \"%s\"", name);
+			return NULL;
+		}
+		*tag = num;
+
+		memcpy(buffer, name, p - name);
+		buffer[p - name] = '\0';
+		name = buffer;
+	}
+
+	da = fr_dict_attr_by_name(NULL, name);
+	if (!da) {
+	unknown:
+		PyErr_Format(PyExc_KeyError, "Unknown attribute \"%s\"", PyString_AS_STRING(key));
+		return NULL;
+	}
+
+	if ((*tag != TAG_ANY) && !da->flags.has_tag) {
+		PyErr_Format(PyExc_KeyError, "Attribute \"%s\" can't have a tag", da->name);
+		return NULL;
+	}
+
+	return da;
+}
+
+/** Remove all instances of an attribute from a list
+ *
+ */
+static void python_pair_delete(VALUE_PAIR **head, fr_dict_attr_t const *da, int8_t tag)
+{
+	VALUE_PAIR *i, *next;
+	VALUE_PAIR **last = head;
+
+	for (i = *head; i; i = next) {
+		next = i->next;
+		if ((i->da == da) && (!i->da->flags.has_tag || TAG_EQ(tag, i->tag))) {
+			*last = next;
+			talloc_free(i);
+		} else {
+			last = &i->next;
+		}
+	}
+}
+
+/** Add a new attribute to a list
+ *
+ */
+static int python_pair_add(TALLOC_CTX *ctx, VALUE_PAIR **head, fr_dict_attr_t const *da, int8_t tag, PyObject *value)
+{
+	VALUE_PAIR *vp;
+
+	vp = fr_pair_afrom_da(ctx, da);
+	if (!vp) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	if (da->flags.has_tag) vp->tag = (tag == TAG_ANY) ? TAG_NONE : tag;
+
+	if (python_vp_from_value(vp, value) < 0) {
+		talloc_free(vp);
+		return -1;
+	}
+
+	fr_pair_add(head, vp);
+
+	return 0;
+}
+
+/** Return the value of the first instance of an attribute in the list
+ *
+ * Raises KeyError if the attribute isn't in the list.
+ */
+static PyObject *python_pair_list_getitem(PyObject *self, PyObject *key)
+{
+	VALUE_PAIR		**head, *vp;
+	vp_cursor_t		cursor;
+	fr_dict_attr_t const	*da;
+	int8_t			tag;
+
+	head = python_pair_list_head((python_pair_list_t *) self, NULL);
+	if (!head) return NULL;
+
+	da = python_key_to_da(key, &tag);
+	if (!da) return NULL;
+
+	fr_cursor_init(&cursor, head);
+	vp = fr_cursor_next_by_da(&cursor, da, tag);
+	if (!vp) {
+		PyErr_SetObject(PyExc_KeyError, key);
+		return NULL;
+	}
+
+	return python_value_from_vp(vp);
+}
+
+/** Replace all instances of an attribute in the list
+ *
+ * Assigning a list or tuple adds one attribute per element.  Deleting
+ * removes all instances.
+ */
+static int python_pair_list_setitem(PyObject *self, PyObject *key, PyObject *value)
+{
+	VALUE_PAIR		**head;
+	TALLOC_CTX		*ctx;
+	fr_dict_attr_t const	*da;
+	int8_t			tag;
+	Py_ssize_t		i;
+
+	head = python_pair_list_head((python_pair_list_t *) self, &ctx);
+	if (!head) return -1;
+
+	da = python_key_to_da(key, &tag);
+	if (!da) return -1;
+
+	python_pair_delete(head, da, tag);
+	if (!value) return 0;
+
+	if (!PyList_Check(value) && !PyTuple_Check(value)) return python_pair_add(ctx, head, da, tag, value);
+
+	for (i = 0; i < PySequence_Fast_GET_SIZE(value); i++) {
+		if (python_pair_add(ctx, head, da, tag, PySequence_Fast_GET_ITEM(value, i)) < 0) return -1;
+	}
+
+	return 0;
+}
+
+static Py_ssize_t python_pair_list_length(PyObject *self)
+{
+	VALUE_PAIR	**head, *vp;
+	vp_cursor_t	cursor;
+	Py_ssize_t	count = 0;
+
+	head = python_pair_list_head((python_pair_list_t *) self, NULL);
+	if (!head) return -1;
+
+	for (vp = fr_cursor_init(&cursor, head); vp; vp = fr_cursor_next(&cursor)) count++;
+
+	return count;
+}
+
+static int python_pair_list_contains(PyObject *self, PyObject *key)
+{
+	VALUE_PAIR		**head;
+	vp_cursor_t		cursor;
+	fr_dict_attr_t const	*da;
+	int8_t			tag;
+
+	head = python_pair_list_head((python_pair_list_t *) self, NULL);
+	if (!head) return -1;
+
+	da = python_key_to_da(key, &tag);
+	if (!da) {
+		/*
+		 *	Unknown attributes just aren't in the list.
+		 */
+		if (!PyErr_ExceptionMatches(PyExc_KeyError)) return -1;
+		PyErr_Clear();
+		return 0;
+	}
+
+	fr_cursor_init(&cursor, head);
+	return (fr_cursor_next_by_da(&cursor, da, tag) != NULL);
+}
+
+/** Iterate over (name, value) tuples, in the same format as the tuple interface
+ *
+ */
+static PyObject *python_pair_list_iter(PyObject *self)
+{
+	VALUE_PAIR	**head, *vp;
+	vp_cursor_t	cursor;
+	PyObject	*items, *iter;
+
+	head = python_pair_list_head((python_pair_list_t *) self, NULL);
+	if (!head) return NULL;
+
+	items = PyList_New(0);
+	if (!items) return NULL;
+
+	for (vp = fr_cursor_init(&cursor, head); vp; vp = fr_cursor_next(&cursor)) {
+		PyObject *pp;
+
+		pp = PyTuple_New(2);
+		if (!pp) goto error;
+
+		if ((mod_populate_vptuple(pp, vp) < 0) || (PyList_Append(items, pp) < 0)) {
+			Py_DECREF(pp);
+		error:
+			Py_DECREF(items);
+			return NULL;
+		}
+		Py_DECREF(pp);
+	}
+
+	iter = PyObject_GetIter(items);
+	Py_DECREF(items);
+
+	return iter;
+}
+
+/** list.get(name[, default]) - Value of the first instance of an attribute, or default
+ *
+ */
+static PyObject *python_pair_list_get(PyObject *self, PyObject *args)
+{
+	PyObject *key, *dflt = Py_None, *value;
+
+	if (!PyArg_ParseTuple(args, "O|O", &key, &dflt)) return NULL;
+
+	value = python_pair_list_getitem(self, key);
+	if (value || !PyErr_ExceptionMatches(PyExc_KeyError)) return value;
+
+	PyErr_Clear();
+	Py_INCREF(dflt);
+
+	return dflt;
+}
+
+/** list.getall(name) - Values of all instances of an attribute
+ *
+ */
+static PyObject *python_pair_list_getall(PyObject *self, PyObject *args)
+{
+	VALUE_PAIR		**head, *vp;
+	vp_cursor_t		cursor;
+	fr_dict_attr_t const	*da;
+	int8_t			tag;
+	PyObject		*key, *values;
+
+	if (!PyArg_ParseTuple(args, "O", &key)) return NULL;
+
+	head = python_pair_list_head((python_pair_list_t *) self, NULL);
+	if (!head) return NULL;
+
+	da = python_key_to_da(key, &tag);
+	if (!da) return NULL;
+
+	values = PyList_New(0);
+	if (!values) return NULL;
+
+	fr_cursor_init(&cursor, head);
+	while ((vp = fr_cursor_next_by_da(&cursor, da, tag))) {
+		PyObject *value;
+
+		value = python_value_from_vp(vp);
+		if (!value || (PyList_Append(values, value) < 0)) {
+			Py_XDECREF(value);
+			Py_DECREF(values);
+			return NULL;
+		}
+		Py_DECREF(value);
+	}
+
+	return values;
+}
+
+static void python_pair_list_dealloc(PyObject *self)
+{
+	Py_XDECREF(((python_pair_list_t *) self)->owner);
+	PyObject_Del(self);
+}
+
+static PyMappingMethods python_pair_list_mapping = {
+	.mp_length		= python_pair_list_length,
+	.mp_subscript		= python_pair_list_getitem,
+	.mp_ass_subscript	= python_pair_list_setitem
+};
+
+static PySequenceMethods python_pair_list_sequence = {
+	.sq_contains		= python_pair_list_contains
+};
+
+static PyMethodDef python_pair_list_methods[] = {
+	{ "get", python_pair_list_get, METH_VARARGS,
+	  "get(name[, default]) - Value of the first instance of an attribute, or default" },
+	{ "getall", python_pair_list_getall, METH_VARARGS,
+	  "getall(name) - List of the values of all instances of an attribute" },
+	{ NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject python_pair_list_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name		= "radiusd.PairList",
+	.tp_basicsize		= sizeof(python_pair_list_t),
+	.tp_dealloc		= python_pair_list_dealloc,
+	.tp_as_sequence		= &python_pair_list_sequence,
+	.tp_as_mapping		= &python_pair_list_mapping,
+	.tp_flags		= Py_TPFLAGS_DEFAULT,
+	.tp_doc			= "Attributes in one of the lists of a request",
+	.tp_iter		= python_pair_list_iter,
+	.tp_methods		= python_pair_list_methods
+};
+
+/** Return a PairList object for one of the lists of the request
+ *
+ */
+static PyObject *python_request_list(PyObject *self, void *closure)
+{
+	python_pair_list_t *pl;
+
+	pl = PyObject_New(python_pair_list_t, &python_pair_list_type);
+	if (!pl) return NULL;
+
+	Py_INCREF(self);
+	pl->owner = (python_request_t *) self;
+	pl->list = (pair_lists_t)(intptr_t) closure;
+
+	return (PyObject *) pl;
+}
+
+static PyGetSetDef python_request_getset[] = {
+	{ "request", python_request_list, NULL, "Attributes in the request",
+	  (void *)(intptr_t) PAIR_LIST_REQUEST },
+	{ "reply", python_request_list, NULL, "Attributes to send in the reply",
+	  (void *)(intptr_t) PAIR_LIST_REPLY },
+	{ "control", python_request_list, NULL, "Control attributes",
+	  (void *)(intptr_t) PAIR_LIST_CONTROL },
+	{ "session_state", python_request_list, NULL, "Attributes kept between rounds of a multi-round exchange",
+	  (void *)(intptr_t) PAIR_LIST_STATE },
+#ifdef WITH_PROXY
+	{ "proxy_request", python_request_list, NULL, "Attributes in the proxied request",
+	  (void *)(intptr_t) PAIR_LIST_PROXY_REQUEST },
+	{ "proxy_reply", python_request_list, NULL, "Attributes in the reply to the proxied request",
+	  (void *)(intptr_t) PAIR_LIST_PROXY_REPLY },
+#endif
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyTypeObject python_request_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name		= "radiusd.Request",
+	.tp_basicsize		= sizeof(python_request_t),
+	.tp_dealloc		= (destructor) PyObject_Del,
+	.tp_flags		= Py_TPFLAGS_DEFAULT,
+	.tp_doc			= "The request being processed",
+	.tp_getset		= python_request_getset
+};
+
+static rlm_rcode_t do_python_single(REQUEST *request, PyObject *pFunc, char const *funcname, bool pass_request)
+{
+	vp_cursor_t	cursor;
+	VALUE_PAIR      *vp;
+	PyObject	*pRet = NULL;
+	PyObject	*pArgs = NULL;
+	int		tuplelen;
+	int		ret;
+
+	/* Default return value is "OK, continue" */
+	ret = RLM_MODULE_OK;
+
+	/*
+	 *	We will pass a tuple containing (name, value) tuples
+	 *	We can safely use the Python function to build up a
+	 *	tuple, since the tuple is not used elsewhere.
+	 *
+	 *	Determine the size of our tuple by walking through the packet.
+	 *	If request is NULL, pass None.
+	 */
+	tuplelen = 0;
+	if (request && pass_request) {
+		python_request_t *pRequest;
+
+		pRequest = PyObject_New(python_request_t, &python_request_type);
+		if (!pRequest) {
+			ret = RLM_MODULE_FAIL;
+			goto finish;
+		}
+		pRequest->request = request;
+		pArgs = (PyObject *) pRequest;
+	} else if (request != NULL) {
+		for (vp = fr_cursor_init(&cursor, &request->packet->vps);
+		     vp;
+		     vp = fr_cursor_next(&cursor)) tuplelen++;
+	}
+
+	if (pArgs) {
+		/* Already have a request object */
+	} else if (tuplelen == 0) {
+		Py_INCREF(Py_None);
+		pArgs = Py_None;
+	} else {
+		int i = 0;
+		if ((pArgs = PyTuple_New(tuplelen)) == NULL) {
+			ret = RLM_MODULE_FAIL;
+			goto finish;
+		}
+
+		for (vp = fr_cursor_init(&cursor, &request->packet->vps);
+		     vp;
+		     vp = fr_cursor_next(&cursor), i++) {
+			PyObject *pp;
+
+			/* The inside tuple has two only: */
+			if ((pp = PyTuple_New(2)) == NULL) {
+				ret = RLM_MODULE_FAIL;
+				goto finish;
+			}
+
+			if (mod_populate_vptuple(pp, vp) == 0) {
+				/* Put the tuple inside the container */
+				PyTuple_SET_ITEM(pArgs, i, pp);
+			} else {
+				Py_INCREF(Py_None);
+				PyTuple_SET_ITEM(pArgs, i, Py_None);
+				Py_DECREF(pp);
+			}
+		}
+	}
+
+	/* Call Python function. */
+	pRet = PyObject_CallFunctionObjArgs(pFunc, pArgs, NULL);
+	if (!pRet) {
+		ret = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	if (!request) {
+		// check return code at module instantiation time
+		if (PyInt_CheckExact(pRet)) ret = PyInt_AsLong(pRet);
+		goto finish;
+	}
+
+	/*
+	 *	The function returns either:
+	 *  1. (returnvalue, replyTuple, configTuple), where
+	 *   - returnvalue is one of the constants RLM_*
+	 *   - replyTuple and configTuple are tuples of string
+	 *      tuples of size 2
+	 *
+	 *  2. the function return value alone
+	 *
+	 *  3. None - default return value is set
+	 *
+	 * xxx This code is messy!
+	 */
+	if (PyTuple_CheckExact(pRet)) {
+		PyObject *pTupleInt;
+
+		if (PyTuple_GET_SIZE(pRet) != 3) {
+			ERROR("%s - Tuple must be (return, replyTuple, configTuple)", funcname);
+			ret = RLM_MODULE_FAIL;
+			goto finish;
+		}
+
+		pTupleInt = PyTuple_GET_ITEM(pRet, 0);
+		if (!PyInt_CheckExact(pTupleInt)) {
+			ERROR("%s - First tuple element not an integer", funcname);
+			ret = RLM_MODULE_FAIL;
+			goto finish;
+		}
+		/* Now have the return value */
+		ret = PyInt_AsLong(pTupleInt);
+		/* Reply item tuple */
+		mod_vptuple(request->reply, request, &request->reply->vps,
+			    PyTuple_GET_ITEM(pRet, 1), funcname, "reply");
+		/* Config item tuple */
+		mod_vptuple(request, request, &request->control,
+			    PyTuple_GET_ITEM(pRet, 2), funcname, "config");
+
+	} else if (PyInt_CheckExact(pRet)) {
+		/* Just an integer */
+		ret = PyInt_AsLong(pRet);
+
+	} else if (pRet == Py_None) {
+		/* returned 'None', return value defaults to "OK, continue." */
+		ret = RLM_MODULE_OK;
+	} else {
+		/* Not tuple or None */
+		ERROR("%s - Function did not return a tuple or None", funcname);
+		ret = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+
+finish:
+	/*
+	 *	The script may have kept a reference to the request
+	 *	object.  Make sure it can't be used after the request
+	 *	is freed.
+	 */
+	if (pArgs && PyObject_TypeCheck(pArgs, &python_request_type)) ((python_request_t *) pArgs)->request = NULL;
+
+	Py_XDECREF(pArgs);
+	Py_XDECREF(pRet);
+
+	return ret;
+}
+
+static void python_obj_destroy(PyObject **ob)
+{
+	if (*ob != NULL) {
+		Py_DECREF(*ob);
+		*ob = NULL;
+	}
+}
+
+static void python_function_destroy(python_func_def_t *def)
+{
+	python_obj_destroy(&def->function);
+	python_obj_destroy(&def->module);
+}
+
+/** Import a user module and load a function from it
+ *
+ */
+static int python_function_load(python_func_def_t *def)
+{
+	char const *funcname = "python_function_load";
+
+	if (def->module_name == NULL || def->function_name == NULL) return 0;
+
+	def->module = PyImport_ImportModule(def->module_name);
+	if (!def->module) {
+		ERROR("%s - Module '%s' not found", funcname, def->module_name);
+
+	error:
+		python_error_log();
+		ERROR("%s - Failed to import python function '%s.%s'",
+		      funcname, def->module_name, def->function_name);
+		Py_XDECREF(def->function);
+		def->function = NULL;
+		Py_XDECREF(def->module);
+		def->module = NULL;
+
+		return -1;
+	}
+
+	def->function = PyObject_GetAttrString(def->module, def->function_name);
+	if (!def->function) {
+		ERROR("%s - Function '%s.%s' is not found", funcname, def->module_name, def->function_name);
+		goto error;
+	}
+
+	if (!PyCallable_Check(def->function)) {
+		ERROR("%s - Function '%s.%s' is not callable", funcname, def->module_name, def->function_name);
+		goto error;
+	}
+
+	return 0;
+}
+
+/*
+ *	Parse a configuration section, and populate a dict.
+ *	This function is recursively called (allows to have nested dicts.)
+ */
+static void python_parse_config(CONF_SECTION *cs, int lvl, PyObject *dict)
+{
+	int		indent_section = (lvl + 1) * 4;
+	int		indent_item = (lvl + 2) * 4;
+	CONF_ITEM	*ci = NULL;
+
+	if (!cs || !dict) return;
+
+	DEBUG("%*s%s {", indent_section, " ", cf_section_name1(cs));
+
+	while ((ci = cf_item_find_next(cs, ci))) {
+		/*
+		 *  This is a section.
+		 *  Create a new dict, store it in current dict,
+		 *  Then recursively call python_parse_config with this section and the new dict.
+		 */
+		if (cf_item_is_section(ci)) {
+			CONF_SECTION *sub_cs = cf_item_to_section(ci);
+			char const *key = cf_section_name1(sub_cs); /* dict key */
+			PyObject *sub_dict, *pKey;
+
+			if (!key) continue;
+
+			pKey = PyString_FromString(key);
+			if (!pKey) continue;
+
+			if (PyDict_Contains(dict, pKey)) {
+				WARN("rlm_python: Ignoring duplicate config section '%s'", key);
+				continue;
+			}
+
+			if (!(sub_dict = PyDict_New())) {
+				WARN("rlm_python: Unable to create subdict for config section '%s'", key);
+			}
+
+			(void)PyDict_SetItem(dict, pKey, sub_dict);
+
+			python_parse_config(sub_cs, lvl + 1, sub_dict);
+		} else if (cf_item_is_pair(ci)) {
+			CONF_PAIR *cp = cf_item_to_pair(ci);
+			char const  *key = cf_pair_attr(cp); /* dict key */
+			char const  *value = cf_pair_value(cp); /* dict value */
+			PyObject *pKey, *pValue;
+
+			if (!key || !value) continue;
+
+			pKey = PyString_FromString(key);
+			pValue = PyString_FromString(value);
+			if (!pKey || !pValue) continue;
+
+			/*
+			 *  This is an item.
+			 *  Store item attr / value in current dict.
+			 */
+			if (PyDict_Contains(dict, pKey)) {
+				WARN("rlm_python: Ignoring duplicate config item '%s'", key);
+				continue;
+			}
+
+			(void)PyDict_SetItem(dict, pKey, pValue);
+
+			DEBUG("%*s%s = %s", indent_item, " ", key, value);
+		}
+	}
+
+	DEBUG("%*s}", indent_section, " ");
+}
+
+/** Copy the module and function names for a set of functions
+ *
+ */
+static void python_funcs_init(python_funcs_t *out, python_funcs_t const *in)
+{
+	memset(out, 0, sizeof(*out));
+
+#define PYTHON_FUNC_NAME(_x) \
+	out->_x.module_name = in->_x.module_name; \
+	out->_x.function_name = in->_x.function_name
+	PYTHON_FUNC_NAME(instantiate);
+	PYTHON_FUNC_NAME(authorize);
+	PYTHON_FUNC_NAME(authenticate);
+	PYTHON_FUNC_NAME(preacct);
+	PYTHON_FUNC_NAME(accounting);
+	PYTHON_FUNC_NAME(checksimul);
+	PYTHON_FUNC_NAME(pre_proxy);
+	PYTHON_FUNC_NAME(post_proxy);
+	PYTHON_FUNC_NAME(post_auth);
+#ifdef WITH_COA
+	PYTHON_FUNC_NAME(recv_coa);
+	PYTHON_FUNC_NAME(send_coa);
+#endif
+	PYTHON_FUNC_NAME(detach);
+#undef PYTHON_FUNC_NAME
+}
+
+/** Load a set of functions into the current interpreter
+ *
+ */
+static int python_funcs_load(python_funcs_t *funcs)
+{
+#define PYTHON_FUNC_LOAD(_x) if (python_function_load(&funcs->_x) < 0) return -1
+	PYTHON_FUNC_LOAD(instantiate);
+	PYTHON_FUNC_LOAD(authenticate);
+	PYTHON_FUNC_LOAD(authorize);
+	PYTHON_FUNC_LOAD(preacct);
+	PYTHON_FUNC_LOAD(accounting);
+	PYTHON_FUNC_LOAD(checksimul);
+	PYTHON_FUNC_LOAD(pre_proxy);
+	PYTHON_FUNC_LOAD(post_proxy);
+	PYTHON_FUNC_LOAD(post_auth);
+#ifdef WITH_COA
+	PYTHON_FUNC_LOAD(recv_coa);
+	PYTHON_FUNC_LOAD(send_coa);
+#endif
+	PYTHON_FUNC_LOAD(detach);
+#undef PYTHON_FUNC_LOAD
+
+	return 0;
+}
+
+/** Release a set of functions
+ *
+ */
+static void python_funcs_destroy(python_funcs_t *funcs)
+{
+#define PYTHON_FUNC_DESTROY(_x) python_function_destroy(&funcs->_x)
+	PYTHON_FUNC_DESTROY(instantiate);
+	PYTHON_FUNC_DESTROY(authorize);
+	PYTHON_FUNC_DESTROY(authenticate);
+	PYTHON_FUNC_DESTROY(preacct);
+	PYTHON_FUNC_DESTROY(accounting);
+	PYTHON_FUNC_DESTROY(checksimul);
+	PYTHON_FUNC_DESTROY(pre_proxy);
+	PYTHON_FUNC_DESTROY(post_proxy);
+	PYTHON_FUNC_DESTROY(post_auth);
+#ifdef WITH_COA
+	PYTHON_FUNC_DESTROY(recv_coa);
+	PYTHON_FUNC_DESTROY(send_coa);
+#endif
+	PYTHON_FUNC_DESTROY(detach);
+#undef PYTHON_FUNC_DESTROY
+}
+
+/** Set up the search path, and the radiusd module in the current interpreter
+ *
+ * Must be called with the GIL held, and a thread state for the
+ * interpreter swapped in.
+ *
+ * @param[in] inst	of rlm_python.
+ * @param[out] module	Where to write the radiusd module.
+ * @param[out] dict	Where to write radiusd.config.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with a python exception set.
+ */
+static int python_module_init(rlm_python_t *inst, PyObject **module, PyObject **dict)
+{
+	CONF_SECTION	*cs;
+	int		i;
+
+	/*
+	 *	Set the python search path
+	 */
+	if (inst->python_path) {
+#if PY_VERSION_HEX > 0x03050000
+		{
+			wchar_t *name;
+
+			path = Py_DecodeLocale(inst->python_path, strlen(inst->python_path));
+			PySys_SetPath(path);
+			PyMem_RawFree(path);
+		}
+#else
+		{
+			char *path;
+
+			path = talloc_strdup(NULL, inst->python_path);
+			PySys_SetPath(path);
+			talloc_free(path);
+		}
+#endif
+	}
+
+	/*
+	 *	Initialise a new module, with our default methods
+	 */
+	*module = Py_InitModule3("radiusd", module_methods, "FreeRADIUS python module");
+	if (!*module) return -1;
+
+	/*
+	 *	Py_InitModule3 returns a borrowed ref, the actual
+	 *	module is owned by sys.modules, so we also need
+	 *	to own the module to prevent it being freed early.
+	 */
+	Py_IncRef(*module);
+
+	for (i = 0; radiusd_constants[i].name; i++) {
+		if ((PyModule_AddIntConstant(*module, radiusd_constants[i].name,
+					     radiusd_constants[i].value)) < 0) return -1;
+	}
+
+	/*
+	 *	The types are static, so they're shared by all
+	 *	interpreters.  PyType_Ready() does nothing after
+	 *	the first call.
+	 */
+	if ((PyType_Ready(&python_request_type) < 0) || (PyType_Ready(&python_pair_list_type) < 0)) return -1;
+
+	Py_INCREF(&python_request_type);
+	if (PyModule_AddObject(*module, "Request", (PyObject *) &python_request_type) < 0) return -1;
+
+	Py_INCREF(&python_pair_list_type);
+	if (PyModule_AddObject(*module, "PairList", (PyObject *) &python_pair_list_type) < 0) return -1;
+
+	/*
+	 *	Convert a FreeRADIUS config structure into a python
+	 *	dictionary.
+	 */
+	*dict = PyDict_New();
+	if (!*dict) {
+		ERROR("Unable to create python dict for config");
+		return -1;
+	}
+
+	/*
+	 *	Add module configuration as a dict
+	 */
+	if (PyModule_AddObject(*module, "config", *dict) < 0) return -1;
+
+	cs = cf_section_sub_find(inst->cs, "config");
+	if (cs) python_parse_config(cs, 0, *dict);
+
+	return 0;
+}
+
+/** Create an interpreter for the current thread
+ *
+ * The radiusd module and the user's functions are loaded into it, and
+ * the instantiate function is called, so each interpreter starts in the
+ * same state as the module instance's.
+ *
+ * Must be called without the GIL held.
+ */
+static int python_thread_interpreter_init(rlm_python_t *inst, python_thread_state_t *this_thread)
+{
+	rlm_rcode_t code;
+
+	PyEval_AcquireLock();
+
+	this_thread->state = Py_NewInterpreter();
+	if (!this_thread->state) {
+		PyEval_ReleaseLock();
+		ERROR("Failed creating interpreter for thread");
+		return -1;
+	}
+	this_thread->interpreter = true;
+
+	python_funcs_init(&this_thread->funcs, &inst->funcs);
+
+	if ((python_module_init(inst, &this_thread->module, &this_thread->pythonconf_dict) < 0) ||
+	    (python_funcs_load(&this_thread->funcs) < 0)) {
+	error:
+		python_error_log();
+		PyEval_SaveThread();
+		return -1;
+	}
+
+	code = do_python_single(NULL, this_thread->funcs.instantiate.function, "instantiate", false);
+	if ((code == RLM_MODULE_FAIL) || (code == RLM_MODULE_REJECT)) goto error;
+
+	PyEval_SaveThread();
+
+	return 0;
+}
+
+static void python_interpreter_free(PyThreadState *interp)
+{
+	PyEval_AcquireLock();
+	PyThreadState_Swap(interp);
+	Py_EndInterpreter(interp);
+	PyEval_ReleaseLock();
+}
+
+/** Destroy a thread state
+ *
+ * @param thread to destroy.
+ * @return 0
+ */
+static int _python_thread_free(python_thread_state_t *thread)
+{
+	if (!thread->state) return 0;
+
+	/*
+	 *	Tear down the interpreter we created for this thread.
+	 */
+	if (thread->interpreter) {
+		PyEval_RestoreThread(thread->state);
+
+		(void) do_python_single(NULL, thread->funcs.detach.function, "detach", false);
+		python_funcs_destroy(&thread->funcs);
+		Py_XDECREF(thread->module);
+
+		Py_EndInterpreter(thread->state);
+		PyEval_ReleaseLock();
+
+		return 0;
+	}
+
+	PyEval_RestoreThread(thread->state);	/* Swap in our local thread state */
+	PyThreadState_Clear(thread->state);
+	PyEval_SaveThread();
+
+	PyThreadState_Delete(thread->state);	/* Don't need to hold lock for this */
+
+	return 0;
+}
+
+/** Callback for rbtree delete walker
+ *
+ */
+static void _python_thread_entry_free(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Cleanup any thread local storage on pthread_exit()
+ *
+ * @param arg The thread currently exiting.
+ */
+static void _python_thread_tree_free(void *arg)
+{
+	rad_assert(arg == local_thread_state);
+
+	rbtree_t *tree = talloc_get_type_abort(arg, rbtree_t);
+	rbtree_free(tree);	/* Needs to be this not talloc_free to execute delete walker */
+
+	local_thread_state = NULL;	/* Prevent double free in unittest env */
+}
+
+/** Compare instance pointers
+ *
+ */
+static int _python_inst_cmp(const void *a, const void *b)
+{
+	python_thread_state_t const *a_p = a, *b_p = b;
+
+	if (a_p->inst < b_p->inst) return -1;
+	if (a_p->inst > b_p->inst) return +1;
 	return 0;
 }
 
@@ -617,17 +1565,19 @@ static int _python_inst_cmp(const void *a, const void *b)
  *
  * Will swap in thread state specific to module/thread.
  */
-static rlm_rcode_t do_python(rlm_python_t *inst, REQUEST *request, PyObject *pFunc, char const *funcname)
+static rlm_rcode_t do_python(rlm_python_t *inst, REQUEST *request, size_t offset, char const *funcname)
 {
 	int			ret;
 	rbtree_t		*thread_tree;
 	python_thread_state_t	*this_thread;
 	python_thread_state_t	find;
+	python_func_def_t	*def;
 
 	/*
 	 *	It's a NOOP if the function wasn't defined
 	 */
-	if (!pFunc) return RLM_MODULE_NOOP;
+	def = (python_func_def_t *)(((uint8_t *) &inst->funcs) + offset);
+	if (!def->function) return RLM_MODULE_NOOP;
 
 	/*
 	 *	Check to see if we've got a thread state tree
@@ -657,19 +1607,32 @@ static rlm_rcode_t do_python(rlm_python_t *inst, REQUEST *request, PyObject *pFu
 	if (!this_thread) {
 		PyThreadState *state;
 
-		state = PyThreadState_New(inst->sub_interpreter->interp);
-
-		RDEBUG3("Initialised new thread state %p", state);
-		if (!state) {
-			REDEBUG("Failed initialising local PyThreadState on first run");
+		this_thread = talloc_zero(NULL, python_thread_state_t);
+		if (!this_thread) {
+			REDEBUG("Failed allocating thread state");
 			return RLM_MODULE_FAIL;
 		}
-
-		this_thread = talloc(NULL, python_thread_state_t);
 		this_thread->inst = inst;
-		this_thread->state = state;
 		talloc_set_destructor(this_thread, _python_thread_free);
 
+		if (inst->thread_interpreters) {
+			if (python_thread_interpreter_init(inst, this_thread) < 0) {
+				REDEBUG("Failed initialising interpreter for thread");
+				talloc_free(this_thread);
+				return RLM_MODULE_FAIL;
+			}
+			state = this_thread->state;
+		} else {
+			state = PyThreadState_New(inst->sub_interpreter->interp);
+			if (!state) {
+				REDEBUG("Failed initialising local PyThreadState on first run");
+				talloc_free(this_thread);
+				return RLM_MODULE_FAIL;
+			}
+			this_thread->state = state;
+		}
+		RDEBUG3("Initialised new thread state %p", state);
+
 		if (!rbtree_insert(thread_tree, this_thread)) {
 			RERROR("Failed inserting thread state into TLS tree");
 			talloc_free(this_thread);
@@ -679,8 +1642,13 @@ static rlm_rcode_t do_python(rlm_python_t *inst, REQUEST *request, PyObject *pFu
 	}
 	RDEBUG3("Using thread state %p", this_thread->state);
 
+	/*
+	 *	Use the function loaded into this thread's interpreter.
+	 */
+	if (this_thread->interpreter) def = (python_func_def_t *)(((uint8_t *) &this_thread->funcs) + offset);
+
 	PyEval_RestoreThread(this_thread->state);	/* Swap in our local thread state */
-	ret = do_python_single(request, pFunc, funcname);
+	ret = do_python_single(request, def->function, funcname, inst->pass_request);
 	PyEval_SaveThread();
 
 	return ret;
@@ -688,7 +1656,7 @@ static rlm_rcode_t do_python(rlm_python_t *inst, REQUEST *request, PyObject *pFu
 
 #define MOD_FUNC(x) \
 static rlm_rcode_t CC_HINT(nonnull) mod_##x(void *instance, REQUEST *request) { \
-	return do_python((rlm_python_t *) instance, request, ((rlm_python_t *)instance)->x.function, #x);\
+	return do_python((rlm_python_t *) instance, request, offsetof(python_funcs_t, x), #x);\
 }
 
 MOD_FUNC(authenticate)
@@ -703,138 +1671,11 @@ MOD_FUNC(post_auth)
 MOD_FUNC(recv_coa)
 MOD_FUNC(send_coa)
 #endif
-static void python_obj_destroy(PyObject **ob)
-{
-	if (*ob != NULL) {
-		Py_DECREF(*ob);
-		*ob = NULL;
-	}
-}
-
-static void python_function_destroy(python_func_def_t *def)
-{
-	python_obj_destroy(&def->function);
-	python_obj_destroy(&def->module);
-}
-
-/** Import a user module and load a function from it
- *
- */
-static int python_function_load(python_func_def_t *def)
-{
-	char const *funcname = "python_function_load";
-
-	if (def->module_name == NULL || def->function_name == NULL) return 0;
-
-	def->module = PyImport_ImportModule(def->module_name);
-	if (!def->module) {
-		ERROR("%s - Module '%s' not found", funcname, def->module_name);
-
-	error:
-		python_error_log();
-		ERROR("%s - Failed to import python function '%s.%s'",
-		      funcname, def->module_name, def->function_name);
-		Py_XDECREF(def->function);
-		def->function = NULL;
-		Py_XDECREF(def->module);
-		def->module = NULL;
-
-		return -1;
-	}
-
-	def->function = PyObject_GetAttrString(def->module, def->function_name);
-	if (!def->function) {
-		ERROR("%s - Function '%s.%s' is not found", funcname, def->module_name, def->function_name);
-		goto error;
-	}
-
-	if (!PyCallable_Check(def->function)) {
-		ERROR("%s - Function '%s.%s' is not callable", funcname, def->module_name, def->function_name);
-		goto error;
-	}
-
-	return 0;
-}
-
-/*
- *	Parse a configuration section, and populate a dict.
- *	This function is recursively called (allows to have nested dicts.)
- */
-static void python_parse_config(CONF_SECTION *cs, int lvl, PyObject *dict)
-{
-	int		indent_section = (lvl + 1) * 4;
-	int		indent_item = (lvl + 2) * 4;
-	CONF_ITEM	*ci = NULL;
-
-	if (!cs || !dict) return;
-
-	DEBUG("%*s%s {", indent_section, " ", cf_section_name1(cs));
-
-	while ((ci = cf_item_find_next(cs, ci))) {
-		/*
-		 *  This is a section.
-		 *  Create a new dict, store it in current dict,
-		 *  Then recursively call python_parse_config with this section and the new dict.
-		 */
-		if (cf_item_is_section(ci)) {
-			CONF_SECTION *sub_cs = cf_item_to_section(ci);
-			char const *key = cf_section_name1(sub_cs); /* dict key */
-			PyObject *sub_dict, *pKey;
-
-			if (!key) continue;
-
-			pKey = PyString_FromString(key);
-			if (!pKey) continue;
-
-			if (PyDict_Contains(dict, pKey)) {
-				WARN("rlm_python: Ignoring duplicate config section '%s'", key);
-				continue;
-			}
-
-			if (!(sub_dict = PyDict_New())) {
-				WARN("rlm_python: Unable to create subdict for config section '%s'", key);
-			}
-
-			(void)PyDict_SetItem(dict, pKey, sub_dict);
-
-			python_parse_config(sub_cs, lvl + 1, sub_dict);
-		} else if (cf_item_is_pair(ci)) {
-			CONF_PAIR *cp = cf_item_to_pair(ci);
-			char const  *key = cf_pair_attr(cp); /* dict key */
-			char const  *value = cf_pair_value(cp); /* dict value */
-			PyObject *pKey, *pValue;
-
-			if (!key || !value) continue;
-
-			pKey = PyString_FromString(key);
-			pValue = PyString_FromString(value);
-			if (!pKey || !pValue) continue;
-
-			/*
-			 *  This is an item.
-			 *  Store item attr / value in current dict.
-			 */
-			if (PyDict_Contains(dict, pKey)) {
-				WARN("rlm_python: Ignoring duplicate config item '%s'", key);
-				continue;
-			}
-
-			(void)PyDict_SetItem(dict, pKey, pValue);
-
-			DEBUG("%*s%s = %s", indent_item, " ", key, value);
-		}
-	}
-
-	DEBUG("%*s}", indent_section, " ");
-}
-
 /** Initialises a separate python interpreter for this module instance
  *
  */
-static int python_interpreter_init(rlm_python_t *inst, CONF_SECTION *conf)
+static int python_interpreter_init(rlm_python_t *inst)
 {
-	int i;
-
 	/*
 	 *	Explicitly load libpython, so symbols will be available to lib-dynload modules
 	 */
@@ -891,75 +1732,13 @@ static int python_interpreter_init(rlm_python_t *inst, CONF_SECTION *conf)
 	 *	with Python C extensions if they use GIL lock functions.
 	 */
 	if (!inst->cext_compat || !main_module) {
-		CONF_SECTION *cs;
-
-		/*
-		 *	Set the python search path
-		 */
-		if (inst->python_path) {
-#if PY_VERSION_HEX > 0x03050000
-			{
-				wchar_t *name;
-
-				path = Py_DecodeLocale(inst->python_path, strlen(inst->python_path));
-				PySys_SetPath(path);
-				PyMem_RawFree(path);
-			}
-#else
-			{
-				char *path;
-
-				path = talloc_strdup(NULL, inst->python_path);
-				PySys_SetPath(path);
-				talloc_free(path);
-			}
-#endif
-		}
-
-		/*
-		 *	Initialise a new module, with our default methods
-		 */
-		inst->module = Py_InitModule3("radiusd", module_methods, "FreeRADIUS python module");
-		if (!inst->module) {
-		error:
+		if (python_module_init(inst, &inst->module, &inst->pythonconf_dict) < 0) {
 			python_error_log();
 			PyEval_SaveThread();
 			return -1;
 		}
 
-		/*
-		 *	Py_InitModule3 returns a borrowed ref, the actual
-		 *	module is owned by sys.modules, so we also need
-		 *	to own the module to prevent it being freed early.
-		 */
-		Py_IncRef(inst->module);
-
 		if (inst->cext_compat) main_module = inst->module;
-
-		for (i = 0; radiusd_constants[i].name; i++) {
-			if ((PyModule_AddIntConstant(inst->module, radiusd_constants[i].name,
-						     radiusd_constants[i].value)) < 0)
-				goto error;
-		}
-
-		/*
-		 *	Convert a FreeRADIUS config structure into a python
-		 *	dictionary.
-		 */
-		inst->pythonconf_dict = PyDict_New();
-		if (!inst->pythonconf_dict) {
-			ERROR("Unable to create python dict for config");
-			python_error_log();
-			return -1;
-		}
-
-		/*
-		 *	Add module configuration as a dict
-		 */
-		if (PyModule_AddObject(inst->module, "config", inst->pythonconf_dict) < 0) goto error;
-
-		cs = cf_section_sub_find(conf, "config");
-		if (cs) python_parse_config(cs, 0, inst->pythonconf_dict);
 	} else {
 		inst->module = main_module;
 		Py_IncRef(inst->module);
@@ -986,15 +1765,25 @@ static int python_interpreter_init(rlm_python_t *inst, CONF_SECTION *conf)
 static int mod_instantiate(CONF_SECTION *conf, void *instance)
 {
 	rlm_python_t	*inst = instance;
-	int		code = 0;
+	rlm_rcode_t	code;
 
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
+	inst->cs = conf;
+
+	/*
+	 *	Threads sharing the main interpreter is the whole
+	 *	point of cext_compat.
+	 */
+	if (inst->thread_interpreters && inst->cext_compat) {
+		cf_log_err_cs(conf, "'thread_interpreters' and 'cext_compat' cannot both be enabled");
+		return -1;
+	}
 
 	/*
 	 *	Load the python code required for this module instance
 	 */
-	if (python_interpreter_init(inst, conf) < 0) return -1;
+	if (python_interpreter_init(inst) < 0) return -1;
 
 	/*
 	 *	Switch to our module specific main thread
@@ -1004,27 +1793,13 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	/*
 	 *	Process the various sections
 	 */
-#define PYTHON_FUNC_LOAD(_x) if (python_function_load(&inst->_x) < 0) goto error
-	PYTHON_FUNC_LOAD(instantiate);
-	PYTHON_FUNC_LOAD(authenticate);
-	PYTHON_FUNC_LOAD(authorize);
-	PYTHON_FUNC_LOAD(preacct);
-	PYTHON_FUNC_LOAD(accounting);
-	PYTHON_FUNC_LOAD(checksimul);
-	PYTHON_FUNC_LOAD(pre_proxy);
-	PYTHON_FUNC_LOAD(post_proxy);
-	PYTHON_FUNC_LOAD(post_auth);
-#ifdef WITH_COA
-	PYTHON_FUNC_LOAD(recv_coa);
-	PYTHON_FUNC_LOAD(send_coa);
-#endif
-	PYTHON_FUNC_LOAD(detach);
+	if (python_funcs_load(&inst->funcs) < 0) goto error;
 
 	/*
 	 *	Call the instantiate function.
 	 */
-	code = do_python_single(NULL, inst->instantiate.function, "instantiate");
-	if (code < 0) {
+	code = do_python_single(NULL, inst->funcs.instantiate.function, "instantiate", false);
+	if ((code == RLM_MODULE_FAIL) || (code == RLM_MODULE_REJECT)) {
 	error:
 		python_error_log();	/* Needs valid thread with GIL */
 		PyEval_SaveThread();
@@ -1045,16 +1820,9 @@ static int mod_detach(void *instance)
 	 */
 	PyEval_RestoreThread(inst->sub_interpreter);
 
-	ret = do_python_single(NULL, inst->detach.function, "detach");
+	ret = do_python_single(NULL, inst->funcs.detach.function, "detach", false);
 
-#define PYTHON_FUNC_DESTROY(_x) python_function_destroy(&inst->_x)
-	PYTHON_FUNC_DESTROY(instantiate);
-	PYTHON_FUNC_DESTROY(authorize);
-	PYTHON_FUNC_DESTROY(authenticate);
-	PYTHON_FUNC_DESTROY(preacct);
-	PYTHON_FUNC_DESTROY(accounting);
-	PYTHON_FUNC_DESTROY(checksimul);
-	PYTHON_FUNC_DESTROY(detach);
+	python_funcs_destroy(&inst->funcs);
 
 	Py_DecRef(inst->pythonconf_dict);
 	Py_DecRef(inst->module);
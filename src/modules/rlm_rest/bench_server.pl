@@ -0,0 +1,101 @@
+#!/usr/bin/perl
+#
+#  Stand-in REST server for throughput testing rlm_rest.
+#
+#  Answers every GET or POST with a small JSON body, after an
+#  artificial delay, to look like a policy API.  Each connection
+#  is handled by its own process, and connections are kept alive,
+#  so the number of connections rlm_rest opens can be observed.
+#
+#  Usage: bench_server.pl [-p <port>] [-d <delay ms>] [-c <max connections>]
+#
+use strict;
+use warnings;
+
+use Getopt::Std;
+use HTTP::Daemon;
+use HTTP::Response;
+use HTTP::Status;
+use POSIX ":sys_wait_h";
+use Time::HiRes qw(usleep);
+
+my %opts;
+getopts('p:d:c:h', \%opts) or usage();
+usage() if $opts{'h'};
+
+my $port = $opts{'p'} // 9090;
+my $delay = $opts{'d'} // 50;
+my $max_conns = $opts{'c'} // 256;
+
+my $children = 0;
+
+sub usage {
+	print STDERR "Usage: bench_server.pl [-p <port>] [-d <delay ms>] [-c <max connections>]\n";
+	exit(1);
+}
+
+sub reap {
+	while (waitpid(-1, WNOHANG) > 0) {
+		$children--;
+	}
+}
+
+$SIG{'CHLD'} = \&reap;
+$SIG{'PIPE'} = 'IGNORE';
+
+my $daemon = HTTP::Daemon->new(ReuseAddr => 1, LocalAddr => '127.0.0.1', LocalPort => $port, Listen => 128);
+if (!defined $daemon) {
+	die "Error opening socket: $!";
+}
+
+print "Listening on ", $daemon->url, ", responding after ${delay}ms\n";
+
+for (;;) {
+	my $client = $daemon->accept;
+	next unless defined $client;	# Interrupted by SIGCHLD
+
+	if ($children >= $max_conns) {
+		$client->send_error(RC_SERVICE_UNAVAILABLE);
+		$client->close();
+		next;
+	}
+
+	my $pid = fork();
+	if (!defined $pid) {
+		warn "fork failed: $!";
+		$client->close();
+		next;
+	}
+
+	if ($pid) {
+		$children++;
+		$client->close();
+		next;
+	}
+
+	#
+	#  Child, answer requests until the client closes the connection.
+	#
+	$daemon->close();
+	my $requests = 0;
+
+	while (my $r = $client->get_request) {
+		usleep($delay * 1000) if $delay;
+
+		if (($r->method eq 'POST') or ($r->method eq 'GET')) {
+			my $resp = HTTP::Response->new('200', 'OK');
+
+			$resp->header('Content-Type' => 'application/json');
+			$resp->content("{\"reply:Reply-Message\":\"Hello from bench_server.pl\"}");
+
+			$client->send_response($resp);
+		} else {
+			$client->send_error(RC_FORBIDDEN);
+		}
+		$requests++;
+	}
+
+	print "Connection closed after $requests requests\n";
+	$client->close();
+	exit(0);
+}
@@ -39,6 +39,10 @@ RCSID("$Id$")
 
 #include "rest.h"
 
+#ifdef REST_MULTI
+#  include <pthread.h>
+#endif
+
 /** Table of encoder/decoder support.
  *
  * Indexes in this table match the http_body_type_t enum, and should be
@@ -301,6 +305,319 @@ void rest_cleanup(void)
 }
 
 
+#ifdef REST_MULTI
+/** A transfer handed off to the multi handle
+ *
+ * Lives on the stack of the worker thread waiting for it to complete.
+ */
+typedef struct rest_multi_transfer {
+	CURL				*candle;	//!< Easy handle, configured by rest_request_config.
+	REQUEST				*request;	//!< Request the transfer is being made for.
+	CURLcode			result;		//!< Result of the transfer.
+	bool				done;		//!< Transfer has completed, result is valid.
+	pthread_cond_t			cond;		//!< Signalled when the transfer completes.
+	struct rest_multi_transfer	*next;		//!< Next transfer in the queue.
+} rest_multi_transfer_t;
+
+/** A multi handle shared between all the connection handles of an instance
+ *
+ * The easy handles in the connection pool no longer hold their own connections.
+ * Transfers are added to the multi handle, which caches connections, keeps them
+ * alive between requests, and multiplexes transfers over HTTP/2 connections where
+ * the server supports it.
+ *
+ * The multi handle is driven by a single thread.  Worker threads queue their
+ * transfers, wake the thread, then wait to be signalled when the transfer completes.
+ */
+struct rest_multi {
+	rlm_rest_t const	*inst;		//!< Instance we belong to.
+	CURLM			*mandle;	//!< The multi handle.
+	pthread_t		thread;		//!< Thread driving the multi handle.
+	pthread_mutex_t		mutex;		//!< Protects the queue, and the completion of transfers.
+	rest_multi_transfer_t	*queue;		//!< Transfers waiting to be added to the multi handle.
+	rest_multi_transfer_t	**queue_tail;	//!< Where to add the next transfer.
+	int			wake[2];	//!< Pipe used to wake the thread.
+	bool			stop;		//!< Tell the thread to exit.
+};
+
+/** Wake the thread driving the multi handle
+ *
+ */
+static void rest_multi_wake(rest_multi_t *multi)
+{
+	ssize_t ret;
+
+	/*
+	 *	If the pipe is full the thread is going to wake anyway.
+	 */
+	ret = write(multi->wake[1], "w", 1);
+	if ((ret < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+		rlm_rest_t const *inst = multi->inst;
+
+		ERROR("Failed waking multi handle thread: %s", fr_syserror(errno));
+	}
+}
+
+/** Signal the worker waiting for a transfer that it has completed
+ *
+ */
+static void rest_multi_done(rest_multi_t *multi, rest_multi_transfer_t *transfer, CURLcode result)
+{
+	pthread_mutex_lock(&multi->mutex);
+	transfer->result = result;
+	transfer->done = true;
+	pthread_cond_signal(&transfer->cond);
+	pthread_mutex_unlock(&multi->mutex);
+}
+
+/** Drive the multi handle, adding queued transfers, and reaping completed ones
+ *
+ */
+static void *rest_multi_thread(void *arg)
+{
+	rest_multi_t		*multi = arg;
+	rlm_rest_t const	*inst = multi->inst;
+	rest_multi_transfer_t	*queue, *transfer;
+
+	for (;;) {
+		struct curl_waitfd	wake;
+		CURLMsg			*msg;
+		CURLMcode		mret;
+		int			running, left, numfds;
+		char			buffer[64];
+
+		pthread_mutex_lock(&multi->mutex);
+		if (multi->stop) {
+			pthread_mutex_unlock(&multi->mutex);
+			break;
+		}
+		queue = multi->queue;
+		multi->queue = NULL;
+		multi->queue_tail = &multi->queue;
+		pthread_mutex_unlock(&multi->mutex);
+
+		/*
+		 *	The worker may free the transfer as soon as
+		 *	it's signalled, so get the next one first.
+		 */
+		while ((transfer = queue)) {
+			queue = transfer->next;
+
+			mret = curl_multi_add_handle(multi->mandle, transfer->candle);
+			if (mret != CURLM_OK) {
+				ERROR("Failed adding transfer to multi handle: %s", curl_multi_strerror(mret));
+				rest_multi_done(multi, transfer, CURLE_FAILED_INIT);
+			}
+		}
+
+		mret = curl_multi_perform(multi->mandle, &running);
+		if (mret != CURLM_OK) ERROR("Failed performing transfers: %s", curl_multi_strerror(mret));
+
+		while ((msg = curl_multi_info_read(multi->mandle, &left))) {
+			CURL		*candle = msg->easy_handle;
+			CURLcode	result = msg->data.result;
+			char		*priv;
+
+			if (msg->msg != CURLMSG_DONE) continue;
+
+			/*
+			 *	msg is invalid once the handle is removed
+			 */
+			curl_easy_getinfo(candle, CURLINFO_PRIVATE, &priv);
+			curl_multi_remove_handle(multi->mandle, candle);
+
+			rest_multi_done(multi, (rest_multi_transfer_t *) priv, result);
+		}
+
+		/*
+		 *	Sleep until there's activity on one of the
+		 *	transfers, a timer expires, or we're woken up.
+		 */
+		wake.fd = multi->wake[0];
+		wake.events = CURL_WAIT_POLLIN;
+		wake.revents = 0;
+
+		mret = curl_multi_wait(multi->mandle, &wake, 1, 1000, &numfds);
+		if (mret != CURLM_OK) ERROR("Failed waiting for transfers: %s", curl_multi_strerror(mret));
+
+		if (wake.revents) while (read(multi->wake[0], buffer, sizeof(buffer)) > 0);
+	}
+
+	/*
+	 *	Fail anything that was queued as we were stopping.
+	 */
+	pthread_mutex_lock(&multi->mutex);
+	queue = multi->queue;
+	multi->queue = NULL;
+	multi->queue_tail = &multi->queue;
+	pthread_mutex_unlock(&multi->mutex);
+
+	while ((transfer = queue)) {
+		queue = transfer->next;
+		rest_multi_done(multi, transfer, CURLE_ABORTED_BY_CALLBACK);
+	}
+
+	return NULL;
+}
+
+/** Hand a transfer off to the multi handle, and wait for it to complete
+ *
+ */
+static CURLcode rest_multi_perform(rest_multi_t *multi, REQUEST *request, CURL *candle)
+{
+	rest_multi_transfer_t	transfer;
+	CURLcode		ret;
+
+	memset(&transfer, 0, sizeof(transfer));
+	transfer.candle = candle;
+	transfer.request = request;
+
+	ret = curl_easy_setopt(candle, CURLOPT_PRIVATE, &transfer);
+	if (ret != CURLE_OK) return ret;
+
+	pthread_cond_init(&transfer.cond, NULL);
+
+	pthread_mutex_lock(&multi->mutex);
+	if (multi->stop) {
+		pthread_mutex_unlock(&multi->mutex);
+		pthread_cond_destroy(&transfer.cond);
+
+		return CURLE_ABORTED_BY_CALLBACK;
+	}
+	*multi->queue_tail = &transfer;
+	multi->queue_tail = &transfer.next;
+	pthread_mutex_unlock(&multi->mutex);
+
+	rest_multi_wake(multi);
+
+	pthread_mutex_lock(&multi->mutex);
+	while (!transfer.done) pthread_cond_wait(&transfer.cond, &multi->mutex);
+	pthread_mutex_unlock(&multi->mutex);
+
+	pthread_cond_destroy(&transfer.cond);
+
+	return transfer.result;
+}
+#endif
+
+/** Start the multi handle shared by the connection handles of an instance
+ *
+ * Does nothing unless multi is enabled.
+ *
+ * @see rest_multi_stop
+ *
+ * @param[in] inst configuration data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rest_multi_start(rlm_rest_t *inst)
+{
+#ifndef REST_MULTI
+	if (!inst->multi) return 0;
+
+	ERROR("multi requires threading support, and libcurl >= 7.28.0");
+	return -1;
+#else
+	rest_multi_t	*multi;
+	CURLMcode	mret;
+	int		rcode;
+
+	if (!inst->multi) return 0;
+
+	multi = talloc_zero(NULL, rest_multi_t);
+	if (!multi) return -1;
+
+	multi->inst = inst;
+	multi->queue_tail = &multi->queue;
+	multi->wake[0] = multi->wake[1] = -1;
+
+	multi->mandle = curl_multi_init();
+	if (!multi->mandle) {
+		ERROR("Failed creating multi handle");
+	error:
+		if (multi->mandle) curl_multi_cleanup(multi->mandle);
+		if (multi->wake[0] >= 0) close(multi->wake[0]);
+		if (multi->wake[1] >= 0) close(multi->wake[1]);
+		talloc_free(multi);
+		return -1;
+	}
+
+#ifdef CURLPIPE_MULTIPLEX
+	mret = curl_multi_setopt(multi->mandle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	if (mret != CURLM_OK) WARN("Failed enabling HTTP/2 multiplexing: %s", curl_multi_strerror(mret));
+#endif
+
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	if (inst->max_host_connections) {
+		mret = curl_multi_setopt(multi->mandle, CURLMOPT_MAX_HOST_CONNECTIONS,
+					 (long) inst->max_host_connections);
+		if (mret != CURLM_OK) {
+			ERROR("Failed setting max_host_connections: %s", curl_multi_strerror(mret));
+			goto error;
+		}
+	}
+#else
+	if (inst->max_host_connections) WARN("max_host_connections requires libcurl >= 7.30.0, ignoring");
+#endif
+
+	if (pipe(multi->wake) < 0) {
+		ERROR("Failed creating wake pipe: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if ((fr_nonblock(multi->wake[0]) < 0) || (fr_nonblock(multi->wake[1]) < 0)) {
+		ERROR("Failed setting wake pipe to non-blocking: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	pthread_mutex_init(&multi->mutex, NULL);
+
+	rcode = pthread_create(&multi->thread, NULL, rest_multi_thread, multi);
+	if (rcode != 0) {
+		ERROR("Failed creating multi handle thread: %s", fr_syserror(rcode));
+		pthread_mutex_destroy(&multi->mutex);
+		goto error;
+	}
+
+	inst->engine = multi;
+
+	return 0;
+#endif
+}
+
+/** Stop the multi handle shared by the connection handles of an instance
+ *
+ * Must only be called once all the connection handles have been freed.
+ *
+ * @see rest_multi_start
+ *
+ * @param[in] inst configuration data.
+ */
+void rest_multi_stop(rlm_rest_t *inst)
+{
+#ifdef REST_MULTI
+	rest_multi_t *multi = inst->engine;
+
+	if (!multi) return;
+
+	pthread_mutex_lock(&multi->mutex);
+	multi->stop = true;
+	pthread_mutex_unlock(&multi->mutex);
+
+	rest_multi_wake(multi);
+	pthread_join(multi->thread, NULL);
+
+	pthread_mutex_destroy(&multi->mutex);
+	curl_multi_cleanup(multi->mandle);
+	close(multi->wake[0]);
+	close(multi->wake[1]);
+	talloc_free(multi);
+
+	inst->engine = NULL;
+#endif
+}
+
 /** Frees a libcurl handle, and any additional memory used by context data.
  *
  * @param[in] randle rlm_rest_handle_t to close and free.
@@ -351,7 +668,13 @@ void *mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *tim
 
 	SET_OPTION(CURLOPT_CONNECTTIMEOUT_MS, FR_TIMEVAL_TO_MS(timeout));
 
-	if (inst->connect_uri) {
+	/*
+	 *  Connections are cached by the multi handle, not by this
+	 *  handle, so there's no point connecting in advance.
+	 */
+	if (inst->multi) {
+		DEBUG2("Skipping pre-connect, connections are cached by the multi handle");
+	} else if (inst->connect_uri) {
 		/*
 		 *  re-establish TCP connection to webserver. This would usually be
 		 *  done on the first request, but we do it here to minimise
@@ -432,6 +755,12 @@ int mod_conn_alive(void *instance, void *handle)
 	long last_socket;
 	CURLcode ret;
 
+	/*
+	 *  The handle doesn't own a socket, the multi handle
+	 *  deals with dead connections.
+	 */
+	if (inst->multi) return true;
+
 	ret = curl_easy_getinfo(candle, CURLINFO_LASTSOCKET, &last_socket);
 	if (ret != CURLE_OK) {
 		ERROR("Couldn't determine socket state: %i - %s", ret, curl_easy_strerror(ret));
@@ -2021,6 +2350,17 @@ int rest_request_config(rlm_rest_t const *instance, rlm_rest_section_t *section,
 	SET_OPTION(CURLOPT_NOSIGNAL, 1);
 	SET_OPTION(CURLOPT_USERAGENT, "FreeRADIUS " RADIUSD_VERSION_STRING);
 
+#if defined(REST_MULTI) && (LIBCURL_VERSION_NUM >= 0x072f00)
+	/*
+	 *	Negotiate HTTP/2 for HTTPS, and wait for a connection
+	 *	we can multiplex over, instead of opening a new one.
+	 */
+	if (instance->engine) {
+		SET_OPTION(CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+		SET_OPTION(CURLOPT_PIPEWAIT, 1);
+	}
+#endif
+
 	/*
 	 *	HTTP/1.1 doesn't require a content type, so only set it
 	 *	if we were provided with one explicitly.
@@ -2349,14 +2689,21 @@ error_header:
  *	- 0 on success.
  *	- -1 on failure.
  */
-int rest_request_perform(UNUSED rlm_rest_t const *instance, UNUSED rlm_rest_section_t *section,
+int rest_request_perform(rlm_rest_t const *instance, UNUSED rlm_rest_section_t *section,
 			 REQUEST *request, void *handle)
 {
 	rlm_rest_handle_t	*randle = handle;
 	CURL			*candle = randle->handle;
 	CURLcode		ret;
 
-	ret = curl_easy_perform(candle);
+#ifdef REST_MULTI
+	if (instance->engine) {
+		ret = rest_multi_perform(instance->engine, request, candle);
+	} else
+#endif
+	{
+		ret = curl_easy_perform(candle);
+	}
 	if (ret != CURLE_OK) {
 		REDEBUG("Request failed: %i - %s", ret, curl_easy_strerror(ret));
 
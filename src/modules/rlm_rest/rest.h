@@ -36,6 +36,14 @@ RCSIDH(other_h, "$Id$")
  */
 #include "../rlm_json/json.h"
 
+/*
+ *	The shared multi handle needs a thread to drive it, and
+ *	curl_multi_wait(), which was added in libcurl 7.28.0.
+ */
+#if defined(HAVE_PTHREAD_H) && (LIBCURL_VERSION_NUM >= 0x071c00)
+#  define REST_MULTI 1
+#endif
+
 #define REST_URI_MAX_LEN		2048
 #define REST_BODY_MAX_LEN		8192
 #define REST_BODY_INIT			1024
@@ -140,6 +148,11 @@ typedef struct rlm_rest_section_t {
 	uint32_t		chunk;		//!< Max chunk-size (mainly for testing the encoders)
 } rlm_rest_section_t;
 
+/*
+ *	Shared curl multi handle, see rest.c
+ */
+typedef struct rest_multi rest_multi_t;
+
 /*
  *	Structure for module configuration
  */
@@ -153,6 +166,12 @@ typedef struct rlm_rest_t {
 
 	fr_connection_pool_t	*pool;		//!< Pointer to the connection pool.
 
+	bool			multi;		//!< Perform transfers with a multi handle shared
+						//!< between all of the connection handles.
+	uint32_t		max_host_connections;	//!< Limit on connections per host for the
+						//!< multi handle.  0 means no limit.
+	rest_multi_t		*engine;	//!< The multi handle, and the thread driving it.
+
 	rlm_rest_section_t	xlat;		//!< Configuration specific to xlat.
 	rlm_rest_section_t	authorize;	//!< Configuration specific to authorisation.
 	rlm_rest_section_t	authenticate;	//!< Configuration specific to authentication.
@@ -254,6 +273,8 @@ int rest_init(rlm_rest_t *instance);
 
 void rest_cleanup(void);
 
+int rest_multi_start(rlm_rest_t *instance);
+void rest_multi_stop(rlm_rest_t *instance);
 void *mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *timeout);
 
 int mod_conn_alive(void *instance, void *handle);
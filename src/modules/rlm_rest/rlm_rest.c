@@ -92,6 +92,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("connect_uri", PW_TYPE_STRING, rlm_rest_t, connect_uri) },
 	{ FR_CONF_DEPRECATED("connect_timeout", PW_TYPE_TIMEVAL, rlm_rest_t, connect_timeout) },
 	{ FR_CONF_OFFSET("connect_proxy", PW_TYPE_STRING, rlm_rest_t, connect_proxy) },
+	{ FR_CONF_OFFSET("multi", PW_TYPE_BOOLEAN, rlm_rest_t, multi), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_host_connections", PW_TYPE_INTEGER, rlm_rest_t, max_host_connections), .dflt = "0" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -878,6 +880,7 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	 */
 	fr_json_version_print();
 	if (rest_init(inst) < 0) return -1;
+	if (rest_multi_start(inst) < 0) return -1;
 	inst->pool = module_connection_pool_init(conf, inst, mod_conn_create, mod_conn_alive, NULL, NULL, NULL);
 	if (!inst->pool) return -1;
 
@@ -893,6 +896,7 @@ static int mod_detach(void *instance)
 	rlm_rest_t *inst = instance;
 
 	fr_connection_pool_free(inst->pool);
+	rest_multi_stop(inst);
 
 	/* Free any memory used by libcurl */
 	rest_cleanup();
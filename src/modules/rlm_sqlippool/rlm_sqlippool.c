@@ -51,6 +51,16 @@ typedef struct rlm_sqlippool_t {
 	int		framed_ip_address; 	//!< the attribute number for Framed-IP(v6)-Address
 
 	time_t		last_clear;		//!< So we only do it once a second.
+	uint32_t	allocate_clear_interval;	//!< Run allocate_clear from a background thread
+						//!< this often, instead of on the request path.
+	bool		allocate_single;	//!< allocate_find allocates the address by itself.
+
+	pthread_t	clear_thread;		//!< Runs allocate_clear every allocate_clear_interval.
+	bool		clear_thread_running;	//!< Whether clear_thread was started.
+	bool		clear_thread_stop;	//!< Tells clear_thread to exit.
+	pthread_mutex_t	clear_mutex;		//!< Protects clear_thread_stop.
+	pthread_cond_t	clear_cond;		//!< Wakes clear_thread up early when we're exiting.
+
 	char const	*allocate_begin;	//!< SQL query to begin.
 	char const	*allocate_clear;	//!< SQL query to clear an IP.
 	char const	*allocate_find;		//!< SQL query to find an unused IP.
@@ -121,6 +131,10 @@ static CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("allocate_clear", PW_TYPE_STRING | PW_TYPE_XLAT , rlm_sqlippool_t, allocate_clear), .dflt = "" },
 
+	{ FR_CONF_OFFSET("allocate_clear_interval", PW_TYPE_INTEGER, rlm_sqlippool_t, allocate_clear_interval), .dflt = "0" },
+
+	{ FR_CONF_OFFSET("allocate_single", PW_TYPE_BOOLEAN, rlm_sqlippool_t, allocate_single), .dflt = "no" },
+
 	{ FR_CONF_OFFSET("allocate_find", PW_TYPE_STRING | PW_TYPE_XLAT | PW_TYPE_REQUIRED, rlm_sqlippool_t, allocate_find), .dflt = "" },
 
 	{ FR_CONF_OFFSET("allocate_update", PW_TYPE_STRING | PW_TYPE_XLAT , rlm_sqlippool_t, allocate_update), .dflt = "" },
@@ -362,6 +376,88 @@ finish:
 	return retval;
 }
 
+/** Run the allocate_clear sequence
+ *
+ * When called from the background thread there's no real request, so
+ * allocate_clear should only reference the pool table, e.g. to clear
+ * every expired lease.
+ */
+static int sqlippool_clear(rlm_sqlippool_t *inst, rlm_sql_handle_t *handle, REQUEST *request)
+{
+	if (DO(allocate_begin) < 0) return -1;
+	if (DO(allocate_clear) < 0) return -1;
+	return DO(allocate_commit);
+}
+
+/** Periodically clear expired leases, so the request path doesn't have to
+ *
+ */
+static void *sqlippool_clear_thread(void *arg)
+{
+	rlm_sqlippool_t		*inst = arg;
+	struct timespec		when;
+
+	pthread_mutex_lock(&inst->clear_mutex);
+	while (!inst->clear_thread_stop) {
+		REQUEST			*request;
+		rlm_sql_handle_t	*handle;
+
+		clock_gettime(CLOCK_REALTIME, &when);
+		when.tv_sec += inst->allocate_clear_interval;
+
+		pthread_cond_timedwait(&inst->clear_cond, &inst->clear_mutex, &when);
+		if (inst->clear_thread_stop) break;
+		pthread_mutex_unlock(&inst->clear_mutex);
+
+		request = request_alloc(NULL);
+		if (!request) goto next;
+
+		request->packet = fr_radius_alloc(request, false);
+		request->reply = fr_radius_alloc(request, false);
+		if (!request->packet || !request->reply) goto next;
+
+		handle = fr_connection_get(inst->sql_inst->pool, request);
+		if (!handle) {
+			ERROR("Failed getting connection to clear expired leases");
+			goto next;
+		}
+
+		if (sqlippool_clear(inst, handle, request) < 0) {
+			ERROR("Failed clearing expired leases");
+		} else {
+			DEBUG2("Cleared expired leases");
+		}
+
+		fr_connection_release(inst->sql_inst->pool, request, handle);
+
+	next:
+		talloc_free(request);
+		pthread_mutex_lock(&inst->clear_mutex);
+	}
+	pthread_mutex_unlock(&inst->clear_mutex);
+
+	return NULL;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_sqlippool_t *inst = instance;
+
+	if (!inst->clear_thread_running) return 0;
+
+	pthread_mutex_lock(&inst->clear_mutex);
+	inst->clear_thread_stop = true;
+	pthread_cond_signal(&inst->clear_cond);
+	pthread_mutex_unlock(&inst->clear_mutex);
+
+	pthread_join(inst->clear_thread, NULL);
+
+	pthread_cond_destroy(&inst->clear_cond);
+	pthread_mutex_destroy(&inst->clear_mutex);
+
+	return 0;
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -405,6 +501,33 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	}
 
 	inst->sql_inst = (rlm_sql_t *) sql_inst->data;
+
+	if (inst->allocate_clear_interval && inst->allocate_clear && *inst->allocate_clear) {
+		int rcode;
+
+		rcode = pthread_mutex_init(&inst->clear_mutex, NULL);
+		if (rcode != 0) {
+			cf_log_err_cs(conf, "Failed initialising clear thread mutex: %s", fr_syserror(rcode));
+			return -1;
+		}
+
+		rcode = pthread_cond_init(&inst->clear_cond, NULL);
+		if (rcode != 0) {
+			cf_log_err_cs(conf, "Failed initialising clear thread condition: %s", fr_syserror(rcode));
+			pthread_mutex_destroy(&inst->clear_mutex);
+			return -1;
+		}
+
+		rcode = pthread_create(&inst->clear_thread, NULL, sqlippool_clear_thread, inst);
+		if (rcode != 0) {
+			cf_log_err_cs(conf, "Failed creating clear thread: %s", fr_syserror(rcode));
+			pthread_cond_destroy(&inst->clear_cond);
+			pthread_mutex_destroy(&inst->clear_mutex);
+			return -1;
+		}
+		inst->clear_thread_running = true;
+	}
+
 	return 0;
 }
 
@@ -474,17 +597,24 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, REQUEST *reque
 	 *	actual work is protected by a transaction.  The idea
 	 *	here is that if we're allocating 100 IPs a second,
 	 *	we're only do 1 CLEAR per second.
+	 *
+	 *	If the clear is done by the background thread, we
+	 *	don't do it here at all.
 	 */
 	now = time(NULL);
-	if (inst->last_clear < now) {
+	if (!inst->clear_thread_running && (inst->last_clear < now)) {
 		inst->last_clear = now;
 
-		DO(allocate_begin);
-		DO(allocate_clear);
-		DO(allocate_commit);
+		sqlippool_clear(inst, handle, request);
 	}
 
-	DO(allocate_begin);
+	/*
+	 *	In single query mode, allocate_find both finds and
+	 *	marks the address as used (e.g. UPDATE ... RETURNING,
+	 *	or a stored procedure).  That's one round trip, and
+	 *	the statement is its own transaction.
+	 */
+	if (!inst->allocate_single) DO(allocate_begin);
 
 	allocation_len = sqlippool_query1(allocation, sizeof(allocation),
 					  inst->allocate_find, handle,
@@ -494,7 +624,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, REQUEST *reque
 	 *	Nothing found...
 	 */
 	if (allocation_len == 0) {
-		DO(allocate_commit);
+		if (!inst->allocate_single) DO(allocate_commit);
 
 		/*
 		 *Should we perform pool-check ?
@@ -549,7 +679,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, REQUEST *reque
 	 */
 	vp = fr_pair_afrom_num(request->reply, 0, inst->framed_ip_address);
 	if (fr_pair_value_from_str(vp, allocation, allocation_len) < 0) {
-		DO(allocate_commit);
+		if (!inst->allocate_single) DO(allocate_commit);
 
 		RDEBUG("Invalid IP number [%s] returned from instbase query.", allocation);
 		fr_connection_release(inst->sql_inst->pool, request, handle);
@@ -562,10 +692,12 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, REQUEST *reque
 	/*
 	 *	UPDATE
 	 */
-	sqlippool_command(inst->allocate_update, handle, inst, request,
-			  allocation, allocation_len);
+	if (!inst->allocate_single) {
+		sqlippool_command(inst->allocate_update, handle, inst, request,
+				  allocation, allocation_len);
 
-	DO(allocate_commit);
+		DO(allocate_commit);
+	}
 
 	fr_connection_release(inst->sql_inst->pool, request, handle);
 
@@ -708,6 +840,7 @@ module_t rlm_sqlippool = {
 	.inst_size	= sizeof(rlm_sqlippool_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting,
 		[MOD_POST_AUTH]		= mod_post_auth
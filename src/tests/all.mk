@@ -1,4 +1,4 @@
-SUBMAKEFILES := rbmonkey.mk eapol_test/all.mk dict/all.mk unit/all.mk map/all.mk xlat/all.mk keywords/all.mk auth/all.mk modules/all.mk daemon/all.mk
+SUBMAKEFILES := rbmonkey.mk pair_bench.mk eapol_test/all.mk dict/all.mk unit/all.mk map/all.mk request_pool/all.mk detail_binary/all.mk radius_batch/all.mk tls_ticket/all.mk pair_index/all.mk xlat/all.mk keywords/all.mk auth/all.mk modules/all.mk daemon/all.mk
 
 #
 #  Include all of the autoconf definitions into the Make variable space
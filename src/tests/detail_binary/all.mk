@@ -0,0 +1,11 @@
+#
+#  Unit tests for encoding and decoding binary detail records
+#
+SUBMAKEFILES := detail_binary_test.mk
+
+DETAIL_BINARY_TEST_BIN	:= $(BUILD_DIR)/bin/local/detail_binary_test
+
+.PHONY: tests.detail_binary
+tests.detail_binary: $(DETAIL_BINARY_TEST_BIN)
+	@echo DETAIL_BINARY_TEST
+	@./build/make/jlibtool --silent --mode=execute $(DETAIL_BINARY_TEST_BIN) -D $(top_srcdir)/share
@@ -0,0 +1,141 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file detail_binary_test.c
+ * @brief Check that binary detail records round trip through the encoder and decoder.
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/conf.h>
+#include <freeradius-devel/detail_binary.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define CHECK(_x) \
+do { \
+	if (!(_x)) { \
+		fprintf(stderr, "detail_binary_test: %s[%d]: Check failed: %s\n", __FILE__, __LINE__, #_x); \
+		return 1; \
+	} \
+} while (0)
+
+/*
+ *	Encode a packet with the given addresses, and decode it from a
+ *	buffer which ends exactly where the record does, as the last
+ *	record in a mapped file would.
+ */
+static int round_trip(int af, char const *src, char const *dst)
+{
+	RADIUS_PACKET		*packet;
+	fr_detail_binary_t	record;
+	VALUE_PAIR		*vp;
+	uint8_t			buffer[FR_DETAIL_BINARY_MAX_LEN];
+	uint8_t			*exact;
+	ssize_t			len, dlen;
+
+	packet = fr_radius_alloc(NULL, false);
+	CHECK(packet != NULL);
+
+	packet->code = PW_CODE_ACCOUNTING_REQUEST;
+	CHECK(fr_inet_pton(&packet->src_ipaddr, src, -1, af, false, true) == 0);
+	CHECK(fr_inet_pton(&packet->dst_ipaddr, dst, -1, af, false, true) == 0);
+	packet->src_port = 32768;
+	packet->dst_port = 1813;
+
+	CHECK(fr_pair_make(packet, &packet->vps, "User-Name", "bob", T_OP_EQ) != NULL);
+	CHECK(fr_pair_make(packet, &packet->vps, "Acct-Session-Id", "0123456789abcdef", T_OP_EQ) != NULL);
+
+	len = fr_detail_binary_encode(buffer, sizeof(buffer), packet, 1234567890, true, NULL, NULL);
+	CHECK(len == (FR_DETAIL_BINARY_HDR_LEN + (2 + 3) + (2 + 16)));
+
+	/*
+	 *	The first attribute starts right after the header,
+	 *	and not on top of the destination address.
+	 */
+	CHECK(buffer[FR_DETAIL_BINARY_HDR_LEN] == PW_USER_NAME);
+	CHECK(buffer[FR_DETAIL_BINARY_HDR_LEN + 1] == (2 + 3));
+
+	exact = talloc_memdup(packet, buffer, len);
+	CHECK(exact != NULL);
+
+	dlen = fr_detail_binary_decode(packet, &record, exact, len);
+	CHECK(dlen == len);
+
+	CHECK(record.code == PW_CODE_ACCOUNTING_REQUEST);
+	CHECK(record.timestamp == 1234567890);
+	CHECK(fr_ipaddr_cmp(&record.src_ipaddr, &packet->src_ipaddr) == 0);
+	CHECK(fr_ipaddr_cmp(&record.dst_ipaddr, &packet->dst_ipaddr) == 0);
+	CHECK(record.src_port == 32768);
+	CHECK(record.dst_port == 1813);
+
+	vp = fr_pair_find_by_num(record.vps, 0, PW_USER_NAME, TAG_ANY);
+	CHECK(vp && (vp->vp_length == 3) && (memcmp(vp->vp_strvalue, "bob", 3) == 0));
+	vp = fr_pair_find_by_num(record.vps, 0, PW_ACCT_SESSION_ID, TAG_ANY);
+	CHECK(vp && (vp->vp_length == 16) && (memcmp(vp->vp_strvalue, "0123456789abcdef", 16) == 0));
+
+	/*
+	 *	A truncated record is reported as such.
+	 */
+	fr_pair_list_free(&record.vps);
+	CHECK(fr_detail_binary_decode(packet, &record, exact, FR_DETAIL_BINARY_HDR_LEN - 1) == 0);
+	CHECK(fr_detail_binary_decode(packet, &record, exact, len - 1) == 0);
+
+	talloc_free(packet);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+
+	while ((c = getopt(argc, argv, "D:")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		default:
+			fprintf(stderr, "usage: detail_binary_test [-D <dictdir>]\n");
+			return 1;
+	}
+
+	if (fr_dict_init(NULL, &dict, dict_dir, RADIUS_DICTIONARY, "radius") < 0) {
+		fr_perror("detail_binary_test");
+		return 1;
+	}
+
+	/*
+	 *	Every byte of both addresses is set, so overlapping
+	 *	the addresses with the attributes would be noticed.
+	 */
+	if (round_trip(AF_INET6, "2001:db8:1111:2222:3333:4444:5555:6666",
+		       "2001:db8:aaaa:bbbb:cccc:dddd:eeee:ffff") != 0) return 1;
+	if (round_trip(AF_INET, "192.0.2.1", "198.51.100.254") != 0) return 1;
+
+	printf("detail_binary_test: OK\n");
+
+	return 0;
+}
@@ -0,0 +1,5 @@
+TARGET		:= detail_binary_test
+SOURCES		:= detail_binary_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
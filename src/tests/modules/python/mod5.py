@@ -0,0 +1,26 @@
+import radiusd
+
+def instantiate(p):
+    return radiusd.RLM_MODULE_OK
+
+def authorize(p):
+    if not isinstance(p, radiusd.Request):
+        return radiusd.RLM_MODULE_FAIL
+
+    if p.request['User-Name'] != 'bob':
+        return radiusd.RLM_MODULE_NOOP
+
+    if 'Calling-Station-Id' in p.request:
+        return radiusd.RLM_MODULE_FAIL
+
+    p.control['Cleartext-Password'] = 'hello'
+    p.reply['Reply-Message'] = ['one', 'two']
+    p.reply['Session-Timeout'] = 3600
+
+    if p.reply['Session-Timeout'] != 3600:
+        return radiusd.RLM_MODULE_FAIL
+
+    if len(p.reply.getall('Reply-Message')) != 2:
+        return radiusd.RLM_MODULE_FAIL
+
+    return radiusd.RLM_MODULE_UPDATED
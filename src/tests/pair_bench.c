@@ -0,0 +1,307 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file pair_bench.c
+ * @brief Compare linear and indexed attribute lookups over accounting packets.
+ *
+ * Builds lists which look like the interim updates sent by a BNG, i.e. the
+ * RFC 2866 attributes, followed by a large number of VSAs, then times the
+ * searches a typical virtual server makes over them.
+ *
+ * Run from the top of the source tree with: pair_bench -D share
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/conf.h>
+
+#include <sys/time.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+/*
+ *	Attributes in a typical Accounting-Request.
+ */
+static char const *acct_attrs[] = {
+	"User-Name", "NAS-IP-Address", "NAS-Port", "Service-Type", "Framed-Protocol",
+	"Framed-IP-Address", "Class", "Called-Station-Id", "Calling-Station-Id",
+	"NAS-Identifier", "Acct-Status-Type", "Acct-Delay-Time", "Acct-Input-Octets",
+	"Acct-Output-Octets", "Acct-Session-Id", "Acct-Authentic", "Acct-Session-Time",
+	"Acct-Input-Packets", "Acct-Output-Packets", "Acct-Terminate-Cause",
+	"Acct-Multi-Session-Id", "Acct-Input-Gigawords", "Acct-Output-Gigawords",
+	"Event-Timestamp", "NAS-Port-Type", "NAS-Port-Id", "Connect-Info",
+	"Acct-Interim-Interval", "Framed-Pool", "ADSL-Agent-Circuit-Id",
+	"ADSL-Agent-Remote-Id", "Actual-Data-Rate-Upstream", "Actual-Data-Rate-Downstream",
+	NULL
+};
+
+/*
+ *	What the policies in a virtual server look for.  Some of these
+ *	are near the end of the list, some aren't in it at all.
+ */
+static char const *search_attrs[] = {
+	"User-Name", "Acct-Status-Type", "Acct-Session-Id", "Acct-Unique-Session-Id",
+	"NAS-IP-Address", "Calling-Station-Id", "Acct-Input-Octets", "Acct-Output-Octets",
+	"Acct-Input-Gigawords", "Acct-Output-Gigawords", "Acct-Session-Time",
+	"Event-Timestamp", "Framed-IP-Address", "Class", "Stripped-User-Name",
+	"Realm", "Cisco-AVPair", "Reply-Message", "Actual-Data-Rate-Downstream",
+	NULL
+};
+
+/*
+ *	Vendors whose VSAs we pad the packets out with.
+ */
+static unsigned int const bng_vendors[] = {
+	4874,	/* ERX / Unisphere */
+	6527,	/* Alcatel-Lucent SR */
+	2636,	/* Juniper */
+	0
+};
+
+static fr_dict_t	*dict;
+static fr_dict_attr_t const *search_da[sizeof(search_attrs) / sizeof(*search_attrs)];
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: pair_bench [options]\n");
+	fprintf(stderr, "  -D <dictdir>     Set main dictionary directory (defaults to share).\n");
+	fprintf(stderr, "  -h               Print usage help information.\n");
+	fprintf(stderr, "  -i <iterations>  Number of packets to process (defaults to 10000).\n");
+	fprintf(stderr, "  -m <modules>     Number of modules searching each packet (defaults to 10).\n");
+	fprintf(stderr, "  -n <attrs>       Number of attributes in each packet (defaults to 120).\n");
+
+	exit(1);
+}
+
+static uint64_t bench_usec(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	return ((now.tv_sec - start->tv_sec) * (uint64_t) 1000000) + (now.tv_usec - start->tv_usec);
+}
+
+/** Add an attribute with a plausible value to the list
+ *
+ */
+static bool bench_pair_add(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_dict_attr_t const *da, unsigned int n)
+{
+	VALUE_PAIR *vp;
+
+	switch (da->type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_OCTETS:
+	case PW_TYPE_INTEGER:
+	case PW_TYPE_INTEGER64:
+	case PW_TYPE_SHORT:
+	case PW_TYPE_BYTE:
+	case PW_TYPE_DATE:
+	case PW_TYPE_IPV4_ADDR:
+	case PW_TYPE_IPV6_ADDR:
+		break;
+
+	default:
+		return false;
+	}
+
+	vp = fr_pair_afrom_da(ctx, da);
+	if (!vp) return false;
+
+	switch (da->type) {
+	case PW_TYPE_STRING:
+		fr_pair_value_snprintf(vp, "bng-%u", n);
+		break;
+
+	case PW_TYPE_OCTETS:
+		fr_pair_value_memcpy(vp, (uint8_t const *) &n, sizeof(n));
+		break;
+
+	default:
+		vp->vp_integer = n;	/* Good enough for all of the fixed size types */
+		break;
+	}
+
+	fr_cursor_append(cursor, vp);
+
+	return true;
+}
+
+/** Build a list which looks like an Accounting-Request from a BNG
+ *
+ */
+static VALUE_PAIR *bench_packet(TALLOC_CTX *ctx, unsigned int num_attrs)
+{
+	VALUE_PAIR		*head = NULL;
+	vp_cursor_t		cursor;
+	fr_dict_attr_t const	*da;
+	unsigned int		count = 0, i, attr;
+	unsigned int const	*vendor;
+
+	fr_cursor_init(&cursor, &head);
+
+	for (i = 0; acct_attrs[i] && (count < num_attrs); i++) {
+		da = fr_dict_attr_by_name(dict, acct_attrs[i]);
+		if (da && bench_pair_add(ctx, &cursor, da, count)) count++;
+	}
+
+	/*
+	 *	Cisco BNGs send a lot of these.
+	 */
+	da = fr_dict_attr_by_name(dict, "Cisco-AVPair");
+	for (i = 0; da && (i < 8) && (count < num_attrs); i++) {
+		if (bench_pair_add(ctx, &cursor, da, count)) count++;
+	}
+
+	for (vendor = bng_vendors; *vendor && (count < num_attrs); vendor++) {
+		for (attr = 1; (attr < 256) && (count < num_attrs); attr++) {
+			da = fr_dict_attr_by_num(dict, *vendor, attr);
+			if (da && bench_pair_add(ctx, &cursor, da, count)) count++;
+		}
+	}
+
+	return head;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	char const		*dict_dir = "share";
+	unsigned int		iterations = 10000, modules = 10, num_attrs = 120;
+	unsigned int		i, j, k, num_vps = 0;
+	uint64_t		linear_usec, indexed_usec, found_linear = 0, found_indexed = 0;
+	struct timeval		start;
+	TALLOC_CTX		*ctx;
+	VALUE_PAIR		*packet, *vp;
+	vp_cursor_t		cursor;
+
+	while ((c = getopt(argc, argv, "D:hi:m:n:")) != -1) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+
+		case 'm':
+			modules = atoi(optarg);
+			break;
+
+		case 'n':
+			num_attrs = atoi(optarg);
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_init(NULL, &dict, dict_dir, RADIUS_DICTIONARY, "radius") < 0) {
+		fr_perror("pair_bench");
+		return 1;
+	}
+
+	for (i = 0; search_attrs[i]; i++) search_da[i] = fr_dict_attr_by_name(dict, search_attrs[i]);
+
+	ctx = talloc_init("pair_bench");
+	packet = bench_packet(ctx, num_attrs);
+	for (vp = fr_cursor_init(&cursor, &packet); vp; vp = fr_cursor_next(&cursor)) num_vps++;
+
+	printf("%u attributes per packet, %u packets, %u modules searching each packet\n",
+	       num_vps, iterations, modules);
+
+	/*
+	 *	Every module walks the list for every attribute.
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < modules; j++) {
+			for (k = 0; search_attrs[k]; k++) {
+				if (!search_da[k]) continue;
+				if (fr_pair_find_by_da(packet, search_da[k], TAG_ANY)) found_linear++;
+			}
+		}
+	}
+	linear_usec = bench_usec(&start);
+
+	/*
+	 *	Index the packet once, then every module uses the index.
+	 *	The cost of building the index is included.
+	 */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < iterations; i++) {
+		fr_pair_index_t *index;
+
+		index = fr_pair_index_alloc(ctx, &packet);
+		if (!index) {
+			fr_perror("pair_bench");
+			return 1;
+		}
+
+		for (j = 0; j < modules; j++) {
+			for (k = 0; search_attrs[k]; k++) {
+				if (!search_da[k]) continue;
+				if (fr_pair_index_find(index, search_da[k], TAG_ANY)) found_indexed++;
+			}
+		}
+
+		talloc_free(index);
+	}
+	indexed_usec = bench_usec(&start);
+
+	if (found_linear != found_indexed) {
+		fprintf(stderr, "pair_bench: Linear search found %" PRIu64 " attributes, indexed found %" PRIu64 "\n",
+			found_linear, found_indexed);
+		return 1;
+	}
+
+	printf("find:      linear %8" PRIu64 " usec, indexed %8" PRIu64 " usec\n", linear_usec, indexed_usec);
+
+	/*
+	 *	Overwrite every attribute in a copy of the packet, as
+	 *	"update request { ... := ... }" would.
+	 */
+	linear_usec = 0;
+	for (i = 0; i < (iterations / 10) + 1; i++) {
+		VALUE_PAIR *to, *from;
+
+		to = fr_pair_list_copy(ctx, packet);
+		from = fr_pair_list_copy(ctx, packet);
+		for (vp = fr_cursor_init(&cursor, &from); vp; vp = fr_cursor_next(&cursor)) vp->op = T_OP_SET;
+
+		gettimeofday(&start, NULL);
+		fr_pair_list_move(ctx, &to, &from);
+		linear_usec += bench_usec(&start);
+
+		fr_pair_list_free(&from);
+		fr_pair_list_free(&to);
+	}
+
+	printf("move:      %8" PRIu64 " usec for %u moves\n", linear_usec, (iterations / 10) + 1);
+
+	talloc_free(ctx);
+	talloc_free(dict);
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := pair_bench
+
+SOURCES := pair_bench.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
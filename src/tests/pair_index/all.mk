@@ -0,0 +1,11 @@
+#
+#  Unit tests for keeping pair list indexes consistent with their lists
+#
+SUBMAKEFILES := pair_index_test.mk
+
+PAIR_INDEX_TEST_BIN	:= $(BUILD_DIR)/bin/local/pair_index_test
+
+.PHONY: tests.pair_index
+tests.pair_index: $(PAIR_INDEX_TEST_BIN)
+	@echo PAIR_INDEX_TEST
+	@./build/make/jlibtool --silent --mode=execute $(PAIR_INDEX_TEST_BIN) -D $(top_srcdir)/share
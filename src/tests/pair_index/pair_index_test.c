@@ -0,0 +1,311 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file pair_index_test.c
+ * @brief Check that pair list indexes stay consistent with the lists they index.
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/conf.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define CHECK(_x) \
+do { \
+	if (!(_x)) { \
+		fprintf(stderr, "pair_index_test: %s[%d]: Check failed: %s\n", __FILE__, __LINE__, #_x); \
+		return 1; \
+	} \
+} while (0)
+
+static char const *names[] = {
+	"User-Name",
+	"Reply-Message",
+	"Filter-Id",
+	"Called-Station-Id",
+	"Calling-Station-Id",
+	"NAS-Identifier",
+	"Callback-Number",
+	"Connect-Info"
+};
+
+#define NUM_NAMES	(sizeof(names) / sizeof(names[0]))
+
+/*
+ *	Long enough that fr_pair_list_move() indexes the list, rather
+ *	than walking it.
+ */
+#define LONG_LIST	40
+
+static VALUE_PAIR *pair_alloc(TALLOC_CTX *ctx, char const *name, char const *value)
+{
+	return fr_pair_make(ctx, NULL, name, value, T_OP_EQ);
+}
+
+/*
+ *	Every attribute except Connect-Info, so appending one adds a
+ *	new entry to the index.
+ */
+static int list_build(TALLOC_CTX *ctx, VALUE_PAIR **vps, unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		char value[32];
+
+		snprintf(value, sizeof(value), "value%u", i);
+		CHECK(fr_pair_make(ctx, vps, names[i % (NUM_NAMES - 1)], value, T_OP_EQ) != NULL);
+	}
+
+	return 0;
+}
+
+static unsigned int count_by_name(VALUE_PAIR *vps, char const *name)
+{
+	fr_dict_attr_t const	*da;
+	vp_cursor_t		cursor;
+	unsigned int		count = 0;
+
+	da = fr_dict_attr_by_name(NULL, name);
+	if (!da) return 0;
+
+	/*
+	 *	By number, so raw and unknown pairs are counted too.
+	 */
+	fr_cursor_init(&cursor, &vps);
+	while (fr_cursor_next_by_num(&cursor, da->vendor, da->attr, TAG_ANY)) count++;
+
+	return count;
+}
+
+/*
+ *	The index must agree with a fresh one built from the list, and
+ *	lookups must find the same pairs as walking the list does.
+ */
+static int index_check(fr_pair_index_t *index)
+{
+	size_t i;
+
+	if (fr_pair_index_verify(index) < 0) {
+		fr_perror("pair_index_test");
+		return 1;
+	}
+
+	for (i = 0; i < NUM_NAMES; i++) {
+		fr_dict_attr_t const *da;
+
+		da = fr_dict_attr_by_name(NULL, names[i]);
+		CHECK(da != NULL);
+		CHECK(fr_pair_index_find(index, da, TAG_ANY) ==
+		      fr_pair_find_by_da(*fr_pair_index_list(index), da, TAG_ANY));
+	}
+
+	return 0;
+}
+
+static int cursor_ops(TALLOC_CTX *ctx)
+{
+	VALUE_PAIR		*vps = NULL, *vp;
+	fr_pair_index_t		*index;
+	vp_cursor_t		cursor;
+	int			i;
+
+	CHECK(list_build(ctx, &vps, LONG_LIST) == 0);
+
+	index = fr_pair_index_alloc(ctx, &vps);
+	CHECK(index != NULL);
+	CHECK(index_check(index) == 0);
+
+	fr_cursor_init_indexed(&cursor, index);
+
+	/*
+	 *	Insert at the head, which becomes the first instance,
+	 *	and at the tail, which is a new attribute.
+	 */
+	vp = pair_alloc(ctx, "Filter-Id", "prepended");
+	CHECK(vp != NULL);
+	fr_cursor_prepend(&cursor, vp);
+	CHECK(index_check(index) == 0);
+	CHECK(fr_pair_index_find(index, vp->da, TAG_ANY) == vp);
+
+	vp = pair_alloc(ctx, "Connect-Info", "appended");
+	CHECK(vp != NULL);
+	fr_cursor_append(&cursor, vp);
+	CHECK(index_check(index) == 0);
+	CHECK(fr_pair_index_find(index, vp->da, TAG_ANY) == vp);
+
+	/*
+	 *	Remove from the head, the middle and the tail.  The
+	 *	last removes the only Connect-Info.
+	 */
+	fr_cursor_first(&cursor);
+	vp = fr_cursor_remove(&cursor);
+	CHECK(vp != NULL);
+	talloc_free(vp);
+	CHECK(index_check(index) == 0);
+
+	fr_cursor_first(&cursor);
+	for (i = 0; i < 10; i++) fr_cursor_next(&cursor);
+	vp = fr_cursor_remove(&cursor);
+	CHECK(vp != NULL);
+	talloc_free(vp);
+	CHECK(index_check(index) == 0);
+
+	fr_cursor_last(&cursor);
+	vp = fr_cursor_remove(&cursor);
+	CHECK(vp != NULL);
+	talloc_free(vp);
+	CHECK(index_check(index) == 0);
+	CHECK(count_by_name(vps, "Connect-Info") == 0);
+
+	/*
+	 *	Replace the head with the same attribute, and a pair in
+	 *	the middle with a different one.
+	 */
+	vp = pair_alloc(ctx, "User-Name", "replaced");
+	CHECK(vp != NULL);
+	fr_cursor_first(&cursor);
+	vp = fr_cursor_replace(&cursor, vp);
+	CHECK(vp != NULL);
+	talloc_free(vp);
+	CHECK(index_check(index) == 0);
+
+	vp = pair_alloc(ctx, "Connect-Info", "replaced");
+	CHECK(vp != NULL);
+	fr_cursor_first(&cursor);
+	for (i = 0; i < 5; i++) fr_cursor_next(&cursor);
+	vp = fr_cursor_replace(&cursor, vp);
+	CHECK(vp != NULL);
+	talloc_free(vp);
+	CHECK(index_check(index) == 0);
+	CHECK(count_by_name(vps, "Connect-Info") == 1);
+
+	/*
+	 *	Free from the middle to the end, then everything.
+	 */
+	fr_cursor_first(&cursor);
+	for (i = 0; i < 20; i++) fr_cursor_next(&cursor);
+	fr_cursor_free(&cursor);
+	CHECK(index_check(index) == 0);
+
+	fr_cursor_first(&cursor);
+	fr_cursor_free(&cursor);
+	CHECK(vps == NULL);
+	CHECK(index_check(index) == 0);
+
+	talloc_free(index);
+
+	return 0;
+}
+
+/*
+ *	The result of fr_pair_list_move() mustn't depend on whether
+ *	the "to" list was long enough to be indexed.
+ */
+static int list_move(TALLOC_CTX *ctx, unsigned int len)
+{
+	VALUE_PAIR		*to = NULL, *from = NULL, *vp;
+	fr_pair_index_t		*index;
+
+	CHECK(list_build(ctx, &to, len) == 0);
+
+	/*
+	 *	A raw Filter-Id has the same number as the one already
+	 *	in the list, but a different da.
+	 */
+	vp = pair_alloc(ctx, "Filter-Id", "raw");
+	CHECK(vp != NULL);
+	CHECK(fr_pair_to_unknown(vp) == 0);
+	fr_pair_add(&to, vp);
+	CHECK(count_by_name(to, "Filter-Id") > 1);
+
+	CHECK(fr_pair_make(ctx, &from, "Filter-Id", "new", T_OP_SET) != NULL);
+	CHECK(fr_pair_make(ctx, &from, "Reply-Message", "set", T_OP_SET) != NULL);
+	CHECK(fr_pair_make(ctx, &from, "User-Name", "ignored", T_OP_EQ) != NULL);
+	CHECK(fr_pair_make(ctx, &from, "Connect-Info", "added", T_OP_EQ) != NULL);
+
+	fr_pair_list_move(ctx, &to, &from);
+
+	CHECK(count_by_name(to, "Filter-Id") == 1);
+	vp = fr_pair_find_by_da(to, fr_dict_attr_by_name(NULL, "Filter-Id"), TAG_ANY);
+	CHECK(vp && (strcmp(vp->vp_strvalue, "new") == 0));
+
+	CHECK(count_by_name(to, "Reply-Message") == 1);
+	vp = fr_pair_find_by_da(to, fr_dict_attr_by_name(NULL, "Reply-Message"), TAG_ANY);
+	CHECK(vp && (strcmp(vp->vp_strvalue, "set") == 0));
+
+	CHECK(count_by_name(to, "Connect-Info") == 1);
+
+	/*
+	 *	Pairs which weren't moved are left behind.
+	 */
+	CHECK(count_by_name(from, "User-Name") == 1);
+	CHECK(count_by_name(from, "Filter-Id") == 0);
+
+	index = fr_pair_index_alloc(ctx, &to);
+	CHECK(index != NULL);
+	CHECK(index_check(index) == 0);
+	talloc_free(index);
+
+	fr_pair_list_free(&to);
+	fr_pair_list_free(&from);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+	TALLOC_CTX	*ctx;
+
+	while ((c = getopt(argc, argv, "D:")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		default:
+			fprintf(stderr, "usage: pair_index_test [-D <dictdir>]\n");
+			return 1;
+	}
+
+	if (fr_dict_init(NULL, &dict, dict_dir, RADIUS_DICTIONARY, "radius") < 0) {
+		fr_perror("pair_index_test");
+		return 1;
+	}
+
+	ctx = talloc_init("pair_index_test");
+	if (!ctx) return 1;
+
+	if (cursor_ops(ctx) != 0) return 1;
+	if (list_move(ctx, 4) != 0) return 1;
+	if (list_move(ctx, LONG_LIST) != 0) return 1;
+
+	talloc_free(ctx);
+
+	printf("pair_index_test: OK\n");
+
+	return 0;
+}
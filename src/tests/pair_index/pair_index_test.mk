@@ -0,0 +1,5 @@
+TARGET		:= pair_index_test
+SOURCES		:= pair_index_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
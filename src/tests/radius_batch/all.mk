@@ -0,0 +1,11 @@
+#
+#  Unit tests for batched verification of RADIUS authenticators
+#
+SUBMAKEFILES := radius_batch_test.mk
+
+RADIUS_BATCH_TEST_BIN	:= $(BUILD_DIR)/bin/local/radius_batch_test
+
+.PHONY: tests.radius_batch
+tests.radius_batch: $(RADIUS_BATCH_TEST_BIN)
+	@echo RADIUS_BATCH_TEST
+	@./build/make/jlibtool --silent --mode=execute $(RADIUS_BATCH_TEST_BIN) -D $(top_srcdir)/share
@@ -0,0 +1,226 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file radius_batch_test.c
+ * @brief Check that fr_radius_verify_batch() agrees with fr_radius_verify().
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/conf.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define CHECK(_x) \
+do { \
+	if (!(_x)) { \
+		fprintf(stderr, "radius_batch_test: %s[%d]: Check failed: %s\n", __FILE__, __LINE__, #_x); \
+		return 1; \
+	} \
+} while (0)
+
+/*
+ *	Covers batches smaller than, equal to, and just over the 4 and 8
+ *	lane widths, and over the 64 packets hashed at once, so the
+ *	lanes left over at the end of each group get used.
+ */
+static unsigned int const batch_sizes[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 63, 64, 65, 130 };
+
+#define MAX_BATCH	130
+
+/*
+ *	The kinds of packet in a batch.  Only the first three are
+ *	verified by fr_radius_verify_batch(), the others are left for
+ *	fr_radius_verify().
+ */
+typedef enum {
+	PACKET_ACCOUNTING = 0,
+	PACKET_COA,
+	PACKET_ACCEPT,
+	PACKET_ACCOUNTING_MA,
+	PACKET_ACCESS_REQUEST,
+	PACKET_KIND_MAX
+} packet_kind_t;
+
+/*
+ *	Copy a signed packet as if it had just been received.
+ */
+static RADIUS_PACKET *packet_receive(TALLOC_CTX *ctx, RADIUS_PACKET const *sent, bool corrupt)
+{
+	RADIUS_PACKET *packet;
+
+	packet = fr_radius_alloc(ctx, false);
+	if (!packet) return NULL;
+
+	packet->src_ipaddr.af = AF_INET;
+	packet->dst_ipaddr.af = AF_INET;
+	packet->data = talloc_memdup(packet, sent->data, sent->data_len);
+	packet->data_len = sent->data_len;
+
+	/*
+	 *	User-Name is the last attribute, so this changes its
+	 *	value without making the packet malformed.
+	 */
+	if (corrupt) packet->data[packet->data_len - 1] ^= 0x01;
+
+	if (!fr_radius_ok(packet, false, NULL)) {
+		talloc_free(packet);
+		return NULL;
+	}
+
+	return packet;
+}
+
+static int batch_test(unsigned int num)
+{
+	TALLOC_CTX	*ctx;
+	RADIUS_PACKET	*batched[MAX_BATCH], *single[MAX_BATCH], *originals[MAX_BATCH];
+	char const	*secrets[MAX_BATCH];
+	bool		expect[MAX_BATCH];
+	unsigned int	i, expected = 0;
+
+	ctx = talloc_init("radius_batch_test");
+	CHECK(ctx != NULL);
+
+	for (i = 0; i < num; i++) {
+		packet_kind_t	kind = i % PACKET_KIND_MAX;
+		bool		corrupt = ((i % 7) == 6);
+		RADIUS_PACKET	*packet;
+		char		*name;
+
+		packet = fr_radius_alloc(ctx, true);
+		CHECK(packet != NULL);
+		packet->id = i & 0xff;
+		originals[i] = NULL;
+
+		switch (kind) {
+		case PACKET_ACCOUNTING:
+		case PACKET_ACCOUNTING_MA:
+			packet->code = PW_CODE_ACCOUNTING_REQUEST;
+			break;
+
+		case PACKET_COA:
+			packet->code = PW_CODE_COA_REQUEST;
+			break;
+
+		case PACKET_ACCEPT:
+			originals[i] = fr_radius_alloc(ctx, true);
+			CHECK(originals[i] != NULL);
+			originals[i]->code = PW_CODE_ACCESS_REQUEST;
+			originals[i]->id = packet->id;
+			packet->code = PW_CODE_ACCESS_ACCEPT;
+			break;
+
+		case PACKET_ACCESS_REQUEST:
+		default:
+			packet->code = PW_CODE_ACCESS_REQUEST;
+			break;
+		}
+
+		if (kind == PACKET_ACCOUNTING_MA) {
+			CHECK(fr_pair_make(packet, &packet->vps, "Message-Authenticator",
+					   "0x00000000000000000000000000000000", T_OP_EQ) != NULL);
+		}
+
+		/*
+		 *	Vary the packet and secret lengths, so lanes in
+		 *	the same group finish after different numbers
+		 *	of MD5 blocks.
+		 */
+		name = talloc_zero_array(packet, char, 1 + ((i * 13) % 200) + 1);
+		CHECK(name != NULL);
+		memset(name, 'a' + (i % 26), talloc_array_length(name) - 1);
+		CHECK(fr_pair_make(packet, &packet->vps, "User-Name", name, T_OP_EQ) != NULL);
+
+		secrets[i] = talloc_asprintf(ctx, "testing123%.*s", (int) (i % 23), "abcdefghijklmnopqrstuvwxyz");
+		CHECK(secrets[i] != NULL);
+
+		CHECK(fr_radius_encode(packet, originals[i], secrets[i]) == 0);
+		CHECK(fr_radius_sign(packet, originals[i], secrets[i]) == 0);
+
+		batched[i] = packet_receive(ctx, packet, corrupt);
+		CHECK(batched[i] != NULL);
+		single[i] = packet_receive(ctx, packet, corrupt);
+		CHECK(single[i] != NULL);
+
+		expect[i] = !corrupt && (kind <= PACKET_ACCEPT);
+		if (expect[i]) expected++;
+	}
+
+	CHECK(fr_radius_verify_batch(batched, originals, secrets, num) == expected);
+
+	for (i = 0; i < num; i++) {
+		int rcode;
+
+		/*
+		 *	The authenticators are put back after hashing.
+		 */
+		CHECK(batched[i]->data_len == single[i]->data_len);
+		CHECK(memcmp(batched[i]->data, single[i]->data, single[i]->data_len) == 0);
+
+		rcode = fr_radius_verify(single[i], originals[i], secrets[i]);
+		if (expect[i]) CHECK(rcode == 0);
+		if (((i % 7) == 6) && ((i % PACKET_KIND_MAX) != PACKET_ACCESS_REQUEST)) CHECK(rcode < 0);
+
+		CHECK(batched[i]->verified == expect[i]);
+		CHECK(fr_radius_verify(batched[i], originals[i], secrets[i]) == rcode);
+	}
+
+	talloc_free(ctx);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict = NULL;
+	size_t		i;
+
+	while ((c = getopt(argc, argv, "D:")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		default:
+			fprintf(stderr, "usage: radius_batch_test [-D <dictdir>]\n");
+			return 1;
+	}
+
+	if (fr_dict_init(NULL, &dict, dict_dir, RADIUS_DICTIONARY, "radius") < 0) {
+		fr_perror("radius_batch_test");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(batch_sizes) / sizeof(batch_sizes[0]); i++) {
+		if (batch_test(batch_sizes[i]) != 0) {
+			fprintf(stderr, "radius_batch_test: failed with %u packets\n", batch_sizes[i]);
+			return 1;
+		}
+	}
+
+	printf("radius_batch_test: OK\n");
+
+	return 0;
+}
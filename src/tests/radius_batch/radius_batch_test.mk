@@ -0,0 +1,5 @@
+TARGET		:= radius_batch_test
+SOURCES		:= radius_batch_test.c
+
+TGT_PREREQS	:= libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
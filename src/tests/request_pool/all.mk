@@ -0,0 +1,11 @@
+#
+#  Unit tests for recycling request pools
+#
+SUBMAKEFILES := request_pool_test.mk
+
+REQUEST_POOL_TEST_BIN	:= $(BUILD_DIR)/bin/local/request_pool_test
+
+.PHONY: tests.request_pool
+tests.request_pool: $(REQUEST_POOL_TEST_BIN)
+	@echo REQUEST_POOL_TEST
+	@./build/make/jlibtool --silent --mode=execute $(REQUEST_POOL_TEST_BIN)
@@ -0,0 +1,137 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file request_pool_test.c
+ * @brief Check that request pools are recycled by request_pool_alloc().
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modpriv.h>
+
+/* Linker hacks */
+char const *get_radius_dir(void)
+{
+	return NULL;
+}
+
+module_instance_t *module_instantiate(UNUSED CONF_SECTION *modules, UNUSED char const *askedname)
+{
+	return NULL;
+}
+
+module_instance_t *module_instantiate_method(UNUSED CONF_SECTION *modules, UNUSED char const *name, UNUSED rlm_components_t *method)
+{
+	return NULL;
+}
+
+main_config_t		main_config;				//!< Main server configuration.
+
+/* Linker hacks */
+
+#define POOL_CACHE	(4)
+
+#define CHECK(_x) \
+do { \
+	if (!(_x)) { \
+		fprintf(stderr, "request_pool_test: %s[%d]: Check failed: %s\n", __FILE__, __LINE__, #_x); \
+		return 1; \
+	} \
+} while (0)
+
+/*
+ *	Give the pool some children, as a request would.
+ */
+static void pool_fill(TALLOC_CTX *ctx)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) (void) talloc_zero_array(ctx, uint8_t, 64);
+}
+
+int main(UNUSED int argc, UNUSED char *argv[])
+{
+	TALLOC_CTX		*first, *ctx;
+	TALLOC_CTX		*pools[POOL_CACHE + 2];
+	request_pool_stats_t	stats;
+	int			i;
+
+	/*
+	 *	The minimum size, so measuring small requests
+	 *	doesn't shrink the pools, and empty the cache.
+	 */
+	main_config.talloc_pool_size = 2048;
+	main_config.talloc_pool_cache = POOL_CACHE;
+
+	/*
+	 *	A released pool is handed out again.
+	 */
+	first = request_pool_alloc("request_pool_test");
+	CHECK(first != NULL);
+	pool_fill(first);
+	request_pool_free(first);
+
+	ctx = request_pool_alloc("request_pool_test");
+	CHECK(ctx == first);
+	CHECK(talloc_total_blocks(ctx) == 1);
+
+	request_pool_stats(&stats);
+	CHECK(stats.created == 1);
+	CHECK(stats.reused == 1);
+	CHECK(stats.size == 2048);
+
+	/*
+	 *	...and its footprint was measured, without being
+	 *	counted as an overflow.
+	 */
+	CHECK(stats.sampled == 1);
+	CHECK(stats.overflowed == 0);
+
+	pool_fill(ctx);
+	request_pool_free(ctx);
+
+	/*
+	 *	The cache only holds POOL_CACHE pools, any more
+	 *	are freed.
+	 */
+	for (i = 0; i < POOL_CACHE + 2; i++) {
+		pools[i] = request_pool_alloc("request_pool_test");
+		CHECK(pools[i] != NULL);
+		pool_fill(pools[i]);
+	}
+	for (i = 0; i < POOL_CACHE + 2; i++) request_pool_free(pools[i]);
+
+	request_pool_stats(&stats);
+	CHECK(stats.created == POOL_CACHE + 2);
+	CHECK(stats.reused == 2);
+
+	for (i = 0; i < POOL_CACHE + 1; i++) pools[i] = request_pool_alloc("request_pool_test");
+
+	request_pool_stats(&stats);
+	CHECK(stats.reused == POOL_CACHE + 2);
+	CHECK(stats.created == POOL_CACHE + 3);
+
+	for (i = 0; i < POOL_CACHE + 1; i++) request_pool_free(pools[i]);
+
+	printf("request_pool_test: %" PRIu64 " pools created, %" PRIu64 " reused\n", stats.created, stats.reused);
+
+	return 0;
+}
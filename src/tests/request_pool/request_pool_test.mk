@@ -0,0 +1,5 @@
+TARGET		:= request_pool_test
+SOURCES		:= request_pool_test.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS)
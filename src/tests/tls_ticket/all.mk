@@ -0,0 +1,17 @@
+#
+#  Unit tests for loading and rotating session ticket keys
+#
+.PHONY: tests.tls_ticket
+
+ifneq ($(OPENSSL_LIBS),)
+SUBMAKEFILES := tls_ticket_test.mk
+
+TLS_TICKET_TEST_BIN	:= $(BUILD_DIR)/bin/local/tls_ticket_test
+
+tests.tls_ticket: $(TLS_TICKET_TEST_BIN)
+	@echo TLS_TICKET_TEST
+	@mkdir -p $(BUILD_DIR)/tests
+	@./build/make/jlibtool --silent --mode=execute $(TLS_TICKET_TEST_BIN) -f $(BUILD_DIR)/tests/tls_ticket.key
+else
+tests.tls_ticket:
+endif
@@ -0,0 +1,232 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls_ticket_test.c
+ * @brief Check that session ticket keys are loaded, reloaded and rotated correctly.
+ *
+ * @copyright 2016  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modpriv.h>
+
+#include <utime.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+/* Linker hacks */
+char const *get_radius_dir(void)
+{
+	return NULL;
+}
+
+module_instance_t *module_instantiate(UNUSED CONF_SECTION *modules, UNUSED char const *askedname)
+{
+	return NULL;
+}
+
+module_instance_t *module_instantiate_method(UNUSED CONF_SECTION *modules, UNUSED char const *name, UNUSED rlm_components_t *method)
+{
+	return NULL;
+}
+
+main_config_t		main_config;				//!< Main server configuration.
+
+/* Linker hacks */
+
+#define KEY_LEN		80
+#define MAX_KEYS	32
+
+#define CHECK(_x) \
+do { \
+	if (!(_x)) { \
+		fprintf(stderr, "tls_ticket_test: %s[%d]: Check failed: %s\n", __FILE__, __LINE__, #_x); \
+		return 1; \
+	} \
+} while (0)
+
+static uint32_t keys_in_use(tls_ticket_keys_t *keys)
+{
+	tls_ticket_stats_t stats;
+
+	tls_ticket_stats(&stats, keys);
+
+	return stats.keys;
+}
+
+/*
+ *	Write "len" bytes of key material, and set the modification
+ *	time, so we control whether the file looks changed.
+ */
+static int key_file_write(char const *file, size_t len, time_t mtime)
+{
+	FILE		*fp;
+	size_t		i;
+	struct utimbuf	times;
+
+	fp = fopen(file, "w");
+	if (!fp) return -1;
+
+	for (i = 0; i < len; i++) {
+		if (fputc((int) (fr_rand() & 0xff), fp) == EOF) {
+			fclose(fp);
+			return -1;
+		}
+	}
+	if (fclose(fp) != 0) return -1;
+
+	times.actime = mtime;
+	times.modtime = mtime;
+
+	return utime(file, &times);
+}
+
+/*
+ *	Keys we generate are kept until "lifetime" seconds after
+ *	they stopped being used to encrypt tickets.
+ */
+static int generated_keys(TALLOC_CTX *ctx)
+{
+	tls_ticket_keys_t	*keys;
+	time_t			now;
+	int			i;
+
+	keys = tls_ticket_keys_alloc(ctx, NULL, 60, 300);
+	CHECK(keys != NULL);
+	now = time(NULL);
+	CHECK(keys_in_use(keys) == 1);
+
+	/*
+	 *	Rotation is lazy.  The first key has been encrypting
+	 *	tickets until now, so it must still be kept, even
+	 *	though it was created long ago.
+	 */
+	CHECK(tls_ticket_keys_rotate(keys, now + 5000) == 0);
+	CHECK(keys_in_use(keys) == 2);
+
+	CHECK(tls_ticket_keys_rotate(keys, now + 5300) == 0);
+	CHECK(keys_in_use(keys) == 3);
+
+	/*
+	 *	The first key was retired at +5000, so it goes.  The
+	 *	second was retired at +5300, so it stays.
+	 */
+	CHECK(tls_ticket_keys_rotate(keys, now + 5400) == 0);
+	CHECK(keys_in_use(keys) == 3);
+
+	CHECK(tls_ticket_keys_rotate(keys, now + 6000) == 0);
+	CHECK(keys_in_use(keys) == 2);
+
+	/*
+	 *	However often we rotate, we never keep more keys
+	 *	than we have room for.
+	 */
+	for (i = 0; i < (MAX_KEYS * 2); i++) {
+		CHECK(tls_ticket_keys_rotate(keys, now + 6001 + i) == 0);
+	}
+	CHECK(keys_in_use(keys) == MAX_KEYS);
+
+	talloc_free(keys);
+
+	return 0;
+}
+
+static int file_keys(TALLOC_CTX *ctx, char const *file)
+{
+	tls_ticket_keys_t	*keys;
+	time_t			mtime = time(NULL) - 3600;
+
+	/*
+	 *	Files which aren't a whole number of keys, or which
+	 *	are empty, are rejected.
+	 */
+	CHECK(key_file_write(file, (KEY_LEN * 2) + 5, mtime) == 0);
+	CHECK(tls_ticket_keys_alloc(ctx, file, 60, 300) == NULL);
+
+	CHECK(key_file_write(file, 0, mtime) == 0);
+	CHECK(tls_ticket_keys_alloc(ctx, file, 60, 300) == NULL);
+
+	CHECK(key_file_write(file, KEY_LEN * 2, mtime) == 0);
+	keys = tls_ticket_keys_alloc(ctx, file, 60, 300);
+	CHECK(keys != NULL);
+	CHECK(keys_in_use(keys) == 2);
+
+	/*
+	 *	The file is only reloaded if its modification time
+	 *	changes.
+	 */
+	CHECK(key_file_write(file, KEY_LEN * 3, mtime) == 0);
+	CHECK(tls_ticket_keys_rotate(keys, time(NULL)) == 0);
+	CHECK(keys_in_use(keys) == 2);
+
+	CHECK(key_file_write(file, KEY_LEN * 3, mtime + 10) == 0);
+	CHECK(tls_ticket_keys_rotate(keys, time(NULL)) == 0);
+	CHECK(keys_in_use(keys) == 3);
+
+	/*
+	 *	A bad file leaves the existing keys alone.
+	 */
+	CHECK(key_file_write(file, (KEY_LEN * 4) + 1, mtime + 20) == 0);
+	CHECK(tls_ticket_keys_rotate(keys, time(NULL)) < 0);
+	CHECK(keys_in_use(keys) == 3);
+
+	/*
+	 *	Keys past the maximum are ignored.
+	 */
+	CHECK(key_file_write(file, KEY_LEN * (MAX_KEYS + 1), mtime + 30) == 0);
+	CHECK(tls_ticket_keys_rotate(keys, time(NULL)) == 0);
+	CHECK(keys_in_use(keys) == MAX_KEYS);
+
+	talloc_free(keys);
+	unlink(file);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	char const	*file = "tls_ticket.key";
+	TALLOC_CTX	*ctx;
+
+	while ((c = getopt(argc, argv, "f:")) != EOF) switch (c) {
+		case 'f':
+			file = optarg;
+			break;
+
+		default:
+			fprintf(stderr, "usage: tls_ticket_test [-f <key file>]\n");
+			return 1;
+	}
+
+	ctx = talloc_init("tls_ticket_test");
+	if (!ctx) return 1;
+
+	if (generated_keys(ctx) != 0) return 1;
+	if (file_keys(ctx, file) != 0) return 1;
+
+	talloc_free(ctx);
+
+	printf("tls_ticket_test: OK\n");
+
+	return 0;
+}
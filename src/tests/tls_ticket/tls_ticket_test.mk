@@ -0,0 +1,7 @@
+TARGET		:= tls_ticket_test
+SOURCES		:= tls_ticket_test.c \
+		   ${top_srcdir}/src/main/tls/log.c \
+		   ${top_srcdir}/src/main/tls/ticket.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-radius.a
+TGT_LDLIBS	:= $(LIBS) $(OPENSSL_LIBS)